@@ -0,0 +1,71 @@
+#pragma once
+#include "optional.h"
+#include "utility.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <filesystem>
+#include <format>
+#include <pthread.h>
+#include <sched.h>
+#include <string_view>
+#include <vector>
+
+namespace dark {
+
+// CPUs listed as in /sys or taskset, e.g. "0-3,8,10-11". Malformed parts are
+// skipped.
+inline auto parse_cpu_list(std::string_view list) -> std::vector<int> {
+    const auto number = [](std::string_view str) {
+        const auto digit = [](char c) { return c >= '0' && c <= '9'; };
+        return !str.empty() && str.size() < 6 && std::ranges::all_of(str, digit);
+    };
+    auto cpus = std::vector<int>{};
+    while (!list.empty()) {
+        const auto comma = list.find(',');
+        const auto part  = list.substr(0, comma);
+        list             = comma == list.npos ? std::string_view{} : list.substr(comma + 1);
+        const auto dash  = part.find('-');
+        const auto from  = part.substr(0, dash);
+        const auto to    = dash == part.npos ? from : part.substr(dash + 1);
+        if (!number(from) || !number(to))
+            continue;
+        const auto first = str_to_int_nocheck<int>(from);
+        const auto last  = str_to_int_nocheck<int>(to);
+        if (first > last || last >= CPU_SETSIZE)
+            continue;
+        for (auto cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// Run the calling thread on `cpu` only. Threads it starts later inherit that.
+[[nodiscard]]
+inline auto pin_thread(int cpu) noexcept -> optional<> {
+    auto set = cpu_set_t{};
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    const auto error = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+    errno            = error;
+    return error == 0;
+}
+
+// The CPU the calling thread runs on, as of now.
+inline auto current_cpu() noexcept -> int {
+    return ::sched_getcpu();
+}
+
+// The NUMA node of a CPU, 0 without NUMA (or without /sys).
+inline auto numa_node(int cpu) -> int {
+    const auto path = std::format("/sys/devices/system/cpu/cpu{}", cpu);
+    auto error      = std::error_code{};
+    for (const auto &entry : std::filesystem::directory_iterator{path, error}) {
+        const auto name = entry.path().filename().native();
+        if (name.starts_with("node"))
+            return str_to_int_nocheck<int>(std::string_view{name}.substr(4));
+    }
+    return 0;
+}
+
+} // namespace dark
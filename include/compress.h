@@ -0,0 +1,75 @@
+#pragma once
+#include "optional.h"
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <zlib.h>
+
+namespace dark {
+
+namespace __detail {
+
+// zlib window bits, plus 16 to select the gzip wrapper (the one HTTP clients accept)
+inline constexpr int gzip_window_bits = 15 + 16;
+
+} // namespace __detail
+
+// Compress a buffer into a complete gzip stream in a single pass.
+[[nodiscard]]
+inline auto gzip_compress(std::string_view src, int level = Z_DEFAULT_COMPRESSION)
+    -> optional<std::string> {
+    auto stream = z_stream{};
+    if (::deflateInit2(
+            &stream, level, Z_DEFLATED, __detail::gzip_window_bits, 8, Z_DEFAULT_STRATEGY
+        ) != Z_OK)
+        return nullopt;
+
+    auto result = std::string{};
+    result.resize_and_overwrite(::deflateBound(&stream, src.size()), [&](char *dst, std::size_t n) {
+        stream.next_in   = reinterpret_cast<Bytef *>(const_cast<char *>(src.data()));
+        stream.avail_in  = static_cast<uInt>(src.size());
+        stream.next_out  = reinterpret_cast<Bytef *>(dst);
+        stream.avail_out = static_cast<uInt>(n);
+        // The output is sized by deflateBound, so a single call always finishes
+        return ::deflate(&stream, Z_FINISH) == Z_STREAM_END ? stream.total_out : 0;
+    });
+    ::deflateEnd(&stream);
+
+    if (result.empty())
+        return nullopt;
+    return result;
+}
+
+// Decompress a complete gzip stream. `size_hint` is the expected output size, if known.
+[[nodiscard]]
+inline auto gzip_decompress(std::string_view src, std::size_t size_hint = 0)
+    -> optional<std::string> {
+    auto stream = z_stream{};
+    if (::inflateInit2(&stream, __detail::gzip_window_bits) != Z_OK)
+        return nullopt;
+
+    stream.next_in  = reinterpret_cast<Bytef *>(const_cast<char *>(src.data()));
+    stream.avail_in = static_cast<uInt>(src.size());
+
+    auto result = std::string{};
+    auto ret    = Z_OK;
+    auto length = std::max(size_hint, src.size() * 4);
+    while (ret == Z_OK) {
+        const auto done = static_cast<std::size_t>(stream.total_out);
+        result.resize_and_overwrite(length, [&](char *dst, std::size_t n) {
+            stream.next_out  = reinterpret_cast<Bytef *>(dst + done);
+            stream.avail_out = static_cast<uInt>(n - done);
+            ret              = ::inflate(&stream, Z_NO_FLUSH);
+            return static_cast<std::size_t>(stream.total_out);
+        });
+        length *= 2; // Only matters if the hint was too small
+    }
+    ::inflateEnd(&stream);
+
+    if (ret != Z_STREAM_END)
+        return nullopt;
+    return result;
+}
+
+} // namespace dark
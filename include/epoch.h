@@ -0,0 +1,184 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace dark {
+
+struct EpochDomain;
+
+namespace __detail {
+
+// One per (thread, domain), on its own cache line: pinning only writes here.
+struct alignas(64) epoch_record {
+    std::atomic<std::uint64_t> epoch{0}; // epoch observed when pinned, 0 if not pinned
+    std::atomic<bool> in_use{true};      // owned by a live thread
+    std::size_t depth{0};                // nesting of pins, touched by the owner only
+    epoch_record *next{nullptr};         // immutable once published
+};
+
+} // namespace __detail
+
+// Pins the calling thread in a domain: nothing retired from now on is freed
+// until the guard is gone. Cheap enough to take around every lookup.
+struct EpochGuard {
+public:
+    explicit EpochGuard(__detail::epoch_record *record) noexcept : _M_record(record) {}
+
+    EpochGuard(const EpochGuard &)                     = delete;
+    auto operator=(const EpochGuard &) -> EpochGuard & = delete;
+
+    ~EpochGuard() noexcept {
+        if (--_M_record->depth == 0)
+            _M_record->epoch.store(0, std::memory_order_release);
+    }
+
+private:
+    __detail::epoch_record *_M_record;
+};
+
+// Epoch-based reclamation. Readers pin the domain while they use shared
+// objects; writers unlink objects first, then retire them. A retired object
+// is freed once every thread pinned at that time has unpinned.
+struct EpochDomain {
+public:
+    EpochDomain() = default;
+
+    EpochDomain(const EpochDomain &)                     = delete;
+    auto operator=(const EpochDomain &) -> EpochDomain & = delete;
+
+    // No thread may still be pinned, nor pin again, when the domain dies.
+    // Records of threads still alive are left to them: they release them on exit.
+    ~EpochDomain() noexcept {
+        for (auto &item : _M_retired)
+            item.deleter(item.ptr);
+        for (auto *record = _M_records.load(); record != nullptr;) {
+            auto *next = record->next;
+            if (!record->in_use.load(std::memory_order_acquire))
+                delete record;
+            record = next;
+        }
+    }
+
+    [[nodiscard]]
+    auto pin() -> EpochGuard {
+        auto *record = _M_local_record();
+        if (record->depth++ == 0) {
+            const auto epoch = _M_epoch.load(std::memory_order_relaxed);
+            record->epoch.store(epoch, std::memory_order_relaxed);
+            // Publish the pin before reading any shared pointer
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        return EpochGuard{record};
+    }
+
+    // Free `ptr` with `delete` once no reader can hold it any more.
+    template <typename _Tp>
+    auto retire(_Tp *ptr) -> void {
+        this->retire(static_cast<void *>(ptr), [](void *p) { delete static_cast<_Tp *>(p); });
+    }
+
+    auto retire(void *ptr, void (*deleter)(void *)) -> void {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto epoch = _M_epoch.load(std::memory_order_relaxed);
+        std::unique_lock lock{_M_mutex};
+        _M_retired.push_back({ptr, deleter, epoch});
+    }
+
+    // Free whatever no pinned thread can still see. Returns the number freed.
+    auto collect() -> std::size_t {
+        auto freeable = std::vector<_Retired>{};
+        {
+            std::unique_lock lock{_M_mutex};
+            if (_M_retired.empty())
+                return 0;
+            // Readers pinning from now on can't reach anything retired so far
+            const auto current = _M_epoch.fetch_add(1, std::memory_order_seq_cst);
+            const auto oldest  = _M_oldest_pinned(current + 1);
+            std::erase_if(_M_retired, [&](const _Retired &item) {
+                if (item.epoch >= oldest)
+                    return false;
+                freeable.push_back(item);
+                return true;
+            });
+        }
+        for (auto &item : freeable)
+            item.deleter(item.ptr);
+        return freeable.size();
+    }
+
+private:
+    struct _Retired {
+        void *ptr;
+        void (*deleter)(void *);
+        std::uint64_t epoch;
+    };
+
+    using _Record_t = __detail::epoch_record;
+
+    // Oldest epoch a thread is pinned at, or `current` if none is pinned.
+    auto _M_oldest_pinned(std::uint64_t current) const -> std::uint64_t {
+        auto oldest = current;
+        for (auto *record = _M_records.load(std::memory_order_acquire); record != nullptr;
+             record       = record->next) {
+            const auto epoch = record->epoch.load(std::memory_order_seq_cst);
+            if (epoch != 0 && epoch < oldest)
+                oldest = epoch;
+        }
+        return oldest;
+    }
+
+    // Released when the owning thread exits, to be reused by another thread.
+    // Domains are told apart by id, as a new one may reuse the address of a dead one.
+    struct _Local {
+        std::uint64_t domain;
+        _Record_t *record;
+    };
+
+    struct _Locals {
+        std::vector<_Local> list;
+        ~_Locals() {
+            for (auto &local : list)
+                local.record->in_use.store(false, std::memory_order_release);
+        }
+    };
+
+    auto _M_local_record() -> _Record_t * {
+        thread_local auto locals = _Locals{};
+        // Almost always the first entry: a thread rarely uses several domains
+        for (auto &local : locals.list)
+            if (local.domain == _M_id)
+                return local.record;
+        auto *record = _M_acquire_record();
+        locals.list.push_back({_M_id, record});
+        return record;
+    }
+
+    auto _M_acquire_record() -> _Record_t * {
+        for (auto *record = _M_records.load(std::memory_order_acquire); record != nullptr;
+             record       = record->next) {
+            auto expected = false;
+            if (record->in_use.compare_exchange_strong(expected, true))
+                return record;
+        }
+        auto *record = new _Record_t{};
+        record->next = _M_records.load(std::memory_order_relaxed);
+        while (!_M_records.compare_exchange_weak(record->next, record, std::memory_order_release))
+            continue;
+        return record;
+    }
+
+    static inline std::atomic<std::uint64_t> _S_next_id{1};
+
+    const std::uint64_t _M_id = _S_next_id.fetch_add(1, std::memory_order_relaxed);
+    std::atomic<std::uint64_t> _M_epoch{1};
+    std::atomic<_Record_t *> _M_records{nullptr};
+    std::mutex _M_mutex;
+    std::vector<_Retired> _M_retired;
+};
+
+} // namespace dark
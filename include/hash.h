@@ -0,0 +1,93 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace dark {
+
+namespace __detail {
+
+inline constexpr std::uint64_t xxh_prime1 = 0x9E3779B185EBCA87ULL;
+inline constexpr std::uint64_t xxh_prime2 = 0xC2B2AE3D27D4EB4FULL;
+inline constexpr std::uint64_t xxh_prime3 = 0x165667B19E3779F9ULL;
+inline constexpr std::uint64_t xxh_prime4 = 0x85EBCA77C2B2AE63ULL;
+inline constexpr std::uint64_t xxh_prime5 = 0x27D4EB2F165667C5ULL;
+
+// Unaligned little-endian load, which compilers fold into a single mov on x86.
+// Spelled out byte by byte to stay constexpr and to avoid <cstring>, whose
+// <string.h> would pick up our own "strings.h" from the include path.
+template <typename _Int>
+inline constexpr auto xxh_read(const char *ptr) noexcept -> _Int {
+    _Int value{};
+    for (std::size_t i = 0; i < sizeof(_Int); ++i)
+        value |= static_cast<_Int>(static_cast<std::uint8_t>(ptr[i])) << (i * 8);
+    return value;
+}
+
+inline constexpr auto xxh_round(std::uint64_t acc, std::uint64_t input) noexcept -> std::uint64_t {
+    acc += input * xxh_prime2;
+    acc = std::rotl(acc, 31);
+    return acc * xxh_prime1;
+}
+
+inline constexpr auto xxh_merge(std::uint64_t acc, std::uint64_t val) noexcept -> std::uint64_t {
+    acc ^= xxh_round(0, val);
+    return acc * xxh_prime1 + xxh_prime4;
+}
+
+} // namespace __detail
+
+// XXH64: 4 independent lanes per 32-byte stripe, which keeps the pipeline busy
+// and runs at memory bandwidth on any 64-bit target without intrinsics.
+inline auto xxhash64(std::string_view str, std::uint64_t seed = 0) noexcept -> std::uint64_t {
+    using namespace __detail;
+    const char *ptr       = str.data();
+    const char *const end = ptr + str.size();
+    auto hash             = std::uint64_t{};
+
+    if (str.size() >= 32) {
+        auto v1 = seed + xxh_prime1 + xxh_prime2;
+        auto v2 = seed + xxh_prime2;
+        auto v3 = seed;
+        auto v4 = seed - xxh_prime1;
+        for (const char *limit = end - 32; ptr <= limit; ptr += 32) {
+            v1 = xxh_round(v1, xxh_read<std::uint64_t>(ptr));
+            v2 = xxh_round(v2, xxh_read<std::uint64_t>(ptr + 8));
+            v3 = xxh_round(v3, xxh_read<std::uint64_t>(ptr + 16));
+            v4 = xxh_round(v4, xxh_read<std::uint64_t>(ptr + 24));
+        }
+        hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        hash = xxh_merge(hash, v1);
+        hash = xxh_merge(hash, v2);
+        hash = xxh_merge(hash, v3);
+        hash = xxh_merge(hash, v4);
+    } else {
+        hash = seed + xxh_prime5;
+    }
+
+    hash += static_cast<std::uint64_t>(str.size());
+
+    for (; ptr + 8 <= end; ptr += 8) {
+        hash ^= xxh_round(0, xxh_read<std::uint64_t>(ptr));
+        hash = std::rotl(hash, 27) * xxh_prime1 + xxh_prime4;
+    }
+    if (ptr + 4 <= end) {
+        hash ^= static_cast<std::uint64_t>(xxh_read<std::uint32_t>(ptr)) * xxh_prime1;
+        hash = std::rotl(hash, 23) * xxh_prime2 + xxh_prime3;
+        ptr += 4;
+    }
+    for (; ptr < end; ++ptr) {
+        hash ^= static_cast<std::uint64_t>(static_cast<std::uint8_t>(*ptr)) * xxh_prime5;
+        hash = std::rotl(hash, 11) * xxh_prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= xxh_prime2;
+    hash ^= hash >> 29;
+    hash *= xxh_prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+} // namespace dark
@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace dark {
+
+// Latency histogram in the manner of HdrHistogram: values below 2^_Bits are
+// counted exactly, larger ones in 2^_Bits linear buckets per power of two,
+// so a recorded value is off by less than 1 / 2^_Bits (0.8% by default) of
+// itself. Any 64-bit value fits, in a fixed array of counts; recording is a
+// few instructions, and histograms of several threads merge exactly.
+template <unsigned _Bits = 7>
+struct Histogram {
+public:
+    Histogram() : _M_counts(buckets) {}
+
+    auto record(std::uint64_t value, std::uint64_t count = 1) -> void {
+        _M_counts[_S_index(value)] += count;
+        _M_total += count;
+        _M_sum += value * count;
+        _M_min = std::min(_M_min, value);
+        _M_max = std::max(_M_max, value);
+    }
+
+    auto merge(const Histogram &other) -> void {
+        for (std::size_t i = 0; i < _M_counts.size(); ++i)
+            _M_counts[i] += other._M_counts[i];
+        _M_total += other._M_total;
+        _M_sum += other._M_sum;
+        _M_min = std::min(_M_min, other._M_min);
+        _M_max = std::max(_M_max, other._M_max);
+    }
+
+    auto reset() -> void {
+        std::ranges::fill(_M_counts, 0);
+        _M_total = 0;
+        _M_sum   = 0;
+        _M_min   = std::numeric_limits<std::uint64_t>::max();
+        _M_max   = 0;
+    }
+
+    auto count() const -> std::uint64_t {
+        return _M_total;
+    }
+
+    auto min() const -> std::uint64_t {
+        return _M_total == 0 ? 0 : _M_min;
+    }
+
+    auto max() const -> std::uint64_t {
+        return _M_max;
+    }
+
+    auto mean() const -> double {
+        return _M_total == 0 ? 0 : static_cast<double>(_M_sum) / static_cast<double>(_M_total);
+    }
+
+    // The value `percent` of the values are at most, as the highest value of
+    // its bucket (never more than the largest value recorded). 0 if empty.
+    auto percentile(double percent) const -> std::uint64_t {
+        if (_M_total == 0)
+            return 0;
+        const auto wanted = static_cast<double>(_M_total) * std::clamp(percent, 0.0, 100.0) / 100;
+        const auto rank   = std::max<std::uint64_t>(static_cast<std::uint64_t>(wanted + 0.5), 1);
+        auto seen         = std::uint64_t{};
+        for (std::size_t i = 0; i < _M_counts.size(); ++i) {
+            seen += _M_counts[i];
+            if (seen >= rank)
+                return std::min(_S_highest(i), _M_max);
+        }
+        return _M_max;
+    }
+
+    // The scale, for histograms kept elsewhere, e.g. in atomics, that come
+    // back here to be merged or read.
+    static constexpr auto bucket_of(std::uint64_t value) -> std::size_t {
+        return _S_index(value);
+    }
+
+    // The highest value counted in a bucket.
+    static constexpr auto bucket_top(std::size_t index) -> std::uint64_t {
+        return _S_highest(index);
+    }
+
+    static constexpr std::size_t buckets = (64 - _Bits + 1) << _Bits;
+
+private:
+    static constexpr std::uint64_t _S_linear = std::uint64_t{1} << _Bits;
+
+    // Values in [2^k, 2^(k+1)) for k >= _Bits go to bucket k - _Bits + 1,
+    // split into _S_linear parts of 2^(k - _Bits) values each.
+    static constexpr auto _S_index(std::uint64_t value) -> std::size_t {
+        if (value < _S_linear)
+            return static_cast<std::size_t>(value);
+        const auto shift = static_cast<unsigned>(std::bit_width(value)) - 1 - _Bits;
+        return static_cast<std::size_t>(shift * _S_linear + (value >> shift));
+    }
+
+    static constexpr auto _S_highest(std::size_t index) -> std::uint64_t {
+        if (index < _S_linear)
+            return index;
+        const auto bucket = index / _S_linear; // >= 1
+        const auto shift  = static_cast<unsigned>(bucket - 1);
+        const auto low    = (_S_linear + index % _S_linear) << shift;
+        return low + ((std::uint64_t{1} << shift) - 1);
+    }
+
+    std::vector<std::uint64_t> _M_counts;
+    std::uint64_t _M_total{};
+    std::uint64_t _M_sum{};
+    std::uint64_t _M_min = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t _M_max{};
+};
+
+static_assert(Histogram<>::buckets == Histogram<>::bucket_of(~std::uint64_t{}) + 1);
+
+} // namespace dark
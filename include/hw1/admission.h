@@ -0,0 +1,142 @@
+#pragma once
+#include "poller.h"
+#include "socket.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <optional>
+#include <span>
+#include <utility>
+
+// Connections accepted but not yet served, waiting for a free slot. Those
+// waiting longer than the deadline are turned away instead of served late.
+// LIFO serves the newest first: under overload, most connections are then
+// served quickly and the oldest time out, rather than all of them waiting
+// behind each other until every one is late. Not thread-safe.
+template <typename _Tp>
+struct AdmissionQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // A zero deadline never expires.
+    AdmissionQueue(std::size_t capacity, std::chrono::milliseconds deadline, bool lifo) :
+        _M_capacity(capacity), _M_deadline(deadline), _M_lifo(lifo) {}
+
+    auto push(_Tp item, Clock::time_point now) -> void {
+        _M_queue.emplace_back(now, std::move(item));
+    }
+
+    // Hand those past their deadline to `reject`. In order of arrival, they
+    // are all at the front.
+    template <typename _Fn>
+    auto expire(Clock::time_point now, _Fn &&reject) -> void {
+        while (!_M_queue.empty() && _M_expired(_M_queue.front().first, now)) {
+            reject(std::move(_M_queue.front().second));
+            _M_queue.pop_front();
+        }
+    }
+
+    // The next to admit, if any, after handing those past their deadline to
+    // `reject`.
+    template <typename _Fn>
+    auto pop(Clock::time_point now, _Fn &&reject) -> std::optional<_Tp> {
+        this->expire(now, reject);
+        if (_M_queue.empty())
+            return std::nullopt;
+        auto &entry = _M_lifo ? _M_queue.back() : _M_queue.front();
+        auto item   = std::move(entry.second);
+        if (_M_lifo)
+            _M_queue.pop_back();
+        else
+            _M_queue.pop_front();
+        return item;
+    }
+
+    // When the oldest goes past its deadline, none if nothing can.
+    auto next_deadline() const -> std::optional<Clock::time_point> {
+        if (_M_queue.empty() || _M_deadline.count() == 0)
+            return std::nullopt;
+        return _M_queue.front().first + _M_deadline;
+    }
+
+    auto full() const -> bool {
+        return _M_queue.size() >= _M_capacity;
+    }
+
+    auto size() const -> std::size_t {
+        return _M_queue.size();
+    }
+
+private:
+    auto _M_expired(Clock::time_point since, Clock::time_point now) const -> bool {
+        return _M_deadline.count() != 0 && now - since >= _M_deadline;
+    }
+
+    std::size_t _M_capacity;
+    std::chrono::milliseconds _M_deadline;
+    bool _M_lifo;
+    std::deque<std::pair<Clock::time_point, _Tp>> _M_queue;
+};
+
+// Accept connections from `server` until `stop` is readable, queueing them
+// for a slot: `admit` serves one while `has_slot()`, and `reject` turns away
+// each past its deadline as soon as it is, slot or not. `shed` may turn one
+// away on arrival instead, true if it did. The server is made nonblocking,
+// and is no longer read while the queue is full. Whoever frees a slot must
+// wake `poller`.
+template <typename _Shed, typename _HasSlot, typename _Admit, typename _Reject>
+auto accept_until_stopped(
+    dark::Poller &poller, dark::Socket &server, dark::Socket &stop,
+    AdmissionQueue<dark::Socket> &queue, _Shed &&shed, _HasSlot &&has_slot, _Admit &&admit,
+    _Reject &&reject
+) -> void {
+    using Clock = AdmissionQueue<dark::Socket>::Clock;
+    server.set_nonblocking().unwrap();
+    poller.add(server, dark::Interest::READ, &server).unwrap();
+    poller.add(stop, dark::Interest::READ, &stop).unwrap();
+
+    auto accepting = true;
+    auto events    = std::array<dark::PollEvent, 2>{};
+    while (true) {
+        // Nothing queued is late here: the wait is never cut to 0
+        auto timeout = std::chrono::milliseconds{-1};
+        if (const auto deadline = queue.next_deadline())
+            timeout = std::chrono::ceil<std::chrono::milliseconds>(
+                std::max(*deadline - Clock::now(), Clock::duration::zero())
+            );
+        auto ready = poller.wait(events, timeout);
+        if (!ready)
+            continue; // Interrupted by a signal
+        const auto stopped = std::ranges::any_of(
+            std::span{events.data(), ready.unwrap()},
+            [&](const dark::PollEvent &event) { return event.data == &stop; }
+        );
+        if (stopped)
+            return;
+
+        while (!queue.full()) {
+            auto conn = server.accept();
+            if (!conn)
+                break;
+            auto client = std::move(conn.unwrap().first);
+            if (!shed(client))
+                queue.push(std::move(client), Clock::now());
+        }
+
+        queue.expire(Clock::now(), reject);
+        while (has_slot()) {
+            auto client = queue.pop(Clock::now(), reject);
+            if (!client)
+                break;
+            admit(std::move(*client));
+        }
+
+        if (accepting != !queue.full()) {
+            accepting           = !queue.full();
+            const auto interest = accepting ? dark::Interest::READ : dark::Interest::NONE;
+            poller.modify(server, interest, &server).unwrap();
+        }
+    }
+}
@@ -1,43 +1,531 @@
 #pragma once
+#include "compress.h"
+#include "epoch.h"
+#include "hash.h"
+#include "hw1/html.h"
+#include "hw1/index.h"
+#include "hw1/policy.h"
+#include "hw1/shared_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <optional>
-#include <shared_mutex>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
-inline std::shared_mutex cache_mutex;
-inline std::unordered_map<std::string, std::string> cache;
+// A response shared by every url whose response has the same content.
+// Large compressible responses are kept gzip-encoded: `data` is then a complete
+// response with rewritten headers, sent as-is to clients accepting gzip, and
+// `identity_header` is the origin's header used to rebuild the original.
+struct CacheBlob {
+    std::string data;
+    std::string identity_header; // empty if `data` is the original response
+    std::size_t raw_size;        // size of the original response
+    std::size_t refs;
+};
 
-inline auto look_up_cache(const std::string &str) -> std::optional<std::string> {
-    std::shared_lock lock{cache_mutex};
-    if (auto iter = cache.find(str); iter != cache.end()) {
-        return iter->second;
+using CacheClock = std::chrono::steady_clock;
+
+// What a url maps to: its blob, and how long the response may be served.
+struct CacheEntry {
+    std::uint64_t key;                  // content hash of the blob
+    const CacheBlob *blob;              // kept alive by the reference this entry holds
+    CacheClock::time_point fresh_until; // served as-is until then
+    CacheClock::time_point stale_until; // then served while revalidating until then
+    std::string request;                // request replayed to refresh the entry
+};
+
+struct CacheHit {
+    std::string response;
+    bool stale;          // the entry should be refreshed in the background
+    std::string request; // for stale hits, the request to refresh with
+};
+
+struct CacheConfig {
+    std::size_t compress_threshold    = 0;  // minimal body size to compress, 0 to disable
+    int compress_level                = 6;  // zlib level, 1 (fast) to 9 (small)
+    std::chrono::seconds stale_window = {}; // default stale-while-revalidate with max-age
+    std::size_t capacity              = 0;  // bytes to hold, bounded by W-TinyLFU, 0 = unbounded
+    std::size_t shared_size           = 0;  // bytes of shared memory to hold the cache instead
+    int shared_fd                     = -1; // or the memfd of a shared cache to take over
+};
+
+// A shared cache neither deduplicates nor compresses: it counts no blobs,
+// and no logical or raw bytes.
+struct CacheStats {
+    std::size_t entries;       // number of cached urls
+    std::size_t blobs;         // number of distinct bodies
+    std::size_t logical_bytes; // bytes we would hold without deduplication
+    std::size_t stored_bytes;  // bytes actually held
+    std::size_t raw_bytes;     // bytes of distinct bodies before compression
+    std::size_t evicted;       // urls evicted to make room for others
+    std::size_t rejected;      // responses the admission policy refused to cache
+
+    auto dedup_ratio() const noexcept -> double {
+        return stored_bytes == 0 ? 1.0 : static_cast<double>(logical_bytes) / stored_bytes;
+    }
+
+    auto compression_ratio() const noexcept -> double {
+        return stored_bytes == 0 ? 1.0 : static_cast<double>(raw_bytes) / stored_bytes;
+    }
+};
+
+// Lookups take no lock: they pin `cache_epoch` while reading entries and blobs,
+// and whatever a writer unlinks meanwhile is freed only after they unpin.
+// Writers of a url serialize on its shard of the index, and on `cache_blob_mutex`
+// to share blobs. Blobs whose contents hash the same share a bucket.
+inline CacheConfig cache_config;
+inline dark::EpochDomain cache_epoch;
+inline ShardedIndex<CacheEntry> cache{cache_epoch}; // url -> entry
+inline std::mutex cache_blob_mutex;
+inline std::unordered_map<std::uint64_t, std::vector<std::unique_ptr<CacheBlob>>> cache_blobs;
+
+// Running totals of `cache_blobs`, kept as blobs are acquired and released,
+// so that reading them (on every scrape) takes no lock.
+struct CacheTotals {
+    std::atomic_size_t blobs;
+    std::atomic_size_t logical_bytes;
+    std::atomic_size_t stored_bytes;
+    std::atomic_size_t raw_bytes;
+};
+
+inline CacheTotals cache_totals;
+
+// The admission policy, present if the cache is bounded. A bounded cache has
+// a single writer at a time, holding this mutex, so that the policy and the
+// index always agree on the set of urls.
+inline std::mutex cache_policy_mutex;
+inline std::optional<WTinyLfuPolicy> cache_policy;
+inline std::size_t cache_evicted;  // guarded by cache_policy_mutex
+inline std::size_t cache_rejected; // guarded by cache_policy_mutex
+
+// For prefork workers, the cache lives in shared memory instead, created before
+// forking so that every worker, and every restart of one, sees the same entries.
+// It bounds itself with per-size-class LRUs and does not deduplicate bodies.
+inline std::optional<SharedCache> cache_shared;
+
+// Set up before serving: the configuration itself is read without locking.
+inline auto configure_cache(const CacheConfig &config) -> void {
+    std::unique_lock lock{cache_policy_mutex};
+    cache_config = config;
+    const auto shared = config.shared_size != 0 || config.shared_fd >= 0;
+    if (config.capacity != 0 && !shared)
+        cache_policy.emplace(config.capacity);
+    else
+        cache_policy.reset();
+    if (config.shared_fd >= 0)
+        cache_shared.emplace(SharedCache::attach(config.shared_fd).unwrap());
+    else if (config.shared_size != 0)
+        cache_shared.emplace(SharedCache::create(config.shared_size).unwrap());
+    else
+        cache_shared.reset();
+}
+
+// Build the blob for a response, compressing its body if configured and worthwhile.
+inline auto _encode_blob(std::string response) -> CacheBlob {
+    auto blob     = CacheBlob{std::move(response), {}, 0, 0};
+    blob.raw_size = blob.data.size();
+
+    const auto threshold = cache_config.compress_threshold;
+    const auto pos       = blob.data.find("\r\n\r\n");
+    if (threshold == 0 || pos == std::string::npos)
+        return blob;
+
+    const auto header = std::string_view{blob.data}.substr(0, pos + 4);
+    const auto body   = std::string_view{blob.data}.substr(pos + 4);
+    const auto length = parse_http(header, "Content-Length: ");
+    // Only complete, unencoded bodies can be re-encoded safely
+    if (body.size() < threshold || length.empty() ||
+        dark::str_to_int_nocheck<std::size_t>(length) != body.size() ||
+        header.find("Content-Encoding: ") != std::string_view::npos ||
+        header.find("Transfer-Encoding: ") != std::string_view::npos)
+        return blob;
+
+    auto result = dark::gzip_compress(body, cache_config.compress_level);
+    if (!result)
+        return blob;
+    const auto gzipped = result.unwrap();
+    if (gzipped.size() >= body.size() / 10 * 9)
+        return blob; // Already compressed content, not worth the decoding cost
+
+    auto encoded = std::string{header};
+    set_http_header(encoded, "Content-Length: ", std::to_string(gzipped.size()));
+    set_http_header(encoded, "Content-Encoding: ", "gzip");
+    set_http_header(encoded, "Vary: ", "Accept-Encoding");
+    blob.identity_header = header;
+    blob.data            = std::move(encoded) + gzipped;
+    return blob;
+}
+
+// Rebuild the original response from a gzip-encoded blob.
+inline auto _decode_blob(std::string_view data, std::string_view header, std::size_t raw_size)
+    -> std::optional<std::string> {
+    const auto body = data.substr(data.find("\r\n\r\n") + 4);
+    auto result     = dark::gzip_decompress(body, raw_size - header.size());
+    if (!result)
+        return {};
+    return std::string{header} + result.unwrap();
+}
+
+// Take one reference to the blob with this content, storing it if it's new.
+// Contents are compared in full within the bucket of their hash.
+inline auto _acquire_blob(CacheBlob blob) -> std::pair<std::uint64_t, const CacheBlob *> {
+    const auto key = dark::xxhash64(blob.data);
+    std::unique_lock lock{cache_blob_mutex};
+    auto &bucket = cache_blobs[key];
+    auto found   = std::ranges::find_if(bucket, [&](const auto &candidate) {
+        return candidate->data == blob.data && candidate->identity_header == blob.identity_header;
+    });
+    if (found == bucket.end()) {
+        found = bucket.insert(bucket.end(), std::make_unique<CacheBlob>(std::move(blob)));
+        cache_totals.blobs.fetch_add(1, std::memory_order_relaxed);
+        cache_totals.stored_bytes.fetch_add((*found)->data.size(), std::memory_order_relaxed);
+        cache_totals.raw_bytes.fetch_add((*found)->raw_size, std::memory_order_relaxed);
+    }
+    ++(*found)->refs;
+    cache_totals.logical_bytes.fetch_add((*found)->data.size(), std::memory_order_relaxed);
+    return {key, found->get()};
+}
+
+// Drop one reference to a blob, retiring it when no url points at it.
+// Readers may still be copying it, so it is only freed once they unpin.
+inline auto _release_blob(std::uint64_t key, const CacheBlob *blob) -> void {
+    std::unique_lock lock{cache_blob_mutex};
+    auto iter = cache_blobs.find(key);
+    if (iter == cache_blobs.end())
+        return;
+    auto &bucket = iter->second;
+    auto found   = std::ranges::find(bucket, blob, &std::unique_ptr<CacheBlob>::get);
+    if (found == bucket.end())
+        return;
+    cache_totals.logical_bytes.fetch_sub(blob->data.size(), std::memory_order_relaxed);
+    if (--(*found)->refs != 0)
+        return;
+    cache_totals.blobs.fetch_sub(1, std::memory_order_relaxed);
+    cache_totals.stored_bytes.fetch_sub(blob->data.size(), std::memory_order_relaxed);
+    cache_totals.raw_bytes.fetch_sub(blob->raw_size, std::memory_order_relaxed);
+    cache_epoch.retire(found->release());
+    bucket.erase(found);
+    if (bucket.empty())
+        cache_blobs.erase(iter);
+}
+
+// The name of a blob on disk: its hash, and its place in the bucket if not first.
+inline auto _blob_name(std::uint64_t key, std::size_t index) -> std::string {
+    return index == 0 ? std::to_string(key) : std::format("{}-{}", key, index);
+}
+
+// Value of a Cache-Control directive such as "max-age=", if present.
+inline auto _cache_directive(std::string_view control, std::string_view directive)
+    -> std::optional<std::size_t> {
+    const auto pos = control.find(directive);
+    if (pos == std::string_view::npos)
+        return {};
+    auto value = control.substr(pos + directive.size());
+    value      = value.substr(0, value.find_first_not_of("0123456789"));
+    return dark::str_to_int_nocheck<std::size_t>(value);
+}
+
+// Freshness of a response from its Cache-Control header. Responses without
+// max-age never expire, which is what the cache did before it had any rules.
+inline auto _make_entry(std::string_view header, std::string request) -> CacheEntry {
+    constexpr auto never = CacheClock::time_point::max();
+    const auto now       = CacheClock::now();
+    const auto control   = parse_http(header, "Cache-Control: ");
+    auto entry           = CacheEntry{0, nullptr, never, never, std::move(request)};
+    if (const auto max_age = _cache_directive(control, "max-age=")) {
+        const auto window = _cache_directive(control, "stale-while-revalidate=");
+        entry.fresh_until = now + std::chrono::seconds{*max_age};
+        entry.stale_until = entry.fresh_until + cache_config.stale_window;
+        if (window)
+            entry.stale_until = entry.fresh_until + std::chrono::seconds{*window};
+    }
+    return entry;
+}
+
+inline auto _erase_entry(std::string_view host) -> bool {
+    auto entry = cache.erase(host);
+    if (!entry)
+        return false;
+    _release_blob(entry->key, entry->blob);
+    return true;
+}
+
+// Ask the policy to admit a url, evicting whatever it decides. Requires cache_policy_mutex.
+inline auto _admit_entry(const std::string &host, std::size_t size) -> bool {
+    if (!cache_policy)
+        return true;
+    auto admitted = true;
+    for (const auto &key : cache_policy->admit(host, size)) {
+        if (key == host) {
+            admitted = false;
+            cache_rejected += 1;
+        } else {
+            cache_evicted += 1;
+        }
+        _erase_entry(key);
+    }
+    return admitted;
+}
+
+// Insert or replace the entry of a url. A replaced entry releases its blob,
+// after the new one is referenced so that an unchanged body is kept alive.
+inline auto _push_blob(std::string host, CacheBlob blob, CacheEntry entry) -> void {
+    if (cache_shared) {
+        const auto item = SharedItem{
+            std::move(blob.data), std::move(blob.identity_header), blob.raw_size,
+            entry.fresh_until,    entry.stale_until,               std::move(entry.request),
+        };
+        if (!cache_shared->store(host, item)) {
+            std::unique_lock lock{cache_policy_mutex};
+            cache_rejected += 1;
+        }
+        return;
+    }
+
+    auto policy_lock = std::unique_lock{cache_policy_mutex, std::defer_lock};
+    if (cache_config.capacity != 0)
+        policy_lock.lock();
+    if (!_admit_entry(host, blob.data.size()))
+        return;
+
+    std::tie(entry.key, entry.blob) = _acquire_blob(std::move(blob));
+    if (auto old = cache.assign(std::move(host), std::move(entry)))
+        _release_blob(old->key, old->blob);
+}
+
+// Hits are handed to the policy in batches from a per-thread buffer, so that
+// a lookup writes no memory shared with other threads. Under contention,
+// dropping some access records is fine.
+inline auto _record_access(const std::string &host) -> void {
+    constexpr std::size_t batch = 32;
+    if (cache_config.capacity == 0)
+        return;
+    thread_local auto pending = std::vector<std::string>{};
+    pending.push_back(host);
+    if (pending.size() < batch)
+        return;
+    if (auto policy_lock = std::unique_lock{cache_policy_mutex, std::try_to_lock}) {
+        if (cache_policy)
+            for (const auto &key : pending)
+                cache_policy->access(key);
+    } else if (pending.size() < batch * 4) {
+        return;
+    }
+    pending.clear();
+}
+
+// Whether a lookup of a url may hit, cheap enough for an event loop: it takes
+// no lock and copies nothing. The shared cache can't be probed without its
+// lock, so any url may be in it.
+inline auto cache_may_hold(const std::string &str) -> bool {
+    if (cache_shared)
+        return true;
+    auto guard        = cache_epoch.pin();
+    const auto *entry = cache.find(str);
+    return entry != nullptr && CacheClock::now() < entry->stale_until;
+}
+
+// Get the response to send for a url. Gzip-encoded blobs are sent as-is to
+// clients accepting gzip, and decompressed (outside of the lock) for the others.
+// Entries past their freshness are still hit, marked stale, within their
+// stale-while-revalidate window, and missed after it.
+inline auto look_up_cache(const std::string &str, bool accept_gzip = false)
+    -> std::optional<CacheHit> {
+    auto hit      = CacheHit{{}, false, {}};
+    auto header   = std::string{};
+    auto raw_size = std::size_t{};
+    if (cache_shared) {
+        auto item      = cache_shared->find(str);
+        const auto now = CacheClock::now();
+        if (!item || now >= item->stale_until)
+            return {};
+        if (now >= item->fresh_until) {
+            hit.stale   = true;
+            hit.request = std::move(item->request);
+        }
+        hit.response = std::move(item->data);
+        if (!accept_gzip) {
+            header   = std::move(item->identity_header);
+            raw_size = item->raw_size;
+        }
     } else {
+        auto guard        = cache_epoch.pin();
+        const auto *entry = cache.find(str);
+        if (entry == nullptr)
+            return {};
+
+        const auto now = CacheClock::now();
+        if (now >= entry->stale_until)
+            return {};
+        if (now >= entry->fresh_until) {
+            hit.stale   = true;
+            hit.request = entry->request;
+        }
+
+        const auto &blob = *entry->blob;
+        hit.response     = blob.data;
+        if (!accept_gzip && !blob.identity_header.empty()) {
+            header   = blob.identity_header;
+            raw_size = blob.raw_size;
+        }
+        _record_access(str);
+    }
+    if (header.empty())
+        return hit;
+    auto response = _decode_blob(hit.response, header, raw_size);
+    if (!response)
         return {};
+    hit.response = std::move(*response);
+    return hit;
+}
+
+// Cache the response to a request, unless the origin forbids storing it.
+inline auto push_to_cache(std::string host, std::string response, std::string request = {})
+    -> void {
+    const auto header = std::string_view{response}.substr(0, response.find("\r\n\r\n"));
+    if (parse_http(header, "Cache-Control: ").find("no-store") != std::string_view::npos)
+        return;
+    auto entry = _make_entry(header, std::move(request));
+    _push_blob(std::move(host), _encode_blob(std::move(response)), std::move(entry));
+}
+
+inline auto erase_from_cache(const std::string &host) -> bool {
+    if (cache_shared)
+        return cache_shared->erase(host);
+    auto policy_lock = std::unique_lock{cache_policy_mutex};
+    if (cache_policy)
+        cache_policy->erase(host);
+    else
+        policy_lock.unlock();
+    return _erase_entry(host);
+}
+
+inline auto cache_stats() -> CacheStats {
+    auto stats = CacheStats{cache.size(), 0, 0, 0, 0, 0, 0};
+    {
+        std::unique_lock lock{cache_policy_mutex};
+        stats.evicted  = cache_evicted;
+        stats.rejected = cache_rejected;
     }
+    if (cache_shared) {
+        const auto shared  = cache_shared->stats();
+        stats.entries      = shared.entries;
+        stats.stored_bytes = shared.stored_bytes;
+        stats.evicted      = shared.evicted;
+        return stats;
+    }
+    stats.blobs         = cache_totals.blobs.load(std::memory_order_relaxed);
+    stats.logical_bytes = cache_totals.logical_bytes.load(std::memory_order_relaxed);
+    stats.stored_bytes  = cache_totals.stored_bytes.load(std::memory_order_relaxed);
+    stats.raw_bytes     = cache_totals.raw_bytes.load(std::memory_order_relaxed);
+    return stats;
 }
 
-inline auto push_to_cache(std::string host, std::string response) -> void {
-    std::unique_lock lock{cache_mutex};
-    cache.try_emplace(std::move(host), std::move(response));
+inline auto print_cache_stats() -> void {
+    const auto stats = cache_stats();
+    if (cache_shared) {
+        std::cout << std::format(
+            "Cache: {} urls, {} bytes stored in shared memory, {} evicted\n", stats.entries,
+            stats.stored_bytes, stats.evicted
+        );
+        return;
+    }
+    std::cout << std::format(
+        "Cache: {} urls, {} bodies, {} bytes stored for {} bytes cached "
+        "(dedup ratio {:.2f}, compression ratio {:.2f}), {} evicted, {} rejected\n",
+        stats.entries, stats.blobs, stats.stored_bytes, stats.logical_bytes, stats.dedup_ratio(),
+        stats.compression_ratio(), stats.evicted, stats.rejected
+    );
 }
 
+// On disk, every blob is written once in its stored form, named by its content
+// hash (and its place among blobs of the same hash), with the identity header of
+// a gzip-encoded blob next to it in "<name>.hdr".
+// The index maps each url to the name of its blob, one "name url" per line,
+// with the request to refresh the url with in "<line>.req", line counted from 0.
 inline auto save_cache_to_file() -> void {
     auto tmp_path = std::filesystem::temp_directory_path() / "proxy_cache";
     auto error    = std::error_code{};
     std::filesystem::create_directories(tmp_path, error);
     auto file = std::ofstream{tmp_path / "index.txt"};
-    std::unique_lock lock{cache_mutex};
 
-    for (auto &[host, data] : cache) {
-        file << host << '\n';
-        const auto hash = std::hash<std::string>{}(host);
-        std::ofstream{tmp_path / std::to_string(hash)} << data;
+    const auto save_blob = [&](const std::string &name, const CacheBlob &blob) {
+        std::ofstream{tmp_path / name} << blob.data;
+        if (!blob.identity_header.empty())
+            std::ofstream{tmp_path / std::format("{}.hdr", name)} << blob.identity_header;
+        else
+            std::filesystem::remove(tmp_path / std::format("{}.hdr", name), error);
+    };
+    auto line           = std::size_t{};
+    const auto save_url = [&](const std::string &name, const std::string &host,
+                              const std::string &request) {
+        const auto path = tmp_path / std::format("{}.req", line++);
+        if (!request.empty())
+            std::ofstream{path} << request;
+        else
+            std::filesystem::remove(path, error);
+        file << name << ' ' << host << '\n';
+    };
+
+    if (cache_shared) {
+        // Items are copies: equal ones are found by content, as in `_acquire_blob`
+        auto saved = std::unordered_map<std::uint64_t, std::vector<CacheBlob>>{};
+        for (auto &[host, item] : cache_shared->items()) {
+            const auto key = dark::xxhash64(item.data);
+            auto &bucket   = saved[key];
+            const auto it  = std::ranges::find_if(bucket, [&](const CacheBlob &blob) {
+                return blob.data == item.data && blob.identity_header == item.identity_header;
+            });
+            const auto i   = static_cast<std::size_t>(it - bucket.begin());
+            if (it == bucket.end()) {
+                bucket.push_back({std::move(item.data), std::move(item.identity_header), 0, 0});
+                save_blob(_blob_name(key, i), bucket.back());
+            }
+            save_url(_blob_name(key, i), host, item.request);
+        }
+        return;
     }
+
+    // Pinned: a blob released meanwhile is not freed, so its address is not reused
+    auto guard = cache_epoch.pin();
+    auto index = std::vector<std::tuple<const CacheBlob *, std::string, std::string>>{};
+    cache.for_each([&](const std::string &host, const CacheEntry &entry) {
+        index.emplace_back(entry.blob, host, entry.request);
+    });
+
+    std::unique_lock lock{cache_blob_mutex};
+    auto names = std::unordered_map<const CacheBlob *, std::string>{};
+    for (auto &[key, bucket] : cache_blobs) {
+        for (std::size_t i = 0; i < bucket.size(); ++i) {
+            const auto &blob = *bucket[i];
+            const auto name  = _blob_name(key, i);
+            save_blob(name, blob);
+            names.emplace(&blob, name);
+        }
+    }
+    // Skip urls whose blob was released by a concurrent writer meanwhile
+    for (auto &[blob, host, request] : index)
+        if (const auto it = names.find(blob); it != names.end())
+            save_url(it->second, host, request);
+}
+
+inline auto _read_file(const std::filesystem::path &path) -> std::string {
+    auto file = std::ifstream{path};
+    return std::string{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
 }
 
 inline auto load_cache_from_file() -> void {
@@ -49,13 +537,40 @@ inline auto load_cache_from_file() -> void {
     std::cout << "Recovering cache...\n";
 
     auto file = std::ifstream{tmp_path / "index.txt"};
-    for (std::string host; std::getline(file, host);) {
-        auto hash = std::hash<std::string>{}(host);
-        auto data = std::ifstream{tmp_path / std::to_string(hash)};
+    auto line = std::string{};
+    for (std::size_t number = 0; std::getline(file, line); ++number) {
+        auto key  = std::string{};
+        auto host = std::string{};
+        if (!(std::istringstream{line} >> key >> host))
+            continue; // Not written by this version, skip it
         std::cout << std::format("- cached: {}\n", host);
-        push_to_cache(
-            host,
-            std::string{std::istreambuf_iterator<char>{data}, std::istreambuf_iterator<char>{}}
-        );
+        auto blob     = CacheBlob{_read_file(tmp_path / key), {}, 0, 0};
+        blob.raw_size = blob.data.size();
+        if (auto hdr_path = tmp_path / (key + ".hdr"); std::filesystem::exists(hdr_path, error)) {
+            blob.identity_header = _read_file(hdr_path);
+            const auto length    = parse_http(blob.identity_header, "Content-Length: ");
+            const auto body_size = dark::str_to_int_nocheck<std::size_t>(length);
+            blob.raw_size        = blob.identity_header.size() + body_size;
+        }
+        // Freshness restarts from the time of recovery
+        const auto &header = blob.identity_header.empty() ? blob.data : blob.identity_header;
+        auto request       = std::string{};
+        if (auto req_path = tmp_path / std::format("{}.req", number);
+            std::filesystem::exists(req_path, error))
+            request = _read_file(req_path);
+        auto entry = _make_entry(header.substr(0, header.find("\r\n\r\n")), std::move(request));
+        _push_blob(host, std::move(blob), std::move(entry));
+    }
+    print_cache_stats();
+}
+
+// Copy every entry of a shared cache into the cache of this process.
+inline auto import_shared_cache(SharedCache shared) -> void {
+    for (auto &[host, item] : shared.items()) {
+        auto &[data, header, raw_size, fresh_until, stale_until, request] = item;
+        auto blob  = CacheBlob{std::move(data), std::move(header), raw_size, 0};
+        auto entry = CacheEntry{0, nullptr, fresh_until, stale_until, std::move(request)};
+        _push_blob(std::move(host), std::move(blob), std::move(entry));
     }
+    print_cache_stats();
 }
@@ -1,6 +1,124 @@
 #pragma once
+#include "logger.h"
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <string>
 #include <string_view>
+#include <vector>
+
+struct ProxyConfig {
+    // Cache compression: gzip cached bodies at least this large, 0 to disable
+    std::size_t compress_threshold = 0;
+    int compress_level             = 6;
+
+    // Stale-while-revalidate: default window for responses with max-age only,
+    // refresh threads, and minimal delay between two refreshes of an origin.
+    // A refresh gives up on an origin silent for `idle_timeout`.
+    std::chrono::seconds stale_window          = std::chrono::seconds{0};
+    std::size_t refresh_workers                = 2;
+    std::chrono::milliseconds refresh_interval = std::chrono::milliseconds{1000};
+
+    // Bytes of responses to cache, 0 for unbounded. A bounded cache admits
+    // responses through W-TinyLFU instead of caching every GET.
+    std::size_t cache_capacity = 0;
+
+    // If set, append "url size" for each cacheable request, replayable by `sim`
+    std::string trace_log;
+
+    // Prefork: serve from this many worker processes, restarted if they die,
+    // 0 to serve from threads of this process. Workers share a cache of
+    // `shared_cache_size` bytes in shared memory, and either one listening
+    // socket or, with `reuse_port`, one SO_REUSEPORT socket each.
+    std::size_t workers           = 0;
+    std::size_t shared_cache_size = std::size_t{256} << 20;
+    bool reuse_port               = false;
+
+    // Zero-downtime restart: a new process started with the same control socket
+    // takes the listening sockets and the cache over from the running one,
+    // which then waits up to `drain_timeout` for its connections to complete.
+    std::string control_path;
+    std::chrono::seconds drain_timeout = std::chrono::seconds{30};
+
+    // Tunnels are relayed by this many event-loop threads. A direction stops
+    // being read once `relay_buffer` bytes wait for the other side, and
+    // resumes once they are down to a quarter of it.
+    std::size_t relay_threads = 1;
+    std::size_t relay_buffer  = std::size_t{256} << 10;
+
+    // Each round of a relay thread, a tunnel reads `relay_quantum` bytes at
+    // most. Tunnels past `bulk_after` bytes go after the others, 0 to disable.
+    std::size_t relay_quantum = std::size_t{64} << 10;
+    std::size_t bulk_after    = std::size_t{1} << 20;
+
+    // Threads of the work-stealing pool doing CPU-bound work such as
+    // compressing responses to cache, off the relay threads.
+    std::size_t cpu_threads = 2;
+
+    // Threads resolving the hosts of new connections, which blocks: past
+    // that many at once, connections wait for one of them.
+    std::size_t resolver_threads = 8;
+
+    // CPUs to run on, none to let the scheduler decide. Relay threads are
+    // pinned to them in turn, and a connection goes to the relay on the CPU
+    // its packets arrive on, or else on the same NUMA node. Prefork workers
+    // run on one CPU each; with `reuse_port`, workers on CPUs 0..N-1 get the
+    // connections arriving on their CPU.
+    std::vector<int> cpus;
+
+    // Relay threads spin this long for events before they sleep, and ask the
+    // kernel to busy poll their sockets: lower latency, for a CPU each. Best
+    // with `cpus`, 0 to disable.
+    std::chrono::microseconds busy_poll{0};
+
+    // Close a client that sent no request head within `header_timeout`, a
+    // target not connected within `connect_timeout`, a connection idle for
+    // `idle_timeout` or open for `max_lifetime`. Zero disables a timeout.
+    std::chrono::seconds header_timeout  = std::chrono::seconds{10};
+    std::chrono::seconds connect_timeout = std::chrono::seconds{10};
+    std::chrono::seconds idle_timeout    = std::chrono::seconds{60};
+    std::chrono::seconds max_lifetime    = std::chrono::seconds{0};
+
+    // Bytes connections may hold in buffers, per process, 0 for unbounded.
+    // From 60% of it, origins are only read as fast as their clients take it;
+    // from 80%, replies are no longer captured for the cache; from 95%, new
+    // connections get a 503 right away.
+    std::size_t memory_budget = 0;
+
+    // Admission: the listening socket queues up to `backlog` connections in
+    // the kernel; accepted ones queue for one of `max_connections` slots (0
+    // for unbounded), up to `accept_queue` of them, and get a 503 once queued
+    // for `queue_timeout` (0 to wait forever). `lifo` serves the newest first.
+    int backlog                             = 128;
+    std::size_t max_connections             = 0;
+    std::size_t accept_queue                = 1024;
+    std::chrono::milliseconds queue_timeout = std::chrono::milliseconds{5000};
+    bool lifo                               = false;
+
+    // Serve metrics in the Prometheus text format at 127.0.0.1:`admin_port`
+    // /metrics, 0 for none. Prefork worker i serves its own on admin_port + i.
+    std::uint16_t admin_port = 0;
+
+    // Messages below this level are not logged; per connection is `info`
+    dark::LogLevel log_level = dark::LogLevel::info;
+
+    // Trace one request in this many, 0 for none: its stages, as spans, are
+    // served in the Chrome trace format at /trace of the admin port.
+    std::size_t trace_sample = 0;
+
+    // Log the round trip, congestion window and retransmits of both sides of
+    // each connection as it closes, from TCP_INFO. Have the kernel timestamp
+    // request heads as they arrive, to tell time queued in the kernel (the
+    // "queue" stage) from time spent by the proxy.
+    bool tcp_info   = false;
+    bool timestamps = false;
+
+    // Count cycles, instructions, cache misses... per stage: handling relay
+    // events, looking up the cache and storing a reply (both on the CPU
+    // pool), exported as proxy_perf_events_total. Only long-lived threads
+    // count, each opening its counters once.
+    bool perf = false;
+};
 
 auto send_mail(std::string_view msg, std::string_view sender, std::string_view target) -> void;
-auto run_proxy(std::string_view ip, std::uint16_t port) -> void;
+auto run_proxy(std::string_view ip, std::uint16_t port, const ProxyConfig &config = {}) -> void;
@@ -0,0 +1,150 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+// How close the bytes held by connections are to the memory budget.
+enum class Pressure : std::uint8_t {
+    normal,
+    throttle, // stop buffering what origins send faster than clients take it
+    uncache,  // ... and drop the replies captured for the cache
+    shed,     // ... and turn new connections away
+};
+
+inline auto pressure_name(Pressure pressure) -> std::string_view {
+    switch (pressure) {
+        case Pressure::normal:   return "normal";
+        case Pressure::throttle: return "throttle";
+        case Pressure::uncache:  return "uncache";
+        case Pressure::shed:     return "shed";
+        default:                 return "unknown";
+    }
+}
+
+struct GovernorStats {
+    std::size_t budget;    // bytes, 0 if unbounded
+    std::size_t held;      // bytes held by connections now
+    std::size_t peak;      // ... at most so far
+    Pressure pressure;     // now
+    std::size_t entered[4]; // times each pressure level was entered
+    std::size_t uncached;  // replies not cached because of the pressure
+    std::size_t shed;      // connections turned away
+};
+
+// Process-wide budget for the bytes connections hold: request heads, relay
+// buffers, replies captured for the cache. Holders charge what they hold and
+// refund it when done, and check the pressure before taking more. Charging
+// is a relaxed atomic add, cheap enough to do on every buffer change.
+struct MemoryGovernor {
+public:
+    // A charge refunded when it goes out of scope.
+    struct Hold {
+        Hold(MemoryGovernor &governor, std::size_t bytes) :
+            _M_governor(&governor), _M_bytes(bytes) {
+            _M_governor->charge(static_cast<std::ptrdiff_t>(bytes));
+        }
+        Hold(Hold &&other) noexcept :
+            _M_governor(other._M_governor), _M_bytes(std::exchange(other._M_bytes, 0)) {}
+        Hold(const Hold &)                     = delete;
+        auto operator=(const Hold &) -> Hold & = delete;
+        ~Hold() {
+            if (_M_bytes != 0)
+                _M_governor->charge(-static_cast<std::ptrdiff_t>(_M_bytes));
+        }
+
+    private:
+        MemoryGovernor *_M_governor;
+        std::size_t _M_bytes;
+    };
+
+    explicit MemoryGovernor(std::size_t budget = 0) : _M_budget(budget) {}
+
+    // 0 for unbounded: the pressure is always normal then.
+    auto set_budget(std::size_t budget) -> void {
+        _M_budget.store(budget, std::memory_order_relaxed);
+    }
+
+    // Add (or refund, if negative) bytes held.
+    auto charge(std::ptrdiff_t bytes) -> void {
+        const auto delta = static_cast<std::size_t>(bytes);
+        const auto held  = _M_held.fetch_add(delta, std::memory_order_relaxed) + delta;
+        if (bytes > 0) {
+            auto peak = _M_peak.load(std::memory_order_relaxed);
+            while (held > peak && !_M_peak.compare_exchange_weak(peak, held))
+                continue;
+        }
+        const auto level = _M_level_of(held);
+        if (level == _M_level.load(std::memory_order_relaxed))
+            return;
+        const auto old = _M_level.exchange(level, std::memory_order_relaxed);
+        if (level > old)
+            _M_entered[static_cast<std::size_t>(level)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]]
+    auto hold(std::size_t bytes) -> Hold {
+        return Hold{*this, bytes};
+    }
+
+    auto pressure() const -> Pressure {
+        return _M_level_of(_M_held.load(std::memory_order_relaxed));
+    }
+
+    auto count_uncached() -> void {
+        _M_uncached.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    auto count_shed() -> void {
+        _M_shed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    auto stats() const -> GovernorStats {
+        auto stats = GovernorStats{
+            .budget   = _M_budget.load(std::memory_order_relaxed),
+            .held     = _M_held.load(std::memory_order_relaxed),
+            .peak     = _M_peak.load(std::memory_order_relaxed),
+            .pressure = this->pressure(),
+            .entered  = {},
+            .uncached = _M_uncached.load(std::memory_order_relaxed),
+            .shed     = _M_shed.load(std::memory_order_relaxed),
+        };
+        for (std::size_t i = 0; i < 4; ++i)
+            stats.entered[i] = _M_entered[i].load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    // Percent of the budget from which each level starts
+    static constexpr std::size_t _S_throttle = 60;
+    static constexpr std::size_t _S_uncache  = 80;
+    static constexpr std::size_t _S_shed     = 95;
+
+    auto _M_level_of(std::size_t held) const -> Pressure {
+        const auto budget = _M_budget.load(std::memory_order_relaxed);
+        if (budget == 0)
+            return Pressure::normal;
+        // A share of the budget, without overflowing on large budgets
+        const auto share = [budget](std::size_t percent) {
+            return budget / 100 * percent + budget % 100 * percent / 100;
+        };
+        if (held >= share(_S_shed))
+            return Pressure::shed;
+        if (held >= share(_S_uncache))
+            return Pressure::uncache;
+        if (held >= share(_S_throttle))
+            return Pressure::throttle;
+        return Pressure::normal;
+    }
+
+    std::atomic_size_t _M_budget;
+    std::atomic_size_t _M_held{};
+    std::atomic_size_t _M_peak{};
+    std::atomic<Pressure> _M_level{Pressure::normal};
+    std::atomic_size_t _M_entered[4]{};
+    std::atomic_size_t _M_uncached{};
+    std::atomic_size_t _M_shed{};
+};
+
+inline MemoryGovernor memory_governor; // of the proxy
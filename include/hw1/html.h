@@ -2,6 +2,9 @@
 #include "address.h"
 #include "socket.h"
 #include "utility.h"
+#include <algorithm>
+#include <optional>
+#include <string>
 #include <string_view>
 
 inline auto parse_http(std::string_view str, std::string_view key, std::string_view end = "\r\n")
@@ -13,6 +16,54 @@ inline auto parse_http(std::string_view str, std::string_view key, std::string_v
     return value.substr(0, value.find(end));
 }
 
+// Where the line of a header starts in a header block, npos if none. It is
+// matched at the start of a line: "Connection: " is not "Proxy-Connection: ".
+inline auto find_http_header(std::string_view header, std::string_view key) -> std::size_t {
+    auto pos = header.find(key);
+    while (pos != std::string_view::npos && (pos < 2 || header.substr(pos - 2, 2) != "\r\n"))
+        pos = header.find(key, pos + 1);
+    return pos;
+}
+
+// Set a header in a complete header block (terminated by an empty line).
+// `key` includes the separator, e.g. "Content-Length: ", just like parse_http.
+inline auto set_http_header(std::string &header, std::string_view key, std::string_view value)
+    -> void {
+    if (auto pos = find_http_header(header, key); pos != std::string::npos) {
+        pos += key.size();
+        header.replace(pos, header.find("\r\n", pos) - pos, value);
+    } else {
+        auto line = std::string{key};
+        line += value;
+        line += "\r\n";
+        header.insert(header.size() - 2, line);
+    }
+}
+
+// Remove every line of a header from a header block.
+inline auto erase_http_header(std::string &header, std::string_view key) -> void {
+    auto pos = find_http_header(header, key);
+    for (; pos != std::string::npos; pos = find_http_header(header, key))
+        header.erase(pos, header.find("\r\n", pos) + 2 - pos);
+}
+
+// Whether the request's Accept-Encoding allows the given content coding.
+inline auto accepts_encoding(std::string_view request, std::string_view coding) -> bool {
+    auto list = parse_http(request, "Accept-Encoding: ");
+    while (!list.empty()) {
+        auto item = list.substr(0, list.find(','));
+        list.remove_prefix(std::min(item.size() + 1, list.size()));
+        item.remove_prefix(std::min(item.find_first_not_of(' '), item.size()));
+        const auto name = item.substr(0, item.find_first_of(" ;"));
+        if (name != coding && name != "*")
+            continue;
+        // An explicit "q=0" means the coding is not acceptable
+        auto quality = parse_http(item, "q=", ";");
+        return quality.find_first_not_of("0. ") != std::string_view::npos || quality.empty();
+    }
+    return false;
+}
+
 template <typename _Op>
 inline auto receive_http(dark::Socket &conn, std::string &buffer, _Op &&op) -> void {
     // Keep reading until the connection is closed
@@ -58,6 +109,8 @@ inline auto parse_host(std::string_view str) -> std::optional<std::pair<dark::Ad
             return {};
         auto host = str.substr(0, pos);
         auto port = dark::str_to_int_nocheck<std::uint16_t>(str.substr(pos + 1));
+        if (dark::is_ipv4_literal(host))
+            return std::make_pair(dark::Address{host, port}, false);
         return std::make_pair(dark::Address{std::string{host}, "", port}, false);
     } else {
         // We support only http now.
@@ -67,7 +120,18 @@ inline auto parse_host(std::string_view str) -> std::optional<std::pair<dark::Ad
         pos = str.find('/');
         if (pos == std::string_view::npos)
             return std::nullopt;
-        auto host = str.substr(0, pos);
+        auto host  = str.substr(0, pos);
+        auto colon = host.find(':');
+        auto port  = std::uint16_t{80};
+        if (colon != std::string_view::npos) { // An origin on a port of its own
+            port = dark::str_to_int_nocheck<std::uint16_t>(host.substr(colon + 1));
+            host = host.substr(0, colon);
+        }
+        // A numeric host is parsed in place: getaddrinfo costs microseconds
+        if (dark::is_ipv4_literal(host))
+            return std::make_pair(dark::Address{host, port}, true);
+        if (colon != std::string_view::npos)
+            return std::make_pair(dark::Address{std::string{host}, "", port}, true);
         return std::make_pair(dark::Address{std::string{host}, "http"}, true);
     }
 }
@@ -0,0 +1,215 @@
+#pragma once
+#include "epoch.h"
+#include "hash.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// A string-keyed hash map whose lookups take no lock and write no shared memory.
+// Keys are spread over shards, each a chained hash table with its own writer mutex.
+// Readers walk the chains under an epoch pin; writers never modify a published
+// record, they link a new one and retire the old, which `domain` frees once no
+// reader can still see it.
+template <typename _Value>
+struct ShardedIndex {
+public:
+    explicit ShardedIndex(dark::EpochDomain &domain) : _M_domain(domain) {
+        for (auto &shard : _M_shards)
+            shard.table.store(new _Table(_S_min_buckets), std::memory_order_relaxed);
+    }
+
+    ShardedIndex(const ShardedIndex &)                     = delete;
+    auto operator=(const ShardedIndex &) -> ShardedIndex & = delete;
+
+    // Nothing may be looking up concurrently any more.
+    ~ShardedIndex() {
+        for (auto &shard : _M_shards) {
+            auto *table = shard.table.load(std::memory_order_relaxed);
+            for (auto &bucket : table->buckets)
+                for (auto *node = bucket.load(std::memory_order_relaxed); node != nullptr;
+                     node       = node->next.load(std::memory_order_relaxed))
+                    delete node->record;
+            _S_delete_table(table);
+        }
+    }
+
+    // The caller must hold a pin of the domain for as long as it uses the result.
+    auto find(std::string_view key) const -> const _Value * {
+        const auto hash   = dark::xxhash64(key);
+        auto *table     = _M_shard(hash).table.load(std::memory_order_acquire);
+        for (auto *node = table->bucket(hash).load(std::memory_order_acquire); node != nullptr;
+             node       = node->next.load(std::memory_order_acquire))
+            if (node->hash == hash && node->record->first == key)
+                return &node->record->second;
+        return nullptr;
+    }
+
+    // Insert or replace the value of a key, returning the replaced value.
+    auto assign(std::string key, _Value value) -> std::optional<_Value> {
+        const auto hash = dark::xxhash64(key);
+        auto &shard     = _M_shard(hash);
+        auto *record    = new _Record{std::move(key), std::move(value)};
+        auto result     = std::optional<_Value>{};
+        {
+            std::unique_lock lock{shard.mutex};
+            auto *table = shard.table.load(std::memory_order_relaxed);
+            auto *link  = _S_find_link(table->bucket(hash), hash, record->first);
+            auto *old   = link->load(std::memory_order_relaxed);
+            if (old != nullptr) {
+                result = old->record->second;
+                auto *node = new _Node{hash, record, old->next.load(std::memory_order_relaxed)};
+                link->store(node, std::memory_order_release);
+                _M_retire(old);
+            } else {
+                auto &bucket = table->bucket(hash);
+                auto *node   = new _Node{hash, record, bucket.load(std::memory_order_relaxed)};
+                bucket.store(node, std::memory_order_release);
+                if (++shard.size > table->buckets.size())
+                    _M_grow(shard, table);
+            }
+        }
+        _M_domain.collect();
+        return result;
+    }
+
+    // Remove a key, returning its value if it was present.
+    auto erase(std::string_view key) -> std::optional<_Value> {
+        const auto hash = dark::xxhash64(key);
+        auto &shard     = _M_shard(hash);
+        auto result     = std::optional<_Value>{};
+        {
+            std::unique_lock lock{shard.mutex};
+            auto *table = shard.table.load(std::memory_order_relaxed);
+            auto *link  = _S_find_link(table->bucket(hash), hash, key);
+            auto *old   = link->load(std::memory_order_relaxed);
+            if (old == nullptr)
+                return result;
+            result = old->record->second;
+            // Readers standing on `old` still find the rest of the chain through it
+            link->store(old->next.load(std::memory_order_relaxed), std::memory_order_release);
+            --shard.size;
+            _M_retire(old);
+        }
+        _M_domain.collect();
+        return result;
+    }
+
+    // Visit every (key, value), one shard at a time under its writer lock.
+    template <typename _Fn>
+    auto for_each(_Fn &&fn) -> void {
+        for (auto &shard : _M_shards) {
+            std::unique_lock lock{shard.mutex};
+            auto *table = shard.table.load(std::memory_order_relaxed);
+            for (auto &bucket : table->buckets)
+                for (auto *node = bucket.load(std::memory_order_relaxed); node != nullptr;
+                     node       = node->next.load(std::memory_order_relaxed))
+                    fn(std::as_const(node->record->first), std::as_const(node->record->second));
+        }
+    }
+
+    auto size() -> std::size_t {
+        auto result = std::size_t{};
+        for (auto &shard : _M_shards) {
+            std::unique_lock lock{shard.mutex};
+            result += shard.size;
+        }
+        return result;
+    }
+
+private:
+    static constexpr std::size_t _S_shards      = 64;
+    static constexpr std::size_t _S_min_buckets = 16;
+
+    using _Record = std::pair<const std::string, _Value>;
+
+    // Records are immutable once published. Nodes only link them, so that
+    // a growing table can relink every record without copying any.
+    struct _Node {
+        std::uint64_t hash;
+        const _Record *record;
+        std::atomic<_Node *> next;
+    };
+
+    struct _Table {
+        explicit _Table(std::size_t size) : buckets(size) {}
+
+        // The low bits of the hash pick the shard, the next ones the bucket
+        auto bucket(std::uint64_t hash) -> std::atomic<_Node *> & {
+            return buckets[(hash / _S_shards) & (buckets.size() - 1)];
+        }
+
+        std::vector<std::atomic<_Node *>> buckets;
+    };
+
+    struct alignas(64) _Shard {
+        std::mutex mutex;
+        std::atomic<_Table *> table;
+        std::size_t size{}; // guarded by mutex
+    };
+
+    auto _M_shard(std::uint64_t hash) const -> const _Shard & {
+        return _M_shards[hash % _S_shards];
+    }
+
+    auto _M_shard(std::uint64_t hash) -> _Shard & {
+        return _M_shards[hash % _S_shards];
+    }
+
+    // The link pointing at the node of a key, or the null link ending its chain.
+    static auto
+    _S_find_link(std::atomic<_Node *> &bucket, std::uint64_t hash, std::string_view key)
+        -> std::atomic<_Node *> * {
+        auto *link = &bucket;
+        for (auto *node = link->load(std::memory_order_relaxed); node != nullptr;
+             node       = link->load(std::memory_order_relaxed)) {
+            if (node->hash == hash && node->record->first == key)
+                break;
+            link = &node->next;
+        }
+        return link;
+    }
+
+    // Frees the nodes of a table, not the records they link.
+    static auto _S_delete_table(_Table *table) -> void {
+        for (auto &bucket : table->buckets)
+            for (auto *node = bucket.load(std::memory_order_relaxed); node != nullptr;) {
+                auto *next = node->next.load(std::memory_order_relaxed);
+                delete node;
+                node = next;
+            }
+        delete table;
+    }
+
+    auto _M_retire(_Node *node) -> void {
+        _M_domain.retire(const_cast<_Record *>(node->record));
+        _M_domain.retire(node);
+    }
+
+    // Relink every record into a table twice as large and publish it.
+    // Readers still walking the old table see a consistent snapshot of it.
+    auto _M_grow(_Shard &shard, _Table *table) -> void {
+        auto *bigger = new _Table(table->buckets.size() * 2);
+        for (auto &bucket : table->buckets)
+            for (auto *node = bucket.load(std::memory_order_relaxed); node != nullptr;
+                 node       = node->next.load(std::memory_order_relaxed)) {
+                auto &target = bigger->bucket(node->hash);
+                target.store(
+                    new _Node{node->hash, node->record, target.load(std::memory_order_relaxed)},
+                    std::memory_order_relaxed
+                );
+            }
+        shard.table.store(bigger, std::memory_order_release);
+        _M_domain.retire(static_cast<void *>(table), [](void *ptr) {
+            _S_delete_table(static_cast<_Table *>(ptr));
+        });
+    }
+
+    dark::EpochDomain &_M_domain;
+    _Shard _M_shards[_S_shards];
+};
@@ -0,0 +1,283 @@
+#pragma once
+#include "hash.h"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Cache admission and eviction policies. A policy only tracks keys and sizes:
+// the cache asks it what to evict, so the same code drives the proxy cache
+// and the offline simulator (src/sim).
+
+// Approximate access frequency of keys, in 16 bytes per tracked key.
+// Counters saturate at 15 and are halved every 10 additions per tracked key,
+// so old popularity fades.
+struct CountMinSketch {
+public:
+    explicit CountMinSketch(std::size_t entries = 16) {
+        this->reserve(entries);
+    }
+
+    // Grow to track about `entries` keys. Each row is duplicated into both halves
+    // of its wider self: a key's new slot is its old slot, or that plus the old
+    // width, so every estimate survives the growth.
+    auto reserve(std::size_t entries) -> void {
+        const auto width = std::bit_ceil(std::max<std::size_t>(entries * _S_slack, 64));
+        const auto old   = _M_mask + 1;
+        if (_M_table.empty()) {
+            _M_table.assign(width * _S_depth, 0);
+            _M_mask = width - 1;
+            return;
+        }
+        if (width <= old)
+            return;
+
+        auto table = std::vector<std::uint8_t>(width * _S_depth);
+        for (std::size_t i = 0; i < _S_depth; ++i)
+            for (std::size_t j = 0; j < width; ++j)
+                table[i * width + j] = _M_table[i * old + (j & _M_mask)];
+        _M_table = std::move(table);
+        _M_mask  = width - 1;
+    }
+
+    auto increment(std::uint64_t hash) -> void {
+        auto changed = false;
+        for (std::size_t i = 0; i < _S_depth; ++i) {
+            auto &counter = _M_table[_M_index(hash, i)];
+            if (counter < _S_max) {
+                ++counter;
+                changed = true;
+            }
+        }
+        if (changed && ++_M_additions >= (_M_mask + 1) / _S_slack * 10)
+            _M_reset();
+    }
+
+    auto frequency(std::uint64_t hash) const -> std::uint8_t {
+        auto result = _S_max;
+        for (std::size_t i = 0; i < _S_depth; ++i)
+            result = std::min(result, _M_table[_M_index(hash, i)]);
+        return result;
+    }
+
+private:
+    static constexpr std::size_t _S_depth = 4;
+    static constexpr std::size_t _S_slack = 4; // counters per row for each key
+    static constexpr std::uint8_t _S_max  = 15;
+
+    // Row i uses hash h1 + i * h2, each row living in its own slice of the table
+    auto _M_index(std::uint64_t hash, std::size_t i) const -> std::size_t {
+        const auto h2 = std::rotl(hash, 32) | 1;
+        return i * (_M_mask + 1) + ((hash + i * h2) & _M_mask);
+    }
+
+    auto _M_reset() -> void {
+        for (auto &counter : _M_table)
+            counter /= 2;
+        _M_additions /= 2;
+    }
+
+    std::vector<std::uint8_t> _M_table;
+    std::size_t _M_mask{};
+    std::size_t _M_additions{};
+};
+
+// Plain LRU bounded by bytes, admitting everything. The baseline to compare with.
+struct LruPolicy {
+public:
+    explicit LruPolicy(std::size_t capacity) : _M_capacity(capacity) {}
+
+    auto contains(const std::string &key) const -> bool {
+        return _M_map.contains(key);
+    }
+
+    auto access(const std::string &key) -> void {
+        if (auto iter = _M_map.find(key); iter != _M_map.end())
+            _M_list.splice(_M_list.begin(), _M_list, iter->second);
+    }
+
+    // Insert a key, returning the keys to evict (the key itself if it can't fit).
+    auto admit(const std::string &key, std::size_t size) -> std::vector<std::string> {
+        auto evicted = std::vector<std::string>{};
+        this->erase(key);
+        if (size > _M_capacity) {
+            evicted.push_back(key);
+            return evicted;
+        }
+        _M_list.push_front({key, size});
+        _M_map.emplace(key, _M_list.begin());
+        _M_size += size;
+        while (_M_size > _M_capacity) {
+            evicted.push_back(_M_list.back().key);
+            this->erase(_M_list.back().key);
+        }
+        return evicted;
+    }
+
+    auto erase(const std::string &key) -> void {
+        if (auto iter = _M_map.find(key); iter != _M_map.end()) {
+            _M_size -= iter->second->size;
+            _M_list.erase(iter->second);
+            _M_map.erase(iter);
+        }
+    }
+
+private:
+    struct _Node {
+        std::string key;
+        std::size_t size;
+    };
+
+    std::size_t _M_capacity;
+    std::size_t _M_size{};
+    std::list<_Node> _M_list;
+    std::unordered_map<std::string, std::list<_Node>::iterator> _M_map;
+};
+
+// W-TinyLFU: new keys enter a small LRU window. Keys falling out of the window
+// only enter the main segmented LRU if they are more frequent than the keys
+// they would push out, so one-hit wonders can't flush the working set.
+struct WTinyLfuPolicy {
+public:
+    // The sketch is sized upfront for `capacity / average_size` keys: growing it
+    // later keeps the collisions of its smaller self.
+    explicit WTinyLfuPolicy(
+        std::size_t capacity, std::size_t average_size = 16384, double window_ratio = 0.01
+    ) :
+        _M_window_capacity(static_cast<std::size_t>(capacity * window_ratio)),
+        _M_main_capacity(capacity - _M_window_capacity),
+        _M_protected_capacity(_M_main_capacity / 5 * 4),
+        _M_sketch(capacity / std::max<std::size_t>(average_size, 1)) {}
+
+    auto contains(const std::string &key) const -> bool {
+        return _M_map.contains(key);
+    }
+
+    // Record a hit: bump its frequency, promote probation keys to protected.
+    auto access(const std::string &key) -> void {
+        _M_sketch.increment(dark::xxhash64(key));
+        auto iter = _M_map.find(key);
+        if (iter == _M_map.end())
+            return;
+        auto node = iter->second;
+        switch (node->segment) {
+            case _Segment::window:    _M_move(node, _Segment::window); break;
+            case _Segment::protected_: _M_move(node, _Segment::protected_); break;
+            case _Segment::probation:
+                _M_move(node, _Segment::protected_);
+                while (_M_bytes(_Segment::protected_) > _M_protected_capacity)
+                    _M_move(std::prev(_M_list(_Segment::protected_).end()), _Segment::probation);
+                break;
+            default: break;
+        }
+    }
+
+    // Insert a key, returning the keys to evict (possibly the key itself).
+    auto admit(const std::string &key, std::size_t size) -> std::vector<std::string> {
+        auto evicted = std::vector<std::string>{};
+        this->erase(key);
+        _M_sketch.increment(dark::xxhash64(key));
+        if (size > _M_window_capacity + _M_main_capacity) {
+            evicted.push_back(key);
+            return evicted;
+        }
+
+        auto &window = _M_list(_Segment::window);
+        window.push_front({key, size, _Segment::window});
+        _M_map.emplace(key, window.begin());
+        _M_bytes(_Segment::window) += size;
+        _M_sketch.reserve(_M_map.size());
+
+        while (_M_bytes(_Segment::window) > _M_window_capacity)
+            _M_promote_candidate(evicted);
+        return evicted;
+    }
+
+    auto erase(const std::string &key) -> void {
+        if (auto iter = _M_map.find(key); iter != _M_map.end()) {
+            auto node = iter->second;
+            _M_bytes(node->segment) -= node->size;
+            _M_list(node->segment).erase(node);
+            _M_map.erase(iter);
+        }
+    }
+
+private:
+    enum class _Segment : std::uint8_t { window, probation, protected_ };
+
+    struct _Node {
+        std::string key;
+        std::size_t size;
+        _Segment segment;
+    };
+
+    using _List_t = std::list<_Node>;
+    using _Iter_t = _List_t::iterator;
+
+    auto _M_list(_Segment segment) -> _List_t & {
+        return _M_lists[static_cast<std::size_t>(segment)];
+    }
+
+    auto _M_bytes(_Segment segment) -> std::size_t & {
+        return _M_sizes[static_cast<std::size_t>(segment)];
+    }
+
+    auto _M_move(_Iter_t node, _Segment segment) -> void {
+        _M_bytes(node->segment) -= node->size;
+        _M_bytes(segment) += node->size;
+        _M_list(segment).splice(_M_list(segment).begin(), _M_list(node->segment), node);
+        node->segment = segment;
+    }
+
+    auto _M_main_bytes() -> std::size_t {
+        return _M_bytes(_Segment::probation) + _M_bytes(_Segment::protected_);
+    }
+
+    // Move the window's LRU key into the main cache if it wins against every
+    // main victim it would displace, otherwise evict it. The victims are all
+    // picked first: either they all go, or none does.
+    auto _M_promote_candidate(std::vector<std::string> &evicted) -> void {
+        const auto candidate = std::prev(_M_list(_Segment::window).end());
+        const auto frequency = _M_sketch.frequency(dark::xxhash64(candidate->key));
+        if (candidate->size > _M_main_capacity) {
+            evicted.push_back(candidate->key);
+            return this->erase(evicted.back());
+        }
+        auto victims = std::vector<_Iter_t>{};
+        auto freed   = std::size_t{};
+        for (const auto segment : {_Segment::probation, _Segment::protected_}) {
+            auto &list = _M_list(segment);
+            for (auto node = list.end(); node != list.begin();) {
+                if (_M_main_bytes() - freed + candidate->size <= _M_main_capacity)
+                    break;
+                victims.push_back(--node);
+                freed += node->size;
+            }
+        }
+        const auto loses = std::ranges::any_of(victims, [&](_Iter_t victim) {
+            return frequency <= _M_sketch.frequency(dark::xxhash64(victim->key));
+        });
+        if (loses) {
+            evicted.push_back(candidate->key);
+            return this->erase(evicted.back());
+        }
+        for (const auto victim : victims) {
+            evicted.push_back(victim->key);
+            this->erase(evicted.back());
+        }
+        _M_move(candidate, _Segment::probation);
+    }
+
+    std::size_t _M_window_capacity;
+    std::size_t _M_main_capacity;
+    std::size_t _M_protected_capacity;
+    std::size_t _M_sizes[3]{};
+    _List_t _M_lists[3];
+    std::unordered_map<std::string, _Iter_t> _M_map;
+    CountMinSketch _M_sketch;
+};
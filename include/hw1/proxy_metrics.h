@@ -0,0 +1,32 @@
+#pragma once
+#include "metrics.h"
+#include <cstdint>
+#include <string_view>
+
+// What the proxy counts on its request path, in the registry of the process.
+// Counts kept elsewhere already (connections, relayed bytes, the cache) are
+// read from where they are when scraped.
+struct ProxyMetrics {
+    dark::Counter &requests;     // request heads received
+    dark::Counter &cache_hits;   // GETs served from the cache
+    dark::Counter &cache_stale;  // ... of which stale, refreshed in the background
+    dark::Counter &cache_misses; // GETs of http urls not in the cache
+
+    // Per stage of a connection: accepted to request head read, head read to
+    // connecting (parsing, resolving the host), connecting to connected, and
+    // accepted to closed.
+    dark::LatencyHistogram &request_time;
+    dark::LatencyHistogram &setup_time;
+    dark::LatencyHistogram &connect_time;
+    dark::LatencyHistogram &total_time;
+    // Of request_time, how long the end of the head waited in the kernel,
+    // received but not read yet: only observed with timestamps on.
+    dark::LatencyHistogram &queue_time;
+};
+
+auto proxy_metrics() -> ProxyMetrics &;
+
+// Serve the metrics of the process in the Prometheus text format, at GET
+// /metrics on `ip`:`port`, and the spans of its traced requests at GET
+// /trace, from a thread of its own.
+auto start_admin(std::string_view ip, std::uint16_t port) -> void;
@@ -0,0 +1,22 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+struct RefreshConfig {
+    std::size_t workers                       = 2;  // threads refreshing stale entries
+    std::chrono::milliseconds origin_interval = {}; // minimal delay between refreshes per origin
+    std::chrono::milliseconds timeout         = {}; // an origin may stay silent, 0 for ever
+};
+
+struct RefreshStats {
+    std::size_t stale_served; // stale hits served while revalidating
+    std::size_t refreshed;    // entries replaced by a background refresh
+    std::size_t blocked;      // refreshes skipped by the per-origin rate limit
+    std::size_t failed;       // refreshes that could not get a response
+};
+
+auto start_refresher(const RefreshConfig &config) -> void;
+auto refresh_in_background(std::string url, std::string request) -> void;
+auto refresh_stats() -> RefreshStats;
+auto print_refresh_stats() -> void;
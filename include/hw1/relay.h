@@ -0,0 +1,780 @@
+#pragma once
+#include "affinity.h"
+#include "hw1/governor.h"
+#include "logger.h"
+#include "metrics.h"
+#include "mpsc.h"
+#include "perf.h"
+#include "poller.h"
+#include "socket.h"
+#include "timer.h"
+#include "trace.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <netinet/in.h>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct RelayConfig {
+    // Stop reading a side once this many of its bytes wait for the other side,
+    // resume once they are down to the low watermark
+    std::size_t high_watermark = std::size_t{256} << 10;
+    std::size_t low_watermark  = std::size_t{64} << 10;
+
+    // Close a client that sent no complete request head within the header
+    // timeout, a target not connected within the connect timeout, a tunnel
+    // that moved no byte for the idle timeout or was open for its lifetime.
+    // Zero disables a timeout.
+    std::chrono::milliseconds header_timeout  = std::chrono::seconds{10};
+    std::chrono::milliseconds connect_timeout = std::chrono::seconds{10};
+    std::chrono::milliseconds idle_timeout    = std::chrono::seconds{60};
+    std::chrono::milliseconds lifetime        = std::chrono::milliseconds{0};
+
+    // Fair share: each round of the event loop, a tunnel ready to be read
+    // reads up to a quantum of bytes, its deficit; what it doesn't get to
+    // waits for the next round. Tunnels past `bulk_after` bytes read are bulk:
+    // in each round, the others go first, cache hits and fresh requests among
+    // them. Zero makes every tunnel interactive.
+    std::size_t quantum    = std::size_t{64} << 10;
+    std::size_t bulk_after = std::size_t{1} << 20;
+
+    // Charged for the buffers of every connection, if any. Under pressure, an
+    // origin is only read while its client keeps up, and captures are dropped.
+    MemoryGovernor *governor = nullptr;
+
+    // Run the relay thread on this CPU only, if any. Its buffers are then
+    // allocated on the NUMA node of the CPU, where they are first touched.
+    int cpu = -1;
+
+    // Busy polling, for latency at the cost of a CPU: the event loop spins
+    // this long before it sleeps, and sockets ask the kernel to busy poll
+    // too (if allowed to). Zero sleeps at once.
+    std::chrono::microseconds busy_poll{0};
+
+    // Observes how long targets take to connect, if any.
+    dark::LatencyHistogram *connect_time = nullptr;
+
+    // Records the spans of traced tunnels, if any: connect, first byte (from
+    // the target) and last byte (sent or received).
+    dark::Tracer *tracer = nullptr;
+
+    // Observes how long the last bytes of request heads waited in the kernel
+    // before they were read, if any: only for clients that timestamp what
+    // they receive, see Socket::opt_recv_timestamping.
+    dark::LatencyHistogram *queue_time = nullptr;
+
+    // Log the kernel's view of both sides of a tunnel as it closes: round
+    // trip, congestion window, retransmits and delivery rate.
+    bool tcp_info = false;
+
+    // Counts the hardware events of handling each batch of events, if any.
+    dark::PerfTotals *perf = nullptr;
+};
+
+struct RelayStats {
+    std::size_t open;         // connections handled by the relay
+    std::size_t relayed;      // bytes delivered, both directions
+    std::size_t paused;       // reads paused by the high watermark
+    std::size_t failures;     // connections closed by an error rather than by both sides
+    std::size_t timeouts;     // ... of which by a timeout
+    std::size_t deferred;     // reads left for the next round, out of quantum
+    std::size_t from_clients; // bytes read from clients
+    std::size_t from_targets; // ... from targets
+};
+
+// Serves connections on one thread, over an event loop: it reads request heads,
+// connects to targets, writes responses and relays tunnels between clients and
+// targets, any number at once.
+// Each direction of a tunnel has its own buffer: a side is only read while the
+// opposite side keeps up, so a slow peer holds back its own tunnel and nothing
+// else. A side that finishes sending is half-closed on the other side only
+// after its last byte is delivered; a tunnel ends once both directions have.
+// Every phase has a deadline, kept in a timer wheel. Reads are scheduled by
+// deficit round robin, so that an elephant flow can't hog the thread.
+// What the buffers hold is charged to the governor, once per event handled.
+struct Relay {
+public:
+    // Called on the relay thread when a connection ends, with what the target
+    // sent if captured, none if the tunnel failed: a reply cut short by a
+    // timeout or a reset is no reply. It must not block, other connections
+    // wait for it.
+    using Done = std::function<void(std::string reply)>;
+    // Called on the relay thread with the client and its request head (and what
+    // followed it), or an empty request if none came in time.
+    using OnRequest = std::function<void(dark::Socket client, std::string request)>;
+
+    explicit Relay(RelayConfig config = {}) :
+        _M_config(config), _M_poller(dark::Poller::create().unwrap()),
+        _M_thread([this] { this->_M_run(); }) {}
+
+    Relay(const Relay &)                     = delete;
+    auto operator=(const Relay &) -> Relay & = delete;
+
+    // Connections still open are closed without calling back.
+    ~Relay() {
+        _M_stopping.store(true);
+        _M_poller.wake();
+        _M_thread.join();
+    }
+
+    // All of these are safe to call from any thread, and never wait for the
+    // relay thread. Sockets are made nonblocking.
+
+    // Read a request head from the client.
+    auto receive_request(dark::Socket client, OnRequest on_request) -> void {
+        auto tunnel        = _S_make(std::move(client), dark::Socket{}, nullptr);
+        tunnel->phase      = _Phase::request;
+        tunnel->on_request = std::move(on_request);
+        this->_M_push(std::move(tunnel));
+    }
+
+    // Send a response to the client, then close it. `trace` is the request
+    // to record spans for, if not 0.
+    auto respond(dark::Socket client, std::string response, Done done, std::uint64_t trace = 0)
+        -> void {
+        auto tunnel           = _S_make(std::move(client), dark::Socket{}, std::move(done));
+        tunnel->trace         = trace;
+        tunnel->pipes[0].eof  = true;
+        tunnel->pipes[0].shut = true; // Whatever the client says now is ignored
+        tunnel->pipes[1].data = std::move(response);
+        tunnel->pipes[1].eof  = true;
+        this->_M_push(std::move(tunnel));
+    }
+
+    // Connect to `address`, then relay between the client and it. `to_target`
+    // and `to_client` are sent first, once connected.
+    auto connect(
+        dark::Socket client, const sockaddr_in &address, std::string to_target,
+        std::string to_client, bool capture, Done done, std::uint64_t trace = 0
+    ) -> void {
+        auto tunnel           = _S_make(std::move(client), dark::Socket{}, std::move(done));
+        tunnel->trace         = trace;
+        tunnel->phase         = _Phase::connecting;
+        tunnel->address       = address;
+        tunnel->capture       = capture;
+        tunnel->pipes[0].data = std::move(to_target);
+        tunnel->pipes[1].data = std::move(to_client);
+        this->_M_push(std::move(tunnel));
+    }
+
+    // Relay between a client and a target already connected.
+    auto add(dark::Socket client, dark::Socket target, bool capture, Done done) -> void {
+        auto tunnel     = _S_make(std::move(client), std::move(target), std::move(done));
+        tunnel->capture = capture;
+        this->_M_push(std::move(tunnel));
+    }
+
+    // Run `task` on the relay thread, e.g. to hand it what a pool computed.
+    auto post(std::function<void()> task) -> void {
+        _M_posted.push(std::move(task));
+        _M_poller.wake();
+    }
+
+    auto stats() const -> RelayStats {
+        return {
+            .open         = _M_open.load(std::memory_order_relaxed),
+            .relayed      = _M_relayed.load(std::memory_order_relaxed),
+            .paused       = _M_paused.load(std::memory_order_relaxed),
+            .failures     = _M_failures.load(std::memory_order_relaxed),
+            .timeouts     = _M_timeouts.load(std::memory_order_relaxed),
+            .deferred     = _M_deferred.load(std::memory_order_relaxed),
+            .from_clients = _M_read[0].load(std::memory_order_relaxed),
+            .from_targets = _M_read[1].load(std::memory_order_relaxed),
+        };
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::size_t _S_chunk    = 16384; // bytes per recv at most
+    static constexpr std::size_t _S_rounds   = 4;     // recvs of a request head per event
+    static constexpr std::size_t _S_max_head = 65536; // bytes of request head at most
+    static constexpr auto _S_tick            = std::chrono::milliseconds{10};
+    static constexpr auto _S_recheck         = std::chrono::milliseconds{50}; // the pressure
+
+    enum class _Phase : std::uint8_t { request, connecting, relaying };
+
+    struct _Tunnel;
+
+    // One socket of a tunnel, what the poller hands back with its events.
+    struct _Side {
+        dark::Socket socket;
+        _Tunnel *tunnel;
+        std::size_t index;
+        dark::Interest interest = dark::Interest::NONE; // as registered
+        bool registered         = false;
+    };
+
+    // Bytes received from one side and not yet sent to the other.
+    struct _Pipe {
+        std::string data;
+        std::size_t offset{}; // sent already
+        bool eof{};           // the sending side is done
+        bool shut{};          // ... and the receiving side was told so
+        bool paused{};        // above the high watermark
+
+        auto pending() const -> std::size_t {
+            return data.size() - offset;
+        }
+    };
+
+    // sides[0] is the client, sides[1] the target, if any. pipes[i] carries
+    // the bytes of sides[i] to the other side. While reading the request,
+    // pipes[0] holds the request.
+    struct _Tunnel {
+        _Tunnel(dark::Socket client, dark::Socket target, Done done) :
+            sides{_Side{std::move(client), this, 0}, _Side{std::move(target), this, 1}},
+            done(std::move(done)) {}
+
+        _Side sides[2];
+        _Pipe pipes[2];
+        _Phase phase = _Phase::relaying;
+        bool capture{};
+        bool closed{};
+        bool failed{};
+        std::string reply;
+        Done done;
+        OnRequest on_request;
+        sockaddr_in address{};
+        dark::TimerHandle timer;
+        Clock::time_point started;
+        Clock::time_point active; // when a byte last moved
+        std::size_t slot{};       // in _M_tunnels
+        std::size_t charged{};    // bytes charged to the governor
+        std::size_t read{};       // bytes read from both sides, in total
+        std::size_t deficit{};    // bytes it may still read this round
+        std::uint64_t round{};    // the last one it was credited for
+        std::uint64_t trace{};    // the request to record spans for, if not 0
+        Clock::time_point mark;   // ... where the next span starts
+        bool first_byte{};        // ... recorded already
+    };
+
+    static auto _S_make(dark::Socket client, dark::Socket target, Done done)
+        -> std::unique_ptr<_Tunnel> {
+        return std::make_unique<_Tunnel>(std::move(client), std::move(target), std::move(done));
+    }
+
+    auto _M_push(std::unique_ptr<_Tunnel> tunnel) -> void {
+        _M_pending.push(std::move(tunnel));
+        _M_poller.wake();
+    }
+
+    auto _M_run() -> void {
+        if (_M_config.cpu >= 0)
+            static_cast<void>(dark::pin_thread(_M_config.cpu)); // Runs anywhere otherwise
+        _M_poller.spin(_M_config.busy_poll);
+        auto events = std::array<dark::PollEvent, 64>{};
+        while (!_M_stopping.load()) {
+            auto timeout = std::chrono::milliseconds{-1};
+            if (const auto next = _M_wheel.next_timeout(_M_now))
+                timeout = std::chrono::ceil<std::chrono::milliseconds>(*next);
+            // Other threads release memory too: look again while throttled
+            if (_M_throttled && (timeout.count() < 0 || timeout > _S_recheck))
+                timeout = _S_recheck;
+            auto ready = _M_poller.wait(events, timeout);
+            _M_now     = Clock::now();
+            if (!ready)
+                continue; // Interrupted by a signal
+            const auto counted = dark::PerfScope{_M_config.perf};
+            _M_check_pressure();
+            _M_take_pending();
+            ++_M_round;
+            // Interactive tunnels first, each class in the order of the poller
+            const auto batch = std::span{events.data(), ready.unwrap()};
+            std::stable_partition(batch.begin(), batch.end(), [this](const dark::PollEvent &e) {
+                return !this->_M_bulk(*static_cast<_Side *>(e.data)->tunnel);
+            });
+            for (const auto &event : batch) {
+                auto *side = static_cast<_Side *>(event.data);
+                if (!side->tunnel->closed)
+                    _M_handle(*side->tunnel, side->index, event);
+            }
+            _M_wheel.advance(_M_now, [this](_Tunnel *tunnel) { this->_M_expire(*tunnel); });
+            _M_reap();
+        }
+    }
+
+    auto _M_take_pending() -> void {
+        while (auto task = _M_posted.pop())
+            (*task)();
+        while (auto pending = _M_pending.pop()) {
+            auto tunnel     = std::move(*pending);
+            tunnel->slot    = _M_tunnels.size();
+            tunnel->started = _M_now;
+            tunnel->mark    = _M_now;
+            tunnel->active  = _M_now;
+            _M_open.fetch_add(1, std::memory_order_relaxed);
+            auto &ref = *_M_tunnels.emplace_back(std::move(tunnel));
+            if (!this->_M_prepare(ref.sides[0].socket))
+                this->_M_close(ref, true);
+            else
+                this->_M_start(ref);
+        }
+    }
+
+    // Make a socket nonblocking, and busy polled if so configured. The kernel
+    // may well refuse to busy poll, which only costs latency.
+    auto _M_prepare(dark::Socket &socket) -> bool {
+        if (_M_config.busy_poll.count() > 0) {
+            const auto budget = static_cast<int>(_M_config.busy_poll.count());
+            static_cast<void>(socket.set_opt(socket.opt_busy_poll(budget)));
+            static_cast<void>(socket.set_opt(socket.opt_prefer_busy_poll));
+        }
+        return socket.set_nonblocking().has_value();
+    }
+
+    // Enter the first phase of a tunnel: arm its deadline, start waiting.
+    auto _M_start(_Tunnel &tunnel) -> void {
+        switch (tunnel.phase) {
+            case _Phase::request: this->_M_arm(tunnel, _M_config.header_timeout); break;
+            case _Phase::connecting:
+                if (!this->_M_connect(tunnel))
+                    return this->_M_close(tunnel, true);
+                if (tunnel.phase == _Phase::connecting)
+                    this->_M_arm(tunnel, _M_config.connect_timeout);
+                break;
+            case _Phase::relaying:
+                if (tunnel.sides[1].socket && !this->_M_prepare(tunnel.sides[1].socket))
+                    return this->_M_close(tunnel, true);
+                this->_M_arm_relay(tunnel);
+                break;
+            default: break;
+        }
+        if (tunnel.phase == _Phase::relaying)
+            return this->_M_kick(tunnel);
+        this->_M_update(tunnel);
+    }
+
+    // Entering the relay: send what was queued before, without waiting for an
+    // event. A response may well be done with right away.
+    auto _M_kick(_Tunnel &tunnel) -> void {
+        if (!this->_M_flush(tunnel, 0) || !this->_M_flush(tunnel, 1))
+            return this->_M_close(tunnel, true);
+        if (tunnel.pipes[0].shut && tunnel.pipes[1].shut)
+            return this->_M_close(tunnel, false);
+        this->_M_update(tunnel);
+    }
+
+    // Start a nonblocking connect, relaying right away if it completes at once.
+    auto _M_connect(_Tunnel &tunnel) -> bool {
+        auto &target = tunnel.sides[1].socket;
+        target = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+        if (!target || !this->_M_prepare(target))
+            return false;
+        if (target.connect(tunnel.address)) {
+            this->_M_connected(tunnel);
+            return true;
+        }
+        return errno == EINPROGRESS;
+    }
+
+    auto _M_connected(_Tunnel &tunnel) -> void {
+        tunnel.phase = _Phase::relaying;
+        this->_M_arm_relay(tunnel);
+        if (_M_config.connect_time != nullptr)
+            _M_config.connect_time->observe(_M_now - tunnel.started);
+        this->_M_span(tunnel, "connect", _M_now);
+    }
+
+    // Record the span from the mark of a traced tunnel to `end`, the next mark.
+    auto _M_span(_Tunnel &tunnel, const char *name, Clock::time_point end) -> void {
+        if (tunnel.trace == 0 || _M_config.tracer == nullptr)
+            return;
+        _M_config.tracer->record(name, tunnel.trace, tunnel.mark, end);
+        tunnel.mark = end;
+    }
+
+    auto _M_bulk(const _Tunnel &tunnel) const -> bool {
+        return _M_config.bulk_after != 0 && tunnel.read >= _M_config.bulk_after;
+    }
+
+    // Entering or leaving the throttle changes what origins are read.
+    auto _M_check_pressure() -> void {
+        const auto *governor = _M_config.governor;
+        const auto throttled = governor != nullptr && governor->pressure() >= Pressure::throttle;
+        if (throttled == _M_throttled)
+            return;
+        _M_throttled = throttled;
+        for (const auto &tunnel : _M_tunnels)
+            if (!tunnel->closed)
+                this->_M_update(*tunnel);
+    }
+
+    // Charge what the buffers of a tunnel hold now, allocated or not.
+    auto _M_account(_Tunnel &tunnel, bool release = false) -> void {
+        if (_M_config.governor == nullptr)
+            return;
+        auto held = std::size_t{};
+        if (!release)
+            held = tunnel.pipes[0].data.capacity() + tunnel.pipes[1].data.capacity()
+                 + tunnel.reply.capacity();
+        if (held == tunnel.charged)
+            return;
+        const auto delta = static_cast<std::ptrdiff_t>(held - tunnel.charged);
+        _M_config.governor->charge(delta);
+        tunnel.charged = held;
+    }
+
+    // Under pressure, the origin is only read while its client keeps up.
+    auto _M_held_back(const _Pipe &pipe, std::size_t index) const -> bool {
+        return index == 1 && _M_throttled && pipe.pending() != 0;
+    }
+
+    auto _M_arm(_Tunnel &tunnel, std::chrono::milliseconds timeout) -> void {
+        _M_wheel.cancel(tunnel.timer);
+        if (timeout.count() != 0)
+            tunnel.timer = _M_wheel.schedule(_M_now + timeout, &tunnel);
+    }
+
+    // The earliest of the idle and lifetime deadlines, if any.
+    auto _M_relay_deadline(const _Tunnel &tunnel) const -> Clock::time_point {
+        auto deadline = Clock::time_point::max();
+        if (_M_config.idle_timeout.count() != 0)
+            deadline = tunnel.active + _M_config.idle_timeout;
+        if (_M_config.lifetime.count() != 0)
+            deadline = std::min(deadline, tunnel.started + _M_config.lifetime);
+        return deadline;
+    }
+
+    // Activity doesn't touch the timer: when it fires, it is pushed back to
+    // the deadline the activity since then earned.
+    auto _M_arm_relay(_Tunnel &tunnel) -> void {
+        _M_wheel.cancel(tunnel.timer);
+        const auto deadline = _M_relay_deadline(tunnel);
+        if (deadline != Clock::time_point::max())
+            tunnel.timer = _M_wheel.schedule(deadline, &tunnel);
+    }
+
+    auto _M_expire(_Tunnel &tunnel) -> void {
+        if (tunnel.phase == _Phase::relaying && _M_relay_deadline(tunnel) > _M_now)
+            return this->_M_arm_relay(tunnel);
+        _M_timeouts.fetch_add(1, std::memory_order_relaxed);
+        this->_M_close(tunnel, true);
+    }
+
+    auto _M_handle(_Tunnel &tunnel, std::size_t index, const dark::PollEvent &event) -> void {
+        switch (tunnel.phase) {
+            case _Phase::request:
+                if (!this->_M_read_request(tunnel))
+                    return this->_M_close(tunnel, true);
+                break;
+            case _Phase::connecting:
+                if (!tunnel.sides[1].socket.connect_result())
+                    return this->_M_close(tunnel, true);
+                this->_M_connected(tunnel);
+                return this->_M_kick(tunnel);
+            case _Phase::relaying: {
+                if (tunnel.round != _M_round) {
+                    tunnel.round = _M_round;
+                    // Reads are sized to fit: nothing would carry over a round
+                    tunnel.deficit = std::max<std::size_t>(_M_config.quantum, 1);
+                }
+                // Writable: the pipe towards this side can move. Readable: its own pipe.
+                auto ok = true;
+                if (event.writable())
+                    ok = this->_M_flush(tunnel, 1 - index);
+                if (ok && event.readable())
+                    ok = this->_M_fill(tunnel, index);
+                if (!ok)
+                    return this->_M_close(tunnel, true);
+                if (tunnel.pipes[0].shut && tunnel.pipes[1].shut)
+                    return this->_M_close(tunnel, false);
+                break;
+            }
+            default: break;
+        }
+        if (!tunnel.closed)
+            this->_M_update(tunnel);
+    }
+
+    // Read the request head into pipes[0]. A complete one ends the tunnel, for
+    // `on_request` to take the client over.
+    auto _M_read_request(_Tunnel &tunnel) -> bool {
+        auto &request = tunnel.pipes[0].data;
+        for (std::size_t round = 0; round < _S_rounds; ++round) {
+            auto got = tunnel.sides[0].socket.recv_timestamped(std::span{_M_scratch});
+            if (!got)
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            const auto [size, stamp] = got.unwrap();
+            if (size == 0)
+                return false;
+            _M_read[0].fetch_add(size, std::memory_order_relaxed);
+            const auto from = request.size() - std::min<std::size_t>(request.size(), 3);
+            request.append(_M_scratch.data(), size);
+            if (request.find("\r\n\r\n", from) != std::string::npos) {
+                // Not stamped if the kernel was not asked to, or not yet
+                if (_M_config.queue_time != nullptr && stamp.time_since_epoch().count() != 0)
+                    _M_config.queue_time->observe(std::chrono::system_clock::now() - stamp);
+                this->_M_close(tunnel, false);
+                return true;
+            }
+            if (request.size() > _S_max_head)
+                return false;
+        }
+        return true;
+    }
+
+    // Read from sides[index] into its pipe, sending right away what fits, as
+    // far as the deficit of the tunnel goes.
+    auto _M_fill(_Tunnel &tunnel, std::size_t index) -> bool {
+        auto &pipe      = tunnel.pipes[index];
+        auto &from      = tunnel.sides[index].socket;
+        auto &to        = tunnel.sides[1 - index].socket;
+        const auto high = _M_config.high_watermark;
+        while (!pipe.eof && !pipe.paused && pipe.pending() < high && !_M_held_back(pipe, index)) {
+            if (tunnel.deficit == 0) {
+                _M_deferred.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            const auto room = std::min({_S_chunk, high - pipe.pending(), tunnel.deficit});
+            auto got        = from.recv(std::span{_M_scratch.data(), room});
+            if (!got) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    return false;
+                break;
+            }
+            const auto size = got.unwrap();
+            if (size == 0) {
+                pipe.eof = true;
+                break;
+            }
+            tunnel.active = _M_now;
+            if (index == 1 && !tunnel.first_byte) {
+                tunnel.first_byte = true;
+                this->_M_span(tunnel, "first byte", _M_now);
+            }
+            tunnel.read += size;
+            tunnel.deficit -= size;
+            _M_read[index].fetch_add(size, std::memory_order_relaxed);
+            auto chunk = std::string_view{_M_scratch.data(), size};
+            if (index == 1 && tunnel.capture)
+                this->_M_capture(tunnel, chunk);
+            // Nothing queued in front: send from the scratch buffer, keep the rest
+            if (pipe.pending() == 0) {
+                auto sent = to.send(chunk);
+                if (!sent && errno != EAGAIN && errno != EWOULDBLOCK)
+                    return false;
+                const auto moved = sent.value_or(0);
+                chunk.remove_prefix(moved);
+                _M_relayed.fetch_add(moved, std::memory_order_relaxed);
+            }
+            pipe.data += chunk;
+        }
+        return this->_M_flush(tunnel, index);
+    }
+
+    // Keep what the target sent for the cache, unless memory runs short.
+    auto _M_capture(_Tunnel &tunnel, std::string_view chunk) -> void {
+        auto *governor = _M_config.governor;
+        if (governor == nullptr || governor->pressure() < Pressure::uncache) {
+            tunnel.reply += chunk;
+            return;
+        }
+        tunnel.capture = false;
+        tunnel.reply   = std::string{};
+        governor->count_uncached();
+    }
+
+    // Send what pipes[index] holds to the other side, half-closing it at the end.
+    auto _M_flush(_Tunnel &tunnel, std::size_t index) -> bool {
+        auto &pipe = tunnel.pipes[index];
+        auto &to   = tunnel.sides[1 - index].socket;
+        while (pipe.pending() != 0) {
+            auto sent = to.send(std::string_view{pipe.data}.substr(pipe.offset));
+            if (!sent) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    return false;
+                break;
+            }
+            const auto size = sent.unwrap();
+            pipe.offset += size;
+            tunnel.active = _M_now;
+            _M_relayed.fetch_add(size, std::memory_order_relaxed);
+        }
+        if (pipe.pending() == 0) {
+            // A burst grew it: give the memory back rather than keep it for later
+            if (pipe.data.capacity() > _S_chunk * _S_rounds)
+                pipe.data = std::string{};
+            else
+                pipe.data.clear();
+            pipe.offset = 0;
+        } else if (pipe.offset >= _S_chunk * _S_rounds) {
+            pipe.data.erase(0, pipe.offset); // Don't let sent bytes pile up in front
+            pipe.offset = 0;
+        }
+
+        if (!pipe.paused && pipe.pending() >= _M_config.high_watermark) {
+            pipe.paused = true;
+            _M_paused.fetch_add(1, std::memory_order_relaxed);
+        } else if (pipe.paused && pipe.pending() <= _M_config.low_watermark) {
+            pipe.paused = false;
+        }
+        if (pipe.eof && !pipe.shut && pipe.pending() == 0) {
+            pipe.shut = true;
+            // The other side may be gone already: nothing left to tell it then
+            static_cast<void>(to.shutdown_write());
+        }
+        return true;
+    }
+
+    // What a side waits for. Reading the request: its head. Connecting: the
+    // target becoming writable. Relaying: reads while the pipe of a side has
+    // room, writes while the pipe towards it has data.
+    auto _M_interest(const _Tunnel &tunnel, const _Side &side) const -> dark::Interest {
+        if (!side.socket)
+            return dark::Interest::NONE;
+        switch (tunnel.phase) {
+            case _Phase::request: return dark::Interest::READ;
+            case _Phase::connecting:
+                return side.index == 1 ? dark::Interest::WRITE : dark::Interest::NONE;
+            case _Phase::relaying: {
+                const auto &own     = tunnel.pipes[side.index];
+                const auto &towards = tunnel.pipes[1 - side.index];
+                auto interest       = dark::Interest::NONE;
+                if (!own.eof && !own.paused && !_M_held_back(own, side.index))
+                    interest = interest | dark::Interest::READ;
+                if (towards.pending() != 0)
+                    interest = interest | dark::Interest::WRITE;
+                return interest;
+            }
+            default: return dark::Interest::NONE;
+        }
+    }
+
+    // A side waiting for nothing leaves the poller, or it would report its
+    // hang-up over and over. Buffers changed by then: charge them too.
+    auto _M_update(_Tunnel &tunnel) -> void {
+        this->_M_account(tunnel);
+        for (auto &side : tunnel.sides) {
+            const auto interest = _M_interest(tunnel, side);
+            if (side.registered == (interest != dark::Interest::NONE) && interest == side.interest)
+                continue;
+
+            auto ok = true;
+            if (interest == dark::Interest::NONE) {
+                ok              = !side.registered || _M_poller.remove(side.socket).has_value();
+                side.registered = false;
+            } else if (side.registered) {
+                ok = _M_poller.modify(side.socket, interest, &side).has_value();
+            } else {
+                ok              = _M_poller.add(side.socket, interest, &side).has_value();
+                side.registered = true;
+            }
+            side.interest = interest;
+            if (!ok)
+                return this->_M_close(tunnel, true);
+        }
+    }
+
+    // Closed tunnels are freed after the current batch of events, which may
+    // still point to them.
+    auto _M_close(_Tunnel &tunnel, bool failed) -> void {
+        if (tunnel.closed)
+            return;
+        tunnel.closed = true;
+        tunnel.failed = failed;
+        // The last span of a traced tunnel ends here, or where the last byte moved
+        if (tunnel.phase == _Phase::connecting)
+            this->_M_span(tunnel, "connect", _M_now);
+        else if (tunnel.phase == _Phase::relaying)
+            this->_M_span(tunnel, "last byte", std::max(tunnel.mark, tunnel.active));
+        if (_M_config.tcp_info && tunnel.phase != _Phase::request)
+            this->_M_log_tcp_info(tunnel);
+        _M_wheel.cancel(tunnel.timer);
+        this->_M_account(tunnel, true);
+        for (auto &side : tunnel.sides)
+            if (side.registered)
+                static_cast<void>(_M_poller.remove(side.socket));
+        if (failed)
+            _M_failures.fetch_add(1, std::memory_order_relaxed);
+        _M_closed.push_back(&tunnel);
+    }
+
+    // One line per tunnel, for the sides that are TCP connections.
+    auto _M_log_tcp_info(const _Tunnel &tunnel) -> void {
+        constexpr const char *names[] = {"client", "target"};
+        auto line                     = std::string{};
+        for (std::size_t i = 0; i < 2; ++i) {
+            auto info = tunnel.sides[i].socket.tcp_info();
+            if (!info)
+                continue;
+            const auto tcp = info.unwrap();
+            std::format_to(
+                std::back_inserter(line),
+                "{}{} rtt {}us (+/- {}us), cwnd {}, {} retransmits, {} lost, {:.2f} MB/s",
+                line.empty() ? "" : "; ", names[i], tcp.rtt.count(), tcp.rtt_var.count(),
+                tcp.cwnd, tcp.retransmits, tcp.lost, static_cast<double>(tcp.delivery_rate) / 1e6
+            );
+        }
+        if (!line.empty())
+            dark::log_info("TCP {}", line);
+    }
+
+    auto _M_reap() -> void {
+        for (auto *tunnel : _M_closed) {
+            auto owned = std::move(_M_tunnels[tunnel->slot]);
+            if (tunnel->slot + 1 != _M_tunnels.size()) {
+                _M_tunnels[tunnel->slot]       = std::move(_M_tunnels.back());
+                _M_tunnels[tunnel->slot]->slot = tunnel->slot;
+            }
+            _M_tunnels.pop_back();
+            _M_open.fetch_sub(1, std::memory_order_relaxed);
+
+            if (owned->phase == _Phase::request) {
+                auto on_request = std::move(owned->on_request);
+                auto client     = std::move(owned->sides[0].socket);
+                auto request    = owned->failed ? std::string{} : std::move(owned->pipes[0].data);
+                owned.reset();
+                on_request(std::move(client), std::move(request));
+                continue;
+            }
+            // Close the sockets first: the peers see the end before `done` runs
+            auto done  = std::move(owned->done);
+            auto reply = owned->failed ? std::string{} : std::move(owned->reply);
+            owned.reset();
+            if (done)
+                done(std::move(reply));
+        }
+        _M_closed.clear();
+    }
+
+    RelayConfig _M_config;
+    dark::Poller _M_poller;
+    std::atomic<bool> _M_stopping{};
+
+    // Handed over by other threads, without locks
+    dark::MpscQueue<std::unique_ptr<_Tunnel>> _M_pending;
+    dark::MpscQueue<std::function<void()>> _M_posted;
+
+    // Owned by the relay thread
+    Clock::time_point _M_now = Clock::now(); // as of the last wake up
+    dark::TimerWheel<_Tunnel *> _M_wheel{_S_tick, _M_now};
+    std::vector<std::unique_ptr<_Tunnel>> _M_tunnels;
+    std::vector<_Tunnel *> _M_closed;
+    std::array<char, _S_chunk> _M_scratch{};
+    bool _M_throttled{}; // by the governor, as of the last wake up
+    std::uint64_t _M_round{};
+
+    std::atomic_size_t _M_open{};
+    std::atomic_size_t _M_relayed{};
+    std::atomic_size_t _M_paused{};
+    std::atomic_size_t _M_failures{};
+    std::atomic_size_t _M_timeouts{};
+    std::atomic_size_t _M_deferred{};
+    std::array<std::atomic_size_t, 2> _M_read{}; // from clients, from targets
+
+    std::thread _M_thread; // last: starts once everything else is ready
+};
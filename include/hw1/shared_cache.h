@@ -0,0 +1,501 @@
+#pragma once
+#include "file.h"
+#include "hash.h"
+#include "optional.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// A cached response as stored in, and copied out of, the shared cache.
+struct SharedItem {
+    std::string data;            // the response as stored, possibly gzip-encoded
+    std::string identity_header; // empty unless `data` is gzip-encoded
+    std::size_t raw_size;        // size of the original response
+    std::chrono::steady_clock::time_point fresh_until;
+    std::chrono::steady_clock::time_point stale_until;
+    std::string request;
+};
+
+struct SharedCacheStats {
+    std::size_t entries;
+    std::size_t stored_bytes; // bytes of items in use
+    std::size_t capacity;     // bytes of slab pages
+    std::size_t evicted;      // items evicted to make room for others
+    std::size_t wiped;        // times a process died in the middle of an update
+};
+
+namespace __detail {
+
+inline constexpr std::uint64_t shm_magic  = 0x325f'6568'6361'6361; // "acache_2"
+inline constexpr std::size_t shm_page     = std::size_t{1} << 20;
+inline constexpr std::size_t shm_classes  = 42; // 128 bytes to a page, by steps of 1.25
+inline constexpr std::size_t shm_min_item = 128;
+
+} // namespace __detail
+
+// A cache living in a memfd mapping, shared by the processes forked after its
+// creation or handed its fd. The processes may map it at different addresses,
+// so everything inside is linked by offset from the start of the mapping.
+// Memory is carved into 1 MiB slab pages, each split into items of one size
+// class; once out of pages, a class evicts its least recently used item. A
+// class left with no item to evict takes a page over from the class whose
+// least recently used item is the coldest, evicting all that page holds.
+// A robust process-shared mutex guards the whole structure: a process dying with
+// it held leaves the cache usable, only wiped if the process died mid-update.
+struct SharedCache {
+public:
+    // Map a new cache of `size` bytes, including its index.
+    [[nodiscard]]
+    static auto create(std::size_t size) -> dark::optional<SharedCache> {
+        auto file = dark::FileManager{::memfd_create("proxy_cache", MFD_CLOEXEC)};
+        if (!file || ::ftruncate(file.unsafe_get(), static_cast<off_t>(size)) != 0)
+            return dark::erropt;
+        const auto fd = file.unsafe_get();
+        auto *base    = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+            return dark::erropt;
+        auto cache = SharedCache{std::move(file), static_cast<char *>(base), size};
+        if (!cache._M_initialize())
+            return dark::nullopt;
+        return cache;
+    }
+
+    // Map the cache behind an fd received from another process, taking ownership of it.
+    [[nodiscard]]
+    static auto attach(int fd) -> dark::optional<SharedCache> {
+        auto file = dark::FileManager{fd};
+        struct stat info {};
+        if (::fstat(fd, &info) != 0)
+            return dark::erropt;
+        const auto size = static_cast<std::size_t>(info.st_size);
+        auto *base      = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+            return dark::erropt;
+        auto cache = SharedCache{std::move(file), static_cast<char *>(base), size};
+        if (size < sizeof(_Header) || cache._M_header()->magic != __detail::shm_magic)
+            return dark::nullopt;
+        return cache;
+    }
+
+    SharedCache(SharedCache &&other) noexcept :
+        _M_file(std::move(other._M_file)),
+        _M_base(std::exchange(other._M_base, nullptr)),
+        _M_size(std::exchange(other._M_size, 0)) {}
+
+    auto operator=(SharedCache &&other) noexcept -> SharedCache & {
+        std::swap(_M_file, other._M_file);
+        std::swap(_M_base, other._M_base);
+        std::swap(_M_size, other._M_size);
+        return *this;
+    }
+
+    ~SharedCache() noexcept {
+        if (_M_base != nullptr)
+            ::munmap(_M_base, _M_size);
+    }
+
+    // The memfd, to hand the cache over to another process.
+    [[nodiscard]]
+    auto fd() const noexcept -> int {
+        return _M_file.unsafe_get();
+    }
+
+    // Copy out the item of a url, marking it recently used.
+    auto find(std::string_view url) -> std::optional<SharedItem> {
+        const auto hash = dark::xxhash64(url);
+        auto lock       = _M_lock();
+        if (!lock)
+            return {};
+        auto *item = _M_find(url, hash);
+        if (item == nullptr)
+            return {};
+        _M_lru_unlink(item);
+        _M_lru_push(item);
+        item->used = _S_ticks(std::chrono::steady_clock::now());
+        return _S_copy(item);
+    }
+
+    // Store the item of a url, replacing any previous one. Fails if it can't
+    // fit, the previous one kept then, or if the cache can't be locked.
+    auto store(std::string_view url, const SharedItem &value) -> bool {
+        const auto hash = dark::xxhash64(url);
+        const auto size = sizeof(_Item) + url.size() + value.identity_header.size() +
+                          value.data.size() + value.request.size();
+        auto lock        = _M_lock();
+        if (!lock)
+            return false;
+        auto *header     = _M_header();
+        const auto klass = _M_class_of(size);
+        if (klass == __detail::shm_classes)
+            return false;
+        // The old item goes only once the new one has room, unless it is the room
+        if (auto *old = _M_find(url, hash); old != nullptr && old->klass == klass)
+            _M_release(old);
+        auto *item = _M_allocate(klass);
+        if (item == nullptr)
+            return false;
+        // Found again: making room may have evicted it already
+        if (auto *old = _M_find(url, hash))
+            _M_release(old);
+
+        item->hash         = hash;
+        item->used         = _S_ticks(std::chrono::steady_clock::now());
+        item->fresh_until  = _S_ticks(value.fresh_until);
+        item->stale_until  = _S_ticks(value.stale_until);
+        item->raw_size     = value.raw_size;
+        item->size         = size;
+        item->url_size     = static_cast<std::uint32_t>(url.size());
+        item->header_size  = static_cast<std::uint32_t>(value.identity_header.size());
+        item->data_size    = static_cast<std::uint32_t>(value.data.size());
+        item->request_size = static_cast<std::uint32_t>(value.request.size());
+        auto *bytes        = reinterpret_cast<char *>(item + 1);
+        bytes              = std::ranges::copy(url, bytes).out;
+        bytes              = std::ranges::copy(value.identity_header, bytes).out;
+        bytes              = std::ranges::copy(value.data, bytes).out;
+        std::ranges::copy(value.request, bytes);
+
+        auto &bucket    = _M_bucket(hash);
+        item->hash_next = bucket;
+        bucket          = _M_offset(item);
+        _M_lru_push(item);
+        header->entries += 1;
+        header->stored_bytes += size;
+        return true;
+    }
+
+    auto erase(std::string_view url) -> bool {
+        const auto hash = dark::xxhash64(url);
+        auto lock       = _M_lock();
+        if (!lock)
+            return false;
+        auto *item = _M_find(url, hash);
+        if (item == nullptr)
+            return false;
+        _M_release(item);
+        return true;
+    }
+
+    // Every url with its item, copied out, to save the cache to disk.
+    auto items() -> std::vector<std::pair<std::string, SharedItem>> {
+        auto result  = std::vector<std::pair<std::string, SharedItem>>{};
+        auto lock    = _M_lock();
+        auto *header = _M_header();
+        if (!lock)
+            return result;
+        for (std::uint64_t i = 0; i < header->bucket_count; ++i)
+            for (auto offset = _M_buckets()[i]; offset != 0; offset = _M_at(offset)->hash_next)
+                result.emplace_back(_S_url(_M_at(offset)), _S_copy(_M_at(offset)));
+        return result;
+    }
+
+    auto stats() -> SharedCacheStats {
+        auto lock          = _M_lock();
+        const auto *header = _M_header();
+        if (!lock)
+            return {};
+        return {
+            .entries      = header->entries,
+            .stored_bytes = header->stored_bytes,
+            .capacity     = header->pages_end - header->pages_begin,
+            .evicted      = header->evicted,
+            .wiped        = header->wiped,
+        };
+    }
+
+private:
+    struct _Item {
+        std::uint64_t hash_next; // next item of the bucket, or of the free list
+        std::uint64_t lru_prev;
+        std::uint64_t lru_next;
+        std::uint64_t hash;
+        std::int64_t used;        // steady_clock ticks, which all processes share
+        std::int64_t fresh_until;
+        std::int64_t stale_until;
+        std::uint64_t raw_size;
+        std::uint64_t size;  // bytes in use, header included, 0 if free
+        std::uint32_t klass; // size class
+        std::uint32_t url_size;
+        std::uint32_t header_size;
+        std::uint32_t data_size;
+        std::uint32_t request_size;
+        // Followed by the url, identity header, data and request
+    };
+
+    struct _Class {
+        std::uint64_t item_size;
+        std::uint64_t free;     // free list, linked through hash_next
+        std::uint64_t lru_head; // most recently used
+        std::uint64_t lru_tail;
+    };
+
+    struct _Header {
+        std::uint64_t magic;
+        pthread_mutex_t mutex;
+        std::uint64_t dirty; // set while the mutex is held
+        std::uint64_t bucket_count;
+        std::uint64_t buckets;
+        std::uint64_t pages_begin;
+        std::uint64_t pages_next; // first page not given to a class yet
+        std::uint64_t pages_end;
+        std::uint64_t entries;
+        std::uint64_t stored_bytes;
+        std::uint64_t evicted;
+        std::uint64_t wiped;
+        _Class classes[__detail::shm_classes];
+    };
+
+    // Releases the mutex on destruction.
+    struct _Lock {
+        explicit _Lock(_Header *header) : header(header) {}
+        _Lock(const _Lock &)                     = delete;
+        auto operator=(const _Lock &) -> _Lock & = delete;
+        ~_Lock() {
+            header->dirty = 0;
+            ::pthread_mutex_unlock(&header->mutex);
+        }
+        _Header *header;
+    };
+
+    explicit SharedCache(dark::FileManager file, char *base, std::size_t size) noexcept :
+        _M_file(std::move(file)), _M_base(base), _M_size(size) {}
+
+    static auto _S_ticks(std::chrono::steady_clock::time_point time) -> std::int64_t {
+        return time.time_since_epoch().count();
+    }
+
+    static auto _S_time(std::int64_t ticks) -> std::chrono::steady_clock::time_point {
+        return std::chrono::steady_clock::time_point{std::chrono::steady_clock::duration{ticks}};
+    }
+
+    static auto _S_url(const _Item *item) -> std::string_view {
+        return {reinterpret_cast<const char *>(item + 1), item->url_size};
+    }
+
+    static auto _S_copy(const _Item *item) -> SharedItem {
+        const auto *bytes = reinterpret_cast<const char *>(item + 1) + item->url_size;
+        auto result       = SharedItem{};
+        result.identity_header.assign(bytes, item->header_size);
+        result.data.assign(bytes + item->header_size, item->data_size);
+        result.request.assign(bytes + item->header_size + item->data_size, item->request_size);
+        result.raw_size    = item->raw_size;
+        result.fresh_until = _S_time(item->fresh_until);
+        result.stale_until = _S_time(item->stale_until);
+        return result;
+    }
+
+    auto _M_header() const -> _Header * {
+        return reinterpret_cast<_Header *>(_M_base);
+    }
+
+    auto _M_at(std::uint64_t offset) const -> _Item * {
+        return reinterpret_cast<_Item *>(_M_base + offset);
+    }
+
+    auto _M_offset(const _Item *item) const -> std::uint64_t {
+        return static_cast<std::uint64_t>(reinterpret_cast<const char *>(item) - _M_base);
+    }
+
+    auto _M_buckets() const -> std::uint64_t * {
+        return reinterpret_cast<std::uint64_t *>(_M_base + _M_header()->buckets);
+    }
+
+    auto _M_bucket(std::uint64_t hash) const -> std::uint64_t & {
+        return _M_buckets()[hash & (_M_header()->bucket_count - 1)];
+    }
+
+    // Lay out the header, the index and the pages in a zeroed mapping.
+    auto _M_initialize() -> bool {
+        constexpr auto align = [](std::size_t n) { return (n + 63) / 64 * 64; };
+        auto *header         = std::construct_at(_M_header());
+        // One bucket for every 4 KiB of memory, the size of a typical response
+        header->bucket_count = std::bit_floor(std::max<std::size_t>(_M_size / 4096, 1024));
+        header->buckets      = align(sizeof(_Header));
+        header->pages_begin  = align(header->buckets + header->bucket_count * 8);
+        if (header->pages_begin + __detail::shm_page > _M_size)
+            return false;
+        const auto pages  = (_M_size - header->pages_begin) / __detail::shm_page;
+        header->pages_end = header->pages_begin + pages * __detail::shm_page;
+
+        auto attr = pthread_mutexattr_t{};
+        ::pthread_mutexattr_init(&attr);
+        ::pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        ::pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        const auto ret = ::pthread_mutex_init(&header->mutex, &attr);
+        ::pthread_mutexattr_destroy(&attr);
+        if (ret != 0)
+            return false;
+
+        _M_format();
+        header->magic = __detail::shm_magic;
+        return true;
+    }
+
+    // Empty the cache: every bucket, class and page becomes unused.
+    auto _M_format() -> void {
+        auto *header = _M_header();
+        std::fill_n(_M_buckets(), header->bucket_count, 0);
+        auto size = __detail::shm_min_item;
+        for (auto &klass : header->classes) {
+            klass = {size, 0, 0, 0};
+            size  = std::min(__detail::shm_page, (size * 5 / 4 + 7) / 8 * 8);
+        }
+        header->pages_next   = header->pages_begin;
+        header->entries      = 0;
+        header->stored_bytes = 0;
+    }
+
+    // Lock the cache. If its last owner died in the middle of an update,
+    // the links can't be trusted any more and the cache starts over empty.
+    // Empty if the mutex can't be taken (e.g. ENOTRECOVERABLE, left by an
+    // owner that died unrecovered): the caller fails rather than go on unlocked.
+    auto _M_lock() -> std::optional<_Lock> {
+        auto *header   = _M_header();
+        const auto ret = ::pthread_mutex_lock(&header->mutex);
+        if (ret == EOWNERDEAD) {
+            if (header->dirty != 0) {
+                _M_format();
+                header->wiped += 1;
+            }
+            ::pthread_mutex_consistent(&header->mutex);
+        } else if (ret != 0) {
+            errno = ret;
+            return {};
+        }
+        header->dirty = 1;
+        return std::optional<_Lock>{std::in_place, header};
+    }
+
+    auto _M_class_of(std::size_t size) const -> std::size_t {
+        const auto &classes = _M_header()->classes;
+        for (std::size_t i = 0; i < __detail::shm_classes; ++i)
+            if (classes[i].item_size >= size)
+                return i;
+        return __detail::shm_classes;
+    }
+
+    auto _M_find(std::string_view url, std::uint64_t hash) const -> _Item * {
+        for (auto offset = _M_bucket(hash); offset != 0; offset = _M_at(offset)->hash_next)
+            if (auto *item = _M_at(offset); item->hash == hash && _S_url(item) == url)
+                return item;
+        return nullptr;
+    }
+
+    auto _M_lru_push(_Item *item) -> void {
+        auto &klass    = _M_header()->classes[item->klass];
+        item->lru_prev = 0;
+        item->lru_next = klass.lru_head;
+        if (klass.lru_head != 0)
+            _M_at(klass.lru_head)->lru_prev = _M_offset(item);
+        else
+            klass.lru_tail = _M_offset(item);
+        klass.lru_head = _M_offset(item);
+    }
+
+    auto _M_lru_unlink(_Item *item) -> void {
+        auto &klass = _M_header()->classes[item->klass];
+        (item->lru_prev != 0 ? _M_at(item->lru_prev)->lru_next : klass.lru_head) = item->lru_next;
+        (item->lru_next != 0 ? _M_at(item->lru_next)->lru_prev : klass.lru_tail) = item->lru_prev;
+    }
+
+    // Unlink an item from its bucket and its LRU list, and free it.
+    auto _M_release(_Item *item) -> void {
+        auto *header = _M_header();
+        auto *link   = &_M_bucket(item->hash);
+        while (*link != _M_offset(item))
+            link = &_M_at(*link)->hash_next;
+        *link = item->hash_next;
+        _M_lru_unlink(item);
+
+        auto &klass     = header->classes[item->klass];
+        item->hash_next = klass.free;
+        klass.free      = _M_offset(item);
+        header->entries -= 1;
+        header->stored_bytes -= item->size;
+        item->size = 0;
+    }
+
+    // Split a page into free items of a class.
+    auto _M_carve(std::uint64_t page, std::size_t index) -> void {
+        auto &klass = _M_header()->classes[index];
+        for (auto offset = page; offset + klass.item_size <= page + __detail::shm_page;
+             offset += klass.item_size) {
+            auto *item      = _M_at(offset);
+            item->size      = 0;
+            item->hash_next = klass.free;
+            klass.free      = offset;
+        }
+    }
+
+    // Give a class the page of the coldest least recently used item of the
+    // others, evicting every item on it, if any other class has one.
+    auto _M_reassign(std::size_t index) -> void {
+        auto *header = _M_header();
+        auto coldest = __detail::shm_classes;
+        for (std::size_t i = 0; i < __detail::shm_classes; ++i) {
+            const auto tail = header->classes[i].lru_tail;
+            if (i != index && tail != 0 &&
+                (coldest == __detail::shm_classes ||
+                 _M_at(tail)->used < _M_at(header->classes[coldest].lru_tail)->used))
+                coldest = i;
+        }
+        if (coldest == __detail::shm_classes)
+            return;
+
+        auto &from        = header->classes[coldest];
+        const auto offset = from.lru_tail - header->pages_begin;
+        const auto page   = header->pages_begin + offset / __detail::shm_page * __detail::shm_page;
+        const auto end    = page + __detail::shm_page;
+        for (auto slot = page; slot + from.item_size <= end; slot += from.item_size)
+            if (auto *item = _M_at(slot); item->size != 0) {
+                _M_release(item);
+                header->evicted += 1;
+            }
+        // All free now, and off the free list of the class they were of
+        for (auto *link = &from.free; *link != 0;)
+            if (*link >= page && *link < end)
+                *link = _M_at(*link)->hash_next;
+            else
+                link = &_M_at(*link)->hash_next;
+        _M_carve(page, index);
+    }
+
+    // Take a free item of a class: from its free list, a new page, its LRU end,
+    // or a page of another class.
+    auto _M_allocate(std::size_t index) -> _Item * {
+        auto *header = _M_header();
+        auto &klass  = header->classes[index];
+        if (klass.free == 0 && header->pages_next < header->pages_end) {
+            _M_carve(header->pages_next, index);
+            header->pages_next += __detail::shm_page;
+        }
+        if (klass.free == 0 && klass.lru_tail != 0) {
+            _M_release(_M_at(klass.lru_tail));
+            header->evicted += 1;
+        }
+        if (klass.free == 0)
+            _M_reassign(index);
+        if (klass.free == 0)
+            return nullptr;
+        auto *item  = _M_at(klass.free);
+        klass.free  = item->hash_next;
+        item->klass = static_cast<std::uint32_t>(index);
+        return item;
+    }
+
+    dark::FileManager _M_file;
+    char *_M_base;
+    std::size_t _M_size;
+};
@@ -0,0 +1,31 @@
+#pragma once
+#include "socket.h"
+#include "unix.h"
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// Zero-downtime restart: a new process asks the running one, over a Unix
+// socket, for its listening sockets and its cache. Once the new process
+// serves, the old one stops accepting, drains its connections and exits.
+
+// What a process taking over receives from its predecessor.
+struct Handoff {
+    std::vector<dark::Socket> servers; // listening sockets, bound and queuing connections
+    int cache_fd;                      // memfd of the shared cache, -1 if it was saved to disk
+    dark::UnixSocket peer;             // to confirm the takeover on
+};
+
+// Ask the process listening on `path` to hand over. Empty if none answers.
+auto request_takeover(const std::string &path) -> std::optional<Handoff>;
+
+// Tell the predecessor that we are serving, so that it can stop.
+auto confirm_takeover(Handoff handoff) -> void;
+
+// Answer takeover requests on `path` from a background thread. Once a successor
+// confirms, `on_handed_over` is called and no other request is answered.
+auto serve_takeover(
+    const std::string &path, std::span<dark::Socket> servers, std::function<void()> on_handed_over
+) -> void;
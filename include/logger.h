@@ -0,0 +1,432 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Messages below this level are compiled out: 0 debug, 1 info, 2 warn, 3 error
+#ifndef DARK_LOG_LEVEL
+#define DARK_LOG_LEVEL 1
+#endif
+
+namespace dark {
+
+enum class LogLevel : std::uint8_t { debug, info, warn, error, off };
+
+inline constexpr auto compiled_log_level = static_cast<LogLevel>(DARK_LOG_LEVEL);
+
+inline auto parse_log_level(std::string_view name) -> std::optional<LogLevel> {
+    constexpr std::string_view names[] = {"debug", "info", "warn", "error", "off"};
+    for (std::size_t i = 0; i < std::size(names); ++i)
+        if (name == names[i])
+            return static_cast<LogLevel>(i);
+    return std::nullopt;
+}
+
+namespace __detail {
+
+template <typename _Tp>
+concept log_string = std::convertible_to<const _Tp &, std::string_view>;
+
+template <typename _Tp>
+concept log_bytes = !log_string<_Tp> && std::is_trivially_copyable_v<_Tp> &&
+                    std::is_default_constructible_v<_Tp>;
+
+// How an argument goes through a ring: plain values as their bytes, strings
+// as their length and characters, anything else formatted on the spot.
+// `Decoded` is what the writer formats in its place.
+template <typename _Tp>
+struct LogCapture {
+    using Decoded = std::string_view;
+    static auto prepare(const _Tp &value) -> std::string {
+        return std::format("{}", value);
+    }
+};
+
+template <log_bytes _Tp>
+struct LogCapture<_Tp> {
+    using Decoded = _Tp;
+    static auto prepare(const _Tp &value) -> const _Tp & {
+        return value;
+    }
+};
+
+template <log_string _Tp>
+struct LogCapture<_Tp> {
+    using Decoded = std::string_view;
+    static auto prepare(const _Tp &value) -> std::string_view {
+        return value;
+    }
+};
+
+template <log_bytes _Tp>
+inline auto log_size(const _Tp &) -> std::size_t {
+    return sizeof(_Tp);
+}
+
+inline auto log_size(std::string_view text) -> std::size_t {
+    return sizeof(std::uint32_t) + text.size();
+}
+
+template <log_bytes _Tp>
+inline auto log_write(std::byte *&out, const _Tp &value) -> void {
+    std::memcpy(out, &value, sizeof(_Tp));
+    out += sizeof(_Tp);
+}
+
+inline auto log_write(std::byte *&out, std::string_view text) -> void {
+    const auto size = static_cast<std::uint32_t>(text.size());
+    std::memcpy(out, &size, sizeof(size));
+    std::memcpy(out + sizeof(size), text.data(), text.size());
+    out += sizeof(size) + text.size();
+}
+
+template <typename _Decoded>
+inline auto log_read(const std::byte *&in) -> _Decoded {
+    if constexpr (std::is_same_v<_Decoded, std::string_view>) {
+        auto size = std::uint32_t{};
+        std::memcpy(&size, in, sizeof(size));
+        const auto text = std::string_view{reinterpret_cast<const char *>(in + sizeof(size)), size};
+        in += sizeof(size) + size;
+        return text;
+    } else {
+        auto value = _Decoded{};
+        std::memcpy(&value, in, sizeof(_Decoded));
+        in += sizeof(_Decoded);
+        return value;
+    }
+}
+
+// Records of bytes, written by one thread and read by another, each behind a
+// word of its size. A record never wraps: one that does not fit before the
+// end starts over at the front, behind a word that says to skip the gap.
+struct LogRing {
+public:
+    // `capacity` is a multiple of 8
+    explicit LogRing(std::size_t capacity) :
+        _M_words(std::make_unique<std::uint64_t[]>(capacity / _S_word)), _M_capacity(capacity) {}
+
+    // Room for `size` bytes, to be committed, or null if the ring is full.
+    // From the producer only.
+    auto reserve(std::size_t size) -> std::byte * {
+        const auto total = _S_word + (size + _S_word - 1) / _S_word * _S_word;
+        auto tail        = _M_tail.load(std::memory_order_relaxed);
+        const auto head  = _M_head.load(std::memory_order_acquire);
+        const auto left  = _M_capacity - tail % _M_capacity;
+        const auto skip  = left < total ? left : 0;
+        if (_M_capacity - (tail - head) < skip + total)
+            return nullptr;
+        if (skip != 0) {
+            this->_M_word(tail) = _S_skip;
+            tail += skip;
+        }
+        this->_M_word(tail) = total;
+        _M_pending          = tail + total;
+        return this->_M_bytes(tail + _S_word);
+    }
+
+    auto commit() -> void {
+        _M_tail.store(_M_pending, std::memory_order_release);
+    }
+
+    // The oldest record, empty if there is none. From the consumer only.
+    auto front() -> std::span<const std::byte> {
+        auto head       = _M_head.load(std::memory_order_relaxed);
+        const auto tail = _M_tail.load(std::memory_order_acquire);
+        if (head != tail && this->_M_word(head) == _S_skip) {
+            head += _M_capacity - head % _M_capacity;
+            _M_head.store(head, std::memory_order_release);
+        }
+        if (head == tail)
+            return {};
+        return {this->_M_bytes(head + _S_word), this->_M_word(head) - _S_word};
+    }
+
+    auto pop() -> void {
+        const auto head = _M_head.load(std::memory_order_relaxed);
+        _M_head.store(head + this->_M_word(head), std::memory_order_release);
+    }
+
+    auto empty() const -> bool {
+        return _M_head.load(std::memory_order_acquire) == _M_tail.load(std::memory_order_acquire);
+    }
+
+    std::atomic_size_t dropped{}; // records that found the ring full
+    std::atomic_bool orphaned{};  // its thread is gone: free to take over once empty
+
+private:
+    static constexpr std::size_t _S_word = sizeof(std::uint64_t);
+    static constexpr auto _S_skip        = ~std::uint64_t{};
+
+    auto _M_word(std::size_t position) -> std::uint64_t & {
+        return _M_words[position % _M_capacity / _S_word];
+    }
+    auto _M_bytes(std::size_t position) -> std::byte * {
+        return reinterpret_cast<std::byte *>(_M_words.get()) + position % _M_capacity;
+    }
+
+    std::unique_ptr<std::uint64_t[]> _M_words;
+    std::size_t _M_capacity;
+    std::size_t _M_pending{};                 // tail past the reserved record
+    alignas(64) std::atomic_size_t _M_head{}; // positions grow without bound
+    alignas(64) std::atomic_size_t _M_tail{};
+};
+
+// The rings of a thread, one per logger it wrote to: left to the loggers
+// when it ends.
+struct LogThread {
+    std::vector<std::pair<std::size_t, std::shared_ptr<LogRing>>> rings; // by logger id
+
+    ~LogThread() {
+        for (auto &[id, ring] : rings)
+            ring->orphaned.store(true, std::memory_order_release);
+    }
+};
+
+inline thread_local LogThread log_thread;
+
+inline std::atomic_size_t next_logger_id{};
+
+} // namespace __detail
+
+struct LoggerConfig {
+    std::size_t ring_bytes = std::size_t{1} << 16; // per thread, a multiple of 8
+    std::function<void(std::string_view)> sink{}; // of the lines; std::cout if empty
+    bool writer = true;                           // else written by `flush` alone
+    std::chrono::microseconds idle{1000};         // between looks while nothing comes
+};
+
+// Logging costs the caller a copy of the arguments into a ring of its thread
+// and no lock: a writer thread formats them later, a line each, and hands the
+// lines to the sink. If the ring is full the message is dropped and counted,
+// rather than waiting. Lines from one thread keep their order, not so across.
+// The format is kept by address, so it is to be a literal.
+struct Logger {
+public:
+    explicit Logger(LoggerConfig config = {}) :
+        _M_config(std::move(config)), _M_id(__detail::next_logger_id.fetch_add(1)) {
+        if (!_M_config.sink)
+            _M_config.sink = [](std::string_view text) {
+                std::cout.write(text.data(), static_cast<std::streamsize>(text.size()));
+                std::cout.flush();
+            };
+        if (_M_config.writer)
+            _M_writer = std::jthread{[this](std::stop_token stop) {
+                while (!stop.stop_requested())
+                    if (this->_M_drain() == 0)
+                        std::this_thread::sleep_for(_M_config.idle);
+            }};
+    }
+
+    Logger(const Logger &)                     = delete;
+    auto operator=(const Logger &) -> Logger & = delete;
+
+    ~Logger() {
+        if (_M_writer.joinable()) {
+            _M_writer.request_stop();
+            _M_writer.join();
+        }
+        this->flush();
+    }
+
+    template <LogLevel _Level, typename... _Args>
+    auto log(std::format_string<_Args...> format, _Args &&...args) -> void {
+        if constexpr (_Level >= compiled_log_level) {
+            if (_Level < _M_level.load(std::memory_order_relaxed))
+                return;
+            this->_M_push(
+                _Level, format.get(),
+                &_S_decode<typename __detail::LogCapture<std::remove_cvref_t<_Args>>::Decoded...>,
+                __detail::LogCapture<std::remove_cvref_t<_Args>>::prepare(args)...
+            );
+        }
+    }
+
+    auto set_level(LogLevel level) -> void {
+        _M_level.store(level, std::memory_order_relaxed);
+    }
+
+    auto level() const -> LogLevel {
+        return _M_level.load(std::memory_order_relaxed);
+    }
+
+    // Write out whatever was logged before the call.
+    auto flush() -> void {
+        while (this->_M_drain() != 0)
+            continue;
+    }
+
+    auto dropped() const -> std::size_t {
+        std::unique_lock lock{_M_mutex};
+        auto total = std::size_t{};
+        for (const auto &ring : _M_rings)
+            total += ring->dropped.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    using _Decode_t = void (*)(std::string_view, const std::byte *, std::string &);
+
+    struct _Header {
+        _Decode_t decode;
+        const char *format;
+        std::size_t format_size;
+        LogLevel level;
+    };
+
+    template <typename... _Decoded>
+    static auto
+    _S_decode(std::string_view format, [[maybe_unused]] const std::byte *in, std::string &out)
+        -> void {
+        const auto values = std::tuple<_Decoded...>{__detail::log_read<_Decoded>(in)...};
+        std::apply(
+            [&](const auto &...value) {
+                std::vformat_to(std::back_inserter(out), format, std::make_format_args(value...));
+            },
+            values
+        );
+    }
+
+    template <typename... _Prepared>
+    auto _M_push(
+        LogLevel level, std::string_view format, _Decode_t decode, const _Prepared &...prepared
+    ) -> void {
+        const auto size = (sizeof(_Header) + ... + __detail::log_size(prepared));
+        auto &ring      = this->_M_ring();
+        auto *out       = ring.reserve(size);
+        if (out == nullptr) {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        const auto header = _Header{decode, format.data(), format.size(), level};
+        std::memcpy(out, &header, sizeof(header));
+        out += sizeof(header);
+        (__detail::log_write(out, prepared), ...);
+        ring.commit();
+    }
+
+    auto _M_ring() -> __detail::LogRing & {
+        for (auto &[id, ring] : __detail::log_thread.rings)
+            if (id == _M_id)
+                return *ring;
+        return this->_M_register();
+    }
+
+    // The first message of a thread: it takes over the ring of a thread that
+    // ended, if one is written out, else gets a new one.
+    auto _M_register() -> __detail::LogRing & {
+        std::unique_lock lock{_M_mutex};
+        auto ring       = std::shared_ptr<__detail::LogRing>{};
+        const auto free = std::ranges::find_if(_M_rings, [](const auto &candidate) {
+            return candidate->orphaned.load(std::memory_order_acquire) && candidate->empty();
+        });
+        if (free != _M_rings.end()) {
+            ring = *free;
+            ring->orphaned.store(false, std::memory_order_relaxed);
+        } else {
+            ring = std::make_shared<__detail::LogRing>(_M_config.ring_bytes);
+            _M_rings.push_back(ring);
+            _M_version.fetch_add(1, std::memory_order_release);
+        }
+        __detail::log_thread.rings.emplace_back(_M_id, ring);
+        return *ring;
+    }
+
+    // Format what is in the rings now and hand it to the sink in one go.
+    // Returns the number of messages.
+    auto _M_drain() -> std::size_t {
+        std::unique_lock drain_lock{_M_drain_mutex};
+        if (const auto version = _M_version.load(std::memory_order_acquire);
+            version != _M_seen_version) {
+            std::unique_lock lock{_M_mutex};
+            _M_draining     = _M_rings;
+            _M_seen_version = version;
+        }
+        constexpr std::string_view prefixes[] = {"Debug: ", "", "Warning: ", "Error: ", ""};
+
+        auto count = std::size_t{};
+        _M_text.clear();
+        for (const auto &ring : _M_draining) {
+            for (auto record = ring->front(); !record.empty(); record = ring->front()) {
+                auto header = _Header{};
+                std::memcpy(&header, record.data(), sizeof(header));
+                _M_text += prefixes[static_cast<std::size_t>(header.level)];
+                const auto format = std::string_view{header.format, header.format_size};
+                try {
+                    header.decode(format, record.data() + sizeof(header), _M_text);
+                } catch (const std::format_error &) {
+                    // A spec for the type of an argument that went as a string
+                    _M_text += format;
+                }
+                _M_text += '\n';
+                ring->pop();
+                count += 1;
+            }
+        }
+        if (!_M_text.empty())
+            _M_config.sink(_M_text);
+        return count;
+    }
+
+    LoggerConfig _M_config;
+    const std::size_t _M_id;
+    std::atomic<LogLevel> _M_level{LogLevel::info};
+
+    mutable std::mutex _M_mutex; // guards the rings, taken by a thread's first message
+    std::vector<std::shared_ptr<__detail::LogRing>> _M_rings;
+    std::atomic_size_t _M_version{}; // bumped on each new ring
+
+    std::mutex _M_drain_mutex; // one consumer at a time, the writer or `flush`
+    std::vector<std::shared_ptr<__detail::LogRing>> _M_draining;
+    std::size_t _M_seen_version{};
+    std::string _M_text;
+
+    std::jthread _M_writer; // last: started once the rest is there
+};
+
+// The logger of the process, its writer started on first use. Never
+// destroyed: detached threads may log until the very end.
+inline auto logger() -> Logger & {
+    static auto *instance = new Logger{};
+    return *instance;
+}
+
+template <typename... _Args>
+inline auto log_debug(std::format_string<_Args...> format, _Args &&...args) -> void {
+    logger().log<LogLevel::debug>(format, std::forward<_Args>(args)...);
+}
+
+template <typename... _Args>
+inline auto log_info(std::format_string<_Args...> format, _Args &&...args) -> void {
+    logger().log<LogLevel::info>(format, std::forward<_Args>(args)...);
+}
+
+template <typename... _Args>
+inline auto log_warn(std::format_string<_Args...> format, _Args &&...args) -> void {
+    logger().log<LogLevel::warn>(format, std::forward<_Args>(args)...);
+}
+
+template <typename... _Args>
+inline auto log_error(std::format_string<_Args...> format, _Args &&...args) -> void {
+    logger().log<LogLevel::error>(format, std::forward<_Args>(args)...);
+}
+
+} // namespace dark
@@ -0,0 +1,253 @@
+#pragma once
+#include "histogram.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dark {
+
+namespace __detail {
+
+inline constexpr std::size_t metric_shards = 16;
+
+inline std::atomic_size_t next_metric_shard{};
+
+// Threads write to shards of their own, in turn, so that the cache line of a
+// count rarely moves between cores. Past `metric_shards` threads, some share.
+inline auto metric_shard() noexcept -> std::size_t {
+    thread_local const auto shard =
+        next_metric_shard.fetch_add(1, std::memory_order_relaxed) % metric_shards;
+    return shard;
+}
+
+template <typename _Tp>
+struct alignas(64) PaddedAtomic {
+    std::atomic<_Tp> value{};
+};
+
+template <typename _Tp>
+using Shards = std::array<PaddedAtomic<_Tp>, metric_shards>;
+
+template <typename _Tp>
+inline auto sum_shards(const Shards<_Tp> &shards) noexcept -> _Tp {
+    auto total = _Tp{};
+    for (const auto &shard : shards)
+        total += shard.value.load(std::memory_order_relaxed);
+    return total;
+}
+
+} // namespace __detail
+
+// Only goes up. An increment is one uncontended atomic add, a few ns; the
+// value, read when scraped, sums the shards.
+struct Counter {
+public:
+    auto add(std::uint64_t n = 1) noexcept -> void {
+        _M_shards[__detail::metric_shard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    auto value() const noexcept -> std::uint64_t {
+        return __detail::sum_shards(_M_shards);
+    }
+
+private:
+    __detail::Shards<std::uint64_t> _M_shards;
+};
+
+// Goes up and down, e.g. connections open: each thread adds what it changes.
+struct Gauge {
+public:
+    auto add(std::int64_t n = 1) noexcept -> void {
+        _M_shards[__detail::metric_shard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    auto sub(std::int64_t n = 1) noexcept -> void {
+        this->add(-n);
+    }
+    auto value() const noexcept -> std::int64_t {
+        return __detail::sum_shards(_M_shards);
+    }
+
+private:
+    __detail::Shards<std::int64_t> _M_shards;
+};
+
+// Durations, in the log-linear buckets of dark::Histogram at 3 bits (within
+// 12.5%), one set per shard: small enough to keep 16 of them.
+struct LatencyHistogram {
+public:
+    using Scale = Histogram<3>;
+
+    struct Snapshot {
+        std::vector<std::uint64_t> counts; // per bucket of Scale
+        std::uint64_t count;
+        std::uint64_t sum; // nanoseconds
+    };
+
+    auto observe(std::chrono::nanoseconds duration) noexcept -> void {
+        const auto value = static_cast<std::uint64_t>(std::max(duration.count(), std::int64_t{}));
+        auto &shard      = _M_shards[__detail::metric_shard()];
+        shard.counts[Scale::bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    auto snapshot() const -> Snapshot {
+        auto result = Snapshot{std::vector<std::uint64_t>(Scale::buckets), 0, 0};
+        for (const auto &shard : _M_shards) {
+            for (std::size_t i = 0; i < Scale::buckets; ++i) {
+                const auto count = shard.counts[i].load(std::memory_order_relaxed);
+                result.counts[i] += count;
+                result.count += count;
+            }
+            result.sum += shard.sum.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+private:
+    struct alignas(64) _Shard {
+        std::array<std::atomic<std::uint64_t>, Scale::buckets> counts{};
+        std::atomic<std::uint64_t> sum{};
+    };
+    std::array<_Shard, __detail::metric_shards> _M_shards{};
+};
+
+// Metrics by name, rendered in the Prometheus text format. A name may come
+// with labels (`stage="connect"`), the samples of a name rendered together.
+// Metrics live as long as the registry, which is meant to be the process.
+struct MetricsRegistry {
+public:
+    // Bounds of the rendered histogram buckets, in seconds: 10us to 10s
+    static constexpr double bounds[] = {
+        1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2,
+        2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+    };
+
+    auto counter(std::string name, std::string help, std::string labels = {}) -> Counter & {
+        auto owned      = std::make_shared<Counter>();
+        auto &counter   = *owned;
+        const auto read = [owned] { return static_cast<double>(owned->value()); };
+        this->_M_add({std::move(name), std::move(help), std::move(labels), "counter", read, {}});
+        return counter;
+    }
+
+    auto gauge(std::string name, std::string help, std::string labels = {}) -> Gauge & {
+        auto owned      = std::make_shared<Gauge>();
+        auto &gauge     = *owned;
+        const auto read = [owned] { return static_cast<double>(owned->value()); };
+        this->_M_add({std::move(name), std::move(help), std::move(labels), "gauge", read, {}});
+        return gauge;
+    }
+
+    auto histogram(std::string name, std::string help, std::string labels = {})
+        -> LatencyHistogram & {
+        auto owned      = std::make_shared<LatencyHistogram>();
+        auto &histogram = *owned;
+        this->_M_add({std::move(name), std::move(help), std::move(labels), "histogram", {}, owned});
+        return histogram;
+    }
+
+    // Read when scraped from state kept elsewhere, at no cost in between.
+    auto counter_fn(
+        std::string name, std::string help, std::function<double()> read, std::string labels = {}
+    ) -> void {
+        this->_M_add({std::move(name), std::move(help), std::move(labels), "counter", read, {}});
+    }
+
+    auto gauge_fn(
+        std::string name, std::string help, std::function<double()> read, std::string labels = {}
+    ) -> void {
+        this->_M_add({std::move(name), std::move(help), std::move(labels), "gauge", read, {}});
+    }
+
+    auto render() const -> std::string {
+        std::unique_lock lock{_M_mutex};
+        auto text = std::string{};
+        auto done = std::vector<bool>(_M_metrics.size());
+        for (std::size_t i = 0; i < _M_metrics.size(); ++i) {
+            if (done[i])
+                continue;
+            const auto &first = _M_metrics[i];
+            text += std::format("# HELP {} {}\n", first.name, first.help);
+            text += std::format("# TYPE {} {}\n", first.name, first.type);
+            for (std::size_t j = i; j < _M_metrics.size(); ++j) {
+                if (_M_metrics[j].name != first.name)
+                    continue;
+                done[j] = true;
+                _S_render(text, _M_metrics[j]);
+            }
+        }
+        return text;
+    }
+
+private:
+    struct _Metric {
+        std::string name;
+        std::string help;
+        std::string labels;
+        std::string_view type;
+        std::function<double()> read;                // counters and gauges
+        std::shared_ptr<LatencyHistogram> histogram; // histograms
+    };
+
+    auto _M_add(_Metric metric) -> void {
+        std::unique_lock lock{_M_mutex};
+        _M_metrics.push_back(std::move(metric));
+    }
+
+    // `name{labels,extra}`, without braces if there are no labels at all.
+    static auto _S_series(std::string_view name, std::string_view labels, std::string_view extra)
+        -> std::string {
+        if (labels.empty() && extra.empty())
+            return std::string{name};
+        const auto comma = labels.empty() || extra.empty() ? "" : ",";
+        return std::format("{}{{{}{}{}}}", name, labels, comma, extra);
+    }
+
+    // Cumulative counts at each bound: those of the buckets whose values are
+    // all below it, exact within a bucket.
+    static auto _S_render(std::string &text, const _Metric &metric) -> void {
+        if (!metric.histogram) {
+            const auto series = _S_series(metric.name, metric.labels, "");
+            text += std::format("{} {}\n", series, metric.read());
+            return;
+        }
+        using Scale     = LatencyHistogram::Scale;
+        const auto shot = metric.histogram->snapshot();
+        const auto name = metric.name + "_bucket";
+        auto bucket     = std::size_t{};
+        auto cumulative = std::uint64_t{};
+        for (const auto bound : bounds) {
+            const auto limit = static_cast<std::uint64_t>(bound * 1e9);
+            for (; bucket < Scale::buckets && Scale::bucket_top(bucket) <= limit; ++bucket)
+                cumulative += shot.counts[bucket];
+            const auto le = std::format("le=\"{}\"", bound);
+            text += std::format("{} {}\n", _S_series(name, metric.labels, le), cumulative);
+        }
+        text += std::format("{} {}\n", _S_series(name, metric.labels, "le=\"+Inf\""), shot.count);
+        const auto seconds = static_cast<double>(shot.sum) / 1e9;
+        text += std::format("{} {}\n", _S_series(metric.name + "_sum", metric.labels, ""), seconds);
+        text += std::format(
+            "{} {}\n", _S_series(metric.name + "_count", metric.labels, ""), shot.count
+        );
+    }
+
+    mutable std::mutex _M_mutex;
+    std::vector<_Metric> _M_metrics;
+};
+
+// The registry of the process.
+inline auto metrics() -> MetricsRegistry & {
+    static auto instance = MetricsRegistry{};
+    return instance;
+}
+
+} // namespace dark
@@ -0,0 +1,84 @@
+#pragma once
+#include "perf.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace dark {
+
+// Keep the compiler from dropping a computation whose result is unused, or
+// from hoisting it out of the loop: `value` is taken to be read from memory.
+template <typename _Tp>
+inline auto do_not_optimize(const _Tp &value) noexcept -> void {
+    __asm__ __volatile__("" : : "r,m"(value) : "memory");
+}
+
+// ... and anything written to memory so far, to be read back.
+inline auto clobber_memory() noexcept -> void {
+    __asm__ __volatile__("" : : : "memory");
+}
+
+struct MicroConfig {
+    std::chrono::milliseconds warmup{50};      // also sizes the batch of a repetition
+    std::chrono::milliseconds repetition{100}; // of each timed batch
+    std::size_t repetitions = 5;
+};
+
+struct MicroResult {
+    double median_ns;        // per operation, over the repetitions
+    double min_ns;           // ...
+    double max_ns;           // ... of the slowest repetition, not a per-call percentile
+    double bytes_per_second; // of the median, 0 without a size
+    std::size_t operations;  // per repetition
+    PerfCounts perf;         // over all repetitions, 0 where not counted
+};
+
+// Time `op()`, which handles `bytes` of input each call. The warmup runs it
+// for a while, to learn how many calls fill a repetition; each repetition
+// then times that many calls in one go, so the clock is not in the loop.
+// The counters of the thread, if any, count the repetitions too.
+template <typename _Fn>
+inline auto measure_micro(const MicroConfig &config, std::size_t bytes, _Fn &&op)
+    -> MicroResult {
+    using Clock = std::chrono::steady_clock;
+
+    auto calls = std::size_t{};
+    const auto warmup_start = Clock::now();
+    auto elapsed            = Clock::duration{};
+    for (auto batch = std::size_t{1}; elapsed < config.warmup; batch *= 2) {
+        for (std::size_t i = 0; i < batch; ++i)
+            op();
+        calls += batch;
+        elapsed = Clock::now() - warmup_start;
+    }
+    const auto per_call   = std::chrono::duration<double>(elapsed) / static_cast<double>(calls);
+    const auto repetition = std::chrono::duration<double>(config.repetition);
+    const auto operations = std::max<std::size_t>(
+        static_cast<std::size_t>(repetition / per_call), 1
+    );
+
+    auto samples           = std::vector<double>{};
+    const auto repetitions = std::max<std::size_t>(config.repetitions, 1);
+    const auto perf_start  = thread_perf().read();
+    for (std::size_t r = 0; r < repetitions; ++r) {
+        const auto start = Clock::now();
+        for (std::size_t i = 0; i < operations; ++i)
+            op();
+        const auto spent = std::chrono::duration<double, std::nano>(Clock::now() - start);
+        samples.push_back(spent.count() / static_cast<double>(operations));
+    }
+    const auto perf = thread_perf().read() - perf_start;
+    std::ranges::sort(samples);
+    const auto median = samples[samples.size() / 2];
+    return {
+        .median_ns        = median,
+        .min_ns           = samples.front(),
+        .max_ns           = samples.back(),
+        .bytes_per_second = bytes == 0 ? 0 : static_cast<double>(bytes) * 1e9 / median,
+        .operations       = operations,
+        .perf             = perf,
+    };
+}
+
+} // namespace dark
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <optional>
+#include <utility>
+
+namespace dark {
+
+// Unbounded multi-producer single-consumer queue (Vyukov). Pushing is one
+// exchange and never waits for other producers nor for the consumer. An item
+// whose push is still in progress may not be popped yet: it is once the push
+// returned, so a producer should push before it wakes the consumer up.
+template <typename _Tp>
+struct MpscQueue {
+public:
+    MpscQueue() : _M_head(&_M_stub), _M_tail(&_M_stub) {}
+
+    MpscQueue(const MpscQueue &)                     = delete;
+    auto operator=(const MpscQueue &) -> MpscQueue & = delete;
+
+    ~MpscQueue() {
+        while (this->pop())
+            continue;
+        if (_M_tail != &_M_stub)
+            delete _M_tail;
+    }
+
+    // From any thread.
+    auto push(_Tp value) -> void {
+        auto *node = new _Node{std::move(value)};
+        auto *prev = _M_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // From the consumer only.
+    auto pop() -> std::optional<_Tp> {
+        auto *tail = _M_tail;
+        auto *next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+            return std::nullopt;
+        // `next` becomes the stub: its value moves out, the old stub goes
+        _M_tail    = next;
+        auto value = std::move(*next->value);
+        next->value.reset();
+        if (tail != &_M_stub)
+            delete tail;
+        return value;
+    }
+
+private:
+    struct _Node {
+        std::optional<_Tp> value;
+        std::atomic<_Node *> next{};
+    };
+
+    _Node _M_stub;
+    alignas(64) std::atomic<_Node *> _M_head; // where producers push
+    alignas(64) _Node *_M_tail;               // where the consumer pops
+};
+
+} // namespace dark
@@ -0,0 +1,220 @@
+#pragma once
+#include "file.h"
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <linux/perf_event.h>
+#include <string_view>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+
+namespace dark {
+
+enum class PerfEvent : std::uint8_t {
+    cycles,
+    instructions,
+    cache_misses, // of the last level cache
+    branch_misses,
+    context_switches,
+};
+
+inline constexpr std::size_t perf_events = 5;
+
+inline constexpr std::string_view perf_event_names[perf_events] = {
+    "cycles", "instructions", "cache_misses", "branch_misses", "context_switches",
+};
+
+// Counts of the events, 0 for those not counted.
+struct PerfCounts {
+    std::array<std::uint64_t, perf_events> values{};
+
+    auto operator[](PerfEvent event) const -> std::uint64_t {
+        return values[static_cast<std::size_t>(event)];
+    }
+
+    // Instructions per cycle, 0 if cycles were not counted.
+    auto ipc() const -> double {
+        const auto cycles = (*this)[PerfEvent::cycles];
+        return cycles == 0 ? 0 : static_cast<double>((*this)[PerfEvent::instructions]) / cycles;
+    }
+
+    friend auto operator-(const PerfCounts &lhs, const PerfCounts &rhs) -> PerfCounts {
+        auto result = PerfCounts{};
+        for (std::size_t i = 0; i < perf_events; ++i)
+            result.values[i] = lhs.values[i] - rhs.values[i];
+        return result;
+    }
+};
+
+namespace __detail {
+
+inline constexpr std::pair<std::uint32_t, std::uint64_t> perf_configs[perf_events] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+} // namespace __detail
+
+// The events of the thread that makes it, from then on, as one group of
+// perf_event_open counters: a read is one syscall. Whatever cannot be opened
+// is not counted, and reads as 0: with perf_event_paranoid above 1, events
+// are counted in user space only (so no context switches); in a VM without
+// a PMU, there are no hardware events; under seccomp, none at all.
+struct PerfCounters {
+public:
+    PerfCounters() {
+        _M_error = this->_M_open(false);
+        if (_M_error != EACCES && _M_error != EPERM)
+            return;
+        for (auto &file : _M_files)
+            static_cast<void>(file.reset());
+        _M_user_only = true;
+        _M_error     = this->_M_open(true);
+    }
+
+    PerfCounters(const PerfCounters &)                     = delete;
+    auto operator=(const PerfCounters &) -> PerfCounters & = delete;
+
+    auto available() const -> bool {
+        return _M_count != 0;
+    }
+
+    auto has(PerfEvent event) const -> bool {
+        return _M_slots[static_cast<std::size_t>(event)] != _S_none;
+    }
+
+    // Why some event is not counted, 0 if all are.
+    auto error() const -> int {
+        return _M_error;
+    }
+
+    // Whether the kernel is left out, not to be profiled by this user.
+    auto user_only() const -> bool {
+        return _M_user_only;
+    }
+
+    // The counts since made, scaled up if the kernel had to share the
+    // hardware counters with other groups for a while.
+    auto read() const -> PerfCounts {
+        auto result = PerfCounts{};
+        if (_M_count == 0)
+            return result;
+        // nr, time enabled, time running, then a value per counter
+        auto buffer     = std::array<std::uint64_t, 3 + perf_events>{};
+        const auto size = static_cast<ssize_t>((3 + _M_count) * sizeof(std::uint64_t));
+        if (::read(_M_files[0].unsafe_get(), buffer.data(), sizeof(buffer)) != size)
+            return result;
+        const auto enabled = buffer[1];
+        const auto running = buffer[2];
+        for (std::size_t i = 0; i < perf_events; ++i) {
+            if (_M_slots[i] == _S_none)
+                continue;
+            auto value = buffer[3 + _M_slots[i]];
+            if (running != 0 && running < enabled)
+                value = static_cast<std::uint64_t>(static_cast<double>(value) * enabled / running);
+            result.values[i] = value;
+        }
+        return result;
+    }
+
+private:
+    static constexpr std::uint8_t _S_none = 0xff;
+
+    // Open what can be, the first one opened leading the group. The errno of
+    // one that can't, 0 if none.
+    auto _M_open(bool user_only) -> int {
+        _M_slots.fill(_S_none);
+        _M_count   = 0;
+        auto error = 0;
+        for (std::size_t i = 0; i < perf_events; ++i) {
+            // Counted in the kernel only
+            if (user_only && static_cast<PerfEvent>(i) == PerfEvent::context_switches)
+                continue;
+            auto attr           = perf_event_attr{};
+            attr.size           = sizeof(attr);
+            attr.type           = __detail::perf_configs[i].first;
+            attr.config         = __detail::perf_configs[i].second;
+            attr.exclude_kernel = user_only;
+            attr.exclude_hv     = 1;
+            attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+                               | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            const auto leader = _M_count == 0 ? -1 : _M_files[0].unsafe_get();
+            const auto fd     = ::syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+            if (fd < 0) {
+                // A denial first: that one is worth another try
+                if (error == 0 || errno == EACCES || errno == EPERM)
+                    error = errno;
+                continue;
+            }
+            _M_files[_M_count] = FileManager{static_cast<int>(fd)};
+            _M_slots[i]        = static_cast<std::uint8_t>(_M_count++);
+        }
+        return error;
+    }
+
+    std::array<FileManager, perf_events> _M_files;    // in the order of the group
+    std::array<std::uint8_t, perf_events> _M_slots{}; // of each event in it, if counted
+    std::size_t _M_count{};
+    int _M_error{};
+    bool _M_user_only{};
+};
+
+// The counters of the calling thread, made on its first call.
+inline auto thread_perf() -> PerfCounters & {
+    thread_local auto counters = PerfCounters{};
+    return counters;
+}
+
+// What scopes counted, added up from any number of threads.
+struct PerfTotals {
+public:
+    auto add(const PerfCounts &counts) noexcept -> void {
+        for (std::size_t i = 0; i < perf_events; ++i)
+            if (counts.values[i] != 0)
+                _M_values[i].fetch_add(counts.values[i], std::memory_order_relaxed);
+    }
+
+    auto load() const noexcept -> PerfCounts {
+        auto result = PerfCounts{};
+        for (std::size_t i = 0; i < perf_events; ++i)
+            result.values[i] = _M_values[i].load(std::memory_order_relaxed);
+        return result;
+    }
+
+private:
+    std::array<std::atomic_uint64_t, perf_events> _M_values{};
+};
+
+// Add the events of this thread, from here to the end of the scope (or to
+// `stop`), to `totals`. Costs nothing without totals, two reads with them.
+struct PerfScope {
+public:
+    explicit PerfScope(PerfTotals *totals) : _M_totals(totals) {
+        if (_M_totals != nullptr)
+            _M_start = thread_perf().read();
+    }
+
+    PerfScope(const PerfScope &)                     = delete;
+    auto operator=(const PerfScope &) -> PerfScope & = delete;
+
+    ~PerfScope() {
+        this->stop();
+    }
+
+    auto stop() -> void {
+        if (_M_totals != nullptr)
+            std::exchange(_M_totals, nullptr)->add(thread_perf().read() - _M_start);
+    }
+
+private:
+    PerfTotals *_M_totals;
+    PerfCounts _M_start;
+};
+
+} // namespace dark
@@ -0,0 +1,169 @@
+#pragma once
+#include "file.h"
+#include "optional.h"
+#include "socket.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <utility>
+
+namespace dark {
+
+// What a registered socket is waited for. Errors and hang-ups are always reported.
+enum class Interest : std::uint32_t {
+    NONE  = 0,
+    READ  = EPOLLIN | EPOLLRDHUP,
+    WRITE = EPOLLOUT,
+    BOTH  = READ | WRITE,
+};
+
+[[nodiscard]]
+constexpr auto operator|(Interest lhs, Interest rhs) noexcept -> Interest {
+    return static_cast<Interest>(static_cast<std::uint32_t>(lhs) | static_cast<std::uint32_t>(rhs));
+}
+
+struct PollEvent {
+    void *data; // as registered
+    std::uint32_t events;
+
+    [[nodiscard]]
+    auto readable() const noexcept -> bool {
+        return (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+    }
+    [[nodiscard]]
+    auto writable() const noexcept -> bool {
+        return (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0;
+    }
+};
+
+// Level-triggered epoll over many sockets, which another thread can wake up.
+// Unlike select, the cost of a wait does not grow with the number of sockets.
+struct Poller {
+private:
+    inline static constexpr std::size_t _S_batch = 64; // events per wait at most
+    inline static constexpr auto _S_forever      = std::chrono::milliseconds{-1};
+
+    explicit Poller(FileManager epoll, FileManager wake) noexcept :
+        _M_epoll(std::move(epoll)), _M_wake(std::move(wake)) {}
+
+    [[nodiscard]]
+    auto _M_control(int op, int fd, std::uint32_t events, void *data) noexcept -> optional<> {
+        auto event = epoll_event{.events = events, .data = {.ptr = data}};
+        return ::epoll_ctl(_M_epoll.unsafe_get(), op, fd, &event) == 0;
+    }
+
+public:
+    Poller(Poller &&other) noexcept                     = default;
+    auto operator=(Poller &&other) noexcept -> Poller & = default;
+
+    [[nodiscard]]
+    static auto create() noexcept -> optional<Poller> {
+        auto epoll = FileManager{::epoll_create1(EPOLL_CLOEXEC)};
+        auto wake  = FileManager{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)};
+        if (!epoll || !wake)
+            return erropt;
+        auto event = epoll_event{.events = EPOLLIN, .data = {.ptr = nullptr}};
+        if (::epoll_ctl(epoll.unsafe_get(), EPOLL_CTL_ADD, wake.unsafe_get(), &event) != 0)
+            return erropt;
+        return Poller{std::move(epoll), std::move(wake)};
+    }
+
+    // `data` comes back with the events of the socket, it must not be null.
+    [[nodiscard]]
+    auto add(const Socket &socket, Interest interest, void *data) noexcept -> optional<> {
+        const auto fd = socket._M_file.unsafe_get();
+        return _M_control(EPOLL_CTL_ADD, fd, static_cast<std::uint32_t>(interest), data);
+    }
+
+    [[nodiscard]]
+    auto modify(const Socket &socket, Interest interest, void *data) noexcept -> optional<> {
+        const auto fd = socket._M_file.unsafe_get();
+        return _M_control(EPOLL_CTL_MOD, fd, static_cast<std::uint32_t>(interest), data);
+    }
+
+    [[nodiscard]]
+    auto remove(const Socket &socket) noexcept -> optional<> {
+        return _M_control(EPOLL_CTL_DEL, socket._M_file.unsafe_get(), 0, nullptr);
+    }
+
+    // Make the current or next `wait` return. Safe to call from any thread.
+    auto wake() noexcept -> void {
+        const auto one = std::uint64_t{1};
+        if (::write(_M_wake.unsafe_get(), &one, sizeof(one)) < 0)
+            errno = 0; // Already pending, the counter is full
+    }
+
+    // Before going to sleep, each `wait` looks for events without blocking
+    // for up to `budget`. Spinning saves the sleep and the wake up, tens of
+    // microseconds per message, for a CPU kept busy. Zero, the default,
+    // never spins.
+    auto spin(std::chrono::microseconds budget) noexcept -> void {
+        _M_spin = budget;
+    }
+
+    auto spins() const noexcept -> std::size_t {
+        return _M_spins;
+    }
+
+    // ... of which found something, without sleeping.
+    auto spin_hits() const noexcept -> std::size_t {
+        return _M_spin_hits;
+    }
+
+    // Wait for events, for at most `timeout` (forever if negative). Returns
+    // how many entries of `events` are filled. A wake up fills none and
+    // returns 0, as does a timeout.
+    [[nodiscard]]
+    auto wait(std::span<PollEvent> events, std::chrono::milliseconds timeout = _S_forever) noexcept
+        -> optional<std::size_t> {
+        using Clock = std::chrono::steady_clock;
+        epoll_event buffer[_S_batch];
+        const auto count = static_cast<int>(std::min(events.size(), _S_batch));
+        const auto fd    = _M_epoll.unsafe_get();
+        auto ret         = 0;
+        if (_M_spin.count() > 0 && timeout.count() != 0) {
+            ++_M_spins;
+            const auto start = Clock::now();
+            auto now         = start;
+            while (ret == 0 && now - start < _M_spin) {
+                ret = ::epoll_wait(fd, buffer, count, 0);
+                now = Clock::now();
+            }
+            _M_spin_hits += ret != 0;
+            if (ret == 0 && timeout.count() > 0) {
+                const auto spent = std::chrono::floor<std::chrono::milliseconds>(now - start);
+                timeout          = std::max(timeout - spent, std::chrono::milliseconds{1});
+            }
+        }
+        if (ret == 0)
+            ret = ::epoll_wait(fd, buffer, count, static_cast<int>(timeout.count()));
+        if (ret < 0)
+            return erropt;
+        auto filled = std::size_t{};
+        for (const auto &event : std::span{buffer, static_cast<std::size_t>(ret)}) {
+            if (event.data.ptr == nullptr) {
+                auto value = std::uint64_t{};
+                if (::read(_M_wake.unsafe_get(), &value, sizeof(value)) < 0)
+                    errno = 0; // Drained by a previous wait
+                continue;
+            }
+            events[filled++] = {event.data.ptr, event.events};
+        }
+        return filled;
+    }
+
+private:
+    FileManager _M_epoll;
+    FileManager _M_wake;
+    std::chrono::microseconds _M_spin{};
+    std::size_t _M_spins{};
+    std::size_t _M_spin_hits{};
+};
+
+} // namespace dark
@@ -0,0 +1,317 @@
+#pragma once
+#include "logger.h"
+#include "mpsc.h"
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace dark {
+
+namespace __detail {
+
+// Chase-Lev work-stealing deque (Lê et al., 2013): its owner pushes and takes
+// at the bottom, other threads steal from the top, all without locks. Arrays
+// outgrown stay alive with the deque: a thief may still read from them.
+template <typename _Tp>
+struct ws_deque {
+public:
+    ws_deque() {
+        this->_M_grow(nullptr, 0, 0);
+    }
+
+    ws_deque(const ws_deque &)                     = delete;
+    auto operator=(const ws_deque &) -> ws_deque & = delete;
+
+    // Owner only.
+    auto push(_Tp *item) -> void {
+        const auto b = _M_bottom.load(std::memory_order_relaxed);
+        const auto t = _M_top.load(std::memory_order_acquire);
+        auto *array  = _M_array.load(std::memory_order_relaxed);
+        if (b - t >= static_cast<std::int64_t>(array->size))
+            array = this->_M_grow(array, t, b);
+        array->at(b).store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        _M_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only: the item pushed last, if no thief got it.
+    auto take() -> _Tp * {
+        const auto b = _M_bottom.load(std::memory_order_relaxed) - 1;
+        auto *array  = _M_array.load(std::memory_order_relaxed);
+        _M_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = _M_top.load(std::memory_order_relaxed);
+        if (t > b) {
+            _M_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        auto *item = array->at(b).load(std::memory_order_relaxed);
+        if (t == b) {
+            // The last one: race the thieves for it
+            if (!_M_top.compare_exchange_strong(
+                    t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed
+                ))
+                item = nullptr;
+            _M_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread: the item pushed first, if any and no one else got it.
+    auto steal() -> _Tp * {
+        auto t = _M_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto b = _M_bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        auto *array = _M_array.load(std::memory_order_acquire);
+        auto *item  = array->at(t).load(std::memory_order_relaxed);
+        if (!_M_top.compare_exchange_strong(
+                t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed
+            ))
+            return nullptr;
+        return item;
+    }
+
+    auto size() const -> std::size_t {
+        const auto b = _M_bottom.load(std::memory_order_relaxed);
+        const auto t = _M_top.load(std::memory_order_relaxed);
+        return b > t ? static_cast<std::size_t>(b - t) : 0;
+    }
+
+private:
+    struct _Array {
+        explicit _Array(std::size_t size) :
+            size(size), slots(std::make_unique<std::atomic<_Tp *>[]>(size)) {}
+
+        auto at(std::int64_t index) -> std::atomic<_Tp *> & {
+            return slots[static_cast<std::size_t>(index) & (size - 1)];
+        }
+
+        std::size_t size; // a power of 2
+        std::unique_ptr<std::atomic<_Tp *>[]> slots;
+    };
+
+    // Twice as large, with the items in [top, bottom) copied over.
+    auto _M_grow(_Array *old, std::int64_t top, std::int64_t bottom) -> _Array * {
+        const auto size = old == nullptr ? std::size_t{64} : old->size * 2;
+        auto &array     = _M_arrays.emplace_back(std::make_unique<_Array>(size));
+        for (auto i = top; i < bottom; ++i) {
+            auto *item = old->at(i).load(std::memory_order_relaxed);
+            array->at(i).store(item, std::memory_order_relaxed);
+        }
+        _M_array.store(array.get(), std::memory_order_release);
+        return array.get();
+    }
+
+    alignas(64) std::atomic<std::int64_t> _M_top{};
+    alignas(64) std::atomic<std::int64_t> _M_bottom{};
+    std::atomic<_Array *> _M_array{};
+    std::vector<std::unique_ptr<_Array>> _M_arrays; // owner only
+};
+
+} // namespace __detail
+
+struct PoolStats {
+    std::size_t executed; // tasks run
+    std::size_t stolen;   // ... taken from the deque of another worker
+};
+
+// Work-stealing thread pool for CPU-bound work, so that event loops don't do
+// it inline. Each worker has a deque of its own tasks: what a task submits
+// goes there, and idle workers steal from the others. Submitting from other
+// threads goes to the lock-free inbox of a worker, round robin; any idle
+// worker may drain an inbox. Results go back to whoever needs them through
+// the task itself, e.g. posted to an event loop. Tasks still queued when the
+// pool is destroyed run first. A task that throws is logged, and the worker
+// goes on.
+struct ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency()) :
+        _M_workers(std::max<std::size_t>(threads, 1)) {
+        for (std::size_t i = 0; i < _M_workers.size(); ++i)
+            _M_workers[i].thread = std::thread{[this, i] { this->_M_run(i); }};
+    }
+
+    ThreadPool(const ThreadPool &)                     = delete;
+    auto operator=(const ThreadPool &) -> ThreadPool & = delete;
+
+    ~ThreadPool() {
+        _M_stopping.store(true);
+        this->_M_signal(true);
+        for (auto &worker : _M_workers)
+            worker.thread.join();
+    }
+
+    // From any thread.
+    auto submit(Task task) -> void {
+        auto *item = new Task{std::move(task)};
+        _M_queued.fetch_add(1, std::memory_order_seq_cst);
+        if (_S_current.pool == this) {
+            _M_workers[_S_current.index].deque.push(item);
+        } else {
+            const auto index = _M_next.fetch_add(1, std::memory_order_relaxed);
+            _M_workers[index % _M_workers.size()].inbox.push(item);
+        }
+        this->_M_signal();
+    }
+
+    // `co_await pool.schedule()` goes on on a worker of the pool.
+    auto schedule() noexcept {
+        struct awaiter {
+            ThreadPool *pool;
+            auto await_ready() const noexcept -> bool {
+                return false;
+            }
+            auto await_suspend(std::coroutine_handle<> handle) -> void {
+                pool->submit([handle] { handle.resume(); });
+            }
+            auto await_resume() const noexcept -> void {}
+        };
+        return awaiter{this};
+    }
+
+    auto size() const -> std::size_t {
+        return _M_workers.size();
+    }
+
+    auto stats() const -> PoolStats {
+        return {
+            .executed = _M_executed.load(std::memory_order_relaxed),
+            .stolen   = _M_stolen.load(std::memory_order_relaxed),
+        };
+    }
+
+private:
+    struct alignas(64) _Worker {
+        __detail::ws_deque<Task> deque;
+        MpscQueue<Task *> inbox;
+        std::atomic_flag draining; // held by whoever pops the inbox
+        std::thread thread;
+    };
+
+    struct _Current {
+        ThreadPool *pool;
+        std::size_t index;
+    };
+
+    inline static thread_local _Current _S_current{};
+
+    // Wake up a sleeping worker, if any: any of them can find the task.
+    // Bumping the signal first makes a worker about to sleep look again.
+    auto _M_signal(bool all = false) -> void {
+        _M_signals.fetch_add(1, std::memory_order_seq_cst);
+        if (_M_sleeping.load(std::memory_order_seq_cst) == 0)
+            return;
+        if (all)
+            _M_signals.notify_all();
+        else
+            _M_signals.notify_one();
+    }
+
+    // Move what an inbox holds to the deque of worker `to`, returning one.
+    auto _M_drain(std::size_t from, std::size_t to) -> Task * {
+        auto &worker = _M_workers[from];
+        if (worker.draining.test_and_set(std::memory_order_acquire))
+            return nullptr;
+        auto *first = static_cast<Task *>(nullptr);
+        while (auto item = worker.inbox.pop()) {
+            if (first == nullptr)
+                first = *item;
+            else
+                _M_workers[to].deque.push(*item);
+        }
+        worker.draining.clear(std::memory_order_release);
+        return first;
+    }
+
+    auto _M_find(std::size_t index, std::uint64_t &random) -> Task * {
+        if (auto *task = _M_workers[index].deque.take())
+            return task;
+        if (auto *task = this->_M_drain(index, index))
+            return task;
+        // Start from a random victim, so that thieves spread out
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        const auto count = _M_workers.size();
+        for (std::size_t k = 0; k < count; ++k) {
+            const auto victim = (random + k) % count;
+            if (victim == index)
+                continue;
+            if (auto *task = _M_workers[victim].deque.steal()) {
+                _M_stolen.fetch_add(1, std::memory_order_relaxed);
+                return task;
+            }
+            if (auto *task = this->_M_drain(victim, index))
+                return task;
+        }
+        return nullptr;
+    }
+
+    auto _M_run(std::size_t index) -> void {
+        _S_current           = {this, index};
+        std::uint64_t random = (index + 1) * 0x9E3779B97F4A7C15ULL;
+        while (true) {
+            if (auto *task = this->_M_find(index, random)) {
+                this->_M_execute(task);
+                continue;
+            }
+            // Look once more after announcing the sleep: a task submitted
+            // since then either shows up here or changes the signal
+            _M_sleeping.fetch_add(1, std::memory_order_seq_cst);
+            const auto seen = _M_signals.load(std::memory_order_seq_cst);
+            auto *task      = this->_M_find(index, random);
+            const auto stopping = _M_stopping.load();
+            const auto done     = task == nullptr && stopping && this->_M_idle();
+            // Stopping, nothing may bump the signal again: what is left is
+            // only out of sight for a moment, e.g. in an inbox being drained
+            if (task == nullptr && !done && !stopping)
+                _M_signals.wait(seen, std::memory_order_seq_cst);
+            else if (task == nullptr && !done)
+                std::this_thread::yield();
+            _M_sleeping.fetch_sub(1, std::memory_order_relaxed);
+            if (task != nullptr)
+                this->_M_execute(task);
+            if (done)
+                return this->_M_signal(true);
+        }
+    }
+
+    auto _M_execute(Task *task) -> void {
+        const auto owned = std::unique_ptr<Task>{task};
+        _M_queued.fetch_sub(1, std::memory_order_seq_cst);
+        try {
+            (*owned)();
+        } catch (const std::exception &e) {
+            log_error("Pool task failed: {}", e.what());
+        } catch (...) { log_error("Pool task failed"); }
+        _M_executed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Nothing queued anywhere, deques and inboxes alike: stopping workers may exit.
+    auto _M_idle() const -> bool {
+        return _M_queued.load(std::memory_order_seq_cst) == 0;
+    }
+
+    std::vector<_Worker> _M_workers;
+    std::atomic_size_t _M_next{};
+    alignas(64) std::atomic<std::uint64_t> _M_signals{};
+    alignas(64) std::atomic_size_t _M_sleeping{};
+    std::atomic<bool> _M_stopping{};
+    std::atomic_size_t _M_queued{}; // submitted, not started yet
+    std::atomic_size_t _M_executed{};
+    std::atomic_size_t _M_stolen{};
+};
+
+} // namespace dark
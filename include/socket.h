@@ -3,21 +3,33 @@
 #include "optional.h"
 #include <arpa/inet.h>
 #include <cerrno>
+#include <chrono>
 #include <cstddef>
 #include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <new>
+#include <span>
 #include <string>
 #include <string_view>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <utility>
 
 namespace dark {
 
 struct Socket;
+struct UnixSocket;
+struct Poller;
 
 namespace __detail {
 
@@ -42,6 +54,32 @@ private:
 template <bool _Empty, int _Tag>
 struct FileSet;
 
+// struct tcp_info of the kernel, as of 4.9: glibc only knows its first part.
+// A kernel fills what it has of it, older ones less.
+struct TcpInfoKernel {
+    ::tcp_info known;
+    std::uint64_t pacing_rate;
+    std::uint64_t max_pacing_rate;
+    std::uint64_t bytes_acked;
+    std::uint64_t bytes_received;
+    std::uint32_t segs_out;
+    std::uint32_t segs_in;
+    std::uint32_t notsent_bytes;
+    std::uint32_t min_rtt;
+    std::uint32_t data_segs_in;
+    std::uint32_t data_segs_out;
+    std::uint64_t delivery_rate;
+};
+
+static_assert(offsetof(TcpInfoKernel, pacing_rate) == 104, "layout of the kernel");
+
+inline auto to_time_point(const timespec &time) noexcept -> std::chrono::system_clock::time_point {
+    const auto since = std::chrono::seconds{time.tv_sec} + std::chrono::nanoseconds{time.tv_nsec};
+    return std::chrono::system_clock::time_point{
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(since)
+    };
+}
+
 } // namespace __detail
 
 enum class Domain {
@@ -57,14 +95,56 @@ enum class Protocol {
     UDP     = IPPROTO_UDP,
 };
 
+// The kernel's view of a TCP connection. Fields newer than the kernel are 0.
+struct TcpInfo {
+    std::uint8_t state;                // TCP_ESTABLISHED, ...
+    std::chrono::microseconds rtt;     // smoothed round trip time
+    std::chrono::microseconds rtt_var; // ... its mean deviation
+    std::chrono::microseconds min_rtt; // ... the least seen lately
+    std::uint32_t cwnd;                // congestion window, in segments
+    std::uint32_t mss;                 // bytes per segment sent
+    std::uint32_t unacked;             // segments in flight
+    std::uint32_t retransmits;         // segments sent again, in total
+    std::uint32_t lost;                // segments taken to be lost, now
+    std::uint64_t delivery_rate;       // bytes per second, of the latest sample
+    std::uint64_t bytes_acked;         // by the peer, in total
+    std::uint64_t bytes_received;      // from the peer, in total
+    std::uint32_t not_sent;            // bytes in the send buffer, not sent yet
+};
+
+// Bytes received, and when the kernel received the latest of them: the
+// epoch if the socket does not timestamp what it receives.
+struct TimedRecv {
+    std::size_t size;
+    std::chrono::system_clock::time_point stamp;
+};
+
+// How far a send got: handed to the packet scheduler, to the device, or
+// acknowledged by the peer.
+enum class SendStage : std::uint32_t {
+    scheduled = SCM_TSTAMP_SCHED,
+    sent      = SCM_TSTAMP_SND,
+    acked     = SCM_TSTAMP_ACK,
+};
+
+struct SendTimestamp {
+    SendStage stage;
+    std::uint32_t id; // of the last byte of the send: bytes sent before it, mod 2^32
+    std::chrono::system_clock::time_point time;
+};
+
 struct Socket {
 private:
     explicit Socket(FileManager file) noexcept : _M_file(std::move(file)) {}
     friend struct __detail::FileSet<false, 0>;
     friend struct __detail::FileSet<false, 1>;
     friend struct __detail::FileSet<false, 2>;
+    friend struct UnixSocket;
+    friend struct Poller;
 
 public:
+    // An invalid socket, to be assigned one later.
+    Socket() noexcept = default;
 
     explicit Socket(Domain dom, Type type, Protocol pro) :
         _M_file(::socket(static_cast<int>(dom), static_cast<int>(type), static_cast<int>(pro))) {}
@@ -76,15 +156,42 @@ public:
     auto operator=(Socket &&other) noexcept -> Socket & = default;
 
     using ReuseAddr = __detail::OptHelper<SO_REUSEADDR>;
+    using ReusePort = __detail::OptHelper<SO_REUSEPORT>;
     using Linger    = __detail::OptHelper<SO_LINGER, SOL_SOCKET, true>;
     using KeepAlive = __detail::OptHelper<SO_KEEPALIVE>;
     using NoDelay   = __detail::OptHelper<TCP_NODELAY, IPPROTO_TCP>;
+    using BusyPoll  = __detail::OptHelper<SO_BUSY_POLL, SOL_SOCKET, true>; // microseconds
+    using PreferBusyPoll = __detail::OptHelper<SO_PREFER_BUSY_POLL>;
+    using ZeroCopy       = __detail::OptHelper<SO_ZEROCOPY>;
+    using SendBuffer     = __detail::OptHelper<SO_SNDBUF, SOL_SOCKET, true>; // bytes
+    using RecvBuffer     = __detail::OptHelper<SO_RCVBUF, SOL_SOCKET, true>; // bytes
+    using Timestamping   = __detail::OptHelper<SO_TIMESTAMPING, SOL_SOCKET, true>;
 
     inline static constexpr auto opt_reuse     = ReuseAddr{1};
+    inline static constexpr auto opt_reuseport = ReusePort{1};
     inline static constexpr auto opt_linger    = Linger{1};
     inline static constexpr auto opt_nolinger  = opt_linger(0); // Disable linger
     inline static constexpr auto opt_keepalive = KeepAlive{1};
     inline static constexpr auto opt_nodelay   = NoDelay{1};
+    // Blocking reads poll the device queue this long before sleeping. Above
+    // the net.core.busy_read sysctl, it takes CAP_NET_ADMIN.
+    inline static constexpr auto opt_busy_poll        = BusyPoll{50};
+    inline static constexpr auto opt_prefer_busy_poll = PreferBusyPoll{1};
+    inline static constexpr auto opt_zerocopy         = ZeroCopy{1}; // For send_zerocopy
+    // The kernel doubles these, and stops tuning them on its own.
+    inline static constexpr auto opt_send_buffer = SendBuffer{1 << 20};
+    inline static constexpr auto opt_recv_buffer = RecvBuffer{1 << 20};
+    // Software timestamps on the realtime clock, of what is received, see
+    // recv_timestamped, and of each send as it goes, see reap_timestamp.
+    // TCP takes them once connected: bytes are numbered from there.
+    // Accepted sockets inherit those of what is received from their listener.
+    inline static constexpr auto opt_timestamping = Timestamping{
+        SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SCHED
+        | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_ACK | SOF_TIMESTAMPING_OPT_ID
+        | SOF_TIMESTAMPING_OPT_TSONLY
+    };
+    inline static constexpr auto opt_recv_timestamping =
+        opt_timestamping(SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE);
 
     template <int _Opt, int _Level, bool _>
     [[nodiscard]]
@@ -92,6 +199,57 @@ public:
         return ::setsockopt(_M_file.unsafe_get(), _Level, _Opt, &h._M_val, sizeof(h._M_val)) == 0;
     }
 
+    // The CPU that handled the latest packets of the connection.
+    [[nodiscard]]
+    auto incoming_cpu() const noexcept -> optional<int> {
+        auto cpu = -1;
+        auto len = socklen_t{sizeof(cpu)};
+        if (::getsockopt(_M_file.unsafe_get(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) != 0)
+            return erropt;
+        return cpu;
+    }
+
+    // Round trip, congestion window, retransmits... of a TCP connection.
+    [[nodiscard]]
+    auto tcp_info() const noexcept -> optional<TcpInfo> {
+        auto info = __detail::TcpInfoKernel{};
+        auto len  = socklen_t{sizeof(info)};
+        if (::getsockopt(_M_file.unsafe_get(), IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+            return erropt;
+        const auto &known = info.known;
+        return TcpInfo{
+            .state          = known.tcpi_state,
+            .rtt            = std::chrono::microseconds{known.tcpi_rtt},
+            .rtt_var        = std::chrono::microseconds{known.tcpi_rttvar},
+            .min_rtt        = std::chrono::microseconds{info.min_rtt},
+            .cwnd           = known.tcpi_snd_cwnd,
+            .mss            = known.tcpi_snd_mss,
+            .unacked        = known.tcpi_unacked,
+            .retransmits    = known.tcpi_total_retrans,
+            .lost           = known.tcpi_lost,
+            .delivery_rate  = info.delivery_rate,
+            .bytes_acked    = info.bytes_acked,
+            .bytes_received = info.bytes_received,
+            .not_sent       = info.notsent_bytes,
+        };
+    }
+
+    // Among the SO_REUSEPORT sockets of a port, in the order they were bound,
+    // hand a new connection to number (CPU its packets arrived on) % `sockets`.
+    [[nodiscard]]
+    auto steer_by_cpu(std::uint32_t sockets) noexcept -> optional<> {
+        sock_filter code[] = {
+            {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<std::uint32_t>(SKF_AD_OFF + SKF_AD_CPU)},
+            {BPF_ALU | BPF_MOD | BPF_K, 0, 0, sockets},
+            {BPF_RET | BPF_A, 0, 0, 0},
+        };
+        const auto length  = static_cast<unsigned short>(sizeof(code) / sizeof(code[0]));
+        const auto program = sock_fprog{.len = length, .filter = code};
+        const auto fd      = _M_file.unsafe_get();
+        return ::setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program))
+            == 0;
+    }
+
     [[nodiscard]]
     auto bind(const sockaddr_in &addr) noexcept -> optional<> {
         const auto *ptr = std::launder(reinterpret_cast<const sockaddr *>(&addr));
@@ -104,6 +262,28 @@ public:
         return ::connect(_M_file.unsafe_get(), ptr, sizeof(addr)) == 0;
     }
 
+    // Once a nonblocking connect made the socket writable: whether it succeeded.
+    [[nodiscard]]
+    auto connect_result() noexcept -> optional<> {
+        auto error = 0;
+        auto len   = socklen_t{sizeof(error)};
+        if (::getsockopt(_M_file.unsafe_get(), SOL_SOCKET, SO_ERROR, &error, &len) != 0)
+            return false;
+        errno = error;
+        return error == 0;
+    }
+
+    // The address bound to, e.g. the port picked for port 0.
+    [[nodiscard]]
+    auto local_address() const noexcept -> optional<sockaddr_in> {
+        auto addr = sockaddr_in{};
+        auto len  = socklen_t{sizeof(addr)};
+        auto *ptr = reinterpret_cast<sockaddr *>(&addr);
+        if (::getsockname(_M_file.unsafe_get(), ptr, &len) != 0)
+            return erropt;
+        return addr;
+    }
+
     [[nodiscard]]
     auto listen(int backlog) noexcept -> optional<> {
         return ::listen(_M_file.unsafe_get(), backlog) == 0;
@@ -135,9 +315,110 @@ public:
         }
     }
 
+    // Receive into `buffer` as is, for callers managing their own buffers.
+    [[nodiscard]]
+    auto recv(std::span<char> buffer) noexcept -> optional<std::size_t> {
+        const auto ret = ::recv(_M_file.unsafe_get(), buffer.data(), buffer.size(), 0);
+        if (ret < 0) {
+            return erropt;
+        } else {
+            return static_cast<std::size_t>(ret);
+        }
+    }
+
+    // Receive into `buffer`, with the timestamp of the kernel if there is
+    // one, once opt_timestamping is set.
+    [[nodiscard]]
+    auto recv_timestamped(std::span<char> buffer) noexcept -> optional<TimedRecv> {
+        char control[128];
+        auto part             = iovec{buffer.data(), buffer.size()};
+        auto header           = msghdr{};
+        header.msg_iov        = &part;
+        header.msg_iovlen     = 1;
+        header.msg_control    = control;
+        header.msg_controllen = sizeof(control);
+        const auto ret        = ::recvmsg(_M_file.unsafe_get(), &header, 0);
+        if (ret < 0)
+            return erropt;
+        auto result = TimedRecv{static_cast<std::size_t>(ret), {}};
+        for (auto *cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr;
+             cmsg       = CMSG_NXTHDR(&header, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING)
+                continue;
+            auto stamps = scm_timestamping{};
+            std::memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            result.stamp = __detail::to_time_point(stamps.ts[0]);
+        }
+        return result;
+    }
+
+    // The next timestamp of a send, from the error queue, once
+    // opt_timestamping is set. Fails with EAGAIN if there is none.
+    [[nodiscard]]
+    auto reap_timestamp() noexcept -> optional<SendTimestamp> {
+        while (true) {
+            char control[256];
+            auto header           = msghdr{};
+            header.msg_control    = control;
+            header.msg_controllen = sizeof(control);
+            if (::recvmsg(_M_file.unsafe_get(), &header, MSG_ERRQUEUE) < 0)
+                return erropt;
+            auto result = SendTimestamp{};
+            auto found  = 0; // of the two parts: the time, then what it is of
+            for (auto *cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr;
+                 cmsg       = CMSG_NXTHDR(&header, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                    auto stamps = scm_timestamping{};
+                    std::memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+                    result.time = __detail::to_time_point(stamps.ts[0]);
+                    found += 1;
+                    continue;
+                }
+                auto error = sock_extended_err{};
+                std::memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+                if (error.ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+                    continue;
+                result.stage = static_cast<SendStage>(error.ee_info);
+                result.id    = error.ee_data;
+                found += 1;
+            }
+            if (found == 2)
+                return result;
+            // Something else on the queue, such as a zero-copy completion
+        }
+    }
+
+    // A peer gone fails with EPIPE instead of killing the process with SIGPIPE.
     [[nodiscard]]
     auto send(std::string_view str) noexcept -> optional<std::size_t> {
-        const auto ret = ::send(_M_file.unsafe_get(), str.data(), str.size(), 0);
+        const auto ret = ::send(_M_file.unsafe_get(), str.data(), str.size(), MSG_NOSIGNAL);
+        if (ret < 0) {
+            return erropt;
+        } else {
+            return static_cast<std::size_t>(ret);
+        }
+    }
+
+    // Gather the parts into one send.
+    [[nodiscard]]
+    auto send(std::span<const iovec> parts) noexcept -> optional<std::size_t> {
+        auto header = msghdr{};
+        header.msg_iov    = const_cast<iovec *>(parts.data());
+        header.msg_iovlen = parts.size();
+        const auto ret    = ::sendmsg(_M_file.unsafe_get(), &header, MSG_NOSIGNAL);
+        if (ret < 0) {
+            return erropt;
+        } else {
+            return static_cast<std::size_t>(ret);
+        }
+    }
+
+    // Send `count` bytes of a file from `offset`, which moves past them,
+    // without copying them through user space.
+    [[nodiscard]]
+    auto send_file(const FileManager &file, off_t &offset, std::size_t count) noexcept
+        -> optional<std::size_t> {
+        const auto ret = ::sendfile(_M_file.unsafe_get(), file.unsafe_get(), &offset, count);
         if (ret < 0) {
             return erropt;
         } else {
@@ -145,6 +426,83 @@ public:
         }
     }
 
+    // Move up to `count` bytes from the read end of a pipe to the socket.
+    [[nodiscard]]
+    auto splice_from(const FileManager &pipe, std::size_t count) noexcept
+        -> optional<std::size_t> {
+        const auto flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+        const auto ret   = ::splice(
+            pipe.unsafe_get(), nullptr, _M_file.unsafe_get(), nullptr, count, flags
+        );
+        if (ret < 0) {
+            return erropt;
+        } else {
+            return static_cast<std::size_t>(ret);
+        }
+    }
+
+    // Send without copying, once opt_zerocopy is set: the kernel reads `str`
+    // until it reports the send complete, see reap_zerocopy. Fails with
+    // ENOBUFS while too many sends are incomplete.
+    [[nodiscard]]
+    auto send_zerocopy(std::string_view str) noexcept -> optional<std::size_t> {
+        const auto flags = MSG_ZEROCOPY | MSG_NOSIGNAL;
+        const auto ret   = ::send(_M_file.unsafe_get(), str.data(), str.size(), flags);
+        if (ret < 0) {
+            return erropt;
+        } else {
+            return static_cast<std::size_t>(ret);
+        }
+    }
+
+    // How many zero-copy sends completed since the last call, from the error
+    // queue. Fails with EAGAIN if none did.
+    [[nodiscard]]
+    auto reap_zerocopy() noexcept -> optional<std::size_t> {
+        char control[128];
+        auto header           = msghdr{};
+        header.msg_control    = control;
+        header.msg_controllen = sizeof(control);
+        if (::recvmsg(_M_file.unsafe_get(), &header, MSG_ERRQUEUE) < 0)
+            return erropt;
+        auto completed = std::size_t{};
+        for (auto *cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr;
+             cmsg       = CMSG_NXTHDR(&header, cmsg)) {
+            auto error = sock_extended_err{};
+            std::memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+            if (error.ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+                completed += error.ee_data - error.ee_info + 1; // A range of sends
+        }
+        return completed;
+    }
+
+    // Send a FIN once the data sent so far is delivered, but keep receiving.
+    [[nodiscard]]
+    auto shutdown_write() noexcept -> optional<> {
+        return ::shutdown(_M_file.unsafe_get(), SHUT_WR) == 0;
+    }
+
+    // Make accept, recv and send fail with EAGAIN instead of blocking.
+    [[nodiscard]]
+    auto set_nonblocking() noexcept -> optional<> {
+        const auto fd    = _M_file.unsafe_get();
+        const auto flags = ::fcntl(fd, F_GETFL);
+        return flags >= 0 && ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+
+    // Make blocking calls fail with EAGAIN once `timeout` passes with no
+    // progress: recv, send, and connect too (with EINPROGRESS). Zero, never.
+    [[nodiscard]]
+    auto set_timeout(std::chrono::milliseconds timeout) noexcept -> optional<> {
+        const auto fd   = _M_file.unsafe_get();
+        const auto time = timeval{
+            .tv_sec  = static_cast<time_t>(timeout.count() / 1000),
+            .tv_usec = static_cast<suseconds_t>(timeout.count() % 1000 * 1000),
+        };
+        return ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &time, sizeof(time)) == 0 &&
+               ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &time, sizeof(time)) == 0;
+    }
+
     [[nodiscard]]
     auto is_valid() const noexcept -> bool {
         return _M_file.valid();
@@ -0,0 +1,204 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace dark {
+
+// Identifies a scheduled timer. Stale once the timer fired or was cancelled,
+// even if its slot is reused by another timer.
+struct TimerHandle {
+    std::uint32_t index      = UINT32_MAX;
+    std::uint32_t generation = 0;
+};
+
+// Hierarchical timing wheel: scheduling, cancelling and firing a timer are
+// O(1), whatever the number of timers. Deadlines are rounded up to ticks.
+// Level l has 64 slots of 64^l ticks each; a timer sits in the level where its
+// deadline falls within one turn, and moves down a level each time the wheel
+// below completes a turn, until it fires from level 0. Not thread-safe.
+template <typename _Tp>
+struct TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TimerWheel(Clock::duration tick, Clock::time_point start = Clock::now()) :
+        _M_tick(tick), _M_start(start) {
+        for (auto &level : _M_slots)
+            for (auto &slot : level)
+                slot = _S_null;
+    }
+
+    // Nodes point into the slots
+    TimerWheel(const TimerWheel &)                     = delete;
+    auto operator=(const TimerWheel &) -> TimerWheel & = delete;
+
+    // Call `value` back at `deadline`, or at the next tick if it is past.
+    auto schedule(Clock::time_point deadline, _Tp value) -> TimerHandle {
+        auto index = _M_free;
+        if (index != _S_null) {
+            _M_free = _M_nodes[index].next;
+        } else {
+            index = static_cast<std::uint32_t>(_M_nodes.size());
+            _M_nodes.emplace_back();
+        }
+        auto &node = _M_nodes[index];
+        node.value = std::move(value);
+        node.due   = std::max(_M_tick_of(deadline), _M_now + 1);
+        node.live  = true;
+        _M_place(index);
+        ++_M_size;
+        return {index, node.generation};
+    }
+
+    // Returns whether the timer was still pending.
+    auto cancel(TimerHandle handle) -> bool {
+        if (handle.index >= _M_nodes.size())
+            return false;
+        auto &node = _M_nodes[handle.index];
+        if (!node.live || node.generation != handle.generation)
+            return false;
+        _M_unlink(handle.index);
+        static_cast<void>(_M_release(handle.index));
+        return true;
+    }
+
+    // Fire every timer due by `now`, in order of deadline, passing its value to
+    // `fn`. `fn` may schedule and cancel timers. Returns the number fired.
+    template <typename _Fn>
+    auto advance(Clock::time_point now, _Fn &&fn) -> std::size_t {
+        const auto target = _M_tick_of(now);
+        auto fired        = std::size_t{};
+        while (_M_now < target) {
+            if (_M_size == 0) {
+                _M_now = target; // Nothing to cascade nor fire on the way
+                break;
+            }
+            ++_M_now;
+            for (std::size_t level = _S_levels - 1; level > 0; --level)
+                if ((_M_now & _S_mask(level)) == 0)
+                    _M_cascade(level, (_M_now >> (_S_bits * level)) & (_S_slots - 1));
+            auto &head = _M_slots[0][_M_now & (_S_slots - 1)];
+            while (head != _S_null) {
+                const auto index = head;
+                _M_unlink(index);
+                fn(_M_release(index));
+                ++fired;
+            }
+        }
+        return fired;
+    }
+
+    // How long until `advance` may have something to fire, none if no timer
+    // is pending. Past level 0, that is when the next cascade happens.
+    auto next_timeout(Clock::time_point now) const -> std::optional<Clock::duration> {
+        if (_M_size == 0)
+            return std::nullopt;
+        auto ticks = _S_slots - (_M_now & (_S_slots - 1));
+        for (std::uint64_t i = 1; i < ticks; ++i)
+            if (_M_slots[0][(_M_now + i) & (_S_slots - 1)] != _S_null) {
+                ticks = i;
+                break;
+            }
+        const auto when = _M_start + _M_tick * static_cast<Clock::rep>(_M_now + ticks);
+        return std::max(when - now, Clock::duration::zero());
+    }
+
+    auto size() const -> std::size_t {
+        return _M_size;
+    }
+
+private:
+    static constexpr std::uint32_t _S_null   = UINT32_MAX;
+    static constexpr std::size_t _S_bits     = 6;
+    static constexpr std::size_t _S_slots    = std::size_t{1} << _S_bits;
+    static constexpr std::size_t _S_levels   = 4; // 2^24 ticks, 4.6 hours of 1ms ticks
+    static constexpr std::uint64_t _S_horizon = std::uint64_t{1} << (_S_bits * _S_levels);
+
+    // Ticks spanned by one slot of a level, minus one.
+    static constexpr auto _S_mask(std::size_t level) -> std::uint64_t {
+        return (std::uint64_t{1} << (_S_bits * level)) - 1;
+    }
+
+    // Free nodes are chained through `next`.
+    struct _Node {
+        _Tp value{};
+        std::uint64_t due{};
+        std::uint32_t prev = _S_null;
+        std::uint32_t next = _S_null;
+        std::uint32_t *slot{}; // head of the list holding it
+        std::uint32_t generation{};
+        bool live{};
+    };
+
+    auto _M_tick_of(Clock::time_point time) const -> std::uint64_t {
+        if (time <= _M_start)
+            return 0;
+        // Rounded up: a timer never fires before its deadline
+        const auto elapsed = time - _M_start + _M_tick - Clock::duration{1};
+        return static_cast<std::uint64_t>(elapsed / _M_tick);
+    }
+
+    auto _M_place(std::uint32_t index) -> void {
+        auto &node = _M_nodes[index];
+        // Beyond the last level: park in its farthest slot, placed again on cascade
+        const auto due   = std::min(node.due, _M_now + _S_horizon - 1);
+        auto level       = std::size_t{};
+        while (level + 1 < _S_levels && due - _M_now >= (_S_mask(level + 1) + 1))
+            ++level;
+        auto &head = _M_slots[level][(due >> (_S_bits * level)) & (_S_slots - 1)];
+        node.prev  = _S_null;
+        node.next  = head;
+        node.slot  = &head;
+        if (head != _S_null)
+            _M_nodes[head].prev = index;
+        head = index;
+    }
+
+    auto _M_unlink(std::uint32_t index) -> void {
+        auto &node = _M_nodes[index];
+        if (node.prev != _S_null)
+            _M_nodes[node.prev].next = node.next;
+        else
+            *node.slot = node.next;
+        if (node.next != _S_null)
+            _M_nodes[node.next].prev = node.prev;
+    }
+
+    // Free an unlinked node, returning its value.
+    auto _M_release(std::uint32_t index) -> _Tp {
+        auto &node = _M_nodes[index];
+        auto value = std::move(node.value);
+        node.live  = false;
+        ++node.generation;
+        node.next = _M_free;
+        _M_free   = index;
+        --_M_size;
+        return value;
+    }
+
+    // Spread the timers of a slot over the levels below.
+    auto _M_cascade(std::size_t level, std::uint64_t slot) -> void {
+        auto &head = _M_slots[level][slot];
+        auto index = std::exchange(head, _S_null);
+        while (index != _S_null) {
+            const auto next = _M_nodes[index].next;
+            _M_place(index);
+            index = next;
+        }
+    }
+
+    Clock::duration _M_tick;
+    Clock::time_point _M_start;
+    std::uint64_t _M_now{}; // ticks since start, all due by now have fired
+    std::size_t _M_size{};
+    std::uint32_t _M_free = _S_null;
+    std::vector<_Node> _M_nodes;
+    std::uint32_t _M_slots[_S_levels][_S_slots];
+};
+
+} // namespace dark
@@ -0,0 +1,207 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace dark {
+
+// A stage of a traced request, from start to end.
+struct Span {
+    using Clock = std::chrono::steady_clock;
+    const char *name{};    // a literal
+    std::uint64_t trace{}; // the request
+    Clock::time_point start;
+    Clock::time_point end;
+    std::uint32_t thread{}; // that recorded it, from 1; a new thread may reuse a number
+};
+
+namespace __detail {
+
+// The latest spans of one thread, the oldest overwritten first. Its lock is
+// only ever contended by a dump.
+struct SpanBuffer {
+    SpanBuffer(std::size_t capacity, std::uint32_t thread) :
+        spans(std::max<std::size_t>(capacity, 1)), thread(thread) {}
+
+    std::mutex mutex;
+    std::vector<Span> spans;
+    std::size_t written{}; // in total: the next goes at written % size
+    std::uint32_t thread;
+    std::atomic_bool orphaned{}; // its thread is gone: the next one takes it
+};
+
+// The buffers of a thread, one per tracer it recorded for.
+struct SpanThread {
+    std::vector<std::pair<std::size_t, std::shared_ptr<SpanBuffer>>> buffers; // by tracer id
+
+    ~SpanThread() {
+        for (auto &[id, buffer] : buffers)
+            buffer->orphaned.store(true, std::memory_order_release);
+    }
+};
+
+inline thread_local SpanThread span_thread;
+
+inline std::atomic_size_t next_tracer_id{};
+
+} // namespace __detail
+
+struct TraceConfig {
+    std::size_t sample_every     = 0;    // trace one request in this many, none if 0
+    std::size_t spans_per_thread = 4096; // the latest are kept
+};
+
+// Spans of sampled requests, kept per thread and dumped on demand in the
+// trace event format of Chrome, which Perfetto reads too. A request is one
+// row of the viewer, its spans laid out on the monotonic clock.
+// Requests not sampled cost one relaxed add each.
+struct Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Tracer(TraceConfig config = {}) :
+        _M_every(config.sample_every), _M_capacity(config.spans_per_thread),
+        _M_id(__detail::next_tracer_id.fetch_add(1)) {}
+
+    Tracer(const Tracer &)                     = delete;
+    auto operator=(const Tracer &) -> Tracer & = delete;
+
+    auto set_sampling(std::size_t every) -> void {
+        _M_every.store(every, std::memory_order_relaxed);
+    }
+
+    // The id of a new request if it is to be traced, else 0.
+    auto sample() -> std::uint64_t {
+        const auto every = _M_every.load(std::memory_order_relaxed);
+        if (every == 0)
+            return 0;
+        const auto n = _M_requests.fetch_add(1, std::memory_order_relaxed);
+        return n % every == 0 ? n + 1 : 0;
+    }
+
+    // Keep a span of request `trace`, unless that is 0.
+    auto record(
+        const char *name, std::uint64_t trace, Clock::time_point start, Clock::time_point end
+    ) -> void {
+        if (trace == 0)
+            return;
+        auto &buffer = this->_M_buffer();
+        std::unique_lock lock{buffer.mutex};
+        buffer.spans[buffer.written++ % buffer.spans.size()] = {
+            name, trace, start, end, buffer.thread
+        };
+    }
+
+    // The spans kept, by start.
+    auto spans() const -> std::vector<Span> {
+        auto result  = std::vector<Span>{};
+        auto buffers = std::vector<std::shared_ptr<__detail::SpanBuffer>>{};
+        {
+            std::unique_lock lock{_M_mutex};
+            buffers = _M_buffers;
+        }
+        for (const auto &buffer : buffers) {
+            std::unique_lock lock{buffer->mutex};
+            const auto kept = std::min(buffer->written, buffer->spans.size());
+            result.insert(result.end(), buffer->spans.begin(), buffer->spans.begin() + kept);
+        }
+        std::ranges::sort(result, {}, &Span::start);
+        return result;
+    }
+
+    // The trace event JSON of the requests that took at least `slower`, from
+    // the start of their first span to the end of their last.
+    auto dump(std::chrono::nanoseconds slower = {}) const -> std::string {
+        using Range      = std::pair<Clock::time_point, Clock::time_point>;
+        const auto spans = this->spans();
+        auto extent      = std::unordered_map<std::uint64_t, Range>{};
+        for (const auto &span : spans) {
+            const auto [it, fresh] = extent.try_emplace(span.trace, span.start, span.end);
+            it->second.first       = std::min(it->second.first, span.start);
+            it->second.second      = std::max(it->second.second, span.end);
+        }
+        const auto micros = [this](Clock::time_point time) {
+            return std::chrono::duration<double, std::micro>(time - _M_epoch).count();
+        };
+        const auto pid = ::getpid();
+
+        auto text  = std::string{"{\"displayTimeUnit\":\"ms\",\"traceEvents\":["};
+        auto comma = "";
+        for (const auto &[trace, range] : extent) {
+            if (range.second - range.first < slower)
+                continue;
+            text += std::format(
+                "{}\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},"
+                "\"args\":{{\"name\":\"request {}\"}}}}",
+                comma, pid, trace, trace
+            );
+            comma = ",";
+        }
+        for (const auto &span : spans) {
+            const auto &range = extent[span.trace];
+            if (range.second - range.first < slower)
+                continue;
+            text += std::format(
+                "{}\n{{\"name\":\"{}\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":{},\"tid\":{},"
+                "\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{\"thread\":{}}}}}",
+                comma, span.name, pid, span.trace, micros(span.start),
+                micros(span.end) - micros(span.start), span.thread
+            );
+            comma = ",";
+        }
+        text += "\n]}\n";
+        return text;
+    }
+
+private:
+    // The first span of a thread: it takes over the buffer of a thread that
+    // ended, if any, else gets a new one.
+    auto _M_buffer() -> __detail::SpanBuffer & {
+        for (auto &[id, buffer] : __detail::span_thread.buffers)
+            if (id == _M_id)
+                return *buffer;
+        std::unique_lock lock{_M_mutex};
+        auto buffer     = std::shared_ptr<__detail::SpanBuffer>{};
+        const auto free = std::ranges::find_if(_M_buffers, [](const auto &candidate) {
+            return candidate->orphaned.load(std::memory_order_acquire);
+        });
+        if (free != _M_buffers.end()) {
+            buffer = *free;
+            buffer->orphaned.store(false, std::memory_order_relaxed);
+        } else {
+            const auto thread = static_cast<std::uint32_t>(_M_buffers.size() + 1);
+            buffer            = std::make_shared<__detail::SpanBuffer>(_M_capacity, thread);
+            _M_buffers.push_back(buffer);
+        }
+        __detail::span_thread.buffers.emplace_back(_M_id, buffer);
+        return *buffer;
+    }
+
+    std::atomic_size_t _M_every;
+    std::atomic_uint64_t _M_requests{};
+    const std::size_t _M_capacity;
+    const std::size_t _M_id;
+    const Clock::time_point _M_epoch = Clock::now(); // time 0 of the dump
+
+    mutable std::mutex _M_mutex; // guards the buffers, taken by a thread's first span
+    std::vector<std::shared_ptr<__detail::SpanBuffer>> _M_buffers;
+};
+
+// The tracer of the process, off until sampling is set. Never destroyed:
+// detached threads may record until the very end.
+inline auto tracer() -> Tracer & {
+    static auto *instance = new Tracer{};
+    return *instance;
+}
+
+} // namespace dark
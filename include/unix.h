@@ -0,0 +1,160 @@
+#pragma once
+#include "file.h"
+#include "optional.h"
+#include "socket.h"
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace dark {
+
+// A Unix domain stream socket, able to pass file descriptors to another
+// process along with a message (SCM_RIGHTS).
+struct UnixSocket {
+private:
+    explicit UnixSocket(FileManager file) noexcept : _M_file(std::move(file)) {}
+
+    inline static constexpr std::size_t _S_max_fds = 64;
+
+    [[nodiscard]]
+    static auto _S_address(std::string_view path) noexcept -> optional<sockaddr_un> {
+        auto addr       = sockaddr_un{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return erropt;
+        }
+        std::ranges::copy(path, addr.sun_path);
+        return addr;
+    }
+
+public:
+    UnixSocket(UnixSocket &&other) noexcept                     = default;
+    auto operator=(UnixSocket &&other) noexcept -> UnixSocket & = default;
+
+    // Listen on a path, replacing whatever socket file was left there.
+    [[nodiscard]]
+    static auto listen(std::string_view path, int backlog = 4) noexcept -> optional<UnixSocket> {
+        auto addr = _S_address(path);
+        if (!addr)
+            return erropt;
+        auto file = FileManager{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+        auto sun  = addr.unwrap();
+        ::unlink(sun.sun_path);
+        const auto *ptr = reinterpret_cast<const sockaddr *>(&sun);
+        if (!file || ::bind(file.unsafe_get(), ptr, sizeof(sun)) != 0 ||
+            ::listen(file.unsafe_get(), backlog) != 0)
+            return erropt;
+        return UnixSocket{std::move(file)};
+    }
+
+    [[nodiscard]]
+    static auto connect(std::string_view path) noexcept -> optional<UnixSocket> {
+        auto addr = _S_address(path);
+        if (!addr)
+            return erropt;
+        auto file       = FileManager{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+        auto sun        = addr.unwrap();
+        const auto *ptr = reinterpret_cast<const sockaddr *>(&sun);
+        if (!file || ::connect(file.unsafe_get(), ptr, sizeof(sun)) != 0)
+            return erropt;
+        return UnixSocket{std::move(file)};
+    }
+
+    // A connected pair of sockets, e.g. to wake a thread blocked in select.
+    [[nodiscard]]
+    static auto pair() noexcept -> optional<std::pair<Socket, Socket>> {
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+            return erropt;
+        return std::pair{Socket{FileManager{fds[0]}}, Socket{FileManager{fds[1]}}};
+    }
+
+    [[nodiscard]]
+    auto accept() noexcept -> optional<UnixSocket> {
+        auto file = FileManager{::accept4(_M_file.unsafe_get(), nullptr, nullptr, SOCK_CLOEXEC)};
+        if (!file)
+            return erropt;
+        return UnixSocket{std::move(file)};
+    }
+
+    // Send a message, with copies of `fds` for the receiving process.
+    [[nodiscard]]
+    auto send(std::string_view data, std::span<const int> fds = {}) noexcept
+        -> optional<std::size_t> {
+        auto iov = iovec{const_cast<char *>(data.data()), data.size()};
+        auto msg = msghdr{};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * _S_max_fds)];
+        msg.msg_iov    = &iov;
+        msg.msg_iovlen = 1;
+        if (!fds.empty()) {
+            if (fds.size() > _S_max_fds) {
+                errno = EINVAL;
+                return erropt;
+            }
+            msg.msg_control    = control;
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+            auto *cmsg         = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level   = SOL_SOCKET;
+            cmsg->cmsg_type    = SCM_RIGHTS;
+            cmsg->cmsg_len     = CMSG_LEN(sizeof(int) * fds.size());
+            std::ranges::copy(fds, reinterpret_cast<int *>(CMSG_DATA(cmsg)));
+        }
+        const auto ret = ::sendmsg(_M_file.unsafe_get(), &msg, MSG_NOSIGNAL);
+        if (ret < 0)
+            return erropt;
+        return static_cast<std::size_t>(ret);
+    }
+
+    // Receive a message into `buffer` (up to its capacity), appending the
+    // descriptors passed along with it to `fds`. The caller owns them.
+    [[nodiscard]]
+    auto recv(std::string &buffer, std::vector<int> &fds) noexcept -> optional<std::size_t> {
+        buffer.resize_and_overwrite(buffer.capacity(), [](char *, std::size_t len) { return len; });
+        auto iov = iovec{buffer.data(), buffer.size()};
+        auto msg = msghdr{};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * _S_max_fds)];
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        const auto ret     = ::recvmsg(_M_file.unsafe_get(), &msg, MSG_CMSG_CLOEXEC);
+        if (ret < 0) {
+            buffer.clear();
+            return erropt;
+        }
+        buffer.resize(static_cast<std::size_t>(ret));
+        for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                continue;
+            const auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const auto *data = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+            fds.insert(fds.end(), data, data + count);
+        }
+        return static_cast<std::size_t>(ret);
+    }
+
+    // The descriptor of a socket, borrowed to pass it to another process.
+    [[nodiscard]]
+    static auto handle_of(const Socket &socket) noexcept -> int {
+        return socket._M_file.unsafe_get();
+    }
+
+    // Take ownership of a socket descriptor received from another process.
+    [[nodiscard]]
+    static auto adopt(int fd) noexcept -> Socket {
+        return Socket{FileManager{fd}};
+    }
+
+private:
+    FileManager _M_file;
+};
+
+} // namespace dark
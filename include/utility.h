@@ -58,6 +58,28 @@ inline constexpr auto string_to_ipv4_nocheck(std::string_view str) noexcept -> i
     return addr;
 }
 
+// Whether `str` is a dotted quad, e.g. "10.0.0.1": four decimal octets, no more
+// than 255 each. Such a name needs no resolver.
+inline constexpr auto is_ipv4_literal(std::string_view str) noexcept -> bool {
+    auto dots   = 0;
+    auto digits = 0;
+    auto octet  = 0;
+    for (const char c : str) {
+        if (c == '.') {
+            if (digits == 0 || ++dots > 3)
+                return false;
+            digits = octet = 0;
+        } else if (c >= '0' && c <= '9') {
+            octet = octet * 10 + (c - '0');
+            if (++digits > 3 || octet > 255)
+                return false;
+        } else {
+            return false;
+        }
+    }
+    return dots == 3 && digits != 0;
+}
+
 template <std::integral _Int, std::size_t base = 10>
 inline constexpr auto str_to_int_nocheck(std::string_view str) noexcept -> _Int {
     _Int value{};
@@ -0,0 +1,7 @@
+#pragma once
+
+// Every subcommand of the bench binary takes the arguments after its name.
+auto bench_cache(int argc, const char **argv) -> int;
+auto bench_pool(int argc, const char **argv) -> int;
+auto bench_pingpong(int argc, const char **argv) -> int;
+auto bench_parse(int argc, const char **argv) -> int;
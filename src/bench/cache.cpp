@@ -0,0 +1,105 @@
+// Hit throughput of the proxy cache from 1 to N threads, against a map guarded
+// by a std::shared_mutex, the way the cache was read before. Lookups that write
+// no shared memory should scale with the number of cores.
+#include "bench.h"
+#include "hw1/cache.h"
+#include "utility.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <format>
+#include <iostream>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+static constexpr std::size_t urls = 1 << 16;
+
+static auto url_of(std::size_t i) -> std::string {
+    return std::format("http://bench.local/object/{}", i);
+}
+
+// Run `lookup(i)` on `threads` threads for `duration`, returning lookups per second.
+template <typename _Fn>
+static auto measure(std::size_t threads, std::chrono::milliseconds duration, _Fn lookup)
+    -> double {
+    auto start   = std::atomic<bool>{false};
+    auto stop    = std::atomic<bool>{false};
+    auto total   = std::atomic<std::size_t>{0};
+    auto workers = std::vector<std::jthread>{};
+    for (std::size_t t = 0; t < threads; ++t)
+        workers.emplace_back([&, t] {
+            auto count = std::size_t{};
+            auto i     = t * 7919;
+            while (!start.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            while (!stop.load(std::memory_order_relaxed)) {
+                // A batch between checks keeps the stop flag off the profile
+                for (int k = 0; k < 64; ++k)
+                    count += lookup(i++ % urls);
+            }
+            total.fetch_add(count);
+        });
+
+    const auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(duration);
+    stop.store(true);
+    workers.clear();
+    const auto elapsed = std::chrono::steady_clock::now() - begin;
+    return static_cast<double>(total.load()) / std::chrono::duration<double>(elapsed).count();
+}
+
+auto bench_cache(int argc, const char **argv) -> int {
+    const auto seconds = argc > 0 ? dark::str_to_int_nocheck<std::size_t>(argv[0]) : 1;
+    const auto maximum = argc > 1 ? dark::str_to_int_nocheck<std::size_t>(argv[1]) : 64;
+    const auto step    = std::chrono::milliseconds{seconds * 1000};
+
+    // Small responses, so that the copy doesn't hide the cost of the lookup
+    const auto response = std::string{"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"};
+    auto baseline       = std::unordered_map<std::string, std::string>{};
+    auto baseline_mutex = std::shared_mutex{};
+    auto keys           = std::vector<std::string>{};
+    for (std::size_t i = 0; i < urls; ++i) {
+        keys.push_back(url_of(i));
+        push_to_cache(keys.back(), response);
+        baseline.emplace(keys.back(), response);
+    }
+
+    const auto lock_free = [&](std::size_t i) -> std::size_t {
+        return look_up_cache(keys[i]).has_value();
+    };
+    const auto shared_mutex = [&](std::size_t i) -> std::size_t {
+        std::shared_lock lock{baseline_mutex};
+        auto iter = baseline.find(keys[i]);
+        if (iter == baseline.end())
+            return 0;
+        auto copy = iter->second;
+        return !copy.empty();
+    };
+
+    std::cout << std::format(
+        "{} urls, {} hardware threads\n", urls, std::thread::hardware_concurrency()
+    );
+    std::cout << std::format(
+        "{:>8}{:>16}{:>10}{:>16}{:>10}\n", "threads", "epoch (op/s)", "speedup",
+        "shared_mutex", "speedup"
+    );
+    auto epoch_single = 0.0;
+    auto mutex_single = 0.0;
+    for (std::size_t threads = 1; threads <= maximum; threads *= 2) {
+        const auto epoch = measure(threads, step, lock_free);
+        const auto mutex = measure(threads, step, shared_mutex);
+        if (threads == 1) {
+            epoch_single = epoch;
+            mutex_single = mutex;
+        }
+        std::cout << std::format(
+            "{:>8}{:>16.0f}{:>10.2f}{:>16.0f}{:>10.2f}\n", threads, epoch, epoch / epoch_single,
+            mutex, mutex / mutex_single
+        );
+    }
+    return 0;
+}
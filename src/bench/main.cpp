@@ -0,0 +1,30 @@
+// Benchmarks of the proxy internals, one subcommand each: `bench <name> [args...]`.
+#include "bench.h"
+#include <format>
+#include <iostream>
+#include <string_view>
+
+struct Subcommand {
+    std::string_view name;
+    std::string_view usage;
+    int (*run)(int, const char **);
+};
+
+static constexpr Subcommand subcommands[] = {
+    {"cache", "[seconds per step = 1] [max threads = 64]", bench_cache},
+    {"pool", "[seconds per step = 1] [max threads = hardware]", bench_pool},
+    {"pingpong", "[round trips per case = 5000] [max spin us = 200]", bench_pingpong},
+    {"parse", "[repetitions = 5] [ms per repetition = 100]", bench_parse},
+};
+
+auto main(int argc, const char **argv) -> int {
+    if (argc >= 2)
+        for (const auto &command : subcommands)
+            if (command.name == argv[1])
+                return command.run(argc - 2, argv + 2);
+
+    std::cerr << std::format("Usage: {} <benchmark> [args...]\n", argv[0]);
+    for (const auto &command : subcommands)
+        std::cerr << std::format("  {} {}\n", command.name, command.usage);
+    return 1;
+}
@@ -0,0 +1,123 @@
+// Cost of the parsing helpers on the request path, on inputs like the proxy
+// sees, each next to what it would be without the helper: the C library or
+// std::string_view for the same job. parse_host is timed on a numeric host,
+// which it parses in place, and on a name, for which it asks the resolver.
+#include "bench.h"
+#include "address.h"
+#include "hw1/html.h"
+#include "microbench.h"
+#include "strings.h"
+#include "utility.h"
+#include <arpa/inet.h>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <string_view>
+
+static constexpr std::string_view response =
+    "HTTP/1.1 200 OK\r\n"
+    "Date: Mon, 19 Oct 2026 08:00:00 GMT\r\n"
+    "Server: Apache/2.4.57 (Debian)\r\n"
+    "Last-Modified: Tue, 01 Sep 2026 12:30:00 GMT\r\n"
+    "ETag: \"5f3a-5a1b2c3d4e5f6\"\r\n"
+    "Accept-Ranges: bytes\r\n"
+    "Vary: Accept-Encoding\r\n"
+    "Cache-Control: public, max-age=3600\r\n"
+    "Content-Type: text/html; charset=UTF-8\r\n"
+    "Content-Length: 1048576\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static constexpr std::string_view request =
+    "GET http://127.0.0.1:8080/static/js/app.min.js?v=20261019 HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:131.0) Gecko/20100101 Firefox/131.0\r\n"
+    "Accept: */*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Proxy-Connection: keep-alive\r\n"
+    "\r\n";
+
+auto bench_parse(int argc, const char **argv) -> int {
+    auto config = dark::MicroConfig{};
+    if (argc > 0)
+        config.repetitions = dark::str_to_int_nocheck<std::size_t>(argv[0]);
+    if (argc > 1)
+        config.repetition = std::chrono::milliseconds{dark::str_to_int_nocheck<int>(argv[1])};
+    if (config.repetitions == 0 || config.repetition.count() == 0)
+        return 1;
+
+    std::cout << std::format(
+        "Median of {} repetitions of {}ms, after {}ms of warmup\n", config.repetitions,
+        config.repetition.count(), config.warmup.count()
+    );
+    std::cout << std::format(
+        "{:<34}{:>12}{:>12}{:>12}\n", "", "ns/op", "min ns/op", "MB/s"
+    );
+    const auto run = [&](std::string_view name, std::string_view input, auto op) {
+        // Read through a barrier, so that the input is not known at compile time
+        const auto result = dark::measure_micro(config, input.size(), [&] {
+            auto copy = input;
+            dark::do_not_optimize(copy);
+            dark::do_not_optimize(op(copy));
+        });
+        std::cout << std::format(
+            "{:<34}{:>12.1f}{:>12.1f}{:>12.1f}\n", name, result.median_ns, result.min_ns,
+            result.bytes_per_second / 1e6
+        );
+    };
+
+    run("str_to_int_nocheck", "1048576", [](std::string_view str) {
+        return dark::str_to_int_nocheck<std::size_t>(str);
+    });
+    run("  std::from_chars", "1048576", [](std::string_view str) {
+        auto value = std::size_t{};
+        std::from_chars(str.data(), str.data() + str.size(), value);
+        return value;
+    });
+    run("string_to_ipv4_nocheck", "192.168.100.200", [](std::string_view str) {
+        return dark::string_to_ipv4_nocheck(str);
+    });
+    run("  inet_pton", "192.168.100.200", [](std::string_view str) {
+        // Null-terminated, as the C library wants it
+        auto text = dark::stack_string<16>{str};
+        auto addr = in_addr{};
+        ::inet_pton(AF_INET, text.c_str(), &addr);
+        return addr.s_addr;
+    });
+    run("is_ipv4_literal", "192.168.100.200", [](std::string_view str) {
+        return dark::is_ipv4_literal(str);
+    });
+
+    run("parse_http Content-Length", response, [](std::string_view str) {
+        return parse_http(str, "Content-Length: ").size();
+    });
+    run("parse_http Host", request, [](std::string_view str) {
+        return parse_http(str, "Host: ").size();
+    });
+    run("cstring_view::find header end", response, [](std::string_view str) {
+        return dark::cstring_view{str.data(), str.size()}.find("\r\n\r\n");
+    });
+    run("  std::string_view::find", response, [](std::string_view str) {
+        return str.find("\r\n\r\n");
+    });
+    run("cstring_view::find_first_of", request, [](std::string_view str) {
+        return dark::cstring_view{str.data(), str.size()}.find_first_of("?#");
+    });
+    run("  std::string_view::find_first_of", request, [](std::string_view str) {
+        return str.find_first_of("?#");
+    });
+
+    run("parse_host numeric", "http://127.0.0.1:8080/static/js/app.min.js", [](auto str) {
+        return parse_host(str).has_value();
+    });
+    run("  getaddrinfo numeric", "127.0.0.1", [](std::string_view str) {
+        return dark::Address{std::string{str}, "", 8080}.is_valid();
+    });
+    run("parse_host name", "http://localhost:8080/static/js/app.min.js", [](auto str) {
+        return parse_host(str).has_value();
+    });
+    return 0;
+}
@@ -0,0 +1,260 @@
+// Round trips of a message between two threads, an echo and a client that
+// times each trip. The first table runs over loopback TCP, with and without
+// TCP_NODELAY, and over a Unix socket pair, with each way of waiting the
+// library has (blocking calls, select, epoll) and messages of 64 B to 64 KB.
+// The second spins in the epoll loops for a while before sleeping: that should
+// cut the median and the tail, for the CPU it burns. The cost column is CPU
+// seconds spent per second, both loops together.
+#include "bench.h"
+#include "address.h"
+#include "histogram.h"
+#include "poller.h"
+#include "select.h"
+#include "socket.h"
+#include "unix.h"
+#include "utility.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#include <thread>
+#include <utility>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr std::size_t sizes[] = {64, 512, 4096, 16384, 65536}; // bytes each way
+static constexpr auto case_limit     = std::chrono::seconds{1};       // of trips per case
+
+enum class Transport { tcp, nodelay, unix_pair };
+enum class Backend { blocking, select, epoll };
+
+static constexpr std::string_view transport_names[] = {"tcp", "nodelay", "unix"};
+static constexpr std::string_view backend_names[]   = {"blocking", "select", "epoll"};
+
+struct Case {
+    Transport transport;
+    Backend backend;
+    std::size_t size;
+    std::chrono::microseconds spin{}; // epoll only
+};
+
+struct Result {
+    double p50;  // microseconds per round trip
+    double p99;  // ...
+    double p999; // ...
+    double cpu;  // CPU seconds per second of wall time
+    double hits; // waits that found the message while spinning, in %
+    std::size_t trips;
+};
+
+static auto cpu_time() -> Clock::duration {
+    auto usage = rusage{};
+    ::getrusage(RUSAGE_SELF, &usage);
+    const auto to_duration = [](const timeval &time) {
+        return std::chrono::seconds{time.tv_sec} + std::chrono::microseconds{time.tv_usec};
+    };
+    return to_duration(usage.ru_utime) + to_duration(usage.ru_stime);
+}
+
+// A connected pair, nonblocking unless the case blocks.
+static auto make_pair(const Case &which) -> std::pair<dark::Socket, dark::Socket> {
+    auto pair = std::pair<dark::Socket, dark::Socket>{};
+    if (which.transport == Transport::unix_pair) {
+        pair = dark::UnixSocket::pair().unwrap();
+    } else {
+        const auto tcp = [] {
+            return dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+        };
+        auto listener = tcp();
+        listener.bind(dark::Address{"127.0.0.1", 0}).unwrap();
+        listener.listen(1).unwrap();
+        pair.first = tcp();
+        pair.first.connect(listener.local_address().unwrap()).unwrap();
+        pair.second = std::move(listener.accept().unwrap().first);
+    }
+    for (auto *socket : {&pair.first, &pair.second}) {
+        if (which.transport == Transport::nodelay)
+            socket->set_opt(socket->opt_nodelay).unwrap();
+        if (which.spin.count() > 0) {
+            // Only takes effect with a NAPI device, and may be refused
+            const auto budget = static_cast<int>(which.spin.count());
+            static_cast<void>(socket->set_opt(socket->opt_busy_poll(budget)));
+            static_cast<void>(socket->set_opt(socket->opt_prefer_busy_poll));
+        }
+        if (which.backend != Backend::blocking)
+            socket->set_nonblocking().unwrap();
+    }
+    return pair;
+}
+
+// One end of the pair, which waits for its socket the way the case says.
+struct Endpoint {
+public:
+    explicit Endpoint(dark::Socket socket, const Case &which) :
+        _M_socket(std::move(socket)), _M_backend(which.backend),
+        _M_poller(dark::Poller::create().unwrap()) {
+        _M_poller.spin(which.spin);
+        // The data is never looked at: there is only the one socket
+        _M_poller.add(_M_socket, dark::Interest::READ, this).unwrap();
+    }
+
+    // Receive exactly `buffer.size()` bytes. False once the peer is gone.
+    auto receive(std::span<char> buffer) -> bool {
+        for (auto got = std::size_t{}; got < buffer.size();) {
+            const auto ret = _M_socket.recv(buffer.subspan(got));
+            if (ret.has_value() && ret.value_or(0) == 0)
+                return false;
+            if (ret.has_value())
+                got += ret.value_or(0);
+            else if (errno == EAGAIN)
+                _M_wait(dark::Interest::READ);
+            else
+                return false;
+        }
+        return true;
+    }
+
+    auto send(std::string_view data) -> bool {
+        for (auto sent = std::size_t{}; sent < data.size();) {
+            const auto ret = _M_socket.send(data.substr(sent));
+            if (ret.has_value())
+                sent += ret.value_or(0);
+            else if (errno == EAGAIN)
+                _M_wait(dark::Interest::WRITE);
+            else
+                return false;
+        }
+        return true;
+    }
+
+    auto shutdown_write() -> void {
+        static_cast<void>(_M_socket.shutdown_write());
+    }
+
+    auto poller() const -> const dark::Poller & {
+        return _M_poller;
+    }
+
+private:
+    // Only nonblocking sockets get here
+    auto _M_wait(dark::Interest interest) -> void {
+        if (_M_backend == Backend::select) {
+            if (interest == dark::Interest::READ)
+                static_cast<void>(dark::select({_M_socket}, nullptr, nullptr));
+            else
+                static_cast<void>(dark::select(nullptr, {_M_socket}, nullptr));
+            return;
+        }
+        auto events = std::array<dark::PollEvent, 1>{};
+        if (interest == dark::Interest::READ) {
+            static_cast<void>(_M_poller.wait(events));
+            return;
+        }
+        // Rare: only a message larger than the socket buffer fills it
+        _M_poller.modify(_M_socket, interest, this).unwrap();
+        static_cast<void>(_M_poller.wait(events));
+        _M_poller.modify(_M_socket, dark::Interest::READ, this).unwrap();
+    }
+
+    dark::Socket _M_socket;
+    Backend _M_backend;
+    dark::Poller _M_poller;
+};
+
+static auto measure(const Case &which, std::size_t trips) -> Result {
+    auto [client_socket, server_socket] = make_pair(which);
+    auto echo = std::jthread{[&which, socket = std::move(server_socket)]() mutable {
+        auto server = Endpoint{std::move(socket), which};
+        auto buffer = std::string(which.size, '\0');
+        while (server.receive(buffer) && server.send(buffer)) {}
+    }};
+
+    auto client    = Endpoint{std::move(client_socket), which};
+    auto buffer    = std::string(which.size, 'p');
+    auto histogram = dark::Histogram<>{}; // nanoseconds
+    auto done      = std::size_t{};
+    const auto cpu_start = cpu_time();
+    const auto begin     = Clock::now();
+    // A stall of the delayed ACK per trip would take minutes: stop early
+    for (; done < trips && Clock::now() - begin < case_limit; ++done) {
+        const auto start = Clock::now();
+        if (!client.send(buffer) || !client.receive(buffer))
+            break;
+        const auto rtt = std::chrono::nanoseconds{Clock::now() - start};
+        histogram.record(static_cast<std::uint64_t>(rtt.count()));
+    }
+    const auto wall = Clock::now() - begin;
+    const auto cpu  = cpu_time() - cpu_start;
+    client.shutdown_write(); // The echo loop sees the end
+    echo.join();
+
+    const auto us = [&](double percent) {
+        return static_cast<double>(histogram.percentile(percent)) / 1000;
+    };
+    const auto &poller = client.poller();
+    const auto spins   = std::max<std::size_t>(poller.spins(), 1);
+    return {
+        .p50   = us(50),
+        .p99   = us(99),
+        .p999  = us(99.9),
+        .cpu   = std::chrono::duration<double>(cpu) / std::chrono::duration<double>(wall),
+        .hits  = 100.0 * static_cast<double>(poller.spin_hits()) / static_cast<double>(spins),
+        .trips = done,
+    };
+}
+
+auto bench_pingpong(int argc, const char **argv) -> int {
+    const auto trips   = argc > 0 ? dark::str_to_int_nocheck<std::size_t>(argv[0]) : 5000;
+    const auto maximum = argc > 1 ? dark::str_to_int_nocheck<int>(argv[1]) : 200;
+    if (trips == 0)
+        return 1;
+
+    std::cout << std::format(
+        "Up to {} round trips per case, for at most {}s, {} hardware threads\n", trips,
+        case_limit.count(), std::thread::hardware_concurrency()
+    );
+    std::cout << std::format(
+        "{:>10}{:>10}{:>8}{:>12}{:>12}{:>12}{:>8}\n", "transport", "backend", "bytes", "p50 (us)",
+        "p99 (us)", "p99.9 (us)", "trips"
+    );
+    for (const auto transport : {Transport::tcp, Transport::nodelay, Transport::unix_pair})
+        for (const auto backend : {Backend::blocking, Backend::select, Backend::epoll})
+            for (const auto size : sizes) {
+                const auto result = measure({transport, backend, size}, trips);
+                std::cout << std::format(
+                    "{:>10}{:>10}{:>8}{:>12.1f}{:>12.1f}{:>12.1f}{:>8}\n",
+                    transport_names[static_cast<std::size_t>(transport)],
+                    backend_names[static_cast<std::size_t>(backend)], size, result.p50,
+                    result.p99, result.p999, result.trips
+                );
+            }
+
+    std::cout << std::format(
+        "\nepoll over tcp with TCP_NODELAY, {} bytes, spinning before each sleep\n", sizes[0]
+    );
+    std::cout << std::format(
+        "{:>10}{:>12}{:>12}{:>12}{:>12}{:>12}\n", "spin (us)", "p50 (us)", "p99 (us)",
+        "p99.9 (us)", "CPU", "spin hits"
+    );
+    const auto report = [](std::string_view label, const Result &result) {
+        std::cout << std::format(
+            "{:>10}{:>12.1f}{:>12.1f}{:>12.1f}{:>12.2f}{:>11.0f}%\n", label, result.p50,
+            result.p99, result.p999, result.cpu, result.hits
+        );
+    };
+    const auto spin_case = [](int spin) {
+        return Case{Transport::nodelay, Backend::epoll, sizes[0], std::chrono::microseconds{spin}};
+    };
+    report("sleep", measure(spin_case(0), trips));
+    for (auto spin = 10; spin <= maximum; spin *= 2)
+        report(std::to_string(spin), measure(spin_case(spin), trips));
+    return 0;
+}
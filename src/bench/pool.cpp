@@ -0,0 +1,141 @@
+// Event loops mixing I/O with CPU-bound work (gzip of a page, as when caching
+// a response), done inline on the loop or handed to the work-stealing pool
+// with its result posted back. The pool should add throughput with threads,
+// and keep the time a loop spends away from its sockets flat.
+#include "bench.h"
+#include "compress.h"
+#include "mpsc.h"
+#include "pool.h"
+#include "socket.h"
+#include "unix.h"
+#include "utility.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr std::size_t loops = 2;  // event loop threads
+static constexpr std::size_t depth = 64; // CPU tasks in flight per loop at most
+
+struct Result {
+    double requests; // per second, all loops
+    double p99;      // microseconds a loop iteration takes, 99th percentile
+};
+
+// Some HTML, compressible the way pages are.
+static auto make_page() -> std::string {
+    auto page = std::string{"<html><body>\n"};
+    for (std::size_t i = 0; page.size() < 16384; ++i)
+        page += std::format("<p class=\"item\">Item {} costs {} coins</p>\n", i, i * 37 % 1000);
+    return page + "</body></html>\n";
+}
+
+// One event loop: a message through a socket pair stands for its I/O, each
+// iteration. Without a pool, each iteration also compresses the page.
+static auto run_loop(
+    dark::ThreadPool *pool, const std::string &page, const std::atomic<bool> &stop,
+    std::atomic<std::size_t> &requests, std::vector<Clock::duration> &iterations
+) -> void {
+    auto [out, in] = dark::UnixSocket::pair().unwrap();
+    auto message   = std::string(1024, 'm');
+    auto buffer    = std::string(1024, '\0');
+    auto done      = dark::MpscQueue<std::size_t>{};
+    auto in_flight = std::size_t{};
+    auto completed = std::size_t{};
+    while (!stop.load(std::memory_order_relaxed)) {
+        const auto start = Clock::now();
+        out.send(message).unwrap();
+        for (auto got = std::size_t{}; got < message.size();)
+            got += in.recv(std::span{buffer.data() + got, message.size() - got}).unwrap();
+
+        if (pool == nullptr) {
+            completed += !dark::gzip_compress(page).unwrap().empty();
+        } else {
+            while (auto size = done.pop()) {
+                completed += *size != 0;
+                --in_flight;
+            }
+            if (in_flight < depth) {
+                ++in_flight;
+                pool->submit([&page, &done] {
+                    done.push(dark::gzip_compress(page).unwrap().size());
+                });
+            }
+        }
+        iterations.push_back(Clock::now() - start);
+    }
+    // Tasks still running post to `done`: wait for them
+    while (in_flight != 0)
+        if (done.pop())
+            --in_flight;
+    requests.fetch_add(completed);
+}
+
+// `threads` pool threads, or none to compress inline.
+static auto measure(std::size_t threads, std::chrono::milliseconds duration) -> Result {
+    const auto page = make_page();
+    auto pool       = threads == 0 ? nullptr : std::make_unique<dark::ThreadPool>(threads);
+    auto stop       = std::atomic<bool>{false};
+    auto requests   = std::atomic<std::size_t>{0};
+    auto samples    = std::vector<std::vector<Clock::duration>>(loops);
+    auto workers    = std::vector<std::jthread>{};
+
+    const auto begin = Clock::now();
+    for (auto &iterations : samples)
+        workers.emplace_back([&] { run_loop(pool.get(), page, stop, requests, iterations); });
+    std::this_thread::sleep_for(duration);
+    stop.store(true);
+    workers.clear();
+    const auto elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    auto all = std::vector<Clock::duration>{};
+    for (const auto &iterations : samples)
+        all.insert(all.end(), iterations.begin(), iterations.end());
+    auto p99 = Clock::duration{};
+    if (!all.empty()) {
+        const auto nth = all.begin() + static_cast<std::ptrdiff_t>(all.size() * 99 / 100);
+        std::ranges::nth_element(all, nth);
+        p99 = *nth;
+    }
+    return {
+        .requests = static_cast<double>(requests.load()) / elapsed,
+        .p99      = std::chrono::duration<double, std::micro>(p99).count(),
+    };
+}
+
+auto bench_pool(int argc, const char **argv) -> int {
+    const auto seconds  = argc > 0 ? dark::str_to_int_nocheck<std::size_t>(argv[0]) : 1;
+    const auto hardware = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+    const auto maximum  = argc > 1 ? dark::str_to_int_nocheck<std::size_t>(argv[1]) : hardware;
+    const auto step     = std::chrono::milliseconds{seconds * 1000};
+
+    std::cout << std::format(
+        "{} event loops, {} KiB pages, {} hardware threads\n", loops, make_page().size() >> 10,
+        hardware
+    );
+    std::cout << std::format(
+        "{:>8}{:>16}{:>10}{:>20}\n", "pool", "requests/s", "speedup", "loop p99 (us)"
+    );
+    const auto inline_result = measure(0, step);
+    std::cout << std::format(
+        "{:>8}{:>16.0f}{:>10.2f}{:>20.1f}\n", "inline", inline_result.requests, 1.0,
+        inline_result.p99
+    );
+    for (std::size_t threads = 1; threads <= maximum; threads *= 2) {
+        const auto result = measure(threads, step);
+        std::cout << std::format(
+            "{:>8}{:>16.0f}{:>10.2f}{:>20.1f}\n", threads, result.requests,
+            result.requests / inline_result.requests, result.p99
+        );
+    }
+    return 0;
+}
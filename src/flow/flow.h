@@ -0,0 +1,86 @@
+#pragma once
+#include "histogram.h"
+#include "socket.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// How the sending side hands its bytes to the kernel.
+enum class Method : std::uint8_t {
+    send,     // one buffer per send
+    writev,   // the buffer in parts, gathered by one sendmsg
+    sendfile, // from a file in memory
+    splice,   // ... through a pipe
+    zerocopy, // MSG_ZEROCOPY, the kernel reading the buffer in place
+};
+
+inline constexpr std::string_view method_names[] = {
+    "send", "writev", "sendfile", "splice", "zerocopy",
+};
+
+inline auto method_name(Method method) -> std::string_view {
+    return method_names[static_cast<std::size_t>(method)];
+}
+
+inline auto parse_method(std::string_view name) -> std::optional<Method> {
+    for (std::size_t i = 0; i < std::size(method_names); ++i)
+        if (method_names[i] == name)
+            return static_cast<Method>(i);
+    return std::nullopt;
+}
+
+struct FlowConfig {
+    std::string host   = "127.0.0.1";
+    std::uint16_t port = 6789;
+
+    std::size_t message = std::size_t{128} << 10; // bytes per send call at most
+    std::size_t streams = 1;                      // connections, spread over the threads
+    std::size_t threads = 1;                      // per side
+
+    // Nothing is counted during the warmup, only during the duration after it
+    std::chrono::seconds warmup{1};
+    std::chrono::seconds duration{10};
+
+    // SO_SNDBUF and SO_RCVBUF, 0 to leave them to the kernel
+    int send_buffer = 0;
+    int recv_buffer = 0;
+
+    Method method = Method::send;
+    bool json     = false;
+
+    // Print the kernel's view of each source stream as it ends, from TCP_INFO.
+    // Have the kernel timestamp what is sent and received, to tell the delays
+    // in its queues from those of the network and of the application.
+    bool tcp_info   = false;
+    bool timestamps = false;
+};
+
+// What one thread did so far, read by the main thread while it runs.
+struct Counters {
+    std::atomic_size_t bytes{};
+    std::atomic_size_t syscalls{}; // I/O and polling calls
+
+    // From the timestamps of the kernel, in nanoseconds, over the whole run:
+    // only read once the thread is done.
+    dark::Histogram<> queued; // source: from the send call to the device
+    dark::Histogram<> acked;  // ... from the device to the acknowledgement
+    dark::Histogram<> waited; // sink: from arriving to being read
+};
+
+// Send over `streams` connections to the sink at `address` until `stop`.
+auto run_source(
+    const FlowConfig &config, const sockaddr_in &address, std::size_t streams,
+    Counters &counters, const std::atomic<bool> &stop
+) -> void;
+
+// Receive whatever connects to `listener` until `stop`. Every thread given the
+// same listener takes its share of the connections.
+auto run_sink(
+    const FlowConfig &config, dark::Socket &listener, Counters &counters,
+    const std::atomic<bool> &stop
+) -> void;
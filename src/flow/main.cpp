@@ -0,0 +1,318 @@
+// TCP throughput benchmark: sources push bytes to sinks over any number of
+// streams and threads, with one of several send methods.
+//
+//   flow local  [options]  both ends in this process, over loopback
+//   flow server [options]  a sink, reporting what it receives every second
+//   flow client [options]  sources against a server, reporting at the end
+//
+// Only the `duration` after the `warmup` counts. Throughput is in Gbit/s of
+// bytes handed to the kernel by the sources; CPU is in percent of one core,
+// per side; syscalls per GB count every I/O and polling call.
+// With timestamps, the delays of the whole run are reported too: in the
+// send queue of the kernel (send call to device), to the acknowledgement
+// (device to ack) and in the receive queue (arrival to recv call).
+#include "address.h"
+#include "flow.h"
+#include "socket.h"
+#include "utility.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <ctime>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static auto usage(const char *name) -> int {
+    std::cerr << std::format(
+        "Usage: {} local|server|client [--key value]...\n"
+        "  --host 127.0.0.1    --port 6789       --message 131072 (bytes)\n"
+        "  --streams 1         --threads 1       --duration 10 (s)   --warmup 1 (s)\n"
+        "  --send-buffer 0     --recv-buffer 0   (bytes, 0 for the kernel default)\n"
+        "  --method send|writev|sendfile|splice|zerocopy             --json 0|1\n"
+        "  --tcp-info 0|1      --timestamps 0|1\n",
+        name
+    );
+    return 1;
+}
+
+static auto parse_options(int argc, const char **argv) -> std::optional<FlowConfig> {
+    auto config = FlowConfig{};
+    for (int i = 0; i < argc; i += 2) {
+        const auto key   = std::string_view{argv[i]};
+        const auto value = std::string_view{i + 1 < argc ? argv[i + 1] : ""};
+        if (key == "--host") {
+            config.host = value;
+        } else if (key == "--port") {
+            config.port = dark::str_to_int_nocheck<std::uint16_t>(value);
+        } else if (key == "--message") {
+            config.message = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--streams") {
+            config.streams = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--threads") {
+            config.threads = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--duration") {
+            config.duration = std::chrono::seconds{dark::str_to_int_nocheck<int>(value)};
+        } else if (key == "--warmup") {
+            config.warmup = std::chrono::seconds{dark::str_to_int_nocheck<int>(value)};
+        } else if (key == "--send-buffer") {
+            config.send_buffer = dark::str_to_int_nocheck<int>(value);
+        } else if (key == "--recv-buffer") {
+            config.recv_buffer = dark::str_to_int_nocheck<int>(value);
+        } else if (key == "--method") {
+            const auto method = parse_method(value);
+            if (!method) {
+                std::cerr << std::format("Unknown method: {}\n", value);
+                return std::nullopt;
+            }
+            config.method = *method;
+        } else if (key == "--json") {
+            config.json = value == "1";
+        } else if (key == "--tcp-info") {
+            config.tcp_info = value == "1";
+        } else if (key == "--timestamps") {
+            config.timestamps = value == "1";
+        } else {
+            std::cerr << std::format("Unknown option: {}\n", key);
+            return std::nullopt;
+        }
+    }
+    if (config.message == 0 || config.streams == 0 || config.threads == 0) {
+        std::cerr << "Messages, streams and threads must not be zero\n";
+        return std::nullopt;
+    }
+    if (config.timestamps && config.method == Method::zerocopy) {
+        std::cerr << "Timestamps and zero-copy completions share the error queue: pick one\n";
+        return std::nullopt;
+    }
+    return config;
+}
+
+// The threads of one side, and what they did so far.
+struct Side {
+    std::vector<std::thread> threads;
+    std::unique_ptr<Counters[]> counters;
+    std::size_t count{};
+
+    explicit Side(std::size_t count) :
+        counters(std::make_unique<Counters[]>(count)), count(count) {}
+};
+
+struct Sample {
+    std::size_t bytes;
+    std::size_t syscalls;
+    std::chrono::nanoseconds cpu; // all threads of the side
+};
+
+static auto sample(Side &side) -> Sample {
+    auto result = Sample{0, 0, {}};
+    for (std::size_t i = 0; i < side.count; ++i) {
+        result.bytes += side.counters[i].bytes.load(std::memory_order_relaxed);
+        result.syscalls += side.counters[i].syscalls.load(std::memory_order_relaxed);
+    }
+    for (auto &thread : side.threads) {
+        auto clock = clockid_t{};
+        auto time  = timespec{};
+        if (::pthread_getcpuclockid(thread.native_handle(), &clock) != 0
+            || ::clock_gettime(clock, &time) != 0)
+            continue; // Gone already
+        result.cpu += std::chrono::seconds{time.tv_sec} + std::chrono::nanoseconds{time.tv_nsec};
+    }
+    return result;
+}
+
+struct Rates {
+    double gbits;    // per second
+    double cpu;      // percent of one core
+    double syscalls; // per GB
+};
+
+static auto rates(const Sample &from, const Sample &to, Clock::duration elapsed) -> Rates {
+    const auto seconds  = std::chrono::duration<double>(elapsed).count();
+    const auto bytes    = static_cast<double>(to.bytes - from.bytes);
+    const auto syscalls = static_cast<double>(to.syscalls - from.syscalls);
+    const auto cpu      = std::chrono::duration<double>(to.cpu - from.cpu).count();
+    return {
+        .gbits    = bytes * 8 / 1e9 / seconds,
+        .cpu      = 100 * cpu / seconds,
+        .syscalls = bytes == 0 ? 0 : syscalls / (bytes / 1e9),
+    };
+}
+
+static auto make_listener(const FlowConfig &config, std::uint16_t port) -> dark::Socket {
+    auto listener = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+    listener.set_opt(listener.opt_reuse).unwrap();
+    // Inherited by accepted sockets; set before listening, for the window scale
+    if (config.recv_buffer > 0)
+        listener.set_opt(listener.opt_recv_buffer(config.recv_buffer)).unwrap();
+    if (config.timestamps)
+        listener.set_opt(listener.opt_recv_timestamping).unwrap("no timestamps: {}");
+    listener.bind(dark::Address{config.host, port}).unwrap("cannot bind: {}");
+    listener.listen(128).unwrap();
+    listener.set_nonblocking().unwrap();
+    return listener;
+}
+
+static auto start_sinks(
+    const FlowConfig &config, dark::Socket &listener, Side &side, const std::atomic<bool> &stop
+) -> void {
+    for (std::size_t i = 0; i < side.count; ++i)
+        side.threads.emplace_back([&config, &listener, &side, &stop, i] {
+            run_sink(config, listener, side.counters[i], stop);
+        });
+}
+
+static auto start_sources(
+    const FlowConfig &config, const sockaddr_in &address, Side &side, const std::atomic<bool> &stop
+) -> void {
+    for (std::size_t i = 0; i < side.count; ++i) {
+        // Streams spread evenly, the first threads taking one more
+        const auto streams = config.streams / side.count + (i < config.streams % side.count);
+        side.threads.emplace_back([&config, address, &side, &stop, i, streams] {
+            run_source(config, address, streams, side.counters[i], stop);
+        });
+    }
+}
+
+static auto stop_all(std::atomic<bool> &stop, Side &side) -> void {
+    stop.store(true);
+    for (auto &thread : side.threads)
+        thread.join();
+}
+
+static auto report(const FlowConfig &config, const Rates &sent, const Rates *received) -> void {
+    if (config.json) {
+        const auto side = [](const Rates &rates) {
+            return std::format(
+                R"({{"cpu_percent": {:.1f}, "syscalls_per_gb": {:.0f}}})", rates.cpu,
+                rates.syscalls
+            );
+        };
+        std::cout << std::format(
+            R"({{"method": "{}", "message": {}, "streams": {}, "threads": {}, )"
+            R"("duration_s": {}, "gbit_per_s": {:.3f}, "sender": {}, "receiver": {}}})"
+            "\n",
+            method_name(config.method), config.message, config.streams, config.threads,
+            config.duration.count(), sent.gbits, side(sent),
+            received == nullptr ? std::string{"null"} : side(*received)
+        );
+        return;
+    }
+    std::cout << std::format(
+        "{}: {} streams on {} threads, {} bytes per call, {}s after {}s of warmup\n",
+        method_name(config.method), config.streams, config.threads, config.message,
+        config.duration.count(), config.warmup.count()
+    );
+    std::cout << std::format("throughput: {:.2f} Gbit/s\n", sent.gbits);
+    std::cout << std::format(
+        "sender:     CPU {:.1f}%, {:.0f} syscalls/GB\n", sent.cpu, sent.syscalls
+    );
+    if (received != nullptr)
+        std::cout << std::format(
+            "receiver:   CPU {:.1f}%, {:.0f} syscalls/GB\n", received->cpu, received->syscalls
+        );
+}
+
+// One delay of the threads of a side, which are done.
+static auto report_delay(
+    const FlowConfig &config, std::string_view name, const Side &side,
+    dark::Histogram<> Counters::*delay
+) -> void {
+    auto merged = dark::Histogram<>{};
+    for (std::size_t i = 0; i < side.count; ++i)
+        merged.merge(side.counters[i].*delay);
+    const auto micros = [&](double percent) {
+        return static_cast<double>(merged.percentile(percent)) / 1e3;
+    };
+    if (config.json) {
+        std::cout << std::format(
+            R"({{"delay": "{}", "samples": {}, "p50_us": {:.1f}, "p99_us": {:.1f}, )"
+            R"("max_us": {:.1f}}})"
+            "\n",
+            name, merged.count(), micros(50), micros(99), micros(100)
+        );
+        return;
+    }
+    std::cout << std::format(
+        "{:<12}{} samples, p50 {:.1f}us, p99 {:.1f}us, max {:.1f}us\n", std::format("{}:", name),
+        merged.count(), micros(50), micros(99), micros(100)
+    );
+}
+
+// Sources against `address`, and sinks too if given: measure, then stop them.
+static auto run_test(const FlowConfig &config, const sockaddr_in &address, Side *sinks) -> void {
+    auto stop    = std::atomic<bool>{false};
+    auto sources = Side{std::min(config.threads, config.streams)};
+    start_sources(config, address, sources, stop);
+    std::this_thread::sleep_for(config.warmup);
+
+    const auto start     = Clock::now();
+    const auto sent_from = sample(sources);
+    const auto recv_from = sinks == nullptr ? Sample{} : sample(*sinks);
+    std::this_thread::sleep_for(config.duration);
+    const auto elapsed = Clock::now() - start;
+    const auto sent    = rates(sent_from, sample(sources), elapsed);
+    stop_all(stop, sources);
+    if (sinks == nullptr) {
+        report(config, sent, nullptr);
+    } else {
+        const auto received = rates(recv_from, sample(*sinks), elapsed);
+        report(config, sent, &received);
+    }
+    if (config.timestamps) {
+        report_delay(config, "send queue", sources, &Counters::queued);
+        report_delay(config, "to ack", sources, &Counters::acked);
+    }
+}
+
+auto main(int argc, const char **argv) -> int {
+    if (argc < 2)
+        return usage(argv[0]);
+    const auto mode   = std::string_view{argv[1]};
+    const auto parsed = parse_options(argc - 2, argv + 2);
+    if (!parsed)
+        return usage(argv[0]);
+    const auto &config = *parsed;
+
+    if (mode == "client") {
+        run_test(config, dark::Address{config.host, config.port}, nullptr);
+    } else if (mode == "local") {
+        auto listener = make_listener(config, 0);
+        auto stop     = std::atomic<bool>{false};
+        auto sinks    = Side{config.threads};
+        start_sinks(config, listener, sinks, stop);
+        run_test(config, listener.local_address().unwrap(), &sinks);
+        stop_all(stop, sinks);
+        if (config.timestamps)
+            report_delay(config, "recv queue", sinks, &Counters::waited);
+    } else if (mode == "server") {
+        auto listener = make_listener(config, config.port);
+        auto stop     = std::atomic<bool>{false};
+        auto sinks    = Side{config.threads};
+        start_sinks(config, listener, sinks, stop);
+        for (auto last = sample(sinks);;) {
+            const auto start = Clock::now();
+            std::this_thread::sleep_for(std::chrono::seconds{1});
+            const auto next = sample(sinks);
+            const auto rate = rates(last, next, Clock::now() - start);
+            std::cout << std::format(
+                "received {:.2f} Gbit/s, CPU {:.1f}%, {:.0f} syscalls/GB\n", rate.gbits,
+                rate.cpu, rate.syscalls
+            ) << std::flush;
+            last = next;
+        }
+    } else {
+        return usage(argv[0]);
+    }
+    return 0;
+}
@@ -0,0 +1,312 @@
+// Both ends of the benchmark: sources push bytes with the method configured,
+// sinks receive them, each thread over an event loop of its own.
+#include "file.h"
+#include "flow.h"
+#include "optional.h"
+#include "poller.h"
+#include "socket.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+static constexpr std::size_t burst = 16; // calls per ready socket, not to starve the others
+static constexpr std::size_t parts = 8;  // of the message, for writev
+
+using SystemClock = std::chrono::system_clock;
+
+// A send call waiting for its timestamps, by the id of its last byte.
+struct InFlight {
+    std::uint32_t id;
+    SystemClock::time_point called;
+    SystemClock::time_point sent{}; // to the device, once known
+};
+
+struct Stream {
+    dark::Socket socket;
+    std::size_t offset{}; // into the message, for send, writev and zerocopy
+    off_t file_offset{};  // into the file, for sendfile and splice
+    dark::FileManager pipe_read{};
+    dark::FileManager pipe_write{};
+    std::size_t piped{}; // bytes in the pipe, for splice
+
+    std::uint32_t next_id{};       // of the next byte sent, with timestamps
+    std::deque<InFlight> inflight; // ... its calls not acknowledged yet
+};
+
+static constexpr std::size_t max_inflight = 4096; // calls, if their timestamps never come
+
+// What every stream of a source thread sends over and over.
+struct Payload {
+    std::string message;
+    dark::FileManager file; // holding the message, for sendfile and splice
+};
+
+static auto make_payload(const FlowConfig &config) -> Payload {
+    auto payload = Payload{std::string(config.message, 'a'), dark::FileManager{}};
+    if (config.method != Method::sendfile && config.method != Method::splice)
+        return payload;
+    payload.file = dark::FileManager{::memfd_create("flow", MFD_CLOEXEC)};
+    const auto size    = static_cast<ssize_t>(payload.message.size());
+    const auto *data   = payload.message.data();
+    const auto written = payload.file && ::write(payload.file.unsafe_get(), data, size) == size;
+    dark::optional<>{written}.unwrap("cannot make the file to send: {}");
+    return payload;
+}
+
+static auto connect(const FlowConfig &config, const sockaddr_in &address) -> Stream {
+    auto stream  = Stream{};
+    auto &socket = stream.socket;
+    socket       = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+    if (config.send_buffer > 0)
+        socket.set_opt(socket.opt_send_buffer(config.send_buffer)).unwrap();
+    socket.connect(address).unwrap("cannot connect to the sink: {}");
+    if (config.timestamps)
+        socket.set_opt(socket.opt_timestamping).unwrap("no timestamps: {}");
+    if (config.method == Method::zerocopy)
+        socket.set_opt(socket.opt_zerocopy).unwrap("no zero-copy send: {}");
+    if (config.method == Method::splice) {
+        int fds[2];
+        dark::optional<>{::pipe2(fds, O_CLOEXEC | O_NONBLOCK) == 0}.unwrap("no pipe: {}");
+        stream.pipe_read  = dark::FileManager{fds[0]};
+        stream.pipe_write = dark::FileManager{fds[1]};
+        // A message per splice, as far as the pipe allows
+        const auto size = static_cast<int>(config.message);
+        static_cast<void>(::fcntl(fds[1], F_SETPIPE_SZ, size));
+    }
+    socket.set_nonblocking().unwrap();
+    return stream;
+}
+
+// One step of sending: the bytes the kernel took, erropt if it took none.
+static auto push(Stream &stream, const Payload &payload, Method method, Counters &counters)
+    -> dark::optional<std::size_t> {
+    const auto &message = payload.message;
+    const auto view     = std::string_view{message}.substr(stream.offset);
+    const auto size     = static_cast<off_t>(message.size());
+    auto sent           = dark::optional<std::size_t>{};
+    counters.syscalls.fetch_add(1, std::memory_order_relaxed);
+    switch (method) {
+        case Method::send:     sent = stream.socket.send(view); break;
+        case Method::zerocopy: sent = stream.socket.send_zerocopy(view); break;
+        case Method::writev: {
+            const auto part = (message.size() + parts - 1) / parts;
+            auto iov        = std::array<iovec, parts>{};
+            auto count      = std::size_t{};
+            for (auto at = stream.offset; at < message.size(); at += part - at % part) {
+                const auto length = std::min(part - at % part, message.size() - at);
+                iov[count++]      = {const_cast<char *>(message.data() + at), length};
+            }
+            sent = stream.socket.send(std::span{iov.data(), count});
+            break;
+        }
+        case Method::sendfile: {
+            const auto count = static_cast<std::size_t>(size - stream.file_offset);
+            sent             = stream.socket.send_file(payload.file, stream.file_offset, count);
+            if (stream.file_offset == size)
+                stream.file_offset = 0;
+            return sent;
+        }
+        case Method::splice: {
+            if (stream.piped == 0) {
+                const auto count = static_cast<std::size_t>(size - stream.file_offset);
+                const auto ret   = ::splice(
+                    payload.file.unsafe_get(), &stream.file_offset,
+                    stream.pipe_write.unsafe_get(), nullptr, count, SPLICE_F_NONBLOCK
+                );
+                counters.syscalls.fetch_add(1, std::memory_order_relaxed);
+                if (ret < 0)
+                    return dark::erropt;
+                stream.piped += static_cast<std::size_t>(ret);
+                if (stream.file_offset == size)
+                    stream.file_offset = 0;
+            }
+            sent = stream.socket.splice_from(stream.pipe_read, stream.piped);
+            if (sent)
+                stream.piped -= sent.value_or(0);
+            return sent;
+        }
+        default: return dark::erropt;
+    }
+    if (sent)
+        stream.offset = (stream.offset + sent.value_or(0)) % message.size();
+    return sent;
+}
+
+// Note a call that sent `size` bytes, to match with its timestamps.
+static auto track(Stream &stream, std::size_t size, SystemClock::time_point called) -> void {
+    const auto id = static_cast<std::uint32_t>(stream.next_id + size - 1);
+    stream.next_id += static_cast<std::uint32_t>(size);
+    stream.inflight.push_back({id, called});
+    if (stream.inflight.size() > max_inflight)
+        stream.inflight.pop_front();
+}
+
+// Nanoseconds from `from` to `to`, 0 if the clock went back.
+static auto nanos(SystemClock::time_point from, SystemClock::time_point to) -> std::uint64_t {
+    return static_cast<std::uint64_t>(std::max<std::int64_t>((to - from) / 1ns, 0));
+}
+
+// Match the timestamps queued on the socket with the calls they are of.
+// Those of a call come in order: scheduled, sent, acknowledged.
+static auto reap_timestamps(Stream &stream, Counters &counters) -> void {
+    while (true) {
+        counters.syscalls.fetch_add(1, std::memory_order_relaxed);
+        auto reaped = stream.socket.reap_timestamp();
+        if (!reaped)
+            return;
+        const auto stamp = reaped.unwrap();
+        if (stamp.stage == dark::SendStage::scheduled)
+            continue;
+        auto &inflight = stream.inflight;
+        if (stamp.stage == dark::SendStage::sent) {
+            const auto it = std::ranges::find(inflight, stamp.id, &InFlight::id);
+            if (it != inflight.end()) {
+                it->sent = stamp.time;
+                counters.queued.record(nanos(it->called, stamp.time));
+            }
+            continue;
+        }
+        // Acknowledged: so are the calls before, whose acknowledgement was merged
+        while (!inflight.empty() && static_cast<std::int32_t>(stamp.id - inflight[0].id) > 0)
+            inflight.pop_front();
+        if (inflight.empty() || inflight[0].id != stamp.id)
+            continue;
+        if (inflight[0].sent != SystemClock::time_point{})
+            counters.acked.record(nanos(inflight[0].sent, stamp.time));
+        inflight.pop_front();
+    }
+}
+
+// The kernel's view of each stream, by its local port, on stderr not to mix
+// with the report.
+static auto print_tcp_info(const std::vector<std::unique_ptr<Stream>> &streams) -> void {
+    for (const auto &stream : streams) {
+        auto info = stream->socket.tcp_info();
+        if (!info)
+            continue;
+        const auto tcp  = info.unwrap();
+        const auto port = ntohs(stream->socket.local_address().value_or(sockaddr_in{}).sin_port);
+        std::cerr << std::format(
+            "stream {}: rtt {}us (+/- {}us, min {}us), cwnd {} x {} bytes, {} retransmits, "
+            "{:.2f} Gbit/s delivered, {} bytes not sent\n",
+            port, tcp.rtt.count(), tcp.rtt_var.count(), tcp.min_rtt.count(), tcp.cwnd, tcp.mss,
+            tcp.retransmits, static_cast<double>(tcp.delivery_rate) * 8 / 1e9, tcp.not_sent
+        );
+    }
+}
+
+auto run_source(
+    const FlowConfig &config, const sockaddr_in &address, std::size_t streams,
+    Counters &counters, const std::atomic<bool> &stop
+) -> void {
+    const auto payload = make_payload(config);
+    auto poller        = dark::Poller::create().unwrap();
+    auto open          = std::vector<std::unique_ptr<Stream>>{};
+    for (std::size_t i = 0; i < streams; ++i) {
+        auto &stream = *open.emplace_back(std::make_unique<Stream>(connect(config, address)));
+        poller.add(stream.socket, dark::Interest::WRITE, &stream).unwrap();
+    }
+
+    auto events = std::array<dark::PollEvent, 64>{};
+    while (!stop.load(std::memory_order_relaxed)) {
+        const auto ready = poller.wait(events, 100ms);
+        counters.syscalls.fetch_add(1, std::memory_order_relaxed);
+        for (const auto &event : std::span{events.data(), ready.value_or(0)}) {
+            auto &stream = *static_cast<Stream *>(event.data);
+            // Completions of zero-copy sends come as errors, until reaped
+            if (config.method == Method::zerocopy && (event.events & EPOLLERR) != 0) {
+                do
+                    counters.syscalls.fetch_add(1, std::memory_order_relaxed);
+                while (stream.socket.reap_zerocopy());
+            }
+            // ... and so do timestamps
+            if (config.timestamps && (event.events & EPOLLERR) != 0)
+                reap_timestamps(stream, counters);
+            for (std::size_t k = 0; k < burst; ++k) {
+                const auto called =
+                    config.timestamps ? SystemClock::now() : SystemClock::time_point{};
+                const auto sent = push(stream, payload, config.method, counters);
+                if (!sent) {
+                    if (errno != EAGAIN && errno != ENOBUFS) {
+                        std::cerr << std::format("Stream failed: {}\n", std::strerror(errno));
+                        static_cast<void>(poller.remove(stream.socket));
+                    }
+                    break;
+                }
+                counters.bytes.fetch_add(sent.value_or(0), std::memory_order_relaxed);
+                if (config.timestamps)
+                    track(stream, sent.value_or(0), called);
+            }
+        }
+    }
+    if (config.tcp_info)
+        print_tcp_info(open);
+}
+
+auto run_sink(
+    const FlowConfig &config, dark::Socket &listener, Counters &counters,
+    const std::atomic<bool> &stop
+) -> void {
+    auto poller = dark::Poller::create().unwrap();
+    poller.add(listener, dark::Interest::READ, &listener).unwrap();
+    auto open   = std::vector<std::unique_ptr<dark::Socket>>{};
+    auto buffer = std::vector<char>(std::max<std::size_t>(config.message, 65536));
+    auto events = std::array<dark::PollEvent, 64>{};
+    while (!stop.load(std::memory_order_relaxed)) {
+        const auto ready = poller.wait(events, 100ms);
+        counters.syscalls.fetch_add(1, std::memory_order_relaxed);
+        for (const auto &event : std::span{events.data(), ready.value_or(0)}) {
+            if (event.data == &listener) {
+                // Other sink threads race for the same connections
+                while (auto accepted = listener.accept()) {
+                    auto socket = std::make_unique<dark::Socket>(accepted.unwrap().first);
+                    socket->set_nonblocking().unwrap();
+                    poller.add(*socket, dark::Interest::READ, socket.get()).unwrap();
+                    open.push_back(std::move(socket));
+                }
+                continue;
+            }
+            auto &socket = *static_cast<dark::Socket *>(event.data);
+            for (std::size_t k = 0; k < burst; ++k) {
+                const auto got = socket.recv_timestamped(std::span{buffer});
+                counters.syscalls.fetch_add(1, std::memory_order_relaxed);
+                const auto [size, stamp] = got.value_or(dark::TimedRecv{});
+                if (size != 0) {
+                    counters.bytes.fetch_add(size, std::memory_order_relaxed);
+                    // Not stamped if the kernel was not asked to, or not yet
+                    if (config.timestamps && stamp != SystemClock::time_point{})
+                        counters.waited.record(nanos(stamp, SystemClock::now()));
+                    continue;
+                }
+                if (got || errno != EAGAIN) {
+                    // The source is done, or gone
+                    static_cast<void>(poller.remove(socket));
+                    std::erase_if(open, [&](const auto &owned) { return owned.get() == &socket; });
+                }
+                break;
+            }
+        }
+    }
+}
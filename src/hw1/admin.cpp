@@ -0,0 +1,128 @@
+#include "hw1/proxy_metrics.h"
+#include "address.h"
+#include "hw1/html.h"
+#include "metrics.h"
+#include "poller.h"
+#include "socket.h"
+#include "trace.h"
+#include "utility.h"
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+static constexpr std::size_t max_head = 8192;
+static constexpr auto patience        = std::chrono::milliseconds{1000}; // per client
+
+auto proxy_metrics() -> ProxyMetrics & {
+    static auto instance = [] {
+        auto &registry   = dark::metrics();
+        const auto stage = [&](std::string_view name) -> dark::LatencyHistogram & {
+            return registry.histogram(
+                "proxy_stage_seconds", "Time spent in each stage of a connection",
+                std::format("stage=\"{}\"", name)
+            );
+        };
+        return ProxyMetrics{
+            .requests     = registry.counter("proxy_requests_total", "Request heads received"),
+            .cache_hits   = registry.counter("proxy_cache_hits_total", "GETs served from cache"),
+            .cache_stale  = registry.counter(
+                "proxy_cache_stale_hits_total", "Cache hits served stale, then refreshed"
+            ),
+            .cache_misses = registry.counter(
+                "proxy_cache_misses_total", "GETs of http urls not in the cache"
+            ),
+            .request_time = stage("request"),
+            .setup_time   = stage("setup"),
+            .connect_time = stage("connect"),
+            .total_time   = stage("total"),
+            .queue_time   = stage("queue"),
+        };
+    }();
+    return instance;
+}
+
+// Wait for `socket` to be ready, for a while. False if it was not.
+static auto wait(dark::Poller &poller, dark::Socket &socket, dark::Interest interest) -> bool {
+    auto events = std::array<dark::PollEvent, 1>{};
+    if (!poller.modify(socket, interest, &socket))
+        return false;
+    return poller.wait(events, patience).value_or(0) != 0;
+}
+
+// One request per connection, one connection at a time: scrapes are rare.
+// A client too slow to ask or to take the answer is dropped.
+static auto answer(dark::Poller &poller, dark::Socket client) -> void {
+    if (!client.set_nonblocking() || !poller.add(client, dark::Interest::READ, &client))
+        return;
+    auto request = std::string{};
+    auto chunk   = std::array<char, 1024>{};
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < max_head) {
+        const auto got = client.recv(std::span{chunk});
+        if (got.has_value() && got.value_or(0) == 0)
+            break;
+        if (got.has_value())
+            request.append(chunk.data(), got.value_or(0));
+        else if (errno != EAGAIN || !wait(poller, client, dark::Interest::READ))
+            break;
+    }
+
+    const auto method = parse_http(request, "", " ");
+    const auto target = parse_http(request, " ", " ");
+    auto response     = std::string{};
+    if (method == "GET" && (target == "/metrics" || target.starts_with("/metrics?"))) {
+        const auto body = dark::metrics().render();
+        response        = std::format(
+            "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: {}\r\nConnection: close\r\n\r\n{}",
+            body.size(), body
+        );
+    } else if (method == "GET" && (target == "/trace" || target.starts_with("/trace?"))) {
+        // Only the requests that took this long, if asked: /trace?min_ms=50
+        auto slower = std::chrono::milliseconds{};
+        if (const auto at = target.find("min_ms="); at != std::string_view::npos) {
+            const auto value = target.substr(at + 7, target.find('&', at) - at - 7);
+            slower           = std::chrono::milliseconds{dark::str_to_int_nocheck<int>(value)};
+        }
+        const auto body = dark::tracer().dump(slower);
+        response        = std::format(
+            "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+            "Content-Length: {}\r\nConnection: close\r\n\r\n{}",
+            body.size(), body
+        );
+    } else {
+        response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    for (auto sent = std::size_t{}; sent < response.size();) {
+        const auto ret = client.send(std::string_view{response}.substr(sent));
+        if (ret.has_value())
+            sent += ret.value_or(0);
+        else if (errno != EAGAIN || !wait(poller, client, dark::Interest::WRITE))
+            break;
+    }
+    static_cast<void>(poller.remove(client));
+}
+
+auto start_admin(std::string_view ip, std::uint16_t port) -> void {
+    auto listener = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+    listener.set_opt(listener.opt_reuse).unwrap();
+    if (!listener.bind(dark::Address{ip, port}) || !listener.listen(16)) {
+        std::cerr << std::format("Cannot serve metrics on {}:{}\n", ip, port);
+        return;
+    }
+    std::cout << std::format("Metrics at http://{}:{}/metrics\n", ip, port);
+    std::thread{[listener = std::move(listener)] mutable {
+        auto poller = dark::Poller::create().unwrap();
+        while (true)
+            if (auto accepted = listener.accept())
+                answer(poller, std::move(accepted.unwrap().first));
+    }}.detach();
+}
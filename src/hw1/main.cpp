@@ -1,10 +1,110 @@
+#include "affinity.h"
 #include "hw1/forward.h"
+#include "utility.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <format>
 #include <iostream>
 #include <string>
+#include <string_view>
 
+// Proxy options, given as "--key value" pairs on the command line.
+static auto parse_options(int argc, const char **argv) -> ProxyConfig {
+    auto config = ProxyConfig{};
+    for (int i = 1; i < argc; i += 2) {
+        const auto key   = std::string_view{argv[i]};
+        const auto value = std::string_view{i + 1 < argc ? argv[i + 1] : ""};
+        if (key == "--compress") {
+            config.compress_threshold = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--compress-level") {
+            config.compress_level = dark::str_to_int_nocheck<int>(value);
+        } else if (key == "--stale-window") {
+            config.stale_window = std::chrono::seconds{dark::str_to_int_nocheck<int>(value)};
+        } else if (key == "--refresh-workers") {
+            config.refresh_workers = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--refresh-interval") {
+            const auto ms           = dark::str_to_int_nocheck<int>(value);
+            config.refresh_interval = std::chrono::milliseconds{ms};
+        } else if (key == "--cache-capacity") {
+            config.cache_capacity = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--trace-log") {
+            config.trace_log = value;
+        } else if (key == "--workers") {
+            config.workers = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--shared-cache-size") {
+            config.shared_cache_size = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--reuse-port") {
+            config.reuse_port = value == "1";
+        } else if (key == "--control-socket") {
+            config.control_path = value;
+        } else if (key == "--drain-timeout") {
+            config.drain_timeout = std::chrono::seconds{dark::str_to_int_nocheck<int>(value)};
+        } else if (key == "--relay-threads") {
+            config.relay_threads = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--relay-buffer") {
+            config.relay_buffer = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--relay-quantum") {
+            config.relay_quantum = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--bulk-after") {
+            config.bulk_after = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--cpu-threads") {
+            config.cpu_threads = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--resolver-threads") {
+            config.resolver_threads = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--cpus") {
+            config.cpus = dark::parse_cpu_list(value);
+        } else if (key == "--busy-poll") {
+            config.busy_poll = std::chrono::microseconds{dark::str_to_int_nocheck<int>(value)};
+        } else if (key == "--header-timeout") {
+            config.header_timeout = std::chrono::seconds{dark::str_to_int_nocheck<int>(value)};
+        } else if (key == "--connect-timeout") {
+            config.connect_timeout = std::chrono::seconds{dark::str_to_int_nocheck<int>(value)};
+        } else if (key == "--idle-timeout") {
+            config.idle_timeout = std::chrono::seconds{dark::str_to_int_nocheck<int>(value)};
+        } else if (key == "--max-lifetime") {
+            config.max_lifetime = std::chrono::seconds{dark::str_to_int_nocheck<int>(value)};
+        } else if (key == "--memory-budget") {
+            config.memory_budget = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--backlog") {
+            config.backlog = dark::str_to_int_nocheck<int>(value);
+        } else if (key == "--max-connections") {
+            config.max_connections = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--accept-queue") {
+            config.accept_queue = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--queue-timeout") {
+            const auto ms        = dark::str_to_int_nocheck<int>(value);
+            config.queue_timeout = std::chrono::milliseconds{ms};
+        } else if (key == "--lifo") {
+            config.lifo = value == "1";
+        } else if (key == "--admin-port") {
+            config.admin_port = dark::str_to_int_nocheck<std::uint16_t>(value);
+        } else if (key == "--trace-sample") {
+            config.trace_sample = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--tcp-info") {
+            config.tcp_info = value == "1";
+        } else if (key == "--timestamps") {
+            config.timestamps = value == "1";
+        } else if (key == "--perf") {
+            config.perf = value == "1";
+        } else if (key == "--log-level") {
+            const auto level = dark::parse_log_level(value);
+            if (!level) {
+                std::cerr << std::format("Unknown log level: {}\n", value);
+                std::exit(1);
+            }
+            config.log_level = *level;
+        } else {
+            std::cerr << std::format("Unknown option: {}\n", key);
+            std::exit(1);
+        }
+    }
+    return config;
+}
 
-auto main() -> int {
+auto main(int argc, const char **argv) -> int {
+    const auto config = parse_options(argc, argv);
     std::cout <<
         R"(choose an demo to run:
     1. send a mail to students in SJTU
@@ -45,7 +145,7 @@ your choice:
         }
     } else if (x == 2) {
         std::cout << "running proxy on localhost:4321\n";
-        run_proxy("127.0.0.1", 4321);
+        run_proxy("127.0.0.1", 4321, config);
     }
     std::cout << "bye\n";
     return 0;
@@ -1,121 +1,843 @@
+#include "affinity.h"
 #include "errors.h"
+#include "hw1/admission.h"
 #include "hw1/cache.h"
 #include "hw1/forward.h"
+#include "hw1/governor.h"
 #include "hw1/html.h"
-#include "select.h"
+#include "hw1/proxy_metrics.h"
+#include "hw1/refresh.h"
+#include "hw1/relay.h"
+#include "hw1/takeover.h"
+#include "logger.h"
+#include "perf.h"
+#include "poller.h"
+#include "pool.h"
 #include "socket.h"
+#include "trace.h"
+#include "unix.h"
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <csignal>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <format>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <netinet/in.h>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
-#include <sys/select.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include <thread>
+#include <unistd.h>
 #include <utility>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
 
 static std::atomic_size_t counter{};
 
-static auto forward_data(dark::Socket &client, dark::Socket &target) -> std::string {
-    auto buffer = std::string(4096, '\0');
-    auto reply  = std::string{};
-    try {
-        while (true) {
-            auto result = dark::select({client, target}, nullptr, nullptr).unwrap();
-            static_assert(sizeof(result) == sizeof(fd_set));
-            if (result.reads.contains(client)) {
-                client.recv(buffer).unwrap();
-                if (buffer.size() == 0)
-                    break;
-                target.send(buffer).unwrap();
-            }
-            if (result.reads.contains(target)) {
-                target.recv(buffer).unwrap();
-                if (buffer.size() == 0)
-                    break;
-                client.send(buffer).unwrap();
-                reply += buffer;
-            }
+static std::mutex trace_mutex;
+static std::ofstream trace_file;
+
+// Record a cacheable request for offline replay, see src/sim
+static auto trace_request(std::string_view host, std::size_t size) -> void {
+    std::unique_lock lock{trace_mutex};
+    if (trace_file.is_open())
+        trace_file << std::format("{} {}\n", host, size);
+}
+
+static std::atomic_size_t active{}; // connections being served by this process
+
+// Woken up when a connection ends, if connections wait for that to be served
+static dark::Poller *accept_poller{};
+static std::atomic_size_t admitted{};
+static std::atomic_size_t rejected{}; // queued past their deadline
+
+static auto release() -> void {
+    active -= 1;
+    if (accept_poller != nullptr)
+        accept_poller->wake();
+}
+
+// Hardware events per stage, counted with `perf` on
+static bool perf_on{};
+static dark::PerfTotals perf_relay;  // handling the events of a relay
+static dark::PerfTotals perf_lookup; // looking up the cache, on the CPU pool
+static dark::PerfTotals perf_store;  // compressing and storing a reply
+
+static const std::pair<std::string_view, dark::PerfTotals *> perf_stages[] = {
+    {"relay", &perf_relay},
+    {"lookup", &perf_lookup},
+    {"store", &perf_store},
+};
+
+// Count the events of this thread into `totals` until it ends, with `perf` on.
+static auto perf_scope(dark::PerfTotals &totals) -> dark::PerfScope {
+    return dark::PerfScope{perf_on ? &totals : nullptr};
+}
+
+// When a connection was accepted, and when its request head was read; the
+// id of its trace if sampled, else 0.
+struct Timing {
+    Clock::time_point accepted;
+    Clock::time_point received;
+    std::uint64_t trace;
+};
+
+// The end of a connection that got as far as its request.
+static auto finish(const Timing &timing) -> void {
+    const auto now = Clock::now();
+    proxy_metrics().total_time.observe(now - timing.accepted);
+    dark::tracer().record("request", timing.trace, timing.accepted, now);
+    release();
+}
+
+// Started by `serve`, in the process that serves: threads don't survive fork
+static std::vector<std::unique_ptr<Relay>> relays;
+static std::vector<int> relay_cpus;  // where each relay runs, -1 if anywhere
+static std::vector<int> relay_nodes; // ... on which NUMA node
+static std::vector<int> cpu_nodes;   // the NUMA node of each CPU, if relays are pinned
+static std::atomic_size_t next_relay{};
+static std::chrono::steady_clock::time_point relays_started;
+
+// Connections by where their packets arrived, relative to their relay
+static std::atomic_size_t same_cpu{};
+static std::atomic_size_t same_node{};
+static std::atomic_size_t cross_node{};
+
+static auto start_relays(const ProxyConfig &config) -> void {
+    const auto relay_config = RelayConfig{
+        .high_watermark  = config.relay_buffer,
+        .low_watermark   = config.relay_buffer / 4,
+        .header_timeout  = config.header_timeout,
+        .connect_timeout = config.connect_timeout,
+        .idle_timeout    = config.idle_timeout,
+        .lifetime        = config.max_lifetime,
+        .quantum         = config.relay_quantum,
+        .bulk_after      = config.bulk_after,
+        .governor        = &memory_governor,
+        .busy_poll       = config.busy_poll,
+        .connect_time    = &proxy_metrics().connect_time,
+        .tracer          = &dark::tracer(),
+        .queue_time      = config.timestamps ? &proxy_metrics().queue_time : nullptr,
+        .tcp_info        = config.tcp_info,
+        .perf            = config.perf ? &perf_relay : nullptr,
+    };
+    relays_started = Clock::now();
+    while (relays.size() < std::max<std::size_t>(config.relay_threads, 1)) {
+        auto pinned = relay_config;
+        if (!config.cpus.empty())
+            pinned.cpu = config.cpus[relays.size() % config.cpus.size()];
+        relay_cpus.push_back(pinned.cpu);
+        relay_nodes.push_back(pinned.cpu < 0 ? -1 : dark::numa_node(pinned.cpu));
+        relays.push_back(std::make_unique<Relay>(pinned));
+    }
+    // Read from /sys once, not for each connection
+    if (relay_cpus.front() >= 0 && cpu_nodes.empty()) {
+        const auto count = std::max<long>(::sysconf(_SC_NPROCESSORS_CONF), 1);
+        for (auto cpu = 0; cpu < count; ++cpu)
+            cpu_nodes.push_back(dark::numa_node(cpu));
+    }
+}
+
+// CPU-bound work, off the relay threads and without a thread each
+static std::unique_ptr<dark::ThreadPool> cpu_pool;
+// Resolving hosts, which blocks, on a bounded number of threads
+static std::unique_ptr<dark::ThreadPool> resolver_pool;
+
+// The relay on the CPU the packets of the client arrive on, or else on its
+// NUMA node, or else the next one.
+static auto pick_relay(const dark::Socket &client) -> Relay & {
+    const auto start = next_relay++;
+    if (relay_cpus.front() < 0)
+        return *relays[start % relays.size()];
+    const auto cpu = client.incoming_cpu().value_or(-1);
+    if (cpu < 0 || static_cast<std::size_t>(cpu) >= cpu_nodes.size())
+        return *relays[start % relays.size()];
+    const auto node = cpu_nodes[cpu];
+    auto nearby     = std::optional<std::size_t>{};
+    for (std::size_t k = 0; k < relays.size(); ++k) {
+        const auto i = (start + k) % relays.size();
+        if (relay_cpus[i] == cpu) {
+            same_cpu += 1;
+            return *relays[i];
         }
-    } catch (const std::exception &) {}
+        if (!nearby && relay_nodes[i] == node)
+            nearby = i;
+    }
+    if (nearby) {
+        same_node += 1;
+        return *relays[*nearby];
+    }
+    cross_node += 1;
+    return *relays[start % relays.size()];
+}
+
+static auto print_affinity_stats() -> void {
+    if (relay_cpus.empty() || relay_cpus.front() < 0)
+        return;
+    const auto seconds = std::chrono::duration<double>(Clock::now() - relays_started);
+    for (std::size_t i = 0; i < relays.size(); ++i) {
+        const auto relayed = static_cast<double>(relays[i]->stats().relayed);
+        std::cout << std::format(
+            "Relay {} on CPU {} (node {}): {:.2f} MB/s\n", i, relay_cpus[i], relay_nodes[i],
+            relayed / seconds.count() / 1e6
+        );
+    }
+    const auto total = same_cpu.load() + same_node.load() + cross_node.load();
+    std::cout << std::format(
+        "Affinity: {} connections on their incoming CPU, {} on its node, {} across nodes "
+        "({:.1f}% cross-node)\n",
+        same_cpu.load(), same_node.load(), cross_node.load(),
+        total == 0 ? 0.0 : 100.0 * static_cast<double>(cross_node.load()) / total
+    );
+}
+
+static auto print_relay_stats() -> void {
+    auto total = RelayStats{};
+    for (const auto &relay : relays) {
+        const auto stats = relay->stats();
+        total.open += stats.open;
+        total.relayed += stats.relayed;
+        total.paused += stats.paused;
+        total.failures += stats.failures;
+        total.timeouts += stats.timeouts;
+        total.deferred += stats.deferred;
+    }
+    std::cout << std::format(
+        "Relay: {} open, {} bytes relayed, {} reads paused, {} deferred, "
+        "{} failed ({} timed out)\n",
+        total.open, total.relayed, total.paused, total.deferred, total.failures, total.timeouts
+    );
+}
 
-    return reply;
+static auto print_memory_stats() -> void {
+    const auto stats = memory_governor.stats();
+    std::cout << std::format(
+        "Memory: {} bytes held, {} at peak, budget {}, pressure {}; entered throttle {} times, "
+        "uncache {}, shed {}; {} replies not cached, {} connections shed\n",
+        stats.held, stats.peak, stats.budget, pressure_name(stats.pressure),
+        stats.entered[static_cast<std::size_t>(Pressure::throttle)],
+        stats.entered[static_cast<std::size_t>(Pressure::uncache)],
+        stats.entered[static_cast<std::size_t>(Pressure::shed)], stats.uncached, stats.shed
+    );
 }
 
-static auto make_connection_impl(dark::Socket client) -> void {
+// The url of a GET of an http url, the requests the cache may answer, or
+// empty for the others.
+static auto cacheable_url(const std::string &message) -> std::string {
+    const auto method = parse_http(message, "", " ");
+    auto host         = std::string{parse_http(message, " ", " ")};
+    if (method != "GET" || !host.starts_with("http://"))
+        return {};
+    return host;
+}
+
+// Serve a GET of `host` from the cache, if it is there, posting the response
+// back to `relay`. On the CPU pool: a lookup may decompress a gzip-encoded
+// blob, or wait on the lock of the shared cache.
+static auto serve_cached(
+    Relay &relay, dark::Socket &client, const std::string &host, const std::string &message,
+    const Timing &timing
+) -> bool {
+    auto lookup = perf_scope(perf_lookup);
+    auto cached = look_up_cache(host, accepts_encoding(message, "gzip"));
+    lookup.stop();
+    if (!cached) {
+        proxy_metrics().cache_misses.add();
+        return false;
+    }
+
     const auto uid = counter++;
-    std::cout << std::format("[{}] New connection\n", uid);
+    dark::tracer().record("parse", timing.trace, timing.received, Clock::now());
+    dark::log_info("[{}] Cache hit{} for {}", uid, cached->stale ? " (stale)" : "", host);
+    proxy_metrics().cache_hits.add();
+    trace_request(host, cached->response.size());
+    if (cached->stale) {
+        proxy_metrics().cache_stale.add();
+        refresh_in_background(host, std::move(cached->request));
+    }
+    relay.respond(
+        std::move(client), std::move(cached->response), [timing](std::string) { finish(timing); },
+        timing.trace
+    );
+    return true;
+}
 
-    auto buffer = std::string(4096, '\0');
+// Returns whether the connection went on to `relay`, which then owns it.
+static auto make_connection_impl(
+    Relay &relay, dark::Socket &client, std::string message, const Timing &timing
+) -> bool {
+    const auto uid = counter++;
+    dark::log_info("[{}] New connection", uid);
 
-    // Receive the request from the client
-    const auto message = receive_http(client, buffer);
-    const auto method  = parse_http(message, "", " ");
-    const auto host    = std::string{parse_http(message, " ", " ")};
-    std::cout << std::format("[{}] Connection to {}\n", uid, host);
+    const auto method = parse_http(message, "", " ");
+    const auto host   = std::string{parse_http(message, " ", " ")};
+    dark::log_info("[{}] Connection to {}", uid, host);
+    const auto is_connect = method == "CONNECT";
+
+    const auto parsed    = Clock::now();
     const auto host_info = parse_host(host);
+    dark::tracer().record("parse", timing.trace, timing.received, parsed);
+    dark::tracer().record("resolve", timing.trace, parsed, Clock::now());
     dark::assertion(host_info, "Invalid host: {}", host);
     const auto [addr, is_http] = *host_info;
     const auto is_http_get     = method == "GET" && is_http;
+    const auto &address        = addr.unwrap("Cannot resolve host: {}");
+
+    // A tunnel goes on with what followed its request, the others with the request
+    auto to_target = std::move(message);
+    auto to_client = std::string{};
+    if (is_connect) {
+        to_target.erase(0, to_target.find("\r\n\r\n") + 4);
+        to_client = "HTTP/1.1 200 OK\r\n\r\n";
+    }
+    const auto request = is_http_get ? to_target : std::string{};
 
-    // if http 'GET' && http request
-    if (is_http_get) {
-        // Check if the response is cached
-        if (auto cached = look_up_cache(host)) {
-            std::cout << std::format("[{}] Cache hit!\n", uid);
-            client.send(*cached).unwrap();
+    // The connection counts as active until its tunnel ends
+    auto done = [=](std::string reply) {
+        if (!is_http_get || reply.empty()) {
+            dark::log_info("[{}] Connection closed", uid);
+            finish(timing);
             return;
         }
+        // Compressing may take a while: not on the relay thread
+        cpu_pool->submit([=, reply = std::move(reply)] mutable {
+            const auto hold = memory_governor.hold(reply.capacity());
+            dark::log_info("[{}] Caching response", uid);
+            trace_request(host, reply.size());
+            const auto start = Clock::now();
+            auto store       = perf_scope(perf_store);
+            // The connection ends either way: a reply not cached is only a miss later
+            try {
+                push_to_cache(host, std::move(reply), request);
+            } catch (const std::exception &e) {
+                dark::log_error("[{}] Cannot cache the response: {}", uid, e.what());
+            }
+            store.stop();
+            dark::tracer().record("cache write", timing.trace, start, Clock::now());
+            dark::log_info("[{}] Connection closed", uid);
+            finish(timing);
+        });
+    };
+    proxy_metrics().setup_time.observe(Clock::now() - timing.received);
+    relay.connect(
+        std::move(client), address, std::move(to_target), std::move(to_client), is_http_get,
+        std::move(done), timing.trace
+    );
+    return true;
+}
+
+static auto
+make_connection(Relay *relay, dark::Socket client, std::string message, Timing timing) -> void {
+    auto relayed = false;
+    try {
+        relayed = make_connection_impl(*relay, client, std::move(message), timing);
+    } catch (const std::exception &e) { dark::log_error("{}", e.what()); }
+    if (!relayed)
+        release();
+}
+
+// Resolving the host may block: not on the relay thread, nor on a thread per
+// connection, which overload would pile up without bound.
+static auto connect_in_background(
+    Relay *relay, dark::Socket client, std::string request, const Timing &timing
+) -> void {
+    auto owned = std::make_shared<dark::Socket>(std::move(client));
+    resolver_pool->submit([=, request = std::move(request)] mutable {
+        make_connection(relay, std::move(*owned), std::move(request), timing);
+    });
+}
+
+// On the thread of `relay`, once the request head is in. An empty request
+// means the client went away or was too slow to send one. The connection
+// stays on that relay: on that CPU, if pinned.
+static auto on_request(
+    Relay *relay, dark::Socket client, std::string request, Clock::time_point accepted
+) -> void {
+    if (request.empty()) {
+        release();
+        return;
+    }
+    const auto timing = Timing{accepted, Clock::now(), dark::tracer().sample()};
+    proxy_metrics().requests.add();
+    proxy_metrics().request_time.observe(timing.received - accepted);
+    dark::tracer().record("accept", timing.trace, accepted, timing.received);
+    // Only the probe of the index runs here: the lookup itself may block
+    auto host = cacheable_url(request);
+    if (!host.empty() && cache_may_hold(host)) {
+        auto owned = std::make_shared<dark::Socket>(std::move(client));
+        cpu_pool->submit([=, host = std::move(host), request = std::move(request)] mutable {
+            if (serve_cached(*relay, *owned, host, request, timing))
+                return;
+            connect_in_background(relay, std::move(*owned), std::move(request), timing);
+        });
+        return;
     }
+    if (!host.empty())
+        proxy_metrics().cache_misses.add();
+    connect_in_background(relay, std::move(client), std::move(request), timing);
+}
 
-    auto target = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
-    target.connect(addr).unwrap();
+static auto receive_request(dark::Socket client) -> void {
+    auto &relay         = pick_relay(client);
+    const auto accepted = Clock::now();
+    relay.receive_request(
+        std::move(client),
+        [&relay, accepted](dark::Socket client, std::string request) {
+            on_request(&relay, std::move(client), std::move(request), accepted);
+        }
+    );
+}
 
-    if (method == "CONNECT") {
-        client.send("HTTP/1.1 200 OK\r\n\r\n").unwrap();
-    } else {
-        target.send(message).unwrap();
+// Counts kept elsewhere, read when scraped. Once per process, as it serves.
+static auto register_metrics() -> void {
+    auto &registry  = dark::metrics();
+    const auto read = [](const std::atomic_size_t &value) {
+        return [&value] { return static_cast<double>(value.load()); };
+    };
+    const auto relay_sum = [](std::size_t RelayStats::*field) {
+        return [field] {
+            auto total = std::size_t{};
+            for (const auto &relay : relays)
+                total += relay->stats().*field;
+            return static_cast<double>(total);
+        };
+    };
+    registry.gauge_fn("proxy_connections_active", "Connections being served", read(active));
+    registry.counter_fn(
+        "proxy_connections_accepted_total", "Connections admitted to be served", read(admitted)
+    );
+    registry.counter_fn(
+        "proxy_connections_rejected_total", "Connections turned away with a 503", read(rejected),
+        "reason=\"deadline\""
+    );
+    registry.counter_fn(
+        "proxy_connections_rejected_total", "Connections turned away with a 503",
+        [] { return static_cast<double>(memory_governor.stats().shed); }, "reason=\"memory\""
+    );
+    registry.counter_fn(
+        "proxy_bytes_received_total", "Bytes read by the relays",
+        relay_sum(&RelayStats::from_clients), "from=\"client\""
+    );
+    registry.counter_fn(
+        "proxy_bytes_received_total", "Bytes read by the relays",
+        relay_sum(&RelayStats::from_targets), "from=\"target\""
+    );
+    registry.counter_fn(
+        "proxy_bytes_sent_total", "Bytes written by the relays", relay_sum(&RelayStats::relayed)
+    );
+    registry.gauge_fn(
+        "proxy_relay_open", "Connections on the relays", relay_sum(&RelayStats::open)
+    );
+    registry.counter_fn(
+        "proxy_relay_failures_total", "Connections closed by an error or a timeout",
+        relay_sum(&RelayStats::failures)
+    );
+    registry.gauge_fn("proxy_cache_hit_ratio", "Cache hits over cacheable GETs", [] {
+        const auto hits   = static_cast<double>(proxy_metrics().cache_hits.value());
+        const auto misses = static_cast<double>(proxy_metrics().cache_misses.value());
+        return hits + misses == 0 ? 0 : hits / (hits + misses);
+    });
+    registry.gauge_fn("proxy_cache_entries", "Urls in the cache", [] {
+        return static_cast<double>(cache_stats().entries);
+    });
+    registry.gauge_fn("proxy_cache_stored_bytes", "Bytes stored by the cache", [] {
+        return static_cast<double>(cache_stats().stored_bytes);
+    });
+    const auto refreshes = std::array<std::pair<const char *, std::size_t RefreshStats::*>, 3>{{
+        {"refreshed", &RefreshStats::refreshed},
+        {"blocked", &RefreshStats::blocked},
+        {"failed", &RefreshStats::failed},
+    }};
+    for (const auto &[result, field] : refreshes) {
+        registry.counter_fn(
+            "proxy_cache_refreshes_total", "Background refreshes of stale entries, by result",
+            [field] { return static_cast<double>(refresh_stats().*field); },
+            std::format("result=\"{}\"", result)
+        );
     }
+    registry.gauge_fn("proxy_memory_held_bytes", "Bytes held in connection buffers", [] {
+        return static_cast<double>(memory_governor.stats().held);
+    });
+    registry.gauge_fn(
+        "proxy_memory_pressure", "Pressure level: 0 normal, 1 throttle, 2 uncache, 3 shed",
+        [] { return static_cast<double>(memory_governor.pressure()); }
+    );
+    for (const auto level : {Pressure::throttle, Pressure::uncache, Pressure::shed}) {
+        registry.counter_fn(
+            "proxy_memory_pressure_entered_total", "Times each pressure level was entered",
+            [level] {
+                const auto stats = memory_governor.stats();
+                return static_cast<double>(stats.entered[static_cast<std::size_t>(level)]);
+            },
+            std::format("level=\"{}\"", pressure_name(level))
+        );
+    }
+    registry.counter_fn(
+        "proxy_memory_uncached_total", "Replies not cached because of the pressure",
+        [] { return static_cast<double>(memory_governor.stats().uncached); }
+    );
+    registry.counter_fn("proxy_log_dropped_total", "Log messages dropped on a full ring", [] {
+        return static_cast<double>(dark::logger().dropped());
+    });
+}
 
-    auto reply = forward_data(client, target);
-    if (is_http_get) {
-        std::cout << std::format("[{}] Caching response\n", uid);
-        push_to_cache(host, std::move(reply));
+// Per stage, the events this process can count. With `perf` on only.
+static auto register_perf_metrics() -> void {
+    auto &registry       = dark::metrics();
+    const auto &counters = dark::thread_perf();
+    for (const auto &[stage, totals] : perf_stages) {
+        for (std::size_t i = 0; i < dark::perf_events; ++i) {
+            if (!counters.has(static_cast<dark::PerfEvent>(i)))
+                continue;
+            registry.counter_fn(
+                "proxy_perf_events_total", "CPU and kernel events counted in each stage",
+                [totals, i] { return static_cast<double>(totals->load().values[i]); },
+                std::format("stage=\"{}\",event=\"{}\"", stage, dark::perf_event_names[i])
+            );
+        }
     }
-    std::cout << std::format("[{}] Connection closed\n", uid);
 }
 
-static auto make_connection(dark::Socket client) -> void {
-    try {
-        make_connection_impl(std::move(client));
-    } catch (const std::exception &e) { std::cerr << "Error: " << e.what() << '\n'; }
+static auto print_pool_stats() -> void {
+    const auto stats = cpu_pool->stats();
+    std::cout << std::format(
+        "CPU pool: {} threads, {} tasks run, {} stolen\n", cpu_pool->size(), stats.executed,
+        stats.stolen
+    );
+}
+
+static auto print_admission_stats() -> void {
+    std::cout << std::format(
+        "Admission: {} connections admitted, {} rejected past their deadline\n", admitted.load(),
+        rejected.load()
+    );
+}
+
+// What this thread, and so likely every thread, can count.
+static auto print_perf_support() -> void {
+    const auto &counters = dark::thread_perf();
+    auto counted         = std::string{};
+    for (std::size_t i = 0; i < dark::perf_events; ++i)
+        if (counters.has(static_cast<dark::PerfEvent>(i)))
+            counted += std::format("{}{}", counted.empty() ? "" : ", ", dark::perf_event_names[i]);
+    std::cout << std::format(
+        "Perf: counting {}{}{}\n", counted.empty() ? "nothing" : counted,
+        counters.user_only() ? " in user space" : "",
+        counters.error() == 0 ? "" : std::format(" (others: {})", std::strerror(counters.error()))
+    );
 }
 
-inline auto interrupt_handler(int) -> void {
+static auto print_perf_stats() -> void {
+    if (!perf_on)
+        return;
+    for (const auto &[stage, totals] : perf_stages) {
+        using dark::PerfEvent;
+        const auto counts = totals->load();
+        std::cout << std::format(
+            "Perf {}: {} cycles, IPC {:.2f}, {} cache misses, {} branch misses, "
+            "{} context switches\n",
+            stage, counts[PerfEvent::cycles], counts.ipc(), counts[PerfEvent::cache_misses],
+            counts[PerfEvent::branch_misses], counts[PerfEvent::context_switches]
+        );
+    }
+}
+
+static auto print_log_stats() -> void {
+    std::cout << std::format("Log: {} messages dropped\n", dark::logger().dropped());
+}
+
+static std::atomic<bool> interrupted{};
+static dark::Socket *interrupt_wake{}; // the other end of the stop socket of `serve`
+
+// Async-signal-safe only: tell `serve` to return, the main thread does the rest.
+static auto interrupt_handler(int) -> void {
+    const auto saved = errno;
+    interrupted      = true;
+    static_cast<void>(interrupt_wake->send("stop"));
+    errno = saved;
+}
+
+// Once interrupted, on the main thread: save the cache and print the summaries.
+static auto shut_down() -> void {
+    dark::logger().flush();
     std::cout << "\nProxy server is shutting down\n";
     save_cache_to_file();
-    std::exit(0);
+    print_cache_stats();
+    print_refresh_stats();
+    print_relay_stats();
+    print_memory_stats();
+    print_admission_stats();
+    print_pool_stats();
+    print_affinity_stats();
+    print_perf_stats();
+    print_log_stats();
 }
 
-auto run_proxy(std::string_view ip, std::uint16_t port) -> void {
-    static_cast<void>(std::signal(SIGINT, interrupt_handler));
-    load_cache_from_file();
-
+static auto make_server(
+    std::string_view ip, std::uint16_t port, const ProxyConfig &config, bool reuse_port
+) -> dark::Socket {
     auto server = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
-
     server.set_opt(server.opt_reuse).unwrap();
+    if (reuse_port)
+        server.set_opt(server.opt_reuseport).unwrap();
+    // Inherited by the connections it accepts
+    if (config.timestamps)
+        server.set_opt(server.opt_recv_timestamping).unwrap();
     server.bind(dark::Address{ip, port}).unwrap();
-    server.listen(10).unwrap();
+    server.listen(config.backlog).unwrap();
+    return server;
+}
+
+static constexpr auto shed_response = std::string_view{
+    "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Length: 0\r\n"
+    "Connection: close\r\n\r\n"
+};
+
+// Turn a connection away cheaply, before reading anything from it.
+static auto reject(dark::Socket client) -> void {
+    static_cast<void>(client.send(shed_response));
+}
+
+// Accept connections until `stop` is readable. The listening socket is
+// nonblocking: other processes sharing it may take a connection first.
+// Accepted connections queue for one of `max_connections` slots; the socket
+// is no longer read while the queue is full, leaving the rest to the backlog.
+static auto serve(dark::Socket &server, dark::Socket &stop, const ProxyConfig &config) -> void {
+    if (!config.trace_log.empty())
+        trace_file.open(config.trace_log, std::ios::app);
+    start_refresher({config.refresh_workers, config.refresh_interval, config.idle_timeout});
+    memory_governor.set_budget(config.memory_budget);
+    perf_on = config.perf;
+    start_relays(config);
+    cpu_pool      = std::make_unique<dark::ThreadPool>(config.cpu_threads);
+    resolver_pool = std::make_unique<dark::ThreadPool>(config.resolver_threads);
+    dark::logger().set_level(config.log_level);
+    dark::tracer().set_sampling(config.trace_sample);
+    register_metrics();
+    if (config.perf) {
+        print_perf_support();
+        register_perf_metrics();
+    }
+    if (config.admin_port != 0)
+        start_admin("127.0.0.1", config.admin_port);
 
+    // Lives as long as the process: connections may end after `serve` returns
+    static auto poller = dark::Poller::create().unwrap();
+    if (config.max_connections != 0)
+        accept_poller = &poller;
+
+    const auto capacity = std::max<std::size_t>(config.accept_queue, 1);
+    auto queue = AdmissionQueue<dark::Socket>{capacity, config.queue_timeout, config.lifo};
     std::cout << "Proxy is ready to serve.\n";
-    while (auto conn = server.accept()) {
-        std::cout << "Proxy connection accepted\n";
-        std::thread{make_connection, std::move(conn.unwrap().first)}.detach();
+    accept_until_stopped(
+        poller, server, stop, queue,
+        [](dark::Socket &client) {
+            // Out of memory for one more: say so before reading anything
+            if (memory_governor.pressure() < Pressure::shed)
+                return false;
+            memory_governor.count_shed();
+            reject(std::move(client));
+            return true;
+        },
+        [limit = config.max_connections] { return limit == 0 || active.load() < limit; },
+        [](dark::Socket client) {
+            dark::log_info("Proxy connection accepted");
+            active += 1;
+            admitted += 1;
+            receive_request(std::move(client));
+        },
+        [](dark::Socket late) {
+            rejected += 1;
+            reject(std::move(late));
+        }
+    );
+    // Accepted already: served while draining, past the limit if need be
+    while (queue.size() != 0)
+        if (auto client = queue.pop(Clock::now(), reject)) {
+            active += 1;
+            admitted += 1;
+            receive_request(std::move(*client));
+        }
+}
+
+// Wait for the connections in flight to complete, for at most `timeout`.
+static auto drain(std::chrono::seconds timeout) -> void {
+    const auto deadline = Clock::now() + timeout;
+    std::cout << std::format("Draining {} connections\n", active.load());
+    while (active.load() != 0 && Clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+}
+
+static std::atomic<bool> stopping{};
+static std::atomic<bool> handed_over{};
+
+// Threads don't survive fork: the worker starts its own, and never returns.
+// With CPUs given, worker `index` and all its threads run on one of them.
+static auto spawn_worker(
+    std::size_t index, dark::Socket &server, dark::Socket &stop, const ProxyConfig &config
+) -> pid_t {
+    const auto pid = ::fork();
+    if (pid != 0)
+        return pid;
+    static_cast<void>(std::signal(SIGINT, SIG_DFL));
+    static_cast<void>(std::signal(SIGTERM, SIG_DFL));
+    auto local = config;
+    if (config.admin_port != 0)
+        local.admin_port = static_cast<std::uint16_t>(config.admin_port + index);
+    if (!config.cpus.empty()) {
+        local.cpus = {config.cpus[index % config.cpus.size()]};
+        if (!dark::pin_thread(local.cpus.front()))
+            std::cerr << std::format("Worker {}: cannot run on CPU {}\n", index, local.cpus[0]);
+    }
+    serve(server, stop, local);
+    drain(config.drain_timeout);
+    std::_Exit(0);
+}
+
+// Keep `config.workers` workers alive until interrupted or handed over. The
+// cache lives in shared memory and the listening sockets in this process, so
+// a worker dying loses neither the cache nor the connections waiting to be
+// accepted. Returns whether a successor took over.
+static auto run_workers(
+    std::vector<dark::Socket> &servers, std::optional<Handoff> handoff, const ProxyConfig &config
+) -> bool {
+    using Clock = std::chrono::steady_clock;
+    struct sigaction action {};
+    action.sa_handler = [](int) { stopping = true; };
+    // Without SA_RESTART, so that waitpid returns when interrupted
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+
+    // Writing to the second socket of a pair tells its worker to drain and exit
+    auto stops = std::vector<std::pair<dark::Socket, dark::Socket>>{};
+    while (stops.size() < config.workers)
+        stops.push_back(dark::UnixSocket::pair().unwrap());
+
+    auto workers = std::vector<pid_t>(config.workers);
+    auto started = std::vector<Clock::time_point>(config.workers);
+    const auto spawn = [&](std::size_t i) {
+        workers[i] = spawn_worker(i, servers[i % servers.size()], stops[i].first, config);
+        started[i] = Clock::now();
+    };
+    for (std::size_t i = 0; i < workers.size(); ++i)
+        spawn(i);
+    std::cout << std::format("Started {} workers\n", workers.size());
+
+    if (handoff)
+        confirm_takeover(std::move(*handoff));
+    if (!config.control_path.empty())
+        serve_takeover(config.control_path, servers, [&stops] {
+            handed_over = true;
+            stopping    = true;
+            for (auto &[_, wake] : stops)
+                static_cast<void>(wake.send("stop"));
+        });
+
+    while (!stopping) {
+        auto status     = 0;
+        const auto pid  = ::waitpid(-1, &status, 0);
+        const auto iter = std::ranges::find(workers, pid);
+        if (pid <= 0 || iter == workers.end())
+            continue;
+        *iter = 0;
+        if (stopping)
+            break;
+        const auto i = static_cast<std::size_t>(iter - workers.begin());
+        std::cout << std::format("Worker {} (pid {}) died, status {}\n", i, pid, status);
+        // A worker dying right after its start would die again: don't spin
+        if (Clock::now() - started[i] < std::chrono::seconds{1})
+            std::this_thread::sleep_for(std::chrono::seconds{1});
+        spawn(i);
     }
 
+    // Handed over, workers drain by themselves; interrupted, they stop now
+    for (const auto pid : workers)
+        if (pid != 0 && !handed_over)
+            ::kill(pid, SIGTERM);
+    for (const auto pid : workers)
+        if (pid != 0)
+            ::waitpid(pid, nullptr, 0);
+    return handed_over;
+}
+
+auto run_proxy(std::string_view ip, std::uint16_t port, const ProxyConfig &config) -> void {
+    auto handoff = std::optional<Handoff>{};
+    if (!config.control_path.empty())
+        handoff = request_takeover(config.control_path);
+
+    const auto prefork  = config.workers != 0;
+    const auto cache_fd = handoff ? handoff->cache_fd : -1;
+    configure_cache({
+        .compress_threshold = config.compress_threshold,
+        .compress_level     = config.compress_level,
+        .stale_window       = config.stale_window,
+        .capacity           = config.cache_capacity,
+        .shared_size        = prefork ? config.shared_cache_size : 0,
+        .shared_fd          = prefork ? cache_fd : -1,
+    });
+    // Before forking, so that every worker sees the loaded cache
+    if (cache_fd < 0)
+        load_cache_from_file();
+    else if (!prefork)
+        import_shared_cache(SharedCache::attach(cache_fd).unwrap());
+
+    auto servers = std::vector<dark::Socket>{};
+    if (handoff)
+        servers = std::move(handoff->servers);
+    else
+        servers.push_back(make_server(ip, port, config, prefork && config.reuse_port));
+    while (!handoff && prefork && config.reuse_port && servers.size() < config.workers)
+        servers.push_back(make_server(ip, port, config, true));
+    // Sockets nobody accepts on would hold their connections forever
+    const auto serving = prefork ? config.workers : 1;
+    if (servers.size() > serving)
+        servers.erase(servers.begin() + static_cast<std::ptrdiff_t>(serving), servers.end());
+    // A connection goes to the worker on the CPU its packets arrive on, if
+    // worker i runs on CPU i. Handed over sockets keep the program they had.
+    if (!handoff && servers.size() > 1 && !config.cpus.empty()) {
+        const auto sockets = static_cast<std::uint32_t>(servers.size());
+        if (!servers.front().steer_by_cpu(sockets))
+            std::cerr << "Cannot steer connections by CPU\n";
+    }
+
+    if (prefork) {
+        if (!run_workers(servers, std::move(handoff), config)) {
+            std::cout << "\nProxy server is shutting down\n";
+            save_cache_to_file();
+            print_cache_stats();
+        }
+        return;
+    }
+
+    auto [stop, wake] = dark::UnixSocket::pair().unwrap();
+    if (handoff)
+        confirm_takeover(std::move(*handoff));
+    if (!config.control_path.empty())
+        serve_takeover(config.control_path, servers, [&wake] {
+            static_cast<void>(wake.send("stop"));
+        });
+    interrupt_wake = &wake;
+    static_cast<void>(std::signal(SIGINT, interrupt_handler));
+    serve(servers.front(), stop, config);
+    if (interrupted) {
+        // Connections in flight are cut short, not drained
+        shut_down();
+        std::exit(0);
+    }
+    drain(config.drain_timeout);
+    dark::logger().flush();
     std::cout << "Proxy server is shutting down\n";
 }
@@ -0,0 +1,167 @@
+#include "hw1/refresh.h"
+#include "hw1/cache.h"
+#include "hw1/html.h"
+#include "logger.h"
+#include "socket.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+struct RefreshJob {
+    std::string url;
+    std::string request;
+};
+
+struct Refresher {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<RefreshJob> jobs;
+    std::unordered_set<std::string> pending; // urls queued or being refreshed
+    std::unordered_map<std::string, CacheClock::time_point> last_refresh; // origin -> time
+    std::size_t prune_at = 64; // size of `last_refresh` to drop those out of the window at
+    RefreshConfig config;
+
+    std::atomic_size_t stale_served{};
+    std::atomic_size_t refreshed{};
+    std::atomic_size_t blocked{};
+    std::atomic_size_t failed{};
+};
+
+// Never destroyed: detached workers wait on it until the process is gone
+static auto refresher() -> Refresher & {
+    static auto &instance = *new Refresher{};
+    return instance;
+}
+
+// "http://host/path" -> "host", the unit of rate limiting
+static auto origin_of(std::string_view url) -> std::string_view {
+    url.remove_prefix(std::min(url.find("://") + 3, url.size()));
+    return url.substr(0, url.find('/'));
+}
+
+// Headers about the connection the request came on, not for the origin.
+static constexpr std::string_view hop_by_hop[] = {
+    "Connection: ", "Proxy-Connection: ", "Keep-Alive: ", "Proxy-Authorization: ",
+    "TE: ",         "Trailer: ",          "Upgrade: ",    "Transfer-Encoding: ",
+};
+
+// Fetch a fresh response from the origin. The request is replayed with
+// "Connection: close", so the response ends when the origin closes, or
+// fails once the origin stays silent for the timeout.
+static auto fetch(const RefreshJob &job, std::chrono::milliseconds timeout) -> std::string {
+    const auto host_info = parse_host(job.url);
+    dark::assertion(host_info.has_value(), "Invalid host: {}", job.url);
+    const auto addr = host_info->first;
+
+    const auto pos = job.request.find("\r\n\r\n");
+    dark::assertion(pos != std::string::npos, "Invalid request for {}", job.url);
+    auto request = job.request.substr(0, pos + 4);
+    for (const auto key : hop_by_hop)
+        erase_http_header(request, key);
+    set_http_header(request, "Connection: ", "close");
+
+    auto target = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+    target.set_timeout(timeout).unwrap();
+    target.connect(addr).unwrap();
+    target.send(request).unwrap();
+
+    auto buffer   = std::string(4096, '\0');
+    auto response = std::string{};
+    while (target.recv(buffer).unwrap() != 0)
+        response += buffer;
+    return response;
+}
+
+static auto work() -> void {
+    auto &self = refresher();
+    while (true) {
+        auto lock = std::unique_lock{self.mutex};
+        self.ready.wait(lock, [&] { return !self.jobs.empty(); });
+        auto job = std::move(self.jobs.front());
+        self.jobs.pop_front();
+        lock.unlock();
+
+        try {
+            auto response     = fetch(job, self.config.timeout);
+            const auto status = parse_http(response, " ", " ");
+            dark::assertion(status.starts_with('2'), "origin replied {}", status);
+            push_to_cache(job.url, std::move(response), job.request);
+            self.refreshed += 1;
+        } catch (const std::exception &e) {
+            dark::log_warn("Refresh of {} failed: {}", job.url, e.what());
+            self.failed += 1;
+        }
+
+        lock.lock();
+        self.pending.erase(job.url);
+    }
+}
+
+auto start_refresher(const RefreshConfig &config) -> void {
+    auto &self  = refresher();
+    self.config = config;
+    for (std::size_t i = 0; i < config.workers; ++i)
+        std::thread{work}.detach();
+}
+
+// Called on each stale hit. At most one refresh per url is in flight, and
+// refreshes of the same origin are spaced by at least `origin_interval`.
+auto refresh_in_background(std::string url, std::string request) -> void {
+    auto &self = refresher();
+    self.stale_served += 1;
+    if (request.empty() || self.config.workers == 0)
+        return; // Nothing to replay, e.g. recovered from disk
+
+    const auto now = CacheClock::now();
+    auto lock      = std::unique_lock{self.mutex};
+    if (self.pending.contains(url))
+        return;
+
+    // Origins last refreshed before the window limit nothing: dropped now and
+    // then, the map stays about as large as the origins refreshed within it
+    if (self.last_refresh.size() >= self.prune_at) {
+        std::erase_if(self.last_refresh, [&](const auto &entry) {
+            return now - entry.second >= self.config.origin_interval;
+        });
+        self.prune_at = std::max<std::size_t>(64, self.last_refresh.size() * 2);
+    }
+
+    auto [iter, is_new] = self.last_refresh.try_emplace(std::string{origin_of(url)}, now);
+    if (!is_new) {
+        if (now - iter->second < self.config.origin_interval) {
+            self.blocked += 1;
+            return;
+        }
+        iter->second = now;
+    }
+
+    self.pending.insert(url);
+    self.jobs.push_back({std::move(url), std::move(request)});
+    self.ready.notify_one();
+}
+
+auto refresh_stats() -> RefreshStats {
+    auto &self = refresher();
+    return {self.stale_served, self.refreshed, self.blocked, self.failed};
+}
+
+auto print_refresh_stats() -> void {
+    const auto stats = refresh_stats();
+    std::cout << std::format(
+        "Refresh: {} stale hits served, {} refreshed, {} blocked, {} failed\n",
+        stats.stale_served, stats.refreshed, stats.blocked, stats.failed
+    );
+}
@@ -0,0 +1,90 @@
+#include "hw1/takeover.h"
+#include "hw1/cache.h"
+#include "socket.h"
+#include "unix.h"
+#include <cstddef>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// The predecessor sends "handoff <sockets> <cache>" along with the listening
+// sockets, then the memfd of the shared cache if <cache> is 1. Otherwise it
+// has saved its cache to disk first. The successor answers "ready" once serving.
+static constexpr std::string_view ready_message = "ready";
+
+static auto hand_over(dark::UnixSocket peer, std::span<dark::Socket> servers) -> bool {
+    auto fds = std::vector<int>{};
+    for (const auto &server : servers)
+        fds.push_back(dark::UnixSocket::handle_of(server));
+    if (cache_shared)
+        fds.push_back(cache_shared->fd());
+    else
+        save_cache_to_file();
+
+    const auto message = std::format("handoff {} {}", servers.size(), cache_shared ? 1 : 0);
+    if (!peer.send(message, fds))
+        return false;
+    // A successor failing to start closes the connection without confirming
+    auto reply = std::string(16, '\0');
+    auto none  = std::vector<int>{};
+    return peer.recv(reply, none) && reply == ready_message;
+}
+
+auto request_takeover(const std::string &path) -> std::optional<Handoff> {
+    auto peer = dark::UnixSocket::connect(path);
+    if (!peer)
+        return {};
+
+    auto socket  = peer.unwrap();
+    auto message = std::string(256, '\0');
+    auto fds     = std::vector<int>{};
+    auto word    = std::string{};
+    auto count   = std::size_t{};
+    auto cache   = std::size_t{};
+    if (!socket.recv(message, fds) || !(std::istringstream{message} >> word >> count >> cache) ||
+        word != "handoff" || cache > 1 || fds.size() != count + cache) {
+        std::cerr << std::format("Takeover: bad handoff from {}\n", path);
+        for (const auto fd : fds)
+            ::close(fd);
+        return {};
+    }
+
+    auto handoff = Handoff{{}, cache != 0 ? fds.back() : -1, std::move(socket)};
+    for (std::size_t i = 0; i < count; ++i)
+        handoff.servers.push_back(dark::UnixSocket::adopt(fds[i]));
+    std::cout << std::format(
+        "Took over {} listening sockets{} from {}\n", count, cache ? " and the cache" : "", path
+    );
+    return handoff;
+}
+
+auto confirm_takeover(Handoff handoff) -> void {
+    static_cast<void>(handoff.peer.send(ready_message));
+}
+
+auto serve_takeover(
+    const std::string &path, std::span<dark::Socket> servers, std::function<void()> on_handed_over
+) -> void {
+    auto listener = dark::UnixSocket::listen(path);
+    if (!listener) {
+        std::cerr << std::format("Takeover: cannot listen on {}\n", path);
+        return;
+    }
+    std::thread{[listener = listener.unwrap(), servers, on_handed_over]() mutable {
+        while (auto peer = listener.accept()) {
+            if (hand_over(peer.unwrap(), servers)) {
+                std::cout << "Handed over to a new process\n";
+                return on_handed_over();
+            }
+        }
+    }}.detach();
+}
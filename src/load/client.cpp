@@ -0,0 +1,198 @@
+// The load generator: requests through the proxy, each on a connection of its
+// own, as the proxy serves one request per connection. Each thread runs an
+// event loop over the requests it has in flight.
+#include "load.h"
+#include "optional.h"
+#include "poller.h"
+#include "socket.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+static constexpr std::size_t max_in_flight = 10000; // per thread, in an open loop
+static constexpr std::string_view status_ok  = "HTTP/1.1 200";
+
+struct Call {
+    dark::Socket socket;
+    std::string request;
+    std::size_t sent{};
+    std::string status;     // the first bytes received
+    std::size_t received{}; // bytes, headers included
+    Clock::time_point due;  // when it was to start, for its latency
+    bool connected{};
+};
+
+// One thread's requests: which object each asks for, and how.
+struct Requests {
+    const LoadConfig &config;
+    std::uint16_t origin_port;
+    std::size_t index;
+    std::size_t next{};
+
+    auto make() -> std::string {
+        const auto sequence = next++;
+        const auto host     = std::format("127.0.0.1:{}", origin_port);
+        constexpr auto get  = "GET http://{}{} HTTP/1.1\r\nHost: {}\r\n\r\n";
+        switch (config.scenario) {
+            case Scenario::hit: {
+                const auto path = object_path(sequence % config.objects, config.size, true);
+                return std::format(get, host, path, host);
+            }
+            case Scenario::miss: {
+                // Unique across threads and runs of the same origin
+                const auto id   = ((index + 1) << 40) | sequence;
+                const auto path = object_path(id, config.size, false);
+                return std::format(get, host, path, host);
+            }
+            case Scenario::connect: {
+                // The GET goes along: the proxy passes on what follows the CONNECT head
+                const auto path = object_path(sequence, config.size, false);
+                return std::format(
+                    "CONNECT {} HTTP/1.1\r\nHost: {}\r\n\r\nGET {} HTTP/1.1\r\nHost: {}\r\n\r\n",
+                    host, host, path, host
+                );
+            }
+            default: return {};
+        }
+    }
+};
+
+// Whether a call that got to its end got what it asked for: a 200 with the
+// whole body (the proxy answers a CONNECT with a 200 of its own first).
+static auto succeeded(const Call &call, const LoadConfig &config) -> bool {
+    return call.status.starts_with(status_ok) && call.received > config.size;
+}
+
+auto run_load(
+    const LoadConfig &config, const sockaddr_in &proxy, std::uint16_t origin_port,
+    std::size_t index, Clock::time_point start
+) -> LoadResult {
+    const auto measured = start + config.warmup;
+    const auto end      = measured + config.duration;
+    const auto share    = [&](std::size_t total) {
+        return total / config.threads + (index < total % config.threads);
+    };
+    const auto connections = share(config.connections);
+    const auto rate        = share(config.rate);
+    const auto per_second  = static_cast<Clock::rep>(std::max<std::size_t>(rate, 1));
+    const auto interval    = Clock::duration{1s} / per_second; // open loop
+
+    auto result   = LoadResult{};
+    auto requests = Requests{config, origin_port, index};
+    auto poller   = dark::Poller::create().unwrap();
+    auto calls    = std::unordered_map<Call *, std::unique_ptr<Call>>{};
+    auto buffer   = std::string(65536, '\0');
+
+    const auto finish = [&](Call &call, bool ok) {
+        static_cast<void>(poller.remove(call.socket));
+        if (call.due >= measured && call.due < end) {
+            if (ok) {
+                const auto latency = std::chrono::nanoseconds{Clock::now() - call.due};
+                result.latency.record(static_cast<std::uint64_t>(latency.count()));
+                result.completed += 1;
+                result.bytes += call.received;
+            } else {
+                result.failed += 1;
+            }
+        }
+        calls.erase(&call);
+    };
+    const auto launch = [&](Clock::time_point due) {
+        auto call     = std::make_unique<Call>();
+        call->socket  = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+        call->request = requests.make();
+        call->due     = due;
+        auto &ref     = *calls.emplace(call.get(), std::move(call)).first->second;
+        if (!ref.socket.set_nonblocking())
+            return finish(ref, false);
+        if (!ref.socket.connect(proxy) && errno != EINPROGRESS)
+            return finish(ref, false);
+        if (!poller.add(ref.socket, dark::Interest::WRITE, &ref))
+            return finish(ref, false);
+    };
+    // Writable: connected, and room for the request. Readable: the response.
+    const auto handle = [&](Call &call, const dark::PollEvent &event) {
+        if (!call.connected) {
+            if (!call.socket.connect_result())
+                return finish(call, false);
+            call.connected = true;
+        }
+        if (call.sent < call.request.size()) {
+            if (!event.writable())
+                return;
+            const auto sent = call.socket.send(std::string_view{call.request}.substr(call.sent));
+            if (!sent)
+                return errno == EAGAIN ? void() : finish(call, false);
+            call.sent += sent.value_or(0);
+            if (call.sent == call.request.size()
+                && !poller.modify(call.socket, dark::Interest::READ, &call))
+                finish(call, false);
+            return;
+        }
+        while (true) {
+            const auto got = call.socket.recv(std::span{buffer});
+            if (!got)
+                return errno == EAGAIN ? void() : finish(call, false);
+            const auto size = got.value_or(0);
+            if (size == 0)
+                return finish(call, succeeded(call, config));
+            if (call.status.size() < status_ok.size())
+                call.status.append(buffer.data(), std::min(size, status_ok.size()));
+            call.received += size;
+        }
+    };
+
+    auto events    = std::array<dark::PollEvent, 64>{};
+    auto next_due  = start;
+    auto last_scan = start;
+    if (rate == 0)
+        for (std::size_t i = 0; i < connections; ++i)
+            launch(start);
+    while (true) {
+        auto now = Clock::now();
+        if (rate != 0) {
+            // Everything due by now starts now, however late
+            for (; next_due <= now && next_due < end; next_due += interval)
+                if (calls.size() < max_in_flight)
+                    launch(next_due);
+                else if (next_due >= measured)
+                    result.failed += 1;
+        }
+        if (now >= end && calls.empty())
+            break;
+        if (now - last_scan >= 10ms) {
+            for (auto it = calls.begin(); it != calls.end();) {
+                auto &call = *(it++)->second; // finish() erases it
+                if (now - call.due > config.timeout)
+                    finish(call, false);
+            }
+            last_scan = now;
+        }
+
+        auto timeout = std::chrono::milliseconds{10};
+        if (rate != 0 && next_due < end && next_due > now)
+            timeout = std::chrono::ceil<std::chrono::milliseconds>(next_due - now);
+        const auto ready = poller.wait(events, timeout);
+        for (const auto &event : std::span{events.data(), ready.value_or(0)}) {
+            const auto count = calls.size();
+            handle(*static_cast<Call *>(event.data), event);
+            // Closed loop: a request done is followed by the next
+            if (rate == 0 && calls.size() < count && Clock::now() < end)
+                launch(Clock::now());
+        }
+    }
+    return result;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "histogram.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <netinet/in.h>
+#include <string>
+#include <string_view>
+
+enum class Scenario : std::uint8_t {
+    hit,     // GETs of a few cacheable objects, fetched once beforehand
+    miss,    // GETs of objects never asked for before, not to be stored
+    connect, // GETs through a CONNECT tunnel
+};
+
+struct LoadConfig {
+    Scenario scenario = Scenario::hit;
+
+    // The proxy to load, or none to run one in this process on `proxy_port`
+    std::string proxy;
+    std::uint16_t proxy_port = 4322;
+
+    std::size_t size    = 16384; // bytes of body per object
+    std::size_t objects = 100;   // distinct objects of the hit scenario
+
+    // Closed loop: each of `connections` requests in flight is followed by
+    // the next once done. Open loop: `rate` requests per second are started
+    // on schedule, done or not, and their latency counts from when they were
+    // due, so that a stall is not hidden by the requests it held back.
+    std::size_t connections = 16;
+    std::size_t rate        = 0; // 0 for a closed loop
+    std::size_t threads     = 1;
+
+    // Only requests started in the `duration` after the `warmup` count; a
+    // request taking longer than `timeout` fails.
+    std::chrono::seconds warmup{1};
+    std::chrono::seconds duration{10};
+    std::chrono::seconds timeout{5};
+};
+
+// What the load generator saw, per thread or in total.
+struct LoadResult {
+    dark::Histogram<> latency; // nanoseconds
+    std::size_t completed{};
+    std::size_t failed{};
+    std::size_t bytes{}; // received
+
+    auto merge(const LoadResult &other) -> void {
+        latency.merge(other.latency);
+        completed += other.completed;
+        failed += other.failed;
+        bytes += other.bytes;
+    }
+};
+
+// Serve objects on 127.0.0.1 from a thread of its own, for the rest of the
+// process. Returns the port.
+auto start_origin() -> std::uint16_t;
+
+// Requests the origin served so far.
+auto origin_served() -> std::size_t;
+
+// Path of an object of `size` bytes on the origin.
+auto object_path(std::size_t id, std::size_t size, bool cacheable) -> std::string;
+
+// One thread of load against the proxy at `proxy`, for objects of the origin
+// on `origin_port`. `index` tells the threads' objects apart.
+auto run_load(
+    const LoadConfig &config, const sockaddr_in &proxy, std::uint16_t origin_port,
+    std::size_t index, std::chrono::steady_clock::time_point start
+) -> LoadResult;
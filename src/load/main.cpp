@@ -0,0 +1,180 @@
+// HTTP load generator for the proxy, with an origin of its own:
+//
+//   load hit|miss|connect [--key value]...
+//
+// Without --proxy, the proxy runs in this process, its output silenced, so
+// that a scenario needs nothing else on the box. Latencies are reported as
+// percentiles of a histogram in microseconds.
+#include "address.h"
+#include "hw1/forward.h"
+#include "load.h"
+#include "socket.h"
+#include "utility.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+static auto usage(const char *name) -> int {
+    std::cerr << std::format(
+        "Usage: {} hit|miss|connect [--key value]...\n"
+        "  --proxy host:port   (none: run one here, on --proxy-port 4322)\n"
+        "  --size 16384        --objects 100     (bytes per object, objects to hit)\n"
+        "  --connections 16    --rate 0          (closed loop, or requests/s open loop)\n"
+        "  --threads 1         --duration 10     --warmup 1      --timeout 5 (s)\n",
+        name
+    );
+    return 1;
+}
+
+static auto parse_options(int argc, const char **argv) -> std::optional<LoadConfig> {
+    auto config   = LoadConfig{};
+    const auto to = [](std::string_view value) { return dark::str_to_int_nocheck<int>(value); };
+    const auto scenario = std::string_view{argv[0]};
+    if (scenario == "hit")
+        config.scenario = Scenario::hit;
+    else if (scenario == "miss")
+        config.scenario = Scenario::miss;
+    else if (scenario == "connect")
+        config.scenario = Scenario::connect;
+    else
+        return std::nullopt;
+    for (int i = 1; i < argc; i += 2) {
+        const auto key   = std::string_view{argv[i]};
+        const auto value = std::string_view{i + 1 < argc ? argv[i + 1] : ""};
+        if (key == "--proxy") {
+            config.proxy = value;
+        } else if (key == "--proxy-port") {
+            config.proxy_port = dark::str_to_int_nocheck<std::uint16_t>(value);
+        } else if (key == "--size") {
+            config.size = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--objects") {
+            config.objects = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--connections") {
+            config.connections = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--rate") {
+            config.rate = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--threads") {
+            config.threads = dark::str_to_int_nocheck<std::size_t>(value);
+        } else if (key == "--duration") {
+            config.duration = std::chrono::seconds{to(value)};
+        } else if (key == "--warmup") {
+            config.warmup = std::chrono::seconds{to(value)};
+        } else if (key == "--timeout") {
+            config.timeout = std::chrono::seconds{to(value)};
+        } else {
+            std::cerr << std::format("Unknown option: {}\n", key);
+            return std::nullopt;
+        }
+    }
+    if (config.threads == 0 || config.objects == 0 || (config.rate == 0 && config.connections == 0))
+        return std::nullopt;
+    return config;
+}
+
+// Wait for something to listen at `address`, for a while.
+static auto wait_for(const sockaddr_in &address) -> bool {
+    for (auto deadline = Clock::now() + 5s; Clock::now() < deadline;) {
+        auto probe = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+        if (probe.connect(address))
+            return true;
+        std::this_thread::sleep_for(10ms);
+    }
+    return false;
+}
+
+static auto report(
+    std::ostream &out, const LoadConfig &config, const LoadResult &result, std::size_t origin
+) -> void {
+    constexpr std::string_view names[] = {"hit", "miss", "connect"};
+    const auto loop = config.rate == 0
+                        ? std::format("closed loop, {} connections", config.connections)
+                        : std::format("open loop, {} requests/s", config.rate);
+    const auto seconds = std::chrono::duration<double>(config.duration).count();
+    out << std::format(
+        "{}: {}, {}-byte objects, {}s after {}s of warmup\n",
+        names[static_cast<std::size_t>(config.scenario)], loop, config.size,
+        config.duration.count(), config.warmup.count()
+    );
+    out << std::format(
+        "requests: {} done ({:.1f}/s), {} failed, {:.1f} MB/s; {} reached the origin\n",
+        result.completed, static_cast<double>(result.completed) / seconds, result.failed,
+        static_cast<double>(result.bytes) / 1e6 / seconds, origin
+    );
+    const auto us = [&](double percent) { return result.latency.percentile(percent) / 1000; };
+    out << std::format(
+        "latency (us): p50 {}, p90 {}, p99 {}, p99.9 {}, max {}\n", us(50), us(90), us(99),
+        us(99.9), result.latency.max() / 1000
+    );
+}
+
+auto main(int argc, const char **argv) -> int {
+    const auto parsed = argc < 2 ? std::nullopt : parse_options(argc - 1, argv + 1);
+    if (!parsed)
+        return usage(argv[0]);
+    const auto &config = *parsed;
+
+    auto out         = std::ostream{std::cout.rdbuf()};
+    const auto local = config.proxy.empty();
+    auto proxy       = dark::Address{"127.0.0.1", config.proxy_port};
+    if (!local) {
+        const auto colon = config.proxy.rfind(':');
+        const auto host  = std::string_view{config.proxy}.substr(0, colon);
+        const auto port  = std::string_view{config.proxy}.substr(colon + 1);
+        proxy            = dark::Address{host, dark::str_to_int_nocheck<std::uint16_t>(port)};
+    } else {
+        // It logs every connection: not in the way of the report
+        std::cout.rdbuf(nullptr);
+        std::thread{[port = config.proxy_port] { run_proxy("127.0.0.1", port, {}); }}.detach();
+    }
+    if (!wait_for(proxy)) {
+        std::cerr << "No proxy to load\n";
+        std::_Exit(1);
+    }
+
+    const auto origin_port = start_origin();
+    if (config.scenario == Scenario::hit) {
+        // Each object once, for the cache; caching is done in the background
+        auto prime        = config;
+        prime.threads     = 1;
+        prime.rate        = 0;
+        prime.connections = config.objects;
+        prime.warmup      = 0s;
+        prime.duration    = 0s;
+        static_cast<void>(run_load(prime, proxy, origin_port, 0, Clock::now()));
+    }
+
+    const auto start   = Clock::now() + 10ms;
+    auto results       = std::vector<LoadResult>(config.threads);
+    auto threads       = std::vector<std::thread>{};
+    auto origin_before = std::size_t{};
+    for (std::size_t i = 0; i < config.threads; ++i)
+        threads.emplace_back([&, i] {
+            results[i] = run_load(config, proxy, origin_port, i, start);
+        });
+    std::this_thread::sleep_until(start + config.warmup);
+    origin_before = origin_served();
+    std::this_thread::sleep_until(start + config.warmup + config.duration);
+    const auto origin = origin_served() - origin_before;
+    for (auto &thread : threads)
+        thread.join();
+
+    auto total = LoadResult{};
+    for (const auto &result : results)
+        total.merge(result);
+    report(out, config, total, origin);
+    out.flush();
+    // The proxy and the origin run on: not to be torn down under them
+    std::_Exit(total.completed == 0 ? 1 : 0);
+}
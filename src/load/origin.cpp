@@ -0,0 +1,149 @@
+// A stand-in for the origin servers behind the proxy: every path names the
+// size of its body and whether it may be cached, so that a run needs nothing
+// but this process. One response per connection, closed once sent.
+#include "address.h"
+#include "load.h"
+#include "poller.h"
+#include "socket.h"
+#include "utility.h"
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+static std::atomic_size_t served{};
+
+struct Connection {
+    dark::Socket socket;
+    std::string request;
+    std::string response;
+    std::size_t sent{};
+};
+
+auto object_path(std::size_t id, std::size_t size, bool cacheable) -> std::string {
+    return std::format("/object/{}?size={}&cache={}", id, size, cacheable ? 1 : 0);
+}
+
+auto origin_served() -> std::size_t {
+    return served.load(std::memory_order_relaxed);
+}
+
+// Value of `key=` in a query, empty if none.
+static auto query_value(std::string_view target, std::string_view key) -> std::string_view {
+    const auto query = target.substr(std::min(target.find('?'), target.size()));
+    for (auto at = query.find(key); at != query.npos; at = query.find(key, at + 1)) {
+        if (query[at - 1] != '?' && query[at - 1] != '&')
+            continue;
+        const auto value = query.substr(at + key.size());
+        return value.substr(0, value.find('&'));
+    }
+    return {};
+}
+
+// The response to a request head, as asked for by its path.
+static auto make_response(std::string_view request) -> std::string {
+    // "GET http://host:port/object/..." from a proxy, "GET /object/..." through a tunnel
+    auto target = request.substr(0, request.find("\r\n"));
+    target      = target.substr(std::min(target.find(' '), target.size() - 1) + 1);
+    target      = target.substr(0, target.find(' '));
+    if (target.starts_with("http://"))
+        target = target.substr(std::min(target.find('/', 7), target.size()));
+    if (!target.starts_with("/object/"))
+        return "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+    const auto size    = dark::str_to_int_nocheck<std::size_t>(query_value(target, "size="));
+    const auto control = query_value(target, "cache=") == "1" ? "max-age=3600" : "no-store";
+    auto response      = std::format(
+        "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: {}\r\n"
+        "Cache-Control: {}\r\nConnection: close\r\n\r\n",
+        size, control
+    );
+    response.resize(response.size() + size, 'o');
+    return response;
+}
+
+// Sends what it can of the response; true once all of it is sent, or the
+// connection failed.
+static auto flush(Connection &connection) -> bool {
+    while (connection.sent < connection.response.size()) {
+        const auto rest = std::string_view{connection.response}.substr(connection.sent);
+        const auto sent = connection.socket.send(rest);
+        if (!sent)
+            return errno != EAGAIN;
+        connection.sent += sent.value_or(0);
+    }
+    return true;
+}
+
+static auto serve(dark::Socket listener) -> void {
+    auto poller = dark::Poller::create().unwrap();
+    poller.add(listener, dark::Interest::READ, &listener).unwrap();
+    auto open   = std::unordered_map<Connection *, std::unique_ptr<Connection>>{};
+    auto events = std::array<dark::PollEvent, 64>{};
+    auto buffer = std::string(65536, '\0');
+    const auto close = [&](Connection &connection) {
+        static_cast<void>(poller.remove(connection.socket));
+        open.erase(&connection);
+    };
+    while (true) {
+        const auto ready = poller.wait(events);
+        for (const auto &event : std::span{events.data(), ready.value_or(0)}) {
+            if (event.data == &listener) {
+                while (auto accepted = listener.accept()) {
+                    auto connection = std::make_unique<Connection>(accepted.unwrap().first);
+                    auto *pointer   = connection.get();
+                    if (!connection->socket.set_nonblocking())
+                        continue;
+                    poller.add(connection->socket, dark::Interest::READ, pointer).unwrap();
+                    open.emplace(pointer, std::move(connection));
+                }
+                continue;
+            }
+            auto &connection = *static_cast<Connection *>(event.data);
+            if (!connection.response.empty()) {
+                if (flush(connection))
+                    close(connection);
+                continue;
+            }
+            const auto got = connection.socket.recv(std::span{buffer});
+            if (!got) {
+                if (errno != EAGAIN)
+                    close(connection);
+                continue;
+            }
+            if (got.value_or(0) == 0) {
+                close(connection); // Gone before asking for anything
+                continue;
+            }
+            connection.request.append(buffer.data(), got.value_or(0));
+            if (connection.request.find("\r\n\r\n") == std::string::npos)
+                continue;
+            served.fetch_add(1, std::memory_order_relaxed);
+            connection.response = make_response(connection.request);
+            if (flush(connection))
+                close(connection);
+            else
+                poller.modify(connection.socket, dark::Interest::WRITE, &connection).unwrap();
+        }
+    }
+}
+
+auto start_origin() -> std::uint16_t {
+    auto listener = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+    listener.bind(dark::Address{"127.0.0.1", 0}).unwrap();
+    listener.listen(1024).unwrap();
+    listener.set_nonblocking().unwrap();
+    const auto port = dark::network_to_host(listener.local_address().unwrap().sin_port);
+    std::thread{serve, std::move(listener)}.detach();
+    return port;
+}
@@ -0,0 +1,96 @@
+// Replay a request log recorded by the proxy (--trace-log) against cache
+// policies of different sizes, to pick a capacity without touching production.
+// Each line of the log is "url size", as seen by the proxy.
+#include "hw1/policy.h"
+#include "utility.h"
+#include <cstddef>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+struct Request {
+    std::string url;
+    std::size_t size;
+};
+
+struct SimResult {
+    std::size_t hits;
+    std::size_t hit_bytes;
+};
+
+// "64M" -> 64 * 2^20, accepting K, M and G suffixes
+static auto parse_size(std::string_view str) -> std::size_t {
+    auto shift = 0;
+    switch (str.empty() ? '\0' : str.back()) {
+        case 'K': shift = 10; break;
+        case 'M': shift = 20; break;
+        case 'G': shift = 30; break;
+        default:  break;
+    }
+    if (shift != 0)
+        str.remove_suffix(1);
+    return dark::str_to_int_nocheck<std::size_t>(str) << shift;
+}
+
+// Same protocol as the proxy cache: a hit records an access, a miss asks the
+// policy to admit the response.
+template <typename _Policy>
+static auto replay(_Policy policy, const std::vector<Request> &trace) -> SimResult {
+    auto result = SimResult{0, 0};
+    for (const auto &[url, size] : trace) {
+        if (policy.contains(url)) {
+            policy.access(url);
+            result.hits += 1;
+            result.hit_bytes += size;
+        } else {
+            static_cast<void>(policy.admit(url, size));
+        }
+    }
+    return result;
+}
+
+auto main(int argc, const char **argv) -> int {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <trace> <capacity>...\n";
+        return 1;
+    }
+
+    auto trace       = std::vector<Request>{};
+    auto total_bytes = std::size_t{};
+    auto file        = std::ifstream{argv[1]};
+    for (std::string line; std::getline(file, line);) {
+        auto request = Request{};
+        if (std::istringstream{line} >> request.url >> request.size) {
+            total_bytes += request.size;
+            trace.push_back(std::move(request));
+        }
+    }
+    if (trace.empty()) {
+        std::cerr << std::format("No request in {}\n", argv[1]);
+        return 1;
+    }
+
+    std::cout << std::format("{} requests, {} bytes\n", trace.size(), total_bytes);
+    std::cout << std::format(
+        "{:<12}{:>14}{:>12}{:>16}\n", "policy", "capacity", "hit ratio", "byte hit ratio"
+    );
+    const auto print = [&](std::string_view name, std::size_t capacity, SimResult result) {
+        std::cout << std::format(
+            "{:<12}{:>14}{:>12.4f}{:>16.4f}\n", name, capacity,
+            static_cast<double>(result.hits) / trace.size(),
+            static_cast<double>(result.hit_bytes) / total_bytes
+        );
+    };
+    const auto average_size = total_bytes / trace.size();
+    for (int i = 2; i < argc; ++i) {
+        const auto capacity = parse_size(argv[i]);
+        print("lru", capacity, replay(LruPolicy{capacity}, trace));
+        print("w-tinylfu", capacity, replay(WTinyLfuPolicy{capacity, average_size}, trace));
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "address.h"
+#include "errors.h"
+#include "hw1/admission.h"
+#include "poller.h"
+#include "socket.h"
+#include "unit_test.h"
+#include "unix.h"
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+static auto test() -> void {
+    using dark::assertion;
+    using namespace std::chrono_literals;
+    using Clock = AdmissionQueue<int>::Clock;
+
+    const auto start = Clock::time_point{};
+    auto late        = std::vector<int>{};
+    const auto drop  = [&](int item) { late.push_back(item); };
+
+    // FIFO: in order of arrival, those past their deadline turned away first
+    auto fifo = AdmissionQueue<int>{3, 100ms, false};
+    for (int i = 0; i < 3; ++i)
+        fifo.push(i, start + std::chrono::milliseconds{i * 40});
+    assertion(fifo.full(), "{} queued of 3", fifo.size());
+    assertion(fifo.next_deadline() == start + 100ms, "wrong deadline");
+    assertion(fifo.pop(start + 110ms, drop) == 1, "oldest in time not first");
+    assertion(late == std::vector{0}, "{} turned away", late.size());
+    assertion(fifo.next_deadline() == start + 180ms, "wrong deadline");
+
+    // LIFO: the newest first, the oldest still turned away once late
+    late.clear();
+    auto lifo = AdmissionQueue<int>{8, 100ms, true};
+    for (int i = 0; i < 4; ++i)
+        lifo.push(i, start + std::chrono::milliseconds{i * 40});
+    assertion(lifo.pop(start + 120ms, drop) == 3, "newest not first");
+    assertion(lifo.pop(start + 120ms, drop) == 2, "newest not first");
+    assertion(late == std::vector{0}, "{} turned away", late.size());
+    assertion(lifo.pop(start + 150ms, drop) == std::nullopt, "late one admitted");
+    assertion(late == std::vector{0, 1}, "{} turned away", late.size());
+
+    // No deadline: nobody is ever late
+    auto patient = AdmissionQueue<int>{1, 0ms, false};
+    patient.push(7, start);
+    assertion(!patient.next_deadline(), "deadline without timeout");
+    assertion(patient.pop(start + 24h, drop) == 7, "turned away without timeout");
+
+    // Serving one slot, held by a long-lived connection: the one queued behind
+    // it is turned away once past its deadline, without spinning meanwhile
+    const auto address = dark::Address{"127.0.0.1", 12397};
+    auto server = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+    assertion(server.set_opt(server.opt_reuse), "set_opt failed");
+    assertion(server.bind(address) && server.listen(4), "cannot listen");
+    auto [stop, wake] = dark::UnixSocket::pair().unwrap();
+    auto poller       = dark::Poller::create().unwrap();
+    auto queue        = AdmissionQueue<dark::Socket>{4, 100ms, false};
+    auto held         = std::vector<dark::Socket>{};
+    auto wakeups      = std::size_t{};
+    auto loop         = std::thread{[&] {
+        accept_until_stopped(
+            poller, server, stop, queue, [](dark::Socket &) { return false; },
+            [&] { return ++wakeups, held.empty(); },
+            [&](dark::Socket client) { held.push_back(std::move(client)); },
+            [](dark::Socket late) { static_cast<void>(late.send("503")); }
+        );
+    }};
+
+    auto first = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+    assertion(first.connect(address), "cannot connect");
+    std::this_thread::sleep_for(20ms);
+    auto second = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+    assertion(second.connect(address) && second.set_nonblocking(), "cannot connect");
+    const auto queued = Clock::now();
+    char buffer[4];
+    auto received = std::size_t{};
+    while (received == 0 && Clock::now() - queued < 1s) {
+        std::this_thread::sleep_for(5ms);
+        received = second.recv(buffer).value_or(0);
+    }
+    const auto waited = Clock::now() - queued;
+    static_cast<void>(wake.send("stop"));
+    loop.join();
+    assertion(received == 3, "queued connection not turned away");
+    assertion(waited >= 90ms && waited < 300ms, "turned away after {}ms", waited / 1ms);
+    assertion(held.size() == 1 && wakeups < 10, "{} served, {} wakeups", held.size(), wakeups);
+}
+
+static auto testcase = Testcase(test);
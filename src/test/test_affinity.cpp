@@ -0,0 +1,39 @@
+#include "address.h"
+#include "affinity.h"
+#include "errors.h"
+#include "socket.h"
+#include "unit_test.h"
+#include <string>
+#include <thread>
+#include <vector>
+
+static auto test() -> void {
+    using dark::assertion;
+
+    const auto cpus = dark::parse_cpu_list("0-2,5,x,7-6,9");
+    assertion(cpus == std::vector<int>{0, 1, 2, 5, 9}, "wrong CPU list");
+    assertion(dark::parse_cpu_list("").empty(), "CPUs from nothing");
+
+    // On a thread of its own, not to pin the tests
+    std::thread{[] {
+        assertion(dark::pin_thread(0).has_value(), "cannot run on CPU 0");
+        assertion(dark::current_cpu() == 0, "not on CPU 0");
+        assertion(dark::numa_node(0) >= 0, "no NUMA node for CPU 0");
+    }}.join();
+
+    // Where the packets of a connection arrive
+    const auto address = dark::Address{"127.0.0.1", 12399};
+    auto server = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+    assertion(server.set_opt(server.opt_reuse), "set_opt failed");
+    assertion(server.bind(address) && server.listen(1), "cannot listen");
+    auto client = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+    assertion(client.connect(address), "cannot connect");
+    auto accepted = server.accept().unwrap().first;
+    assertion(client.send("ping"), "send failed");
+    auto buffer = std::string(4, '\0');
+    assertion(accepted.recv(buffer), "recv failed");
+    const auto cpu = accepted.incoming_cpu();
+    assertion(cpu.value_or(-1) >= 0, "no incoming CPU");
+}
+
+static auto testcase = Testcase(test);
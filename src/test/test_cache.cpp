@@ -0,0 +1,101 @@
+#include "errors.h"
+#include "hw1/cache.h"
+#include "unit_test.h"
+#include <memory>
+#include <string>
+
+static auto test() -> void {
+    using dark::assertion;
+
+    const auto body = std::string(4096, 'x');
+    push_to_cache("http://a.com/x", body);
+    push_to_cache("http://mirror.a.com/x", body);
+    push_to_cache("http://a.com/y", "another body");
+
+    auto stats = cache_stats();
+    assertion(stats.entries == 3, "expected 3 urls, got {}", stats.entries);
+    assertion(stats.blobs == 2, "identical bodies must share a blob, got {}", stats.blobs);
+    assertion(stats.dedup_ratio() > 1.9, "dedup ratio too low: {}", stats.dedup_ratio());
+    assertion(look_up_cache("http://mirror.a.com/x")->response == body, "mirror lookup mismatch");
+
+    // The blob is reclaimed only after the last url referring to it is gone
+    assertion(erase_from_cache("http://a.com/x"), "erase failed");
+    assertion(look_up_cache("http://mirror.a.com/x")->response == body, "blob reclaimed early");
+    assertion(erase_from_cache("http://mirror.a.com/x"), "erase failed");
+    assertion(cache_stats().blobs == 1, "blob not reclaimed");
+    assertion(erase_from_cache("http://a.com/y"), "erase failed");
+    assertion(cache_stats().entries == 0, "cache should be empty");
+
+    // Compressible bodies are stored gzip-encoded and served as-is to gzip clients
+    cache_config.compress_threshold = 1024;
+    const auto header   = std::string{"HTTP/1.1 200 OK\r\nContent-Length: 4096\r\n\r\n"};
+    const auto response = header + body;
+    push_to_cache("http://a.com/z", response);
+    assertion(cache_stats().stored_bytes < response.size() / 4, "response not compressed");
+
+    const auto gzipped = look_up_cache("http://a.com/z", true)->response;
+    assertion(parse_http(gzipped, "Content-Encoding: ") == "gzip", "missing Content-Encoding");
+    const auto length = parse_http(gzipped, "Content-Length: ");
+    const auto size   = gzipped.size() - gzipped.find("\r\n\r\n") - 4;
+    assertion(dark::str_to_int_nocheck<std::size_t>(length) == size, "bad Content-Length");
+    assertion(look_up_cache("http://a.com/z")->response == response, "identity mismatch");
+    assertion(erase_from_cache("http://a.com/z"), "erase failed");
+    cache_config.compress_threshold = 0;
+
+    // Expired entries are hit as stale within their stale-while-revalidate window
+    const auto stale = std::string{"HTTP/1.1 200 OK\r\nCache-Control: max-age=0, "
+                                   "stale-while-revalidate=60\r\nContent-Length: 2\r\n\r\nok"};
+    const auto dead  = std::string{"HTTP/1.1 200 OK\r\nCache-Control: max-age=0\r\n\r\n"};
+    push_to_cache("http://a.com/stale", stale, "GET http://a.com/stale HTTP/1.1\r\n\r\n");
+    push_to_cache("http://a.com/dead", dead);
+    push_to_cache("http://a.com/none", "HTTP/1.1 200 OK\r\nCache-Control: no-store\r\n\r\n");
+    const auto hit = look_up_cache("http://a.com/stale");
+    assertion(hit && hit->stale && hit->request.starts_with("GET"), "stale entry not served");
+    assertion(!look_up_cache("http://a.com/dead"), "expired entry served");
+    assertion(!look_up_cache("http://a.com/none"), "no-store response cached");
+
+    // Refreshing replaces the entry in place
+    push_to_cache("http://a.com/stale", "HTTP/1.1 200 OK\r\n\r\n", hit->request);
+    assertion(!look_up_cache("http://a.com/stale")->stale, "refreshed entry still stale");
+    assertion(cache_stats().blobs == 2, "replaced blob not reclaimed");
+    assertion(erase_from_cache("http://a.com/stale") && erase_from_cache("http://a.com/dead"));
+
+    // Contents whose hashes collide share a bucket, and dedup survives either leaving it
+    push_to_cache("http://a.com/c1", body);
+    auto &[key, bucket] = *cache_blobs.begin();
+    bucket.push_back(std::make_unique<CacheBlob>(CacheBlob{"collision", {}, 9, 1}));
+    const auto *collision = bucket.back().get();
+    for (auto *total : {&cache_totals.logical_bytes, &cache_totals.stored_bytes})
+        *total += collision->data.size();
+    cache_totals.raw_bytes += collision->raw_size;
+    ++cache_totals.blobs;
+    assertion(erase_from_cache("http://a.com/c1"), "erase failed");
+    push_to_cache("http://a.com/c2", body);
+    push_to_cache("http://a.com/c3", body);
+    assertion(cache_stats().blobs == 2, "colliding content not deduplicated");
+    _release_blob(key, collision);
+    push_to_cache("http://a.com/c4", body);
+    assertion(cache_stats().blobs == 1, "dedup lost after a collision left");
+    assertion(look_up_cache("http://a.com/c4")->response == body, "collision lookup mismatch");
+    for (const auto *url : {"http://a.com/c2", "http://a.com/c3", "http://a.com/c4"})
+        assertion(erase_from_cache(url), "erase failed");
+    assertion(cache_blobs.empty(), "bucket not reclaimed");
+    stats = cache_stats();
+    assertion(stats.blobs == 0 && stats.stored_bytes == 0, "running totals not released");
+    assertion(stats.logical_bytes == 0 && stats.raw_bytes == 0, "running totals not released");
+
+    assertion(accepts_encoding("Accept-Encoding: gzip, br\r\n", "gzip"));
+    assertion(accepts_encoding("Accept-Encoding: br;q=1.0, gzip;q=0.5\r\n", "gzip"));
+    assertion(!accepts_encoding("Accept-Encoding: gzip;q=0\r\n", "gzip"));
+    assertion(!accepts_encoding("Accept-Encoding: identity\r\n", "gzip"));
+    assertion(!accepts_encoding("Host: a.com\r\n", "gzip"));
+
+    // Headers are matched at the start of a line only
+    auto request = std::string{"GET / HTTP/1.1\r\nProxy-Connection: keep-alive\r\n\r\n"};
+    set_http_header(request, "Connection: ", "close");
+    assertion(parse_http(request, "Proxy-Connection: ") == "keep-alive", "wrong header set");
+    erase_http_header(request, "Proxy-Connection: ");
+    assertion(request == "GET / HTTP/1.1\r\nConnection: close\r\n\r\n", "bad request {}", request);
+}
+
+static auto testcase = Testcase(test);
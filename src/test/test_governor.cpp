@@ -0,0 +1,51 @@
+#include "errors.h"
+#include "hw1/governor.h"
+#include "unit_test.h"
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+static auto test() -> void {
+    using dark::assertion;
+
+    auto governor = MemoryGovernor{1000};
+    const auto entered = [&](Pressure level) {
+        return governor.stats().entered[static_cast<std::size_t>(level)];
+    };
+
+    // Each level starts at its share of the budget
+    governor.charge(599);
+    assertion(governor.pressure() == Pressure::normal, "{}", pressure_name(governor.pressure()));
+    {
+        const auto hold = governor.hold(1);
+        assertion(governor.pressure() == Pressure::throttle, "not throttled");
+        governor.charge(200);
+        assertion(governor.pressure() == Pressure::uncache, "not uncached");
+        governor.charge(150);
+        assertion(governor.pressure() == Pressure::shed, "not shed");
+        governor.charge(-350);
+    }
+    assertion(governor.pressure() == Pressure::normal, "hold not refunded");
+    assertion(entered(Pressure::throttle) == 1, "throttled {} times", entered(Pressure::throttle));
+    assertion(entered(Pressure::shed) == 1, "entered shed {} times", entered(Pressure::shed));
+    assertion(governor.stats().peak == 950, "peak {}", governor.stats().peak);
+
+    // Charges from many threads add up, and all refunded leave nothing
+    auto threads = std::vector<std::thread>{};
+    for (std::size_t i = 0; i < 8; ++i)
+        threads.emplace_back([&] {
+            for (std::size_t j = 0; j < 10000; ++j)
+                const auto hold = governor.hold(j % 100);
+        });
+    for (auto &thread : threads)
+        thread.join();
+    governor.charge(-599);
+    assertion(governor.stats().held == 0, "{} bytes left", governor.stats().held);
+
+    // Unbounded: never any pressure
+    auto unbounded = MemoryGovernor{};
+    unbounded.charge(std::ptrdiff_t{1} << 40);
+    assertion(unbounded.pressure() == Pressure::normal, "unbounded under pressure");
+}
+
+static auto testcase = Testcase(test);
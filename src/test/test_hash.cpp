@@ -0,0 +1,24 @@
+#include "errors.h"
+#include "hash.h"
+#include "unit_test.h"
+#include <string>
+
+static auto test() -> void {
+    using dark::assertion;
+    using dark::xxhash64;
+
+    // Reference values from the xxHash specification
+    assertion(xxhash64("") == 0xEF46DB3751D8E999ULL, "xxhash64 of empty string");
+    assertion(xxhash64("a") == 0xD24EC4F1A98C6E5BULL, "xxhash64 of 'a'");
+    assertion(xxhash64("abc") == 0x44BC2CF5AD770999ULL, "xxhash64 of 'abc'");
+
+    // Long inputs go through the 32-byte stripe loop and every tail path
+    auto str = std::string(1000, 'x');
+    for (std::size_t i = 0; i < str.size(); ++i)
+        str[i] = static_cast<char>('a' + i % 26);
+    for (std::size_t n = 0; n < 64; ++n)
+        assertion(xxhash64(str.substr(0, 900 + n)) != xxhash64(str.substr(0, 901 + n)));
+    assertion(xxhash64(str, 1) != xxhash64(str, 2), "seed must change the hash");
+}
+
+static auto testcase = Testcase(test);
@@ -0,0 +1,43 @@
+#include "errors.h"
+#include "histogram.h"
+#include "unit_test.h"
+#include <cstdint>
+
+static auto test() -> void {
+    using dark::assertion;
+
+    // Small values are exact
+    auto small = dark::Histogram<>{};
+    for (std::uint64_t i = 1; i <= 100; ++i)
+        small.record(i);
+    assertion(small.percentile(50) == 50, "median {}", small.percentile(50));
+    assertion(small.percentile(99) == 99, "p99 {}", small.percentile(99));
+    assertion(small.percentile(100) == 100, "max {}", small.percentile(100));
+    assertion(small.min() == 1 && small.mean() == 50.5, "min {}", small.min());
+
+    // Large ones within 1%, never above the largest recorded
+    auto large = dark::Histogram<>{};
+    for (std::uint64_t i = 1; i <= 1000000; ++i)
+        large.record(i * 1000);
+    for (const auto percent : {10.0, 50.0, 90.0, 99.0, 99.9}) {
+        const auto expected = static_cast<double>(percent * 1e7);
+        const auto actual   = static_cast<double>(large.percentile(percent));
+        assertion(
+            actual >= expected && actual <= expected * 1.01, "p{} is {}, expected {}", percent,
+            actual, expected
+        );
+    }
+    assertion(large.percentile(100) == 1000000000, "max {}", large.percentile(100));
+
+    // Counts at once, merged, and reset
+    auto other = dark::Histogram<>{};
+    other.record(UINT64_MAX, 3);
+    small.merge(other);
+    assertion(small.count() == 103, "count {}", small.count());
+    assertion(small.max() == UINT64_MAX, "max {}", small.max());
+    assertion(small.percentile(97) == 100, "p97 {}", small.percentile(97));
+    small.reset();
+    assertion(small.count() == 0 && small.percentile(50) == 0, "not reset");
+}
+
+static auto testcase = Testcase(test);
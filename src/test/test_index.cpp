@@ -0,0 +1,69 @@
+#include "epoch.h"
+#include "errors.h"
+#include "hw1/index.h"
+#include "unit_test.h"
+#include <atomic>
+#include <format>
+#include <string>
+#include <thread>
+#include <vector>
+
+static auto test() -> void {
+    using dark::assertion;
+
+    // A retired object outlives the pins taken before its retirement
+    auto domain  = dark::EpochDomain{};
+    auto counter = std::atomic<int>{0};
+    struct Tracked {
+        std::atomic<int> *freed;
+        ~Tracked() {
+            freed->fetch_add(1);
+        }
+    };
+    {
+        auto guard = domain.pin();
+        domain.retire(new Tracked{&counter});
+        domain.collect();
+        assertion(counter.load() == 0, "freed while pinned");
+    }
+    domain.collect();
+    assertion(counter.load() == 1, "not freed after unpin");
+
+    // Readers never see a torn or freed value while writers replace and erase
+    auto index = ShardedIndex<std::string>{domain};
+    for (int i = 0; i < 1000; ++i)
+        static_cast<void>(index.assign(std::format("k{}", i), std::format("v{}", i)));
+    assertion(index.size() == 1000, "expected 1000 keys, got {}", index.size());
+
+    auto stop    = std::atomic<bool>{false};
+    auto errors  = std::atomic<int>{0};
+    auto readers = std::vector<std::jthread>{};
+    for (int t = 0; t < 4; ++t)
+        readers.emplace_back([&] {
+            while (!stop.load()) {
+                for (int i = 0; i < 1000; ++i) {
+                    auto guard        = domain.pin();
+                    const auto *value = index.find(std::format("k{}", i));
+                    if (value != nullptr && !value->starts_with('v'))
+                        errors.fetch_add(1);
+                }
+            }
+        });
+    for (int round = 0; round < 20; ++round)
+        for (int i = round % 2; i < 1000; i += 2) {
+            const auto key = std::format("k{}", i);
+            if (round % 4 == 3)
+                static_cast<void>(index.erase(key));
+            else
+                static_cast<void>(index.assign(key, std::format("v{}-{}", i, round)));
+        }
+    stop.store(true);
+    readers.clear();
+    assertion(errors.load() == 0, "{} bad reads", errors.load());
+
+    auto guard = domain.pin();
+    assertion(*index.find("k0") == "v0-18", "lost update: {}", *index.find("k0"));
+    assertion(index.erase("k0") && index.find("k0") == nullptr, "erase failed");
+}
+
+static auto testcase = Testcase(test);
@@ -0,0 +1,136 @@
+#include "errors.h"
+#include "logger.h"
+#include "unit_test.h"
+#include <cstddef>
+#include <format>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Lines handed to a sink, as one string.
+struct Captured {
+    std::mutex mutex;
+    std::string text;
+
+    auto sink() {
+        return [this](std::string_view lines) {
+            std::unique_lock lock{mutex};
+            text += lines;
+        };
+    }
+    auto take() -> std::string {
+        std::unique_lock lock{mutex};
+        return std::exchange(text, {});
+    }
+};
+
+static auto test() -> void {
+    using dark::assertion;
+    using dark::LogLevel;
+
+    auto captured = Captured{};
+    {
+        auto logger = dark::Logger{{.sink = captured.sink(), .writer = false}};
+        // Strings are copied: theirs may be gone by the time they are written
+        logger.log<LogLevel::info>("[{}] {} to {}", 42, std::string{"Connection"}, "host");
+        logger.log<LogLevel::info>("{} {} {}", 1.5, 'x', 7u);
+        logger.log<LogLevel::warn>("slow");
+        logger.log<LogLevel::error>("{}", std::string_view{"failed"});
+        logger.flush();
+        const auto text = captured.take();
+        assertion(
+            text == "[42] Connection to host\n1.5 x 7\nWarning: slow\nError: failed\n",
+            "got:\n{}", text
+        );
+
+        // Filtered at run time, not counted as dropped; debug is compiled out
+        logger.set_level(LogLevel::warn);
+        logger.log<LogLevel::info>("hidden");
+        logger.log<LogLevel::warn>("shown");
+        logger.set_level(LogLevel::debug);
+        logger.log<LogLevel::debug>("compiled out");
+        logger.flush();
+        assertion(captured.take() == "Warning: shown\n", "level filter");
+        assertion(logger.dropped() == 0, "dropped {}", logger.dropped());
+    }
+
+    // A full ring drops, and takes messages again once written out
+    {
+        auto logger = dark::Logger{{.ring_bytes = 256, .sink = captured.sink(), .writer = false}};
+        for (int i = 0; i < 100; ++i)
+            logger.log<LogLevel::info>("{}", i);
+        logger.flush();
+        const auto lines = captured.take();
+        const auto count = static_cast<std::size_t>(std::ranges::count(lines, '\n'));
+        assertion(lines.starts_with("0\n1\n"), "got:\n{}", lines);
+        assertion(logger.dropped() > 0, "nothing dropped");
+        assertion(count + logger.dropped() == 100, "{} written", count);
+    }
+
+    // Records of all sizes, wrapping around the ring: up to 152 bytes, two fit
+    {
+        auto logger   = dark::Logger{{.ring_bytes = 512, .sink = captured.sink(), .writer = false}};
+        auto expected = std::string{};
+        for (std::size_t i = 0; i < 200; ++i) {
+            const auto word = std::string(i % 97, 'a' + static_cast<char>(i % 26));
+            logger.log<LogLevel::info>("{}:{}", i, word);
+            expected += std::format("{}:{}\n", i, word);
+            if (i % 2 == 0)
+                logger.flush();
+        }
+        logger.flush();
+        assertion(captured.take() == expected, "wrapped records");
+        assertion(logger.dropped() == 0, "dropped {}", logger.dropped());
+    }
+
+    // Many threads, the writer on its own: each keeps its order
+    {
+        auto logger = dark::Logger{{.ring_bytes = 1 << 17, .sink = captured.sink()}};
+        auto threads = std::vector<std::jthread>{};
+        for (int t = 0; t < 4; ++t)
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < 1000; ++i)
+                    logger.log<LogLevel::info>("{} {}", t, i);
+            });
+        threads.clear();
+        // Rings of threads that ended are taken over
+        for (int t = 4; t < 8; ++t)
+            std::jthread{[&, t] { logger.log<LogLevel::info>("{} {}", t, 0); }}.join();
+        logger.flush();
+        assertion(logger.dropped() == 0, "dropped {}", logger.dropped());
+
+        auto next   = std::vector<int>(8);
+        auto stream = std::istringstream{captured.take()};
+        auto thread = int{};
+        auto index  = int{};
+        while (stream >> thread >> index) {
+            assertion(index == next[thread], "thread {}: {} after {}", thread, index, next[thread]);
+            next[thread] += 1;
+        }
+        for (int t = 0; t < 8; ++t)
+            assertion(next[t] == (t < 4 ? 1000 : 1), "thread {}: {} lines", t, next[t]);
+    }
+}
+
+static auto testcase = Testcase(test);
+
+// What a message costs, written out in batches of 1024 as the writer would.
+static auto bench_log = Benchmark("log_info_and_write", [] {
+    static auto logger = dark::Logger{{.sink = [](std::string_view) {}, .writer = false}};
+    static auto calls  = std::size_t{};
+    logger.log<dark::LogLevel::info>("[{}] Connection to {}", calls, "http://127.0.0.1/");
+    if (++calls % 1024 == 0)
+        logger.flush();
+});
+
+static auto bench_filtered = Benchmark("log_info_filtered", [] {
+    static auto logger = [] {
+        auto logger = std::make_unique<dark::Logger>(dark::LoggerConfig{.writer = false});
+        logger->set_level(dark::LogLevel::error);
+        return logger;
+    }();
+    logger->log<dark::LogLevel::info>("[{}] Connection to {}", 1, "http://127.0.0.1/");
+});
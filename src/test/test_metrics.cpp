@@ -0,0 +1,68 @@
+#include "errors.h"
+#include "metrics.h"
+#include "unit_test.h"
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+static auto test() -> void {
+    using dark::assertion;
+    using namespace std::chrono_literals;
+
+    auto registry = dark::MetricsRegistry{};
+    auto &hits    = registry.counter("test_hits_total", "Hits");
+    auto &open    = registry.gauge("test_open", "Open");
+    auto &fast    = registry.histogram("test_seconds", "Stages", "stage=\"fast\"");
+    auto &slow    = registry.histogram("test_seconds", "Stages", "stage=\"slow\"");
+    registry.gauge_fn("test_answer", "Computed when scraped", [] { return 42.0; });
+
+    // Shards add up, whatever thread counted what
+    auto threads = std::vector<std::jthread>{};
+    for (int t = 0; t < 8; ++t)
+        threads.emplace_back([&] {
+            for (int i = 0; i < 10000; ++i) {
+                hits.add();
+                open.add(2);
+                open.sub();
+                fast.observe(20us);
+            }
+        });
+    threads.clear();
+    slow.observe(2s);
+    assertion(hits.value() == 80000, "hits {}", hits.value());
+    assertion(open.value() == 80000, "open {}", open.value());
+    assertion(fast.snapshot().count == 80000, "observed {}", fast.snapshot().count);
+    assertion(fast.snapshot().sum == 80000 * 20000, "sum {}", fast.snapshot().sum);
+
+    const auto text     = registry.render();
+    const auto contains = [&](std::string_view line) {
+        assertion(text.find(line) != std::string::npos, "no \"{}\" in:\n{}", line, text);
+    };
+    contains("# TYPE test_hits_total counter\ntest_hits_total 80000\n");
+    contains("# TYPE test_open gauge\ntest_open 80000\n");
+    contains("test_answer 42\n");
+    // 20us lies in a bucket that ends past 20us, but well before 25us
+    contains("test_seconds_bucket{stage=\"fast\",le=\"1e-05\"} 0\n");
+    contains("test_seconds_bucket{stage=\"fast\",le=\"2.5e-05\"} 80000\n");
+    contains("test_seconds_bucket{stage=\"slow\",le=\"1\"} 0\n");
+    contains("test_seconds_bucket{stage=\"slow\",le=\"2.5\"} 1\n");
+    contains("test_seconds_bucket{stage=\"slow\",le=\"+Inf\"} 1\n");
+    contains("test_seconds_count{stage=\"slow\"} 1\n");
+    contains("test_seconds_sum{stage=\"slow\"} 2\n");
+    // One HELP per name, the labelled samples after it
+    assertion(text.find("# HELP test_seconds") == text.rfind("# HELP test_seconds"), "two HELP");
+}
+
+static auto testcase = Testcase(test);
+
+static auto bench_counter = Benchmark("counter_add", [] {
+    static auto &counter = dark::metrics().counter("bench_counter_total", "Benchmark");
+    counter.add();
+});
+
+static auto bench_histogram = Benchmark("latency_histogram_observe", [] {
+    static auto &histogram = dark::metrics().histogram("bench_seconds", "Benchmark");
+    histogram.observe(std::chrono::microseconds{150});
+});
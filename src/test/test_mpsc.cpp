@@ -0,0 +1,44 @@
+#include "errors.h"
+#include "mpsc.h"
+#include "unit_test.h"
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+static auto test() -> void {
+    using dark::assertion;
+
+    // Every item comes out once, in the order of its producer
+    constexpr auto producers = std::size_t{4};
+    constexpr auto items     = std::size_t{100000};
+    auto queue   = dark::MpscQueue<std::size_t>{};
+    auto threads = std::vector<std::thread>{};
+    for (std::size_t p = 0; p < producers; ++p)
+        threads.emplace_back([&, p] {
+            for (std::size_t i = 0; i < items; ++i)
+                queue.push(p * items + i);
+        });
+    auto next     = std::vector<std::size_t>(producers);
+    auto received = std::size_t{};
+    while (received < producers * items) {
+        const auto item = queue.pop();
+        if (!item)
+            continue;
+        const auto p = *item / items;
+        assertion(*item % items == next[p], "producer {} out of order at {}", p, next[p]);
+        ++next[p];
+        ++received;
+    }
+    for (auto &thread : threads)
+        thread.join();
+    assertion(!queue.pop(), "more items than pushed");
+
+    // What is left is freed with the queue
+    auto owned = dark::MpscQueue<std::unique_ptr<int>>{};
+    owned.push(std::make_unique<int>(1));
+    owned.push(std::make_unique<int>(2));
+    assertion(**owned.pop() == 1, "wrong item");
+}
+
+static auto testcase = Testcase(test);
@@ -0,0 +1,64 @@
+#include "errors.h"
+#include "microbench.h"
+#include "perf.h"
+#include "unit_test.h"
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+static auto test() -> void {
+    using dark::assertion;
+    using dark::PerfEvent;
+    using namespace std::chrono_literals;
+
+    auto counts   = dark::PerfCounts{};
+    counts.values = {2000, 3000, 7, 5, 1};
+    assertion(counts.ipc() == 1.5, "IPC {}", counts.ipc());
+    assertion((counts - counts).ipc() == 0, "IPC without cycles");
+
+    // Whatever this machine lets us count, on a thread of its own: it counts
+    // only the thread that made it
+    std::jthread{[] {
+        const auto &counters = dark::thread_perf();
+        const auto before    = counters.read();
+        auto sum             = std::uint64_t{};
+        for (std::uint64_t i = 0; i < 1000000; ++i)
+            dark::do_not_optimize(sum += i);
+        for (int i = 0; i < 3; ++i)
+            std::this_thread::sleep_for(1ms);
+        const auto counted = counters.read() - before;
+        if (!counters.available()) {
+            assertion(counted.values == dark::PerfCounts{}.values, "counted nothing");
+            return;
+        }
+        if (counters.has(PerfEvent::instructions))
+            assertion(counted[PerfEvent::instructions] >= 1000000, "too few instructions");
+        if (counters.has(PerfEvent::context_switches))
+            assertion(counted[PerfEvent::context_switches] >= 3, "slept without switching");
+        if (!counters.has(PerfEvent::cycles))
+            assertion(counters.error() != 0, "cycles not counted, for no reason");
+    }}.join();
+
+    // Scopes add up to where they stop; none without totals
+    auto totals   = dark::PerfTotals{};
+    auto switches = std::uint64_t{};
+    std::jthread{[&] {
+        {
+            auto none    = dark::PerfScope{nullptr};
+            auto counted = dark::PerfScope{&totals};
+            std::this_thread::sleep_for(1ms);
+        }
+        switches     = totals.load()[PerfEvent::context_switches];
+        auto stopped = dark::PerfScope{&totals};
+        stopped.stop();
+        for (int i = 0; i < 3; ++i)
+            std::this_thread::sleep_for(1ms);
+    }}.join();
+    if (dark::thread_perf().has(PerfEvent::context_switches)) {
+        const auto after = totals.load()[PerfEvent::context_switches];
+        assertion(switches >= 1, "slept without switching");
+        assertion(after - switches < 3, "counted past the stop");
+    }
+}
+
+static auto testcase = Testcase(test);
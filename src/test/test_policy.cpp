@@ -0,0 +1,62 @@
+#include "errors.h"
+#include "hw1/policy.h"
+#include "unit_test.h"
+#include <cstddef>
+#include <format>
+#include <string>
+#include <vector>
+
+static auto test() -> void {
+    using dark::assertion;
+
+    // A hot set of 50 keys, then a scan of 1000 one-hit wonders
+    constexpr auto capacity = std::size_t{100 * 100};
+    auto lru                = LruPolicy{capacity};
+    auto tinylfu            = WTinyLfuPolicy{capacity, 100};
+    for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < 50; ++i) {
+            const auto key = std::format("hot-{}", i);
+            if (lru.contains(key))
+                lru.access(key);
+            else
+                static_cast<void>(lru.admit(key, 100));
+            if (tinylfu.contains(key))
+                tinylfu.access(key);
+            else
+                static_cast<void>(tinylfu.admit(key, 100));
+        }
+    }
+    for (int i = 0; i < 1000; ++i) {
+        const auto key = std::format("scan-{}", i);
+        static_cast<void>(lru.admit(key, 100));
+        static_cast<void>(tinylfu.admit(key, 100));
+    }
+
+    auto lru_hot     = 0;
+    auto tinylfu_hot = 0;
+    for (int i = 0; i < 50; ++i) {
+        lru_hot += lru.contains(std::format("hot-{}", i));
+        tinylfu_hot += tinylfu.contains(std::format("hot-{}", i));
+    }
+    assertion(lru_hot == 0, "lru should be flushed by the scan, kept {}", lru_hot);
+    assertion(tinylfu_hot == 50, "w-tinylfu should keep the hot set, kept {}", tinylfu_hot);
+
+    // Oversized entries are rejected outright
+    const auto evicted = tinylfu.admit("huge", capacity + 1);
+    assertion(evicted.size() == 1 && evicted[0] == "huge", "oversized entry admitted");
+
+    // A candidate displacing a cold key and a hot one loses to the hot one,
+    // and takes nothing with it
+    auto sized = WTinyLfuPolicy{capacity, 100};
+    static_cast<void>(sized.admit("cold", 4900));
+    for (int i = 0; i < 5; ++i)
+        sized.access("hot");
+    static_cast<void>(sized.admit("hot", 4900));
+    for (int i = 0; i < 3; ++i)
+        sized.access("large");
+    const auto displaced = sized.admit("large", 5100);
+    assertion(displaced == std::vector<std::string>{"large"}, "{} evicted", displaced.size());
+    assertion(sized.contains("cold") && sized.contains("hot"), "victim evicted for nothing");
+}
+
+static auto testcase = Testcase(test);
@@ -0,0 +1,107 @@
+#include "errors.h"
+#include "pool.h"
+#include "unit_test.h"
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Starts at once, frees itself at the end: enough to hop onto a pool.
+struct Detached {
+    struct promise_type {
+        auto get_return_object() noexcept -> Detached {
+            return {};
+        }
+        auto initial_suspend() noexcept -> std::suspend_never {
+            return {};
+        }
+        auto final_suspend() noexcept -> std::suspend_never {
+            return {};
+        }
+        auto return_void() noexcept -> void {}
+        auto unhandled_exception() noexcept -> void {
+            std::terminate();
+        }
+    };
+};
+
+// GCC warns about the switch it generates for the coroutine itself
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch-default"
+static auto hop(dark::ThreadPool &pool, std::atomic<std::thread::id> &where) -> Detached {
+    co_await pool.schedule();
+    where.store(std::this_thread::get_id());
+}
+#pragma GCC diagnostic pop
+
+static auto test() -> void {
+    using dark::assertion;
+    using namespace std::chrono_literals;
+
+    auto sum = std::atomic<std::size_t>{};
+    {
+        auto pool = dark::ThreadPool{4};
+
+        // Submitted from outside, from several threads at once
+        auto threads = std::vector<std::thread>{};
+        for (std::size_t t = 0; t < 4; ++t)
+            threads.emplace_back([&] {
+                for (std::size_t i = 1; i <= 10000; ++i)
+                    pool.submit([&sum, i] { sum.fetch_add(i); });
+            });
+        for (auto &thread : threads)
+            thread.join();
+
+        // A task fanning out onto its own deque: idle workers steal from it
+        auto leaves = std::atomic<std::size_t>{};
+        pool.submit([&] {
+            for (std::size_t i = 0; i < 1000; ++i)
+                pool.submit([&] {
+                    std::this_thread::sleep_for(10us);
+                    leaves.fetch_add(1);
+                });
+        });
+        while (leaves.load() != 1000)
+            std::this_thread::sleep_for(1ms);
+        assertion(pool.stats().stolen != 0, "nothing stolen from a busy worker");
+
+        // A coroutine goes on on a worker
+        auto where = std::atomic<std::thread::id>{};
+        hop(pool, where);
+        while (where.load() == std::thread::id{})
+            std::this_thread::sleep_for(1ms);
+        assertion(where.load() != std::this_thread::get_id(), "not resumed on the pool");
+
+        // Tasks still queued run before the pool is gone
+        for (std::size_t i = 0; i < 1000; ++i)
+            pool.submit([&sum] { sum.fetch_add(1); });
+    }
+    const auto expected = 4 * (10000 * 10001 / 2) + 1000;
+    assertion(sum.load() == expected, "sum {}, expected {}", sum.load(), expected);
+
+    // A task that throws is logged, and its worker goes on
+    auto after = std::atomic<std::size_t>{};
+    {
+        auto pool = dark::ThreadPool{1};
+        pool.submit([] { throw std::runtime_error{"thrown on purpose"}; });
+        pool.submit([&after] { after.fetch_add(1); });
+    }
+    assertion(after.load() == 1, "worker gone after a throwing task");
+
+    // Destroyed right after tasks are submitted to the inboxes: every worker
+    // exits, however the tasks were spread when the pool began to stop
+    auto ran = std::atomic<std::size_t>{};
+    for (std::size_t round = 0; round < 200; ++round) {
+        auto pool = dark::ThreadPool{4};
+        for (std::size_t i = 0; i < 64; ++i)
+            pool.submit([&ran] { ran.fetch_add(1); });
+    }
+    assertion(ran.load() == 200 * 64, "{} tasks run", ran.load());
+}
+
+static auto testcase = Testcase(test);
@@ -0,0 +1,197 @@
+#include "errors.h"
+#include "hw1/governor.h"
+#include "hw1/relay.h"
+#include "socket.h"
+#include "unit_test.h"
+#include "unix.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+// A tunnel whose ends are socket pairs: the test plays both client and target.
+struct Ends {
+    dark::Socket client;
+    dark::Socket target;
+};
+
+static auto open_tunnel(Relay &relay, std::atomic<std::size_t> &reply_size) -> Ends {
+    auto [client, client_relay] = dark::UnixSocket::pair().unwrap();
+    auto [target_relay, target] = dark::UnixSocket::pair().unwrap();
+    relay.add(std::move(client_relay), std::move(target_relay), true, [&](std::string reply) {
+        reply_size.store(reply.size());
+    });
+    return {std::move(client), std::move(target)};
+}
+
+static auto receive_all(dark::Socket &socket) -> std::size_t {
+    auto buffer = std::string(65536, '\0');
+    auto total  = std::size_t{};
+    while (socket.recv(buffer).unwrap() != 0)
+        total += buffer.size();
+    return total;
+}
+
+static auto test() -> void {
+    using dark::assertion;
+    using namespace std::chrono_literals;
+
+    auto relay = Relay{{.high_watermark = 65536, .low_watermark = 16384}};
+    auto slow_reply = std::atomic<std::size_t>{0};
+    auto fast_reply = std::atomic<std::size_t>{0};
+    auto slow       = open_tunnel(relay, slow_reply);
+    auto fast       = open_tunnel(relay, fast_reply);
+
+    // The target floods a client that doesn't read: the relay stops reading it
+    constexpr auto total = std::size_t{4} << 20;
+    auto flood           = std::thread{[&] {
+        const auto chunk = std::string(65536, 'x');
+        for (auto sent = std::size_t{}; sent < total; sent += chunk.size())
+            for (auto view = std::string_view{chunk}; !view.empty();)
+                view.remove_prefix(slow.target.send(view).unwrap());
+        slow.target.shutdown_write().unwrap();
+    }};
+    while (relay.stats().paused == 0)
+        std::this_thread::sleep_for(1ms);
+
+    // ... and the other tunnel still goes through, both ways
+    auto buffer = std::string(16, '\0');
+    fast.client.send("ping").unwrap();
+    fast.target.recv(buffer).unwrap();
+    assertion(buffer == "ping", "fast tunnel stalled: {}", buffer);
+    fast.target.send("pong").unwrap();
+    fast.client.recv(buffer).unwrap();
+    assertion(buffer == "pong", "fast tunnel stalled: {}", buffer);
+
+    // Half-close: the client still gets everything after the target is done
+    const auto received = receive_all(slow.client);
+    flood.join();
+    assertion(received == total, "relayed {} of {} bytes", received, total);
+    slow.client.send("bye").unwrap();
+    slow.client.shutdown_write().unwrap();
+    assertion(receive_all(slow.target) == 3, "lost the client's last words");
+    while (slow_reply.load() == 0)
+        std::this_thread::sleep_for(1ms);
+    assertion(slow_reply.load() == total, "captured {} bytes", slow_reply.load());
+
+    // A side vanishing ends its tunnel as failed
+    {
+        auto gone = std::move(fast.client);
+    }
+    fast.target.send(std::string(1 << 20, 'y')).discard();
+    while (relay.stats().open != 0)
+        std::this_thread::sleep_for(1ms);
+    assertion(relay.stats().failures == 1, "{} failures", relay.stats().failures);
+
+    // A request head comes in pieces; a client too slow to send one is dropped
+    auto quick = Relay{{.header_timeout = 100ms, .idle_timeout = 100ms}};
+    auto heads = std::atomic<int>{0};
+    auto empty = std::atomic<int>{0};
+    auto on_request = [&](dark::Socket client, std::string request) {
+        if (request.empty())
+            return static_cast<void>(empty.fetch_add(1));
+        assertion(request == "GET / HTTP/1.1\r\n\r\nbody", "bad request: {}", request);
+        heads.fetch_add(1);
+        quick.respond(std::move(client), "HTTP/1.1 204 No Content\r\n\r\n", nullptr);
+    };
+    auto [user, client]   = dark::UnixSocket::pair().unwrap();
+    auto [loris, dropped]  = dark::UnixSocket::pair().unwrap();
+    quick.receive_request(std::move(client), on_request);
+    quick.receive_request(std::move(dropped), on_request);
+    user.send("GET / HTTP/1.1\r").unwrap();
+    loris.send("GET / HTTP/1.1\r\n").unwrap();
+    std::this_thread::sleep_for(20ms);
+    user.send("\n\r\nbody").unwrap();
+    assertion(receive_all(user) == 27, "no response");
+    assertion(receive_all(loris) == 0, "slow client not dropped");
+    assertion(heads.load() == 1, "{} requests", heads.load());
+    assertion(empty.load() == 1, "{} clients dropped", empty.load());
+
+    // A tunnel moving no byte for the idle timeout is closed, and what the
+    // target sent so far is not handed over as its reply
+    auto idle_reply = std::atomic<std::size_t>{1};
+    auto idle       = open_tunnel(quick, idle_reply);
+    idle.client.send("still there").unwrap();
+    idle.target.send("partial").unwrap();
+    assertion(receive_all(idle.target) == 11, "idle tunnel not closed");
+    assertion(receive_all(idle.client) == 7, "partial reply not relayed");
+    assertion(quick.stats().timeouts == 2, "{} timeouts", quick.stats().timeouts);
+    while (idle_reply.load() == 1)
+        std::this_thread::sleep_for(1ms);
+    assertion(idle_reply.load() == 0, "failed tunnel captured {} bytes", idle_reply.load());
+
+    // Under memory pressure, an origin flooding a stalled client is held back
+    // well below the watermark, and its reply is no longer captured
+    auto governor = MemoryGovernor{std::size_t{256} << 10};
+    auto tight    = Relay{{.high_watermark = std::size_t{4} << 20, .governor = &governor}};
+    auto tight_reply = std::atomic<std::size_t>{1};
+    auto stalled     = open_tunnel(tight, tight_reply);
+    auto origin      = std::thread{[&] {
+        const auto chunk = std::string(65536, 'z');
+        for (auto sent = std::size_t{}; sent < total; sent += chunk.size())
+            for (auto view = std::string_view{chunk}; !view.empty();)
+                view.remove_prefix(stalled.target.send(view).unwrap());
+        stalled.target.shutdown_write().unwrap();
+    }};
+    while (governor.stats().uncached == 0)
+        std::this_thread::sleep_for(1ms);
+    std::this_thread::sleep_for(100ms);
+    const auto held = governor.stats().held;
+    // Buffers grow by doubling: past the budget a little, but far from 4 MiB
+    assertion(held < std::size_t{1} << 20, "{} bytes held by a stalled tunnel", held);
+    assertion(receive_all(stalled.client) == total, "lost bytes under pressure");
+    origin.join();
+    stalled.client.shutdown_write().unwrap();
+    while (tight_reply.load() != 0)
+        std::this_thread::sleep_for(1ms);
+    assertion(governor.stats().held == 0, "{} bytes left held", governor.stats().held);
+
+    // An elephant flow takes a quantum per round, and small exchanges on the
+    // same thread still get through quickly
+    auto fair = Relay{{.quantum = 16384, .bulk_after = 65536}};
+    auto elephant_reply = std::atomic<std::size_t>{1};
+    auto mouse_reply    = std::atomic<std::size_t>{1};
+    auto elephant       = open_tunnel(fair, elephant_reply);
+    auto mouse          = open_tunnel(fair, mouse_reply);
+    constexpr auto herd = std::size_t{32} << 20;
+    auto stampede       = std::thread{[&] {
+        const auto chunk = std::string(65536, 'e');
+        for (auto sent = std::size_t{}; sent < herd; sent += chunk.size())
+            for (auto view = std::string_view{chunk}; !view.empty();)
+                view.remove_prefix(elephant.target.send(view).unwrap());
+        elephant.target.shutdown_write().unwrap();
+    }};
+    auto eaten = std::size_t{};
+    auto eater = std::thread{[&] { eaten = receive_all(elephant.client); }};
+    while (fair.stats().deferred == 0)
+        std::this_thread::sleep_for(1ms);
+    auto slowest = std::chrono::steady_clock::duration{};
+    for (std::size_t i = 0; i < 100; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        mouse.client.send("squeak").unwrap();
+        mouse.target.recv(buffer).unwrap();
+        mouse.target.send("squeak").unwrap();
+        mouse.client.recv(buffer).unwrap();
+        slowest = std::max(slowest, std::chrono::steady_clock::now() - start);
+    }
+    stampede.join();
+    eater.join();
+    assertion(eaten == herd, "relayed {} of {} bytes", eaten, herd);
+    const auto slowest_ms = std::chrono::duration_cast<std::chrono::milliseconds>(slowest);
+    assertion(slowest < 100ms, "a round trip took {}ms", slowest_ms.count());
+
+    // Busy polling: the relay spins before it sleeps, and still relays
+    auto spinning   = Relay{{.busy_poll = 50us}};
+    auto spin_reply = std::atomic<std::size_t>{1};
+    auto spun       = open_tunnel(spinning, spin_reply);
+    for (std::size_t i = 0; i < 100; ++i) {
+        spun.client.send("tick").unwrap();
+        spun.target.recv(buffer).unwrap();
+        assertion(buffer == "tick", "busy polled tunnel lost {}", buffer);
+    }
+}
+
+static auto testcase = Testcase(test);
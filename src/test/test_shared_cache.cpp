@@ -0,0 +1,60 @@
+#include "errors.h"
+#include "hw1/shared_cache.h"
+#include "unit_test.h"
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static auto test() -> void {
+    using dark::assertion;
+
+    // Room for the index and two slab pages
+    auto cache     = SharedCache::create(std::size_t{3} << 20).unwrap();
+    const auto now = std::chrono::steady_clock::now();
+    const auto item = [&](std::string data) {
+        return SharedItem{std::move(data), {}, 0, now, now + std::chrono::hours{1}, "GET"};
+    };
+
+    assertion(cache.store("http://a.com/x", item("hello")), "store failed");
+    auto found = cache.find("http://a.com/x");
+    assertion(found && found->data == "hello" && found->request == "GET", "lookup mismatch");
+    assertion(found->stale_until == now + std::chrono::hours{1}, "times not kept");
+    assertion(cache.store("http://a.com/x", item("world")), "replace failed");
+    assertion(cache.find("http://a.com/x")->data == "world", "replace not visible");
+    assertion(cache.stats().entries == 1, "replace leaked an entry");
+    assertion(!cache.store("http://a.com/huge", item(std::string(2 << 20, 'x'))), "huge stored");
+    assertion(!cache.store("http://a.com/x", item(std::string(2 << 20, 'x'))), "huge stored");
+    assertion(cache.find("http://a.com/x")->data == "world", "failed store lost the old item");
+
+    // A forked process shares the cache, and its death leaves it intact
+    if (const auto pid = ::fork(); pid == 0) {
+        cache.store("http://a.com/child", item("from child"));
+        std::_Exit(0);
+    } else {
+        ::waitpid(pid, nullptr, 0);
+    }
+    assertion(cache.find("http://a.com/child")->data == "from child", "child store not shared");
+
+    // A full size class evicts its least recently used item
+    const auto body = std::string(500, 'x');
+    for (int i = 0; i < 5000; ++i)
+        assertion(cache.store(std::format("http://b.com/{}", i), item(body)), "store {} failed", i);
+    const auto stats = cache.stats();
+    assertion(stats.evicted > 0, "nothing evicted from a full cache");
+    assertion(cache.find("http://b.com/4999").has_value(), "newest item evicted");
+    assertion(!cache.find("http://b.com/0").has_value(), "oldest item kept");
+    assertion(cache.erase("http://b.com/4999") && !cache.find("http://b.com/4999"), "erase failed");
+
+    // A class with no page takes one over from the class of the coldest item,
+    // here the first page, of the items stored before the full class
+    assertion(cache.store("http://c.com/big", item(std::string(2000, 'y'))), "no page taken over");
+    assertion(cache.find("http://c.com/big")->data.size() == 2000, "page taken over lost");
+    assertion(!cache.find("http://a.com/child"), "item of the page taken over kept");
+    assertion(cache.find("http://b.com/4998").has_value(), "warmer page taken over");
+    assertion(cache.stats().entries == stats.entries - 2, "{} entries", cache.stats().entries);
+}
+
+static auto testcase = Testcase(test);
@@ -0,0 +1,56 @@
+#include "address.h"
+#include "errors.h"
+#include "socket.h"
+#include "unit_test.h"
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <thread>
+
+static auto test() -> void {
+    using dark::assertion;
+    using namespace std::chrono_literals;
+
+    const auto address = dark::Address{"127.0.0.1", 12398};
+    auto server = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+    assertion(server.set_opt(server.opt_reuse), "set_opt failed");
+    assertion(server.set_opt(server.opt_recv_timestamping), "cannot timestamp");
+    assertion(server.bind(address) && server.listen(1), "cannot listen");
+    auto client = dark::Socket{dark::Domain::INET4, dark::Type::STREAM, dark::Protocol::TCP};
+    assertion(client.connect(address), "cannot connect");
+    assertion(client.set_opt(client.opt_timestamping), "cannot timestamp");
+    auto accepted = server.accept().unwrap().first;
+    // The kernel turns timestamps on for all packets a moment after the first ask
+    std::this_thread::sleep_for(10ms);
+
+    // Timestamped by the kernel as it arrived, before the call
+    const auto before = std::chrono::system_clock::now();
+    assertion(client.send("ping"), "send failed");
+    std::this_thread::sleep_for(10ms);
+    char buffer[16];
+    const auto received = accepted.recv_timestamped(buffer).unwrap();
+    assertion(received.size == 4, "received {} bytes", received.size);
+    assertion(received.stamp >= before - 1s, "no timestamp");
+    assertion(std::chrono::system_clock::now() - received.stamp >= 10ms, "stamped late");
+
+    // The stages of the send, its last byte numbered 3
+    auto acked = false;
+    while (auto stamp = client.reap_timestamp()) {
+        const auto sent = stamp.unwrap();
+        assertion(sent.id == 3, "id {}", sent.id);
+        assertion(sent.time >= before - 1s, "no time");
+        acked = acked || sent.stage == dark::SendStage::acked;
+    }
+    assertion(errno == EAGAIN, "reap failed");
+    assertion(acked, "not acknowledged");
+
+    // The kernel's view of the connection: the SYN is acknowledged as a byte
+    const auto info = client.tcp_info().unwrap();
+    assertion(info.state == TCP_ESTABLISHED, "state {}", +info.state);
+    assertion(info.rtt > 0us && info.cwnd > 0 && info.mss > 0, "no round trip");
+    assertion(info.bytes_acked == 5, "{} bytes acknowledged", info.bytes_acked);
+    assertion(info.retransmits == 0, "{} retransmits", info.retransmits);
+    assertion(accepted.tcp_info().unwrap().bytes_received == 4, "bytes received");
+}
+
+static auto testcase = Testcase(test);
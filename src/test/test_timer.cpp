@@ -0,0 +1,71 @@
+#include "errors.h"
+#include "timer.h"
+#include "unit_test.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+static auto test() -> void {
+    using dark::assertion;
+    using namespace std::chrono_literals;
+    using Clock = std::chrono::steady_clock;
+
+    // Timers fire at their deadline rounded up to a tick, never early, across
+    // every level, whatever the order they are scheduled in
+    const auto start = Clock::time_point{};
+    auto wheel       = dark::TimerWheel<std::size_t>{1ms, start};
+    auto random      = std::mt19937_64{42};
+    auto deadlines   = std::vector<std::int64_t>{};
+    auto handles     = std::vector<dark::TimerHandle>{};
+    for (std::size_t i = 0; i < 100000; ++i) {
+        // Mostly short timeouts, some up to 4 hours, a few beyond the last level
+        const auto range = i % 100 == 0 ? 40'000'000 : i % 10 == 0 ? 1'000'000 : 5'000;
+        deadlines.push_back(static_cast<std::int64_t>(random() % range) + 1);
+        handles.push_back(wheel.schedule(start + std::chrono::milliseconds{deadlines[i]}, i));
+    }
+    // Cancel a third of them
+    auto cancelled = std::size_t{};
+    for (std::size_t i = 0; i < handles.size(); i += 3) {
+        assertion(wheel.cancel(handles[i]), "timer {} not pending", i);
+        assertion(!wheel.cancel(handles[i]), "timer {} cancelled twice", i);
+        deadlines[i] = -1;
+        ++cancelled;
+    }
+    assertion(wheel.size() == handles.size() - cancelled, "{} timers pending", wheel.size());
+
+    // Advance in uneven steps, asking when to wake up like an event loop would
+    auto now   = std::int64_t{};
+    auto fired = std::size_t{};
+    while (wheel.size() != 0) {
+        const auto next = wheel.next_timeout(start + std::chrono::milliseconds{now});
+        assertion(next.has_value(), "no timeout with {} timers", wheel.size());
+        const auto wait = std::chrono::ceil<std::chrono::milliseconds>(*next).count();
+        now += std::max<std::int64_t>(1, wait);
+        now += static_cast<std::int64_t>(random() % 3);
+        wheel.advance(start + std::chrono::milliseconds{now}, [&](std::size_t i) {
+            assertion(deadlines[i] >= 0, "cancelled timer {} fired", i);
+            assertion(deadlines[i] <= now, "timer {} fired at {}, due {}", i, now, deadlines[i]);
+            // The loop oversleeps by 2ms at most here: later than that is a bug
+            assertion(now - deadlines[i] <= 2, "timer {} late at {}, due {}", i, now, deadlines[i]);
+            deadlines[i] = -1;
+            ++fired;
+        });
+    }
+    assertion(fired + cancelled == handles.size(), "{} of {} timers fired", fired, handles.size());
+    assertion(!wheel.next_timeout(start).has_value(), "timeout without timers");
+
+    // A stale handle doesn't cancel the timer reusing its node
+    const auto later = start + std::chrono::milliseconds{now + 10};
+    const auto first = wheel.schedule(later, 1);
+    assertion(wheel.cancel(first), "cancel failed");
+    const auto second = wheel.schedule(later, 2);
+    assertion(!wheel.cancel(first), "stale handle cancelled a timer");
+    auto value = std::size_t{};
+    wheel.advance(later, [&](std::size_t v) { value = v; });
+    assertion(value == 2, "fired {}", value);
+    assertion(!wheel.cancel(second), "fired timer cancelled");
+}
+
+static auto testcase = Testcase(test);
@@ -0,0 +1,68 @@
+#include "errors.h"
+#include "hw1/relay.h"
+#include "trace.h"
+#include "unit_test.h"
+#include "unix.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+static auto test() -> void {
+    using dark::assertion;
+    using namespace std::chrono_literals;
+    using Clock = dark::Tracer::Clock;
+
+    // One request in four, its id nonzero; none while off
+    auto tracer = dark::Tracer{{.sample_every = 0, .spans_per_thread = 4}};
+    assertion(tracer.sample() == 0, "sampled while off");
+    tracer.set_sampling(4);
+    auto ids = std::vector<std::uint64_t>{};
+    for (int i = 0; i < 8; ++i)
+        ids.push_back(tracer.sample());
+    assertion(ids == std::vector<std::uint64_t>{1, 0, 0, 0, 5, 0, 0, 0}, "sampled ids");
+
+    // Each thread keeps its latest spans; those of requests not traced are dropped
+    const auto t0 = Clock::now();
+    for (int i = 0; i < 10; ++i)
+        tracer.record("connect", 1, t0 + i * 1ms, t0 + i * 1ms + 500us);
+    tracer.record("connect", 0, t0, t0 + 1s);
+    std::jthread{[&] { tracer.record("resolve", 5, t0, t0 + 80ms); }}.join();
+    const auto spans = tracer.spans();
+    assertion(spans.size() == 5, "{} spans", spans.size());
+    assertion(spans.front().trace == 5 && spans[1].start == t0 + 6ms, "not the latest");
+    assertion(spans.front().thread != spans.back().thread, "one thread");
+
+    // Only the slow request, when asked for
+    const auto all      = tracer.dump();
+    const auto slow     = tracer.dump(50ms);
+    const auto contains = [](std::string_view text, std::string_view part) {
+        return text.find(part) != std::string_view::npos;
+    };
+    assertion(all.starts_with("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["), "got:\n{}", all);
+    assertion(contains(all, "\"name\":\"connect\",\"cat\":\"request\",\"ph\":\"X\""), "no span");
+    assertion(contains(all, "\"args\":{\"name\":\"request 1\"}"), "no request row");
+    assertion(contains(slow, "\"name\":\"resolve\""), "slow request missing");
+    assertion(!contains(slow, "\"name\":\"connect\""), "fast request kept");
+
+    // A traced response records its last byte on the relay
+    auto relay_tracer = dark::Tracer{};
+    auto relay        = Relay{{.tracer = &relay_tracer}};
+    auto done         = std::atomic_bool{};
+
+    auto [user, client] = dark::UnixSocket::pair().unwrap();
+    relay.respond(
+        std::move(client), "HTTP/1.1 204 No Content\r\n\r\n", [&](std::string) { done = true; }, 9
+    );
+    while (!done.load())
+        std::this_thread::sleep_for(1ms);
+    const auto relayed = relay_tracer.spans();
+    assertion(relayed.size() == 1, "{} spans", relayed.size());
+    assertion(std::string_view{relayed[0].name} == "last byte", "{}", relayed[0].name);
+    assertion(relayed[0].trace == 9 && relayed[0].start <= relayed[0].end, "bad span");
+}
+
+static auto testcase = Testcase(test);
@@ -0,0 +1,52 @@
+#include "errors.h"
+#include "unit_test.h"
+#include "unix.h"
+#include <format>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static auto test() -> void {
+    using dark::assertion;
+
+    const auto path = std::format("/tmp/dark_test_unix_{}.sock", ::getpid());
+    auto listener   = dark::UnixSocket::listen(path).unwrap();
+    auto client     = dark::UnixSocket::connect(path).unwrap();
+    auto server     = listener.accept().unwrap();
+    ::unlink(path.c_str());
+
+    // Pass one end of a socket pair: the receiver talks through its own copy
+    auto [mine, theirs] = dark::UnixSocket::pair().unwrap();
+    const int fds[]     = {dark::UnixSocket::handle_of(theirs)};
+    assertion(client.send("take this", fds).unwrap() == 9, "send failed");
+
+    auto buffer   = std::string(64, '\0');
+    auto received = std::vector<int>{};
+    server.recv(buffer, received).unwrap();
+    assertion(buffer == "take this", "bad message: {}", buffer);
+    assertion(received.size() == 1 && received[0] != fds[0], "no descriptor received");
+
+    auto adopted = dark::UnixSocket::adopt(received[0]);
+    static_cast<void>(theirs.set_nonblocking()); // shared with the copy
+    adopted.send("hello").unwrap();
+    mine.recv(buffer).unwrap();
+    assertion(buffer == "hello", "passed socket not connected: {}", buffer);
+}
+
+static auto testcase = Testcase(test);
+
+// A message there and back over a socket pair, in one thread
+static auto bench_round_trip = Benchmark(
+    "unix_pair_round_trip_64",
+    [pair   = std::make_shared<decltype(dark::UnixSocket::pair().unwrap())>(
+         dark::UnixSocket::pair().unwrap()
+     ),
+     buffer = std::string(64, 'u')]() mutable {
+        pair->first.send(buffer).unwrap();
+        pair->second.recv(std::span{buffer}).unwrap();
+        pair->second.send(buffer).unwrap();
+        pair->first.recv(std::span{buffer}).unwrap();
+    },
+    {.bytes = 128}
+);
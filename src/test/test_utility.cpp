@@ -1,14 +1,51 @@
+#include "errors.h"
 #include "unit_test.h"
 #include "utility.h"
 #include <arpa/inet.h>
+#include <cstddef>
 #include <format>
 #include <iostream>
+#include <string_view>
 
 static auto test() -> void {
     auto data = ::inet_addr("0.0.0.1");
     std::cout << std::format("data: {}\n", data);
     data = dark::string_to_ipv4_nocheck("0.0.0.1");
     std::cout << std::format("data: {}\n", data);
+
+    for (const std::string_view ip : {"0.0.0.1", "127.0.0.1", "255.255.255.255", "10.01.0.1"})
+        dark::assertion(dark::is_ipv4_literal(ip), "not a literal: {}", ip);
+    for (const std::string_view name :
+         {"", "localhost", "1.2.3", "1.2.3.4.5", "1..2.3", "1.2.3.", "256.0.0.1", "1.2.3.4a",
+          "1000.0.0.1"})
+        dark::assertion(!dark::is_ipv4_literal(name), "a literal: {}", name);
 }
 
 static auto testcase = Testcase(test);
+
+template <typename _Fn>
+static auto parse(std::string_view input, _Fn parser) {
+    return [input, parser] {
+        auto copy = input; // not a constant to the compiler
+        dark::do_not_optimize(copy);
+        dark::do_not_optimize(parser(copy));
+    };
+}
+
+static auto bench_ipv4 = Benchmark(
+    "string_to_ipv4_nocheck",
+    parse("192.168.100.200", [](std::string_view str) { return dark::string_to_ipv4_nocheck(str); }
+    ),
+    {.bytes = 15}
+);
+static auto bench_literal = Benchmark(
+    "is_ipv4_literal",
+    parse("192.168.100.200", [](std::string_view str) { return dark::is_ipv4_literal(str); }),
+    {.bytes = 15}
+);
+static auto bench_int = Benchmark(
+    "str_to_int_nocheck",
+    parse("1048576", [](std::string_view str) { return dark::str_to_int_nocheck<std::size_t>(str); }
+    ),
+    {.bytes = 7}
+);
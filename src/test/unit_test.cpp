@@ -1,9 +1,26 @@
 #include "unit_test.h"
+#include "affinity.h"
+#include <atomic>
+#include <chrono>
 #include <format>
+#include <fstream>
 #include <iostream>
+#include <string>
 #include <string_view>
 #include <syncstream>
 #include <thread>
+#include <unordered_map>
+
+static constexpr auto bench_config = dark::MicroConfig{
+    .warmup      = std::chrono::milliseconds{20},
+    .repetition  = std::chrono::milliseconds{10},
+    .repetitions = 31,
+};
+
+static constexpr auto passed = std::string_view{"\033[1;32mpassed\033[0m"};
+static constexpr auto failed = std::string_view{"\033[1;31mfailed\033[0m"};
+
+static std::atomic_bool any_failed{};
 
 auto tester_instance() -> Tester & {
     static auto instance = Tester{};
@@ -14,29 +31,126 @@ static auto thread_test(std::function<void()> function, std::string name) -> voi
     auto thread_id = std::this_thread::get_id();
     std::osyncstream(std::cout) << std::format("{:=^80}\nThread ID: ", "") << thread_id
                                 << std::format("\n - Running test: {}\n{:=^80}\n", name, "");
-    auto msg = std::string_view{"\033[1;32mpassed\033[0m"};
+    auto msg = passed;
     auto tic = std::chrono::high_resolution_clock::now();
     try {
         function();
-    } catch (...) { msg = "\033[1;31mfailed\033[0m"; }
+    } catch (...) {
+        msg = failed;
+        any_failed.store(true);
+    }
     auto toc = std::chrono::high_resolution_clock::now();
     auto dur = std::chrono::duration_cast<std::chrono::milliseconds>(toc - tic).count();
 
     std::cout << std::format("{:=^80}\nTest {} - {} after {}ms\n{:=^80}\n", "", name, msg, dur, "");
 }
 
-auto Tester::run() -> void {
+// Lines of "<name> <median ns/op>", as written by `save`.
+static auto load_baseline(const std::string &path) -> std::unordered_map<std::string, double> {
+    auto baseline = std::unordered_map<std::string, double>{};
+    auto file     = std::ifstream{path};
+    auto name     = std::string{};
+    auto median   = double{};
+    while (file >> name >> median)
+        baseline[name] = median;
+    return baseline;
+}
+
+// Counted by the counters of the benchmark thread, "-" where not.
+static auto per_operation(const dark::MicroResult &result, dark::PerfEvent event)
+    -> std::string {
+    const auto count = result.perf[event];
+    if (count == 0)
+        return "-";
+    const auto operations = result.operations * bench_config.repetitions;
+    return std::format("{:.1f}", static_cast<double>(count) / static_cast<double>(operations));
+}
+
+static auto ipc(const dark::MicroResult &result) -> std::string {
+    const auto ipc = result.perf.ipc();
+    return ipc == 0 ? "-" : std::format("{:.2f}", ipc);
+}
+
+auto Tester::run(const RunOptions &options) -> bool {
     auto threads = std::vector<std::thread>{};
     for (auto &testcase : testcases) {
         using namespace std::chrono_literals;
+        if (!options.tests)
+            break;
         std::this_thread::sleep_for(0.1s);
         threads.emplace_back(thread_test, std::move(testcase.function), std::move(testcase.name));
     }
     testcases.clear();
     for (auto &thread : threads)
         thread.join();
+    if (!options.benchmarks || benchmarks.empty())
+        return !any_failed.load();
+
+    // Alone on the machine, as far as this process goes: tests are done
+    const auto baseline = options.baseline.empty() ? std::unordered_map<std::string, double>{}
+                                                   : load_baseline(options.baseline);
+    auto save = std::ofstream{};
+    if (!options.save.empty())
+        save.open(options.save);
+    std::cout << std::format(
+        "{:=^80}\n{:<32}{:>10}{:>10}{:>10}{:>10}{:>10}{:>6}  {}\n", "", "Benchmark", "ns/op",
+        "min", "max rep", "MB/s", "cyc/op", "IPC", "baseline"
+    );
+    for (auto &benchmark : benchmarks) {
+        auto result = dark::MicroResult{};
+        auto pinned = true;
+        std::jthread{[&] {
+            if (benchmark.options.cpu >= 0)
+                pinned = dark::pin_thread(benchmark.options.cpu).has_value();
+            result = benchmark.measure(bench_config);
+        }}.join();
+
+        auto verdict = std::string{"-"};
+        if (const auto it = baseline.find(benchmark.name); it != baseline.end()) {
+            const auto ratio = result.median_ns / it->second;
+            const auto slow  = ratio > 1 + benchmark.options.tolerance;
+            verdict          = std::format("x{:.2f} {}", ratio, slow ? failed : passed);
+            if (slow)
+                any_failed.store(true);
+        }
+        if (!pinned)
+            verdict += std::format(" (not pinned to CPU {})", benchmark.options.cpu);
+        std::cout << std::format(
+            "{:<32}{:>10.1f}{:>10.1f}{:>10.1f}{:>10.1f}{:>10}{:>6}  {}\n", benchmark.name,
+            result.median_ns, result.min_ns, result.max_ns, result.bytes_per_second / 1e6,
+            per_operation(result, dark::PerfEvent::cycles), ipc(result), verdict
+        );
+        if (save.is_open())
+            save << std::format("{} {}\n", benchmark.name, result.median_ns);
+    }
+    benchmarks.clear();
+    return !any_failed.load();
+}
+
+static auto usage(const char *name) -> int {
+    std::cerr << std::format(
+        "Usage: {} [--no-tests] [--no-bench] [--baseline file] [--save file]\n"
+        "  --baseline: fail benchmarks slower than their line in the file, past tolerance\n"
+        "  --save:     write the medians of this run, to be a baseline\n",
+        name
+    );
+    return 2;
 }
 
-auto main() -> int {
-    tester_instance().run();
+auto main(int argc, const char **argv) -> int {
+    auto options = RunOptions{};
+    for (int i = 1; i < argc; ++i) {
+        const auto arg = std::string_view{argv[i]};
+        if (arg == "--no-tests")
+            options.tests = false;
+        else if (arg == "--no-bench")
+            options.benchmarks = false;
+        else if (arg == "--baseline" && i + 1 < argc)
+            options.baseline = argv[++i];
+        else if (arg == "--save" && i + 1 < argc)
+            options.save = argv[++i];
+        else
+            return usage(argv[0]);
+    }
+    return tester_instance().run(options) ? 0 : 1;
 }
@@ -1,18 +1,41 @@
 #pragma once
+#include "microbench.h"
+#include <cstddef>
 #include <functional>
 #include <source_location>
 #include <string>
+#include <utility>
 #include <vector>
 
+struct BenchmarkOptions {
+    std::size_t bytes = 0;   // handled per call, for a rate
+    int cpu           = -1;  // to pin the benchmark to, none if negative
+    double tolerance  = 0.5; // slower than the baseline by more than this fails
+};
+
+struct RunOptions {
+    bool tests      = true;
+    bool benchmarks = true;
+    std::string baseline; // file of median ns/op to compare with, if any
+    std::string save;     // file to write the medians to, if any
+};
+
 struct Tester {
 public:
     using _Function_t = std::function<void(void)>;
+    using _Measure_t  = std::function<dark::MicroResult(const dark::MicroConfig &)>;
     auto &add(std::string name, _Function_t function) {
         testcases.push_back({name, function});
         return *this;
     }
+    auto &add_benchmark(std::string name, _Measure_t measure, BenchmarkOptions options) {
+        benchmarks.push_back({std::move(name), std::move(measure), options});
+        return *this;
+    }
 
-    auto run() -> void;
+    // Tests run at once, each on a thread of its own; benchmarks after them,
+    // one at a time. False if any failed.
+    auto run(const RunOptions &options) -> bool;
     friend auto tester_instance() -> Tester &;
 
 private:
@@ -21,7 +44,13 @@ private:
         std::string name;
         _Function_t function;
     };
+    struct BenchCase {
+        std::string name;
+        _Measure_t measure;
+        BenchmarkOptions options;
+    };
     std::vector<TestCase> testcases;
+    std::vector<BenchCase> benchmarks;
 };
 
 auto tester_instance() -> Tester &;
@@ -33,3 +62,16 @@ struct Testcase {
         tester_instance().add(loc.file_name(), std::forward<_F>(function));
     }
 };
+
+// A performance case: `function` is one operation, called in batches that
+// the harness sizes itself. `name` keys the baseline file, so no spaces.
+struct Benchmark {
+    template <typename _F>
+    Benchmark(std::string name, _F function, BenchmarkOptions options = {}) {
+        const auto bytes = options.bytes;
+        auto measure     = [function, bytes](const dark::MicroConfig &config) mutable {
+            return dark::measure_micro(config, bytes, function);
+        };
+        tester_instance().add_benchmark(std::move(name), std::move(measure), options);
+    }
+};
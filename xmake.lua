@@ -21,10 +21,23 @@ set_kind("binary")
 
 target("hw1")
     add_files("src/hw1/*.cpp")
+    add_links("z")
 
 target("unit_test")
     add_includedirs("src/test/")
     add_files("src/test/*.cpp")
+    add_links("z")
 
 target("flow")
     add_files("src/flow/*.cpp")
+
+target("load")
+    add_files("src/load/*.cpp", "src/hw1/*.cpp|main.cpp")
+    add_links("z")
+
+target("sim")
+    add_files("src/sim/*.cpp")
+
+target("bench")
+    add_files("src/bench/*.cpp")
+    add_links("z")